@@ -9,17 +9,22 @@
  *
  * Important behavior:
  * - The object is a `QThread`. The `run()` method performs initialization
- *   and enters the capture loop. The capture loop appends `AudioSample`
- *   chunks to `m_buffer` while respecting a time-bound buffer limit.
+ *   and enters the capture loop. The capture loop writes each chunk into
+ *   `m_ring`, a preallocated lock-free ring holding the newest
+ *   BUFFER_SECONDS of audio, or with compressed storage enabled into
+ *   `m_packets`, which keeps COMPRESSED_BUFFER_SECONDS as Opus/AAC packets.
  * - Public methods are safe to call from the GUI thread. Use signals to
  *   observe start/stop and error conditions.
  */
 
 #include "AudioCapture.h"
+#include "Telemetry.h"
+#include "SyntheticSource.h"
 #include <QDebug>
-#include <QDateTime>
+#include <algorithm>
 #include <cstring>
 
+
 #ifdef _WIN32
 #include <comdef.h>
 #include <avrt.h>
@@ -28,6 +33,29 @@ const CLSID CLSID_MMDeviceEnumerator = __uuidof(MMDeviceEnumerator);
 const IID IID_IMMDeviceEnumerator = __uuidof(IMMDeviceEnumerator);
 const IID IID_IAudioClient = __uuidof(IAudioClient);
 const IID IID_IAudioCaptureClient = __uuidof(IAudioCaptureClient);
+
+// MediaClock seconds of a QPC reading in 100 ns units, as WASAPI reports
+// the capture time of a packet's first frame
+static double qpcToMediaSeconds(UINT64 qpc100ns) {
+    LARGE_INTEGER now, frequency;
+    QueryPerformanceCounter(&now);
+    QueryPerformanceFrequency(&frequency);
+    const UINT64 ticks = static_cast<UINT64>(now.QuadPart);
+    const UINT64 freq = static_cast<UINT64>(frequency.QuadPart);
+    const UINT64 now100ns = (ticks / freq) * 10000000ULL + (ticks % freq) * 10000000ULL / freq;
+    const double age = (now100ns > qpc100ns ? now100ns - qpc100ns : 0) / 10000000.0;
+    return MediaClock::nowSeconds() - age;
+}
+#elif __APPLE__
+#include <CoreAudio/HostTime.h>
+
+// MediaClock seconds of a host time, as Audio Queue reports the capture
+// time of a buffer's first frame
+static double hostTimeToMediaSeconds(UInt64 hostTime) {
+    const UInt64 now = AudioGetCurrentHostTime();
+    const double age = now > hostTime ? AudioConvertHostTimeToNanos(now - hostTime) / 1e9 : 0.0;
+    return MediaClock::nowSeconds() - age;
+}
 #endif
 
 AudioCapture::AudioCapture(DeviceType type, QObject *parent)
@@ -35,17 +63,26 @@ AudioCapture::AudioCapture(DeviceType type, QObject *parent)
     , m_deviceType(type)
     , m_capturing(false)
     , m_stopRequested(false)
+    , m_periodMs(DEFAULT_PERIOD_MS)
+    , m_compressed(false)
+    , m_wantCompressed(false)
+    , m_wantCodec(AudioPacketRing::Opus)
+    , m_wantBitrate(96000)
 #ifdef _WIN32
     , m_deviceEnumerator(nullptr)
     , m_device(nullptr)
     , m_audioClient(nullptr)
     , m_captureClient(nullptr)
     , m_waveFormat(nullptr)
+    , m_captureEvent(nullptr)
     , m_comInitialized(false)
 #elif __APPLE__
     , m_audioQueue(nullptr)
 #else
-    , m_pulseAudio(nullptr)
+    , m_paMainloop(nullptr)
+    , m_paContext(nullptr)
+    , m_paStream(nullptr)
+    , m_paFailed(false)
 #endif
 {
 }
@@ -199,12 +236,21 @@ bool AudioCapture::setDevice(const QString& deviceId) {
     return true;
 }
 
+bool AudioCapture::setSyntheticSource(std::shared_ptr<SyntheticAudioSource> source) {
+    if (isRunning()) {
+        emit errorOccurred("Cannot change the audio source while capturing");
+        return false;
+    }
+    m_synthetic = std::move(source);
+    return true;
+}
+
 void AudioCapture::startCapture() {
     if (m_capturing.load()) {
         qDebug() << "Already capturing";
         return;
     }
-    if (m_deviceId.isEmpty()) {
+    if (m_deviceId.isEmpty() && !m_synthetic) {
         emit errorOccurred("No device selected");
         return;
     }
@@ -214,6 +260,17 @@ void AudioCapture::startCapture() {
     start();
 }
 
+void AudioCapture::setPeriodMs(int ms) {
+    // The ring keeps chunk records for 5 ms chunks or longer
+    m_periodMs = (std::max)(5, (std::min)(ms, 100));
+}
+
+void AudioCapture::setCompressedStorage(bool enabled, AudioPacketRing::Codec codec, int bitrate) {
+    m_wantCompressed = enabled;
+    m_wantCodec = codec;
+    m_wantBitrate = (std::max)(16000, (std::min)(bitrate, 320000));
+}
+
 void AudioCapture::stopCapture() {
     if (!isRunning()) {
         qDebug() << "Capture thread not running";
@@ -234,46 +291,46 @@ void AudioCapture::stopCapture() {
     qDebug() << "Audio capture stopped";
 }
 
-std::vector<AudioSample> AudioCapture::getBuffer(int seconds) {
-    QMutexLocker locker(&m_bufferMutex);
-    
-    qDebug() << "Getting audio buffer for" << seconds << "seconds";
-    qDebug() << "  Current buffer size:" << m_buffer.size() << "chunks";
-    
-    std::vector<AudioSample> result;
-    if (m_buffer.empty()) {
-        qDebug() << "  Buffer is empty!";
-        return result;
-    }
-
-    // Iterate the buffer in reverse and collect chunks until we have at least
-    // `seconds` duration of audio. We start from the back to get the most recent audio.
-    double collected = 0;
-    for (auto it = m_buffer.rbegin(); it != m_buffer.rend(); ++it) {
-        if (it->channels > 0 && it->sampleRate > 0) {
-            double chunkDuration = it->data.size() / (double)(it->channels * it->sampleRate);
-            result.insert(result.begin(), *it);
-            collected += chunkDuration;
-            if (collected >= seconds) {
-                break;
-            }
-        }
+AudioSnapshot AudioCapture::getBuffer(int seconds) {
+    const bool compressed = m_compressed.load();
+    AudioSnapshot snapshot;
+    {
+        Telemetry::Timer timer(Telemetry::SaveSnapshot);
+        snapshot = compressed ? m_packets.snapshot(seconds) : m_ring.snapshot(seconds);
     }
-    
-    qDebug() << "  Retrieved" << result.size() << "chunks (" << collected << "seconds)";
-    
-    return result;
+    // Timing goes to Telemetry; one line is enough here
+    qDebug() << "Audio buffer:" << snapshot.size() << "chunks for" << seconds << "seconds";
+    return snapshot;
 }
 
 void AudioCapture::clearBuffer() {
-    QMutexLocker locker(&m_bufferMutex);
-    qDebug() << "Clearing audio buffer (" << m_buffer.size() << "chunks)";
-    m_buffer.clear();
+    if (m_compressed.load()) {
+        qDebug() << "Clearing audio buffer (" << m_packets.bufferedSeconds() << "seconds)";
+        m_packets.clear();
+        return;
+    }
+    qDebug() << "Clearing audio buffer (" << m_ring.bufferedSeconds() << "seconds)";
+    m_ring.clear();
 }
 
 void AudioCapture::run() {
     qDebug() << "=== Audio capture thread started ===";
     qDebug() << "Device type:" << (m_deviceType == Microphone ? "Microphone" : "Desktop Audio");
+
+    if (m_synthetic) {
+        const SyntheticAudioSource::Config& config = m_synthetic->config();
+        if (!allocateRing(config.sampleRate, config.channels)) {
+            return;
+        }
+        m_capturing = true;
+        emit captureStarted();
+        captureSynthetic();
+        m_packets.close();
+        m_capturing = false;
+        emit captureStopped();
+        qDebug() << "=== Audio capture thread stopped ===";
+        return;
+    }
     
 #ifdef _WIN32
     // On Windows, each thread must initialize COM independently. We use MULTITHREADED
@@ -288,7 +345,8 @@ void AudioCapture::run() {
     m_comInitialized = true;
     qDebug() << "COM initialized successfully";
 
-    if (!initWASAPI()) {
+    if (!initWASAPI() ||
+        !allocateRing(m_waveFormat->nSamplesPerSec, m_waveFormat->nChannels)) {
         qDebug() << "WASAPI initialization failed";
         cleanupWASAPI();
         CoUninitialize();
@@ -308,7 +366,8 @@ void AudioCapture::run() {
     m_comInitialized = false;
     
 #elif __APPLE__
-    if (!initCoreAudio()) {
+    // The queue callback writes as soon as it starts, so allocate first
+    if (!allocateRing(SAMPLE_RATE, CHANNELS) || !initCoreAudio()) {
         return;
     }
     m_capturing = true;
@@ -318,20 +377,93 @@ void AudioCapture::run() {
     }
     cleanupCoreAudio();
 #else
-    if (!initPulseAudio()) {
+    // The stream's read callback writes as soon as it connects
+    if (!allocateRing(SAMPLE_RATE, CHANNELS) || !initPulseAudio()) {
+        cleanupPulseAudio();
         return;
     }
     m_capturing = true;
     emit captureStarted();
-    capturePulseAudio();
+    while (!m_stopRequested.load() && !m_paFailed.load()) {
+        msleep(50);
+    }
+    if (m_paFailed.load()) {
+        emit errorOccurred("PulseAudio stream failed");
+    }
     cleanupPulseAudio();
 #endif
     
+    // The packets stay readable; only the encoder goes
+    m_packets.close();
     m_capturing = false;
     emit captureStopped();
     qDebug() << "=== Audio capture thread stopped ===";
 }
 
+void AudioCapture::captureSynthetic() {
+    const SyntheticAudioSource::Config& config = m_synthetic->config();
+    const size_t periodFrames = (size_t)config.sampleRate * m_periodMs.load() / 1000;
+    std::vector<float> period(periodFrames * config.channels);
+
+    // Paced like a device: one period per period, stamped with the time of
+    // its last frame, catching up in whole periods after a late wakeup
+    int64_t nextUs = MediaClock::nowUs();
+    const int64_t periodUs = (int64_t)periodFrames * 1000000 / config.sampleRate;
+    while (!m_stopRequested.load()) {
+        nextUs += periodUs;
+        const int64_t waitUs = nextUs - MediaClock::nowUs();
+        if (waitUs > 0) {
+            usleep((unsigned long)waitUs);
+        }
+        m_synthetic->generate(period.data(), periodFrames);
+        store(period.data(), periodFrames, nextUs / 1000000.0);
+    }
+}
+
+bool AudioCapture::allocateRing(int sampleRate, int channels) {
+    if (m_wantCompressed.load()) {
+        const auto codec = static_cast<AudioPacketRing::Codec>(m_wantCodec.load());
+        if (m_packets.open(codec, m_wantBitrate.load(), COMPRESSED_BUFFER_SECONDS, sampleRate, channels)) {
+            m_compressed = true;
+            return true;
+        }
+        qDebug() << "Compressed audio storage unavailable, keeping raw samples";
+    }
+    m_compressed = false;
+    if (!m_ring.allocate(BUFFER_SECONDS, sampleRate, channels)) {
+        emit errorOccurred("Failed to allocate the audio buffer");
+        return false;
+    }
+    return true;
+}
+
+void AudioCapture::store(const float* samples, size_t frames, double timestamp) {
+    Telemetry::Timer timer(Telemetry::AudioCallback);
+    if (m_compressed.load(std::memory_order_relaxed)) {
+        m_packets.write(samples, frames, timestamp);
+    } else {
+        m_ring.write(samples, frames, timestamp);
+    }
+}
+
+void AudioCapture::storeInt16(const int16_t* samples, size_t frames, double timestamp) {
+    Telemetry::Timer timer(Telemetry::AudioCallback);
+    if (m_compressed.load(std::memory_order_relaxed)) {
+        m_packets.writeInt16(samples, frames, timestamp);
+    } else {
+        m_ring.writeInt16(samples, frames, timestamp);
+    }
+}
+
+void AudioCapture::storeSilence(size_t frames, double timestamp) {
+    Telemetry::Timer timer(Telemetry::AudioCallback);
+    if (m_compressed.load(std::memory_order_relaxed)) {
+        m_packets.writeSilence(frames, timestamp);
+    } else {
+        m_ring.writeSilence(frames, timestamp);
+    }
+}
+
 #ifdef _WIN32
 bool AudioCapture::initWASAPI() {
     qDebug() << "[WASAPI Init] Starting initialization...";
@@ -380,15 +512,17 @@ bool AudioCapture::initWASAPI() {
     qDebug() << "  Channels:" << m_waveFormat->nChannels;
     qDebug() << "  Bits per sample:" << m_waveFormat->wBitsPerSample;
 
-    DWORD streamFlags = 0;
+    // Event driven: the engine wakes the capture thread once per device
+    // period instead of the thread polling on a timer
+    DWORD streamFlags = AUDCLNT_STREAMFLAGS_EVENTCALLBACK;
     if (m_deviceType == DesktopAudio) {
         streamFlags |= AUDCLNT_STREAMFLAGS_LOOPBACK;
         qDebug() << "[WASAPI Init] Using LOOPBACK mode for desktop audio";
     }
 
     // Set buffer duration to 100ms. REFERENCE_TIME is in 100-nanosecond units,
-    // so 1000000 = 0.1 seconds. This balances latency (lower = more responsive)
-    // with buffer stability and CPU efficiency.
+    // so 1000000 = 0.1 seconds. Packets are drained on every wakeup, so the
+    // buffer size adds no latency; it is headroom for a late thread.
     REFERENCE_TIME bufferDuration = 1000000;
     
     
@@ -415,6 +549,19 @@ bool AudioCapture::initWASAPI() {
     }
     qDebug() << "[WASAPI Init] Audio client initialized";
 
+    m_captureEvent = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+    if (!m_captureEvent) {
+        qDebug() << "[WASAPI Init] Failed to create capture event:" << GetLastError();
+        emit errorOccurred("Failed to create audio capture event");
+        return false;
+    }
+    hr = m_audioClient->SetEventHandle(m_captureEvent);
+    if (FAILED(hr)) {
+        qDebug() << "[WASAPI Init] Failed to set event handle:" << QString::number(hr, 16);
+        emit errorOccurred("Failed to set audio capture event");
+        return false;
+    }
+
     hr = m_audioClient->GetService(IID_IAudioCaptureClient, (void**)&m_captureClient);
     if (FAILED(hr)) {
         qDebug() << "[WASAPI Init] Failed to get capture client:" << QString::number(hr, 16);
@@ -458,6 +605,12 @@ void AudioCapture::cleanupWASAPI() {
         qDebug() << "[WASAPI Cleanup] Wave format freed";
     }
     
+    if (m_captureEvent) {
+        CloseHandle(m_captureEvent);
+        m_captureEvent = nullptr;
+        qDebug() << "[WASAPI Cleanup] Capture event closed";
+    }
+    
     if (m_device) { 
         m_device->Release(); 
         m_device = nullptr; 
@@ -479,9 +632,12 @@ void AudioCapture::captureWASAPI() {
     // Request "Pro Audio" thread priority from Windows. This elevates our scheduling
     // priority to minimize missed capture windows and audio glitches.
     DWORD taskIndex = 0;
-    HANDLE hTask = AvSetMmThreadCharacteristics(L"Pro Audio", &taskIndex);
+    HANDLE hTask = AvSetMmThreadCharacteristicsW(L"Pro Audio", &taskIndex);
     if (hTask) {
-        qDebug() << "[WASAPI Capture] Thread priority set to Pro Audio";
+        AvSetMmThreadPriority(hTask, AVRT_PRIORITY_HIGH);
+        qDebug() << "[WASAPI Capture] Registered with MMCSS as Pro Audio, task" << taskIndex;
+    } else {
+        qDebug() << "[WASAPI Capture] MMCSS registration failed:" << GetLastError();
     }
     
     // Determine the audio format negotiated with the device. Some devices report
@@ -498,10 +654,15 @@ void AudioCapture::captureWASAPI() {
     int chunkCount = 0;
     size_t totalSamples = 0;
 
+    // Loopback streams are not signalled on every Windows version, and it
+    // bounds how long a stop request waits; a timeout drains like an event
+    const DWORD waitMs = static_cast<DWORD>(m_periodMs.load() * 4);
+    
     while (!m_stopRequested.load()) {
-        // Sleep briefly to allow other threads to run. 10ms is a reasonable balance
-        // between CPU usage and capture responsiveness.
-        Sleep(10);
+        if (WaitForSingleObject(m_captureEvent, waitMs) == WAIT_FAILED) {
+            qDebug() << "[WASAPI Capture] Wait failed:" << GetLastError();
+            break;
+        }
         
         UINT32 packetLength = 0;
         HRESULT hr = m_captureClient->GetNextPacketSize(&packetLength);
@@ -514,7 +675,8 @@ void AudioCapture::captureWASAPI() {
             BYTE* pData;
             UINT32 numFramesAvailable;
             DWORD flags;
-            hr = m_captureClient->GetBuffer(&pData, &numFramesAvailable, &flags, nullptr, nullptr);
+            UINT64 qpcPosition = 0;
+            hr = m_captureClient->GetBuffer(&pData, &numFramesAvailable, &flags, nullptr, &qpcPosition);
             if (FAILED(hr)) {
                 qDebug() << "[WASAPI Capture] GetBuffer failed:" << QString::number(hr, 16);
                 break;
@@ -525,55 +687,25 @@ void AudioCapture::captureWASAPI() {
                 break;
             }
 
-            AudioSample sample;
-            sample.channels = m_waveFormat->nChannels;
-            sample.sampleRate = m_waveFormat->nSamplesPerSec;
-            sample.timestamp = QDateTime::currentMSecsSinceEpoch() / 1000.0;
-            size_t totalSamplesInBuffer = numFramesAvailable * sample.channels;
+            // Stamp the chunk's end from the device's capture time of its
+            // first frame; how late the loop woke up does not matter
+            const double duration = numFramesAvailable / (double)m_waveFormat->nSamplesPerSec;
+            const double timestamp = (flags & AUDCLNT_BUFFERFLAGS_TIMESTAMP_ERROR) || qpcPosition == 0
+                ? MediaClock::nowSeconds()
+                : qpcToMediaSeconds(qpcPosition) + duration;
+            if (flags & AUDCLNT_BUFFERFLAGS_DATA_DISCONTINUITY) {
+                qDebug() << "[WASAPI Capture] Data discontinuity (glitch) before chunk" << chunkCount;
+            }
+            size_t totalSamplesInBuffer = numFramesAvailable * m_waveFormat->nChannels;
 
+            // Straight into the store: no allocation, no lock
             if (flags & AUDCLNT_BUFFERFLAGS_SILENT) {
-                sample.data.resize(totalSamplesInBuffer, 0.0f);
+                storeSilence(numFramesAvailable, timestamp);
+            } else if (isFloat) {
+                store(reinterpret_cast<float*>(pData), numFramesAvailable, timestamp);
             } else {
-                sample.data.reserve(totalSamplesInBuffer);
-                if (isFloat) {
-                    float* floatData = reinterpret_cast<float*>(pData);
-                    sample.data.assign(floatData, floatData + totalSamplesInBuffer);
-                } else {
-                    // Convert 16-bit PCM to float in range [-1.0, 1.0]. Each sample is
-                    // divided by 32768 (2^15) to normalize to float range. This preserves
-                    // dynamic range while converting from integer to float representation.
-                    int16_t* int16Data = reinterpret_cast<int16_t*>(pData);
-                    sample.data.resize(totalSamplesInBuffer);
-                    for (size_t i = 0; i < totalSamplesInBuffer; i++) {
-                        sample.data[i] = int16Data[i] / 32768.0f;
-                    }
-                }
-            }
-
-            {
-                QMutexLocker locker(&m_bufferMutex);
-                m_buffer.push_back(sample);
-                
-                // Maintain the buffer with time-based pruning. We keep only the most recent
-                // audio up to a maximum of 60 seconds. As new chunks arrive, old ones are
-                // discarded once the total duration exceeds this limit. This prevents
-                // unbounded memory growth while preserving instant replay data.
-                double totalDuration = 0;
-                for (const auto& s : m_buffer) {
-                    if (s.channels > 0 && s.sampleRate > 0) {
-                        totalDuration += s.data.size() / (double)(s.channels * s.sampleRate);
-                    }
-                }
-                
-                // Remove old chunks if we exceed the desired buffer time
-                const double maxBufferSeconds = 60.0;
-                while (totalDuration > maxBufferSeconds && m_buffer.size() > 1) {
-                    const auto& oldSample = m_buffer.front();
-                    if (oldSample.channels > 0 && oldSample.sampleRate > 0) {
-                        totalDuration -= oldSample.data.size() / (double)(oldSample.channels * oldSample.sampleRate);
-                    }
-                    m_buffer.pop_front();
-                }
+                // 16-bit PCM is normalised to [-1.0, 1.0] on the way in
+                storeInt16(reinterpret_cast<int16_t*>(pData), numFramesAvailable, timestamp);
             }
             
             chunkCount++;
@@ -583,14 +715,13 @@ void AudioCapture::captureWASAPI() {
             if (chunkCount == 1) {
                 qDebug() << "[WASAPI Capture] First audio chunk captured!";
                 qDebug() << "  Samples:" << totalSamplesInBuffer;
-                qDebug() << "  Duration:" << (totalSamplesInBuffer / (double)(sample.channels * sample.sampleRate)) << "seconds";
+                qDebug() << "  Duration:" << (numFramesAvailable / (double)m_waveFormat->nSamplesPerSec) << "seconds";
             }
             
             // Periodic status
             if (chunkCount % 100 == 0) {
                 double duration = totalSamples / (double)(m_waveFormat->nChannels * m_waveFormat->nSamplesPerSec);
-                QMutexLocker locker(&m_bufferMutex);
-                qDebug() << "[WASAPI Capture] Captured" << chunkCount << "chunks (" << duration << "seconds total," << m_buffer.size() << "in buffer)";
+                qDebug() << "[WASAPI Capture] Captured" << chunkCount << "chunks (" << duration << "seconds total," << (m_compressed.load() ? m_packets.bufferedSeconds() : m_ring.bufferedSeconds()) << "seconds in buffer)";
             }
 
             m_captureClient->ReleaseBuffer(numFramesAvailable);
@@ -602,10 +733,7 @@ void AudioCapture::captureWASAPI() {
     qDebug() << "  Total chunks captured:" << chunkCount;
     qDebug() << "  Total samples:" << totalSamples;
     
-    {
-        QMutexLocker locker(&m_bufferMutex);
-        qDebug() << "  Final buffer size:" << m_buffer.size() << "chunks";
-    }
+    qDebug() << "  Final buffer size:" << (m_compressed.load() ? m_packets.bufferedSeconds() : m_ring.bufferedSeconds()) << "seconds";
     
     if (hTask) {
         AvRevertMmThreadCharacteristics(hTask);
@@ -625,39 +753,15 @@ void AudioCapture::audioInputCallback(void* userData, AudioQueueRef queue,
         return;
     }
     
-    AudioSample sample;
-    sample.channels = CHANNELS;
-    sample.sampleRate = SAMPLE_RATE;
-    sample.timestamp = QDateTime::currentMSecsSinceEpoch() / 1000.0;
-    
-    // Copy audio data
-    float* audioData = static_cast<float*>(buffer->mAudioData);
-    size_t sampleCount = buffer->mAudioDataByteSize / sizeof(float);
-    sample.data.assign(audioData, audioData + sampleCount);
-    
-    // Add to buffer
-    {
-        QMutexLocker locker(&capture->m_bufferMutex);
-        capture->m_buffer.push_back(sample);
-        
-        // Prune old buffer chunks using the same time-based strategy as WASAPI.
-        // This ensures consistent buffer behavior across platforms.
-        double totalDuration = 0;
-        for (const auto& s : capture->m_buffer) {
-            if (s.channels > 0 && s.sampleRate > 0) {
-                totalDuration += s.data.size() / (double)(s.channels * s.sampleRate);
-            }
-        }
-        
-        const double maxBufferSeconds = 60.0;
-        while (totalDuration > maxBufferSeconds && capture->m_buffer.size() > 1) {
-            const auto& oldSample = capture->m_buffer.front();
-            if (oldSample.channels > 0 && oldSample.sampleRate > 0) {
-                totalDuration -= oldSample.data.size() / (double)(oldSample.channels * oldSample.sampleRate);
-            }
-            capture->m_buffer.pop_front();
-        }
-    }
+    // Copy audio data into the store; this runs on the real-time queue
+    // thread, so no allocation and no lock
+    const float* audioData = static_cast<const float*>(buffer->mAudioData);
+    const size_t frameCount = buffer->mAudioDataByteSize / (sizeof(float) * CHANNELS);
+    // The chunk ends one buffer after the host time of its first frame
+    const double timestamp = startTime && (startTime->mFlags & kAudioTimeStampHostTimeValid)
+        ? hostTimeToMediaSeconds(startTime->mHostTime) + frameCount / (double)SAMPLE_RATE
+        : MediaClock::nowSeconds();
+    capture->store(audioData, frameCount, timestamp);
     
     // Re-enqueue buffer
     AudioQueueEnqueueBuffer(queue, buffer, 0, nullptr);
@@ -701,9 +805,12 @@ bool AudioCapture::initCoreAudio() {
         return false;
     }
     
-    // Allocate buffers
-    const int bufferSize = SAMPLE_RATE * CHANNELS * sizeof(float) / 2; // 0.5 second buffers
-    for (int i = 0; i < 3; i++) {
+    // One period per buffer, with enough of them queued to cover ~100 ms
+    // should the callback run late
+    const int periodMs = m_periodMs.load();
+    const int bufferSize = SAMPLE_RATE * periodMs / 1000 * CHANNELS * sizeof(float);
+    const int bufferCount = std::max(3, 100 / periodMs);
+    for (int i = 0; i < bufferCount; i++) {
         AudioQueueBufferRef buffer;
         status = AudioQueueAllocateBuffer(m_audioQueue, bufferSize, &buffer);
         if (status == noErr) {
@@ -733,77 +840,153 @@ void AudioCapture::cleanupCoreAudio() {
 
 #else
 
+void AudioCapture::pulseContextState(pa_context* context, void* userData) {
+    AudioCapture* capture = static_cast<AudioCapture*>(userData);
+    const pa_context_state_t state = pa_context_get_state(context);
+    if (state == PA_CONTEXT_FAILED || state == PA_CONTEXT_TERMINATED) {
+        capture->m_paFailed = true;
+    }
+    pa_threaded_mainloop_signal(capture->m_paMainloop, 0);
+}
+
+void AudioCapture::pulseStreamState(pa_stream* stream, void* userData) {
+    AudioCapture* capture = static_cast<AudioCapture*>(userData);
+    const pa_stream_state_t state = pa_stream_get_state(stream);
+    if (state == PA_STREAM_FAILED || state == PA_STREAM_TERMINATED) {
+        capture->m_paFailed = true;
+    }
+    pa_threaded_mainloop_signal(capture->m_paMainloop, 0);
+}
+
+void AudioCapture::pulseStreamRead(pa_stream* stream, size_t, void* userData) {
+    AudioCapture* capture = static_cast<AudioCapture*>(userData);
+    
+    // Runs on the main loop thread, which is the ring's only producer
+    while (pa_stream_readable_size(stream) > 0) {
+        const void* data = nullptr;
+        size_t bytes = 0;
+        if (pa_stream_peek(stream, &data, &bytes) < 0 || bytes == 0) {
+            return;
+        }
+        
+        // The latency is the age of the oldest unread frame, which is the
+        // first frame of this fragment
+        const size_t frames = bytes / (sizeof(float) * CHANNELS);
+        double timestamp = MediaClock::nowSeconds() + frames / (double)SAMPLE_RATE;
+        pa_usec_t latency = 0;
+        int negative = 0;
+        if (pa_stream_get_latency(stream, &latency, &negative) == 0) {
+            timestamp += (negative ? 1.0 : -1.0) * latency / 1000000.0;
+        }
+        
+        if (data) {
+            capture->store(static_cast<const float*>(data), frames, timestamp);
+        } else {
+            // A hole in the stream: keep the sample count honest
+            capture->storeSilence(frames, timestamp);
+        }
+        pa_stream_drop(stream);
+    }
+}
+
 bool AudioCapture::initPulseAudio() {
     pa_sample_spec spec;
     spec.format = PA_SAMPLE_FLOAT32LE;
     spec.channels = CHANNELS;
     spec.rate = SAMPLE_RATE;
     
-    int error;
-    const char* deviceName = m_deviceId.split('|').last().toUtf8().constData();
+    m_paFailed = false;
+    m_paMainloop = pa_threaded_mainloop_new();
+    if (!m_paMainloop) {
+        emit errorOccurred("PulseAudio error: could not create main loop");
+        return false;
+    }
+    m_paContext = pa_context_new(pa_threaded_mainloop_get_api(m_paMainloop), "ScreenClipRecorder");
+    if (!m_paContext) {
+        emit errorOccurred("PulseAudio error: could not create context");
+        return false;
+    }
+    pa_context_set_state_callback(m_paContext, pulseContextState, this);
     
-    m_pulseAudio = pa_simple_new(
-        nullptr,
-        "ScreenClipRecorder",
-        m_deviceType == Microphone ? PA_STREAM_RECORD : PA_STREAM_RECORD,
-        deviceName,
-        "capture",
-        &spec,
-        nullptr,
-        nullptr,
-        &error);
+    pa_threaded_mainloop_lock(m_paMainloop);
+    if (pa_context_connect(m_paContext, nullptr, PA_CONTEXT_NOFLAGS, nullptr) < 0 ||
+        pa_threaded_mainloop_start(m_paMainloop) < 0) {
+        pa_threaded_mainloop_unlock(m_paMainloop);
+        emit errorOccurred(QString("PulseAudio error: %1").arg(pa_strerror(pa_context_errno(m_paContext))));
+        return false;
+    }
+    while (pa_context_get_state(m_paContext) != PA_CONTEXT_READY) {
+        if (!PA_CONTEXT_IS_GOOD(pa_context_get_state(m_paContext))) {
+            pa_threaded_mainloop_unlock(m_paMainloop);
+            emit errorOccurred(QString("PulseAudio error: %1").arg(pa_strerror(pa_context_errno(m_paContext))));
+            return false;
+        }
+        pa_threaded_mainloop_wait(m_paMainloop);
+    }
     
-    if (!m_pulseAudio) {
-        emit errorOccurred(QString("PulseAudio error: %1").arg(pa_strerror(error)));
+    m_paStream = pa_stream_new(m_paContext, "capture", &spec, nullptr);
+    if (!m_paStream) {
+        pa_threaded_mainloop_unlock(m_paMainloop);
+        emit errorOccurred(QString("PulseAudio error: %1").arg(pa_strerror(pa_context_errno(m_paContext))));
+        return false;
+    }
+    pa_stream_set_state_callback(m_paStream, pulseStreamState, this);
+    pa_stream_set_read_callback(m_paStream, pulseStreamRead, this);
+    
+    // Ask the server for one fragment per period instead of its default
+    // (often two seconds) so chunks stay small and timestamps fine-grained
+    const int periodMs = m_periodMs.load();
+    pa_buffer_attr attr;
+    attr.maxlength = (uint32_t)-1;
+    attr.tlength = (uint32_t)-1;
+    attr.prebuf = (uint32_t)-1;
+    attr.minreq = (uint32_t)-1;
+    attr.fragsize = (uint32_t)pa_usec_to_bytes((pa_usec_t)periodMs * 1000, &spec);
+    
+    const QByteArray device = m_deviceId.split('|').last().toUtf8();
+    const char* deviceName = (device.isEmpty() || device == "default") ? nullptr : device.constData();
+    const pa_stream_flags_t flags = static_cast<pa_stream_flags_t>(
+        PA_STREAM_ADJUST_LATENCY | PA_STREAM_INTERPOLATE_TIMING | PA_STREAM_AUTO_TIMING_UPDATE);
+    
+    if (pa_stream_connect_record(m_paStream, deviceName, &attr, flags) < 0) {
+        pa_threaded_mainloop_unlock(m_paMainloop);
+        emit errorOccurred(QString("PulseAudio error: %1").arg(pa_strerror(pa_context_errno(m_paContext))));
         return false;
     }
+    while (pa_stream_get_state(m_paStream) != PA_STREAM_READY) {
+        if (!PA_STREAM_IS_GOOD(pa_stream_get_state(m_paStream))) {
+            pa_threaded_mainloop_unlock(m_paMainloop);
+            emit errorOccurred(QString("PulseAudio error: %1").arg(pa_strerror(pa_context_errno(m_paContext))));
+            return false;
+        }
+        pa_threaded_mainloop_wait(m_paMainloop);
+    }
     
+    const pa_buffer_attr* actual = pa_stream_get_buffer_attr(m_paStream);
+    qDebug() << "[PulseAudio] Recording with" << (actual ? pa_bytes_to_usec(actual->fragsize, &spec) / 1000 : 0)
+             << "ms fragments";
+    pa_threaded_mainloop_unlock(m_paMainloop);
     return true;
 }
 
 void AudioCapture::cleanupPulseAudio() {
-    if (m_pulseAudio) {
-        pa_simple_free(m_pulseAudio);
-        m_pulseAudio = nullptr;
-    }
-}
-
-void AudioCapture::capturePulseAudio() {
-    const int bufferSize = SAMPLE_RATE * CHANNELS / 2; // 0.5 second
-    std::vector<float> buffer(bufferSize);
-    
-    while (!m_stopRequested.load()) {
-        int error;
-        if (pa_simple_read(m_pulseAudio, buffer.data(), bufferSize * sizeof(float), &error) < 0) {
-            emit errorOccurred(QString("Read error: %1").arg(pa_strerror(error)));
-            break;
-        }
-        
-        AudioSample sample;
-        sample.channels = CHANNELS;
-        sample.sampleRate = SAMPLE_RATE;
-        sample.timestamp = QDateTime::currentMSecsSinceEpoch() / 1000.0;
-        sample.data = buffer;
-        
-        QMutexLocker locker(&m_bufferMutex);
-        m_buffer.push_back(sample);
-        
-        // Apply the same time-based pruning logic as other platforms for consistency.
-        double totalDuration = 0;
-        for (const auto& s : m_buffer) {
-            if (s.channels > 0 && s.sampleRate > 0) {
-                totalDuration += s.data.size() / (double)(s.channels * s.sampleRate);
-            }
-        }
-        
-        const double maxBufferSeconds = 60.0;
-        while (totalDuration > maxBufferSeconds && m_buffer.size() > 1) {
-            const auto& oldSample = m_buffer.front();
-            if (oldSample.channels > 0 && oldSample.sampleRate > 0) {
-                totalDuration -= oldSample.data.size() / (double)(oldSample.channels * oldSample.sampleRate);
-            }
-            m_buffer.pop_front();
-        }
+    // Stopping the loop first means no callback runs during teardown
+    if (m_paMainloop) {
+        pa_threaded_mainloop_stop(m_paMainloop);
+    }
+    if (m_paStream) {
+        pa_stream_disconnect(m_paStream);
+        pa_stream_unref(m_paStream);
+        m_paStream = nullptr;
+    }
+    if (m_paContext) {
+        pa_context_disconnect(m_paContext);
+        pa_context_unref(m_paContext);
+        m_paContext = nullptr;
+    }
+    if (m_paMainloop) {
+        pa_threaded_mainloop_free(m_paMainloop);
+        m_paMainloop = nullptr;
     }
 }
 
@@ -2,12 +2,15 @@
 #define AUDIOCAPTURE_H
 
 #include <QObject>
-#include <QMutex>
 #include <QThread>
 #include <vector>
-#include <deque>
 #include <memory>
 #include <atomic>
+#include "MediaClock.h"
+#include "AudioRing.h"
+#include "AudioPacketRing.h"
+
+class SyntheticAudioSource;
 
 #ifdef _WIN32
 #include <windows.h>
@@ -19,16 +22,8 @@
 #include <AudioToolbox/AudioToolbox.h>
 #else
 #include <pulse/pulseaudio.h>
-#include <pulse/simple.h>
 #endif
 
-struct AudioSample {
-    std::vector<float> data;
-    int channels;
-    int sampleRate;
-    double timestamp;
-};
-
 class AudioCapture : public QThread {
     Q_OBJECT
 
@@ -59,6 +54,16 @@ public:
     bool setDevice(const QString& deviceId);
     QString currentDevice() const { return m_deviceId; }
 
+    /*
+     * Synthetic input
+     * - `setSyntheticSource` replaces the platform backend with a
+     *   generator (used by `clipper_bench`): the capture thread writes one
+     *   period of generated audio per period, paced by `MediaClock`, at the
+     *   source's rate and channel count. No device needs to be selected.
+     *   Pass nullptr to go back to the device. Fails while capturing.
+     */
+    bool setSyntheticSource(std::shared_ptr<SyntheticAudioSource> source);
+
     /*
      * Control
      * - `startCapture()` requests that the background capture thread start.
@@ -69,12 +74,42 @@ public:
     void stopCapture();
     bool isCapturing() const { return m_capturing.load(); }
 
+    /*
+     * Capture period
+     * - `setPeriodMs` sets how much audio the backend hands over per
+     *   wakeup: the PulseAudio fragment size and the Audio Queue buffer
+     *   size. WASAPI is woken by the audio engine once per device period
+     *   (10 ms on most systems) and uses this only to bound its wait.
+     * - Takes effect on the next `startCapture()`. Clamped to 5..100 ms.
+     */
+    void setPeriodMs(int ms);
+    int periodMs() const { return m_periodMs.load(); }
+
+    /*
+     * Compressed storage
+     * - With `setCompressedStorage(true, ...)` the capture thread encodes
+     *   its audio into Opus or AAC packets (see `AudioPacketRing`) and keeps
+     *   COMPRESSED_BUFFER_SECONDS instead of BUFFER_SECONDS of raw floats.
+     *   `getBuffer()` decodes the requested window, so callers see no
+     *   difference.
+     * - Takes effect on the next `startCapture()`. If no encoder can be
+     *   opened the capture falls back to raw storage.
+     */
+    void setCompressedStorage(bool enabled, AudioPacketRing::Codec codec = AudioPacketRing::Opus,
+                              int bitrate = 96000);
+    bool compressedStorage() const { return m_wantCompressed.load(); }
+    AudioPacketRing::Codec compressedCodec() const { return static_cast<AudioPacketRing::Codec>(m_wantCodec.load()); }
+    int compressedBitrate() const { return m_wantBitrate.load(); }
+
     /*
      * Buffer access
-     * - `getBuffer(seconds)` returns up to `seconds` of recent audio chunks.
-     * - `clearBuffer()` removes all buffered audio immediately.
+     * - `getBuffer(seconds)` returns a copy of the most recent chunks
+     *   covering at least `seconds` (or everything buffered). It never
+     *   blocks the capture thread.
+     * - `clearBuffer()` removes all buffered audio immediately; snapshots
+     *   already handed out are unaffected.
      */
-    std::vector<AudioSample> getBuffer(int seconds);
+    AudioSnapshot getBuffer(int seconds);
     void clearBuffer();
 
 signals:
@@ -90,14 +125,31 @@ private:
     QString m_deviceId;
     std::atomic<bool> m_capturing;
     std::atomic<bool> m_stopRequested;
+    std::atomic<int> m_periodMs;
+    std::shared_ptr<SyntheticAudioSource> m_synthetic;
+    void captureSynthetic();
     
-    // Circular buffer for audio samples
-    std::deque<AudioSample> m_buffer;
-    QMutex m_bufferMutex;
+    // Newest BUFFER_SECONDS of audio; written lock-free by the capture thread
+    AudioRing m_ring;
+    // Newest COMPRESSED_BUFFER_SECONDS as packets, used instead of m_ring
+    // when compressed storage is on
+    AudioPacketRing m_packets;
+    std::atomic<bool> m_compressed;
+    std::atomic<bool> m_wantCompressed;
+    std::atomic<int> m_wantCodec;
+    std::atomic<int> m_wantBitrate;
+    bool allocateRing(int sampleRate, int channels);
+
+    // Capture thread: append one chunk to whichever store is active
+    void store(const float* samples, size_t frames, double timestamp);
+    void storeInt16(const int16_t* samples, size_t frames, double timestamp);
+    void storeSilence(size_t frames, double timestamp);
     
     static constexpr int SAMPLE_RATE = 48000;
     static constexpr int CHANNELS = 2;
-    static constexpr int BUFFER_SECONDS = 300; // 5 minutes max
+    static constexpr int BUFFER_SECONDS = 60;
+    static constexpr int COMPRESSED_BUFFER_SECONDS = 3600;
+    static constexpr int DEFAULT_PERIOD_MS = 10;
     
 #ifdef _WIN32
     // Windows WASAPI
@@ -106,6 +158,7 @@ private:
     IAudioClient* m_audioClient;
     IAudioCaptureClient* m_captureClient;
     WAVEFORMATEX* m_waveFormat;
+    HANDLE m_captureEvent;   // signalled by the engine when a packet is ready
     bool m_comInitialized;
     
     bool initWASAPI();
@@ -123,12 +176,18 @@ private:
                                    UInt32 numPackets,
                                    const AudioStreamPacketDescription* packetDesc);
 #else
-    // Linux PulseAudio
-    pa_simple* m_pulseAudio;
+    // Linux PulseAudio, asynchronous API: the read callback runs on the
+    // threaded main loop and writes straight into the ring
+    pa_threaded_mainloop* m_paMainloop;
+    pa_context* m_paContext;
+    pa_stream* m_paStream;
+    std::atomic<bool> m_paFailed;
     
     bool initPulseAudio();
     void cleanupPulseAudio();
-    void capturePulseAudio();
+    static void pulseContextState(pa_context* context, void* userData);
+    static void pulseStreamState(pa_stream* stream, void* userData);
+    static void pulseStreamRead(pa_stream* stream, size_t bytes, void* userData);
 #endif
 };
 
@@ -0,0 +1,439 @@
+/*
+ * AudioMixer.cpp
+ *
+ * Block-streaming mixer for saved clips. Each source is walked chunk by
+ * chunk, converted to stereo (and resampled by libswresample when its rate
+ * differs) into a fixed block, and the two blocks are combined by the
+ * vector kernels below. Nothing here grows with the clip length.
+ */
+
+#include "AudioMixer.h"
+#include "Telemetry.h"
+#include <QDebug>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+extern "C" {
+#include <libavutil/channel_layout.h>
+#include <libavutil/opt.h>
+#include <libavutil/samplefmt.h>
+#include <libswresample/swresample.h>
+}
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CLIPPER_MIX_SSE2
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define CLIPPER_MIX_NEON
+#endif
+
+// Sources are kept at unity; the sum is scaled down a little for headroom
+static const float MIC_GAIN = 1.0f;
+static const float DESKTOP_GAIN = 1.0f;
+static const float OUTPUT_GAIN = 0.95f;
+// Linear below the knee, then bending smoothly towards full scale
+static const float CLIP_KNEE = 0.8f;
+
+static const double MAX_VIDEO_OFFSET = 5.0;
+
+// Drift correction: how often it is re-evaluated, the largest rate change
+// it may apply (0.1%, far below audible pitch change), and the error past
+// which it jumps instead of stretching
+static const int DRIFT_UPDATE_MS = 250;
+static const double MAX_DRIFT_CORRECTION = 0.001;
+static const double RESYNC_SECONDS = 0.05;
+
+static inline float softClip(float x) {
+    const float magnitude = std::fabs(x);
+    const float over = std::max(magnitude - CLIP_KNEE, 0.0f) / (1.0f - CLIP_KNEE);
+    const float y = std::min(magnitude, CLIP_KNEE) + (1.0f - CLIP_KNEE) * over / (1.0f + over);
+    return std::copysign(y, x);
+}
+
+// out = softClip(a * gainA + b * gainB) * OUTPUT_GAIN, `count` samples
+static void mixBlock(float* out, const float* a, float gainA, const float* b, float gainB, size_t count) {
+    size_t i = 0;
+#if defined(CLIPPER_MIX_SSE2)
+    const __m128 ga = _mm_set1_ps(gainA);
+    const __m128 gb = _mm_set1_ps(gainB);
+    const __m128 knee = _mm_set1_ps(CLIP_KNEE);
+    const __m128 range = _mm_set1_ps(1.0f - CLIP_KNEE);
+    const __m128 invRange = _mm_set1_ps(1.0f / (1.0f - CLIP_KNEE));
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 level = _mm_set1_ps(OUTPUT_GAIN);
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    for (; i + 4 <= count; i += 4) {
+        const __m128 sum = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(a + i), ga), _mm_mul_ps(_mm_loadu_ps(b + i), gb));
+        const __m128 sign = _mm_and_ps(sum, signMask);
+        const __m128 magnitude = _mm_andnot_ps(signMask, sum);
+        const __m128 over = _mm_mul_ps(_mm_max_ps(_mm_sub_ps(magnitude, knee), zero), invRange);
+        const __m128 y = _mm_add_ps(_mm_min_ps(magnitude, knee),
+                                    _mm_mul_ps(range, _mm_div_ps(over, _mm_add_ps(one, over))));
+        _mm_storeu_ps(out + i, _mm_or_ps(_mm_mul_ps(y, level), sign));
+    }
+#elif defined(CLIPPER_MIX_NEON)
+    const float32x4_t ga = vdupq_n_f32(gainA);
+    const float32x4_t gb = vdupq_n_f32(gainB);
+    const float32x4_t knee = vdupq_n_f32(CLIP_KNEE);
+    const float32x4_t range = vdupq_n_f32(1.0f - CLIP_KNEE);
+    const float32x4_t invRange = vdupq_n_f32(1.0f / (1.0f - CLIP_KNEE));
+    const float32x4_t one = vdupq_n_f32(1.0f);
+    const float32x4_t zero = vdupq_n_f32(0.0f);
+    const float32x4_t level = vdupq_n_f32(OUTPUT_GAIN);
+    const uint32x4_t signMask = vdupq_n_u32(0x80000000u);
+    for (; i + 4 <= count; i += 4) {
+        const float32x4_t sum = vaddq_f32(vmulq_f32(vld1q_f32(a + i), ga), vmulq_f32(vld1q_f32(b + i), gb));
+        const float32x4_t magnitude = vabsq_f32(sum);
+        const float32x4_t over = vmulq_f32(vmaxq_f32(vsubq_f32(magnitude, knee), zero), invRange);
+        const float32x4_t y = vaddq_f32(vminq_f32(magnitude, knee),
+                                        vmulq_f32(range, vdivq_f32(over, vaddq_f32(one, over))));
+        // Sign bit from the sum, the rest from the clipped magnitude
+        vst1q_f32(out + i, vbslq_f32(signMask, sum, vmulq_f32(y, level)));
+    }
+#endif
+    for (; i < count; i++) {
+        out[i] = softClip(a[i] * gainA + b[i] * gainB) * OUTPUT_GAIN;
+    }
+}
+
+// Interleaved `channels` to interleaved stereo
+static void toStereo(float* out, const float* in, size_t frames, int channels) {
+    if (channels == 2) {
+        memcpy(out, in, frames * 2 * sizeof(float));
+        return;
+    }
+    for (size_t i = 0; i < frames; i++) {
+        const float* frame = in + i * channels;
+        out[i * 2] = frame[0];
+        out[i * 2 + 1] = channels == 1 ? frame[0] : frame[1];
+    }
+}
+
+struct AudioMixer::Source {
+    Source(const AudioSnapshot& audio, int outRate);
+    ~Source();
+
+    Source(const Source&) = delete;
+    Source& operator=(const Source&) = delete;
+
+    bool valid() const { return m_swr != nullptr; }
+    // MediaClock seconds of the first sample
+    double startTime() const;
+
+    // Stereo at the output rate, after the leading silence/discard
+    size_t read(float* out, size_t frames);
+
+    double origin = 0.0;  // MediaClock seconds of output frame 0
+    size_t silence = 0;   // output frames of silence before the audio
+    size_t discard = 0;   // output frames to drop from the front
+
+private:
+    size_t pull(float* out, size_t frames);
+    size_t chunkFrames() const { return m_audio[m_chunk].data.size() / m_channels; }
+    void advance(size_t frames);
+    bool track();
+    bool correct(double error);
+
+    const AudioSnapshot& m_audio;
+    int m_rate;
+    int m_channels;
+    int m_outRate;
+    size_t m_chunk = 0;   // read position: chunk and frame within it
+    size_t m_frame = 0;
+    SwrContext* m_swr = nullptr;
+    bool m_drained = false;
+    std::vector<float> m_converted;   // resampler output, source channels
+    std::vector<float> m_scratch;     // sink for discarded frames
+
+    // Drift tracking: output position of the next input frame, compared
+    // with where its timestamp says it belongs
+    int64_t m_emitted = 0;        // output frames placed on the timeline
+    double m_errorSum = 0.0;
+    int m_errorCount = 0;
+    size_t m_sinceUpdate = 0;     // input frames since the last correction
+    size_t m_trackedChunk = SIZE_MAX;
+};
+
+AudioMixer::Source::Source(const AudioSnapshot& audio, int outRate)
+    : m_audio(audio)
+    , m_rate(audio[0].sampleRate)
+    , m_channels(std::max(1, audio[0].channels))
+    , m_outRate(outRate)
+{
+    qDebug() << "[AudioMixer] Source:" << audio.size() << "chunks at" << m_rate << "Hz," << m_channels << "channels";
+    // A resync can ask for a drop in the middle of any read, not only at
+    // the start, so the sink is always there
+    m_scratch.resize(BLOCK_FRAMES * 2);
+
+    // Same layout in and out; the stereo mapping is done afterwards so
+    // mono keeps its level instead of being mixed down by -3 dB per side.
+    // The resampler runs even at equal rates so drift can be corrected.
+    AVChannelLayout layout;
+    av_channel_layout_default(&layout, m_channels);
+    int ret = swr_alloc_set_opts2(&m_swr, &layout, AV_SAMPLE_FMT_FLT, m_outRate,
+                                  &layout, AV_SAMPLE_FMT_FLT, m_rate, 0, nullptr);
+    if (ret >= 0) {
+        ret = av_opt_set_int(m_swr, "flags", SWR_FLAG_RESAMPLE, 0);
+    }
+    if (ret >= 0) {
+        ret = swr_init(m_swr);
+    }
+    av_channel_layout_uninit(&layout);
+    if (ret < 0) {
+        qDebug() << "[AudioMixer] Could not resample from" << m_rate << "to" << m_outRate << "Hz";
+        swr_free(&m_swr);
+        return;
+    }
+    m_converted.resize(BLOCK_FRAMES * m_channels);
+}
+
+AudioMixer::Source::~Source() {
+    swr_free(&m_swr);
+}
+
+double AudioMixer::Source::startTime() const {
+    // Chunk timestamps mark the end of a chunk
+    const AudioSample& first = m_audio[0];
+    return first.timestamp - (first.data.size() / m_channels) / (double)std::max(1, m_rate);
+}
+
+void AudioMixer::Source::advance(size_t frames) {
+    m_frame += frames;
+    m_sinceUpdate += frames;
+    if (m_frame >= chunkFrames()) {
+        m_chunk++;
+        m_frame = 0;
+    }
+}
+
+// True when it resynced, so the caller should stop and emit the jump
+bool AudioMixer::Source::track() {
+    const AudioSample& chunk = m_audio[m_chunk];
+    const double start = chunk.timestamp - chunkFrames() / (double)m_rate;
+    const double expected = (start - origin) * m_outRate;
+    const double actual = (double)m_emitted + (double)silence - (double)discard +
+                          (double)swr_get_delay(m_swr, m_outRate);
+    m_errorSum += actual - expected;
+    m_errorCount++;
+
+    // Chunk timestamps jitter by a few ms; correct on the average
+    if (m_sinceUpdate < (size_t)m_rate * DRIFT_UPDATE_MS / 1000) {
+        return false;
+    }
+    const double error = m_errorSum / m_errorCount;
+    m_errorSum = 0.0;
+    m_errorCount = 0;
+    m_sinceUpdate = 0;
+    return correct(error);
+}
+
+bool AudioMixer::Source::correct(double error) {
+    // A gap (loopback delivers nothing while the system is silent, or
+    // the device glitched) is too large to stretch out: jump instead
+    if (std::fabs(error) > RESYNC_SECONDS * m_outRate) {
+        const size_t frames = (size_t)llround(std::fabs(error));
+        if (error > 0) {
+            discard += frames;
+        } else {
+            silence += frames;
+        }
+        swr_set_compensation(m_swr, 0, 0);
+        qDebug() << "[AudioMixer] Resynced source by" << -error * 1000.0 / m_outRate << "ms";
+        return true;
+    }
+
+    // Ahead of the clock: produce a little less over the next second,
+    // behind it: a little more. Small enough to be inaudible.
+    const int limit = (int)(m_outRate * MAX_DRIFT_CORRECTION);
+    const int delta = (int)std::max<long long>(-limit, std::min<long long>(limit, llround(-error)));
+    swr_set_compensation(m_swr, delta, m_outRate);
+    return false;
+}
+
+size_t AudioMixer::Source::pull(float* out, size_t frames) {
+    size_t produced = 0;
+    while (produced < frames && !m_drained) {
+        const int space = (int)std::min<size_t>(frames - produced, BLOCK_FRAMES);
+        uint8_t* dst = reinterpret_cast<uint8_t*>(m_converted.data());
+        int got;
+        if (m_chunk < m_audio.size()) {
+            const size_t available = chunkFrames() - m_frame;
+            if (available == 0) {
+                advance(0);
+                continue;
+            }
+            if (m_chunk != m_trackedChunk) {
+                m_trackedChunk = m_chunk;
+                if (track()) {
+                    break;
+                }
+            }
+            // Feed roughly what fits, so the resampler only ever holds a
+            // few frames of its own
+            const size_t wanted = std::max<size_t>(1, (size_t)space * m_rate / m_outRate);
+            const size_t n = std::min(available, wanted);
+            const uint8_t* src = reinterpret_cast<const uint8_t*>(
+                m_audio[m_chunk].data.data() + m_frame * m_channels);
+            got = swr_convert(m_swr, &dst, space, &src, (int)n);
+            advance(n);
+        } else {
+            // Input is exhausted: drain the filter's delay line
+            got = swr_convert(m_swr, &dst, space, nullptr, 0);
+            if (got == 0) {
+                m_drained = true;
+            }
+        }
+        if (got < 0) {
+            qDebug() << "[AudioMixer] Resampling failed, ending the source early";
+            m_drained = true;
+            break;
+        }
+        toStereo(out + produced * 2, m_converted.data(), (size_t)got, m_channels);
+        produced += got;
+        m_emitted += got;
+    }
+    return produced;
+}
+
+size_t AudioMixer::Source::read(float* out, size_t frames) {
+    size_t done = 0;
+    while (done < frames) {
+        // Dropped frames never reach the timeline
+        while (discard > 0) {
+            const size_t n = pull(m_scratch.data(), std::min<size_t>(discard, BLOCK_FRAMES));
+            m_emitted -= n;
+            if (n == 0) {
+                discard = 0;
+                break;
+            }
+            discard -= n;
+        }
+
+        const size_t pad = std::min(silence, frames - done);
+        std::fill(out + done * 2, out + (done + pad) * 2, 0.0f);
+        silence -= pad;
+        m_emitted += pad;
+        done += pad;
+
+        // A resync may ask for silence or a drop mid-read; go round again
+        const size_t got = pull(out + done * 2, frames - done);
+        done += got;
+        if (got == 0 && silence == 0 && discard == 0) {
+            break;
+        }
+    }
+    return done;
+}
+
+AudioMixer::AudioMixer(const AudioSnapshot& mic, const AudioSnapshot& desktop, int sampleRate)
+    : m_sampleRate(sampleRate)
+    , m_startTime(0.0)
+{
+    if (!mic.empty()) {
+        m_mic.reset(new Source(mic, sampleRate));
+        if (!m_mic->valid()) {
+            m_mic.reset();
+        }
+    }
+    if (!desktop.empty()) {
+        m_desktop.reset(new Source(desktop, sampleRate));
+        if (!m_desktop->valid()) {
+            m_desktop.reset();
+        }
+    }
+
+    if (m_mic && m_desktop) {
+        const double micStart = m_mic->startTime();
+        const double deskStart = m_desktop->startTime();
+        const double diff = deskStart - micStart;
+        // The source that started later opens with silence
+        Source& later = diff > 0 ? *m_desktop : *m_mic;
+        later.silence = (size_t)llround(std::fabs(diff) * sampleRate);
+        m_startTime = std::min(micStart, deskStart);
+        m_micBlock.resize(BLOCK_FRAMES * 2);
+        m_deskBlock.resize(BLOCK_FRAMES * 2);
+        qDebug() << "[AudioMixer] Mixing mic and desktop at" << sampleRate << "Hz, desktop offset"
+                 << diff * 1000.0 << "ms";
+    } else if (m_mic) {
+        m_startTime = m_mic->startTime();
+    } else if (m_desktop) {
+        m_startTime = m_desktop->startTime();
+    }
+    setOrigin();
+}
+
+void AudioMixer::setOrigin() {
+    for (Source* source : {m_mic.get(), m_desktop.get()}) {
+        if (source) {
+            source->origin = m_startTime;
+        }
+    }
+}
+
+AudioMixer::~AudioMixer() = default;
+
+bool AudioMixer::hasAudio() const {
+    return m_mic || m_desktop;
+}
+
+void AudioMixer::alignTo(int64_t videoStartUs) {
+    if (!hasAudio()) {
+        return;
+    }
+
+    const double lead = videoStartUs / 1000000.0 - m_startTime;
+    if (std::fabs(lead) > MAX_VIDEO_OFFSET) {
+        qDebug() << "[AudioMixer] Audio/video start differ by" << lead << "s - not aligning";
+        return;
+    }
+
+    // Audio started earlier: drop its head. Later: pad with silence.
+    const long long offset = llround(lead * m_sampleRate);
+    for (Source* source : {m_mic.get(), m_desktop.get()}) {
+        if (!source) {
+            continue;
+        }
+        if (offset >= 0) {
+            const size_t drop = (size_t)offset;
+            const size_t absorbed = std::min(source->silence, drop);
+            source->silence -= absorbed;
+            source->discard += drop - absorbed;
+        } else {
+            source->silence += (size_t)-offset;
+        }
+    }
+    m_startTime += lead;
+    setOrigin();
+    qDebug() << "[AudioMixer] Aligned audio to first video frame:" << lead * 1000.0 << "ms";
+}
+
+size_t AudioMixer::read(float* out, size_t frames) {
+    Telemetry::Timer timer(Telemetry::Mix);
+    if (!m_mic || !m_desktop) {
+        Source* only = m_mic ? m_mic.get() : m_desktop.get();
+        return only ? only->read(out, frames) : 0;
+    }
+
+    size_t total = 0;
+    while (total < frames) {
+        const size_t n = std::min<size_t>(BLOCK_FRAMES, frames - total);
+        const size_t micFrames = m_mic->read(m_micBlock.data(), n);
+        const size_t deskFrames = m_desktop->read(m_deskBlock.data(), n);
+        const size_t mixed = std::max(micFrames, deskFrames);
+        if (mixed == 0) {
+            break;
+        }
+        // Whichever source ended first contributes silence
+        std::fill(m_micBlock.data() + micFrames * 2, m_micBlock.data() + mixed * 2, 0.0f);
+        std::fill(m_deskBlock.data() + deskFrames * 2, m_deskBlock.data() + mixed * 2, 0.0f);
+        mixBlock(out + total * 2, m_micBlock.data(), MIC_GAIN, m_deskBlock.data(), DESKTOP_GAIN, mixed * 2);
+        total += mixed;
+        if (mixed < n) {
+            break;
+        }
+    }
+    return total;
+}
@@ -0,0 +1,77 @@
+#ifndef AUDIOMIXER_H
+#define AUDIOMIXER_H
+
+#include "AudioRing.h"
+#include <memory>
+#include <vector>
+#include <cstdint>
+
+/*
+ * AudioMixer
+ *
+ * Purpose
+ * - Turns the microphone and desktop snapshots of a clip into one
+ *   interleaved stereo float stream at the output sample rate, a block at
+ *   a time, so encoders can pull exactly as much audio as the video they
+ *   have written needs. Working memory is a few fixed-size blocks no
+ *   matter how long the clip is; nothing is concatenated up front.
+ *
+ * Behaviour
+ * - Each source is read chunk by chunk in place and goes through
+ *   libswresample for rate conversion. Mono is spread to both channels,
+ *   more than two channels keep the first two.
+ * - Sources are lined up by their `MediaClock` timestamps: the later one
+ *   starts with silence.
+ * - Drift: device clocks never run at exactly their nominal rate. While
+ *   reading, each source compares where a chunk lands in the output with
+ *   where its timestamp says it belongs, averages that over a quarter
+ *   second to ride out timestamp jitter, and asks the resampler to add or
+ *   drop up to 0.1% of samples to close the gap. Gaps over 50 ms (a
+ *   glitch, loopback delivering nothing during silence) are closed at
+ *   once with silence or a skip. Long clips stay in sync with the video
+ *   without a pass over the whole buffer.
+ * - With both sources present every block is summed, soft clipped and
+ *   scaled by SIMD kernels (SSE2 on x86, NEON on ARM64, scalar
+ *   otherwise). A single source passes through unchanged.
+ * - `alignTo()` drops or pads the start so the first frame `read()`
+ *   returns sits at the first video frame's timestamp.
+ *
+ * Threading
+ * - Not synchronised; used by one encoder at a time. The snapshots must
+ *   outlive the mixer.
+ */
+class AudioMixer {
+public:
+    // Frames mixed per pass; `read()` accepts any count
+    static constexpr size_t BLOCK_FRAMES = 1024;
+
+    AudioMixer(const AudioSnapshot& mic, const AudioSnapshot& desktop, int sampleRate);
+    ~AudioMixer();
+
+    AudioMixer(const AudioMixer&) = delete;
+    AudioMixer& operator=(const AudioMixer&) = delete;
+
+    bool hasAudio() const;
+    int sampleRate() const { return m_sampleRate; }
+
+    // Call before the first read(); offsets beyond 5 s point at a stale
+    // buffer and are ignored
+    void alignTo(int64_t videoStartUs);
+
+    // Writes up to `frames` stereo frames; fewer only once the audio ends
+    size_t read(float* out, size_t frames);
+
+private:
+    struct Source;
+
+    void setOrigin();
+
+    int m_sampleRate;
+    double m_startTime;     // MediaClock seconds of the first output frame
+    std::unique_ptr<Source> m_mic;
+    std::unique_ptr<Source> m_desktop;
+    std::vector<float> m_micBlock;
+    std::vector<float> m_deskBlock;
+};
+
+#endif // AUDIOMIXER_H
@@ -0,0 +1,506 @@
+/*
+ * AudioPacketRing.cpp
+ *
+ * Compressed audio storage. The capture thread encodes codec-sized frames
+ * with libavcodec and appends the packets to blocks which, like the
+ * replay buffer's slabs, are only ever appended to; snapshots share the
+ * blocks and decode their window outside any lock.
+ */
+
+#include "AudioPacketRing.h"
+#include "MediaClock.h"
+#include <QDebug>
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <new>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/channel_layout.h>
+#include <libavutil/samplefmt.h>
+}
+
+// Room for ~5 s of packets per block at the usual bitrates
+static const size_t BLOCK_SLOTS = 256;
+static const size_t BLOCK_BYTES = 64 * 1024;
+
+// Packets decoded ahead of a snapshot window and thrown away, so the
+// decoder's overlap state has settled by the first kept frame
+static const size_t PREROLL_PACKETS = 4;
+
+struct AudioPacketBlock {
+    struct Slot {
+        uint32_t offset;
+        uint32_t size;
+        double timestamp;   // MediaClock seconds at the end of the packet's audio
+    };
+
+    std::unique_ptr<char[]> bytes;
+    std::unique_ptr<Slot[]> slots;
+    size_t used = 0;                // bytes written, producer only
+    std::atomic<size_t> count{0};   // slots published to readers
+};
+
+// A block only the ring references can be reused; one a snapshot still
+// holds is left to the snapshot to free
+static std::shared_ptr<AudioPacketBlock> reclaim(std::shared_ptr<AudioPacketBlock> block) {
+    if (block.use_count() != 1) {
+        return nullptr;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    block->used = 0;
+    block->count.store(0, std::memory_order_relaxed);
+    return block;
+}
+
+// Sample `i` of channel `c` of a decoded frame, whichever layout the
+// decoder picked
+static float sampleAt(const AVFrame* frame, int channels, int c, int i) {
+    switch (frame->format) {
+    case AV_SAMPLE_FMT_FLTP:
+        return reinterpret_cast<const float*>(frame->extended_data[c])[i];
+    case AV_SAMPLE_FMT_FLT:
+        return reinterpret_cast<const float*>(frame->data[0])[i * channels + c];
+    case AV_SAMPLE_FMT_S16P:
+        return reinterpret_cast<const int16_t*>(frame->extended_data[c])[i] / 32768.0f;
+    case AV_SAMPLE_FMT_S16:
+        return reinterpret_cast<const int16_t*>(frame->data[0])[i * channels + c] / 32768.0f;
+    default:
+        return 0.0f;
+    }
+}
+
+AudioPacketRing::AudioPacketRing()
+    : m_codec(Opus)
+    , m_encoder(nullptr)
+    , m_frame(nullptr)
+    , m_packet(nullptr)
+    , m_inputChannels(0)
+    , m_frameSize(0)
+    , m_pendingFrames(0)
+    , m_inputFrames(0)
+    , m_lastIndex(0)
+    , m_lastTimestamp(0.0)
+    , m_windowSeconds(0.0)
+    , m_clearedBefore(-std::numeric_limits<double>::infinity())
+{
+}
+
+AudioPacketRing::~AudioPacketRing() {
+    close();
+}
+
+QString AudioPacketRing::codecName(Codec codec) {
+    return codec == Opus ? "Opus" : "AAC";
+}
+
+bool AudioPacketRing::open(Codec codec, int bitrate, int seconds, int sampleRate, int channels) {
+    close();
+    if (bitrate <= 0 || seconds <= 0 || sampleRate <= 0 || channels <= 0) {
+        return false;
+    }
+
+    const AVCodec* encoder = nullptr;
+    if (codec == Opus) {
+        static const int opusRates[] = { 48000, 24000, 16000, 12000, 8000 };
+        if (std::find(std::begin(opusRates), std::end(opusRates), sampleRate) != std::end(opusRates)) {
+            encoder = avcodec_find_encoder_by_name("libopus");
+        }
+        if (!encoder) {
+            qDebug() << "[AudioPacketRing] Opus unavailable at" << sampleRate << "Hz, using AAC";
+            codec = Aac;
+        }
+    }
+    if (codec == Aac) {
+        encoder = avcodec_find_encoder(AV_CODEC_ID_AAC);
+    }
+    if (!encoder) {
+        qDebug() << "[AudioPacketRing] No" << codecName(codec) << "encoder available";
+        return false;
+    }
+
+    const int encodedChannels = std::min(channels, 2);
+    m_encoder = avcodec_alloc_context3(encoder);
+    if (!m_encoder) {
+        return false;
+    }
+    m_encoder->sample_fmt = codec == Opus ? AV_SAMPLE_FMT_FLT : AV_SAMPLE_FMT_FLTP;
+    m_encoder->sample_rate = sampleRate;
+    av_channel_layout_default(&m_encoder->ch_layout, encodedChannels);
+    m_encoder->bit_rate = bitrate;
+    m_encoder->time_base = AVRational{1, sampleRate};
+    // Puts the decoder configuration in extradata for snapshots to use
+    m_encoder->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+
+    int ret = avcodec_open2(m_encoder, encoder, nullptr);
+    if (ret < 0) {
+        char buf[AV_ERROR_MAX_STRING_SIZE] = {0};
+        av_strerror(ret, buf, sizeof(buf));
+        qDebug() << "[AudioPacketRing] Could not open the" << codecName(codec) << "encoder:" << buf;
+        close();
+        return false;
+    }
+    m_frameSize = m_encoder->frame_size > 0 ? m_encoder->frame_size : 1024;
+
+    m_frame = av_frame_alloc();
+    m_packet = av_packet_alloc();
+    if (m_frame) {
+        m_frame->nb_samples = m_frameSize;
+        m_frame->format = m_encoder->sample_fmt;
+        m_frame->sample_rate = sampleRate;
+        av_channel_layout_copy(&m_frame->ch_layout, &m_encoder->ch_layout);
+    }
+    if (!m_frame || !m_packet || av_frame_get_buffer(m_frame, 0) < 0) {
+        qDebug() << "[AudioPacketRing] Could not allocate encoder buffers";
+        close();
+        return false;
+    }
+
+    m_codec = codec;
+    m_inputChannels = channels;
+    m_pending.assign((size_t)m_frameSize * encodedChannels, 0.0f);
+    m_pendingFrames = 0;
+    m_inputFrames = 0;
+    m_lastIndex = 0;
+    m_lastTimestamp = 0.0;
+    m_windowSeconds = seconds;
+
+    Format format;
+    format.codecId = encoder->id;
+    format.sampleRate = sampleRate;
+    format.channels = encodedChannels;
+    format.extradata = QByteArray(reinterpret_cast<const char*>(m_encoder->extradata), m_encoder->extradata_size);
+    {
+        // Packets of an earlier format cannot be decoded with this one
+        QMutexLocker locker(&m_mutex);
+        m_format = format;
+        while (!m_blocks.empty()) {
+            std::shared_ptr<AudioPacketBlock> spare = reclaim(std::move(m_blocks.back()));
+            m_blocks.pop_back();
+            if (spare) {
+                m_spare.push_back(std::move(spare));
+            }
+        }
+    }
+    m_clearedBefore = -std::numeric_limits<double>::infinity();
+
+    qDebug() << "[AudioPacketRing] Encoding" << codecName(codec) << "at" << bitrate / 1000 << "kbps,"
+             << sampleRate << "Hz," << encodedChannels << "channels, keeping" << seconds << "seconds";
+    return true;
+}
+
+void AudioPacketRing::close() {
+    avcodec_free_context(&m_encoder);
+    av_frame_free(&m_frame);
+    av_packet_free(&m_packet);
+    m_pendingFrames = 0;
+}
+
+template <typename Fill>
+void AudioPacketRing::writeWith(size_t frames, double timestamp, Fill fill) {
+    if (!m_encoder || frames == 0) {
+        return;
+    }
+
+    // The chunk's last frame was captured at `timestamp`; packet times are
+    // derived from it
+    m_lastIndex = m_inputFrames + (int64_t)frames;
+    m_lastTimestamp = timestamp;
+
+    const size_t channels = m_encoder->ch_layout.nb_channels;
+    size_t done = 0;
+    while (done < frames) {
+        const size_t take = std::min(frames - done, (size_t)m_frameSize - m_pendingFrames);
+        fill(m_pending.data() + m_pendingFrames * channels, done, take, channels);
+        m_pendingFrames += take;
+        m_inputFrames += take;
+        done += take;
+        if (m_pendingFrames == (size_t)m_frameSize) {
+            encodePending();
+        }
+    }
+}
+
+void AudioPacketRing::write(const float* samples, size_t frames, double timestamp) {
+    const size_t in = m_inputChannels;
+    writeWith(frames, timestamp, [samples, in](float* dst, size_t fromFrame, size_t count, size_t out) {
+        const float* src = samples + fromFrame * in;
+        if (in == out) {
+            memcpy(dst, src, count * out * sizeof(float));
+            return;
+        }
+        for (size_t i = 0; i < count; i++) {
+            for (size_t c = 0; c < out; c++) {
+                dst[i * out + c] = src[i * in + c];
+            }
+        }
+    });
+}
+
+void AudioPacketRing::writeInt16(const int16_t* samples, size_t frames, double timestamp) {
+    const size_t in = m_inputChannels;
+    writeWith(frames, timestamp, [samples, in](float* dst, size_t fromFrame, size_t count, size_t out) {
+        // 16-bit PCM to [-1.0, 1.0)
+        const int16_t* src = samples + fromFrame * in;
+        for (size_t i = 0; i < count; i++) {
+            for (size_t c = 0; c < out; c++) {
+                dst[i * out + c] = src[i * in + c] / 32768.0f;
+            }
+        }
+    });
+}
+
+void AudioPacketRing::writeSilence(size_t frames, double timestamp) {
+    writeWith(frames, timestamp, [](float* dst, size_t, size_t count, size_t out) {
+        std::fill(dst, dst + count * out, 0.0f);
+    });
+}
+
+void AudioPacketRing::encodePending() {
+    m_pendingFrames = 0;
+    if (av_frame_make_writable(m_frame) < 0) {
+        return;
+    }
+
+    const int channels = m_encoder->ch_layout.nb_channels;
+    if (m_encoder->sample_fmt == AV_SAMPLE_FMT_FLTP) {
+        for (int c = 0; c < channels; c++) {
+            float* plane = reinterpret_cast<float*>(m_frame->data[c]);
+            for (int i = 0; i < m_frameSize; i++) {
+                plane[i] = m_pending[(size_t)i * channels + c];
+            }
+        }
+    } else {
+        memcpy(m_frame->data[0], m_pending.data(), (size_t)m_frameSize * channels * sizeof(float));
+    }
+    // pts counts input frames, so packet times follow from m_lastIndex
+    m_frame->pts = m_inputFrames - m_frameSize;
+
+    if (avcodec_send_frame(m_encoder, m_frame) < 0) {
+        return;
+    }
+    while (avcodec_receive_packet(m_encoder, m_packet) == 0) {
+        storePacket(m_packet);
+        av_packet_unref(m_packet);
+    }
+}
+
+void AudioPacketRing::storePacket(const AVPacket* packet) {
+    const size_t size = packet->size > 0 ? (size_t)packet->size : 0;
+    if (size == 0 || size > BLOCK_BYTES) {
+        return;
+    }
+
+    // Where the packet's audio ends, counted back from the newest frame
+    const int64_t end = packet->pts + (packet->duration > 0 ? packet->duration : m_frameSize);
+    const double timestamp = m_lastTimestamp - (m_lastIndex - end) / (double)m_encoder->sample_rate;
+
+    // Only this thread changes m_blocks, so reading it needs no lock
+    const bool fits = !m_blocks.empty() &&
+                      m_blocks.back()->count.load(std::memory_order_relaxed) < BLOCK_SLOTS &&
+                      BLOCK_BYTES - m_blocks.back()->used >= size;
+    if (!fits && !openBlock()) {
+        return;
+    }
+
+    AudioPacketBlock& block = *m_blocks.back();
+    const size_t index = block.count.load(std::memory_order_relaxed);
+    memcpy(block.bytes.get() + block.used, packet->data, size);
+    block.slots[index].offset = (uint32_t)block.used;
+    block.slots[index].size = (uint32_t)size;
+    block.slots[index].timestamp = timestamp;
+    block.used += size;
+    block.count.store(index + 1, std::memory_order_release);
+}
+
+bool AudioPacketRing::openBlock() {
+    QMutexLocker locker(&m_mutex);
+
+    // Blocks that ended a window ago go; the newest always stays
+    while (m_blocks.size() > 1) {
+        const AudioPacketBlock& oldest = *m_blocks.front();
+        const size_t count = oldest.count.load(std::memory_order_relaxed);
+        if (count > 0 && m_lastTimestamp - oldest.slots[count - 1].timestamp < m_windowSeconds) {
+            break;
+        }
+        std::shared_ptr<AudioPacketBlock> spare = reclaim(std::move(m_blocks.front()));
+        m_blocks.pop_front();
+        if (spare) {
+            m_spare.push_back(std::move(spare));
+        }
+    }
+
+    std::shared_ptr<AudioPacketBlock> block;
+    if (!m_spare.empty()) {
+        block = std::move(m_spare.back());
+        m_spare.pop_back();
+    } else {
+        block.reset(new (std::nothrow) AudioPacketBlock);
+        if (block) {
+            block->bytes.reset(new (std::nothrow) char[BLOCK_BYTES]);
+            block->slots.reset(new (std::nothrow) AudioPacketBlock::Slot[BLOCK_SLOTS]);
+        }
+        if (!block || !block->bytes || !block->slots) {
+            qDebug() << "[AudioPacketRing] Could not allocate a packet block";
+            return false;
+        }
+    }
+    m_blocks.push_back(std::move(block));
+    return true;
+}
+
+AudioSnapshot AudioPacketRing::snapshot(double seconds) const {
+    AudioSnapshot snapshot;
+    if (seconds <= 0) {
+        return snapshot;
+    }
+
+    Format format;
+    std::vector<std::shared_ptr<const AudioPacketBlock>> blocks;
+    {
+        QMutexLocker locker(&m_mutex);
+        format = m_format;
+        blocks.assign(m_blocks.begin(), m_blocks.end());
+    }
+
+    // Counts are read once; the producer may keep appending meanwhile
+    std::vector<size_t> counts(blocks.size());
+    double newest = -std::numeric_limits<double>::infinity();
+    for (size_t b = 0; b < blocks.size(); b++) {
+        counts[b] = blocks[b]->count.load(std::memory_order_acquire);
+        if (counts[b] > 0) {
+            newest = blocks[b]->slots[counts[b] - 1].timestamp;
+        }
+    }
+    if (format.codecId == 0 || newest == -std::numeric_limits<double>::infinity()) {
+        return snapshot;
+    }
+    const double begin = std::max(newest - seconds, m_clearedBefore.load());
+
+    // Newest first, back to the first packet ending inside the window and
+    // then the pre-roll before it
+    std::vector<const AudioPacketBlock::Slot*> window;
+    std::vector<const AudioPacketBlock*> owners;
+    size_t before = 0;
+    for (size_t b = blocks.size(); b-- > 0 && before < PREROLL_PACKETS; ) {
+        for (size_t s = counts[b]; s-- > 0; ) {
+            if (blocks[b]->slots[s].timestamp <= begin && ++before > PREROLL_PACKETS) {
+                break;
+            }
+            window.push_back(&blocks[b]->slots[s]);
+            owners.push_back(blocks[b].get());
+        }
+    }
+    std::reverse(window.begin(), window.end());
+    std::reverse(owners.begin(), owners.end());
+    const size_t preroll = std::min(before, PREROLL_PACKETS);
+    if (window.size() <= preroll) {
+        return snapshot;
+    }
+
+    const AVCodec* decoder = avcodec_find_decoder(static_cast<AVCodecID>(format.codecId));
+    AVCodecContext* ctx = decoder ? avcodec_alloc_context3(decoder) : nullptr;
+    AVPacket* packet = av_packet_alloc();
+    AVFrame* frame = av_frame_alloc();
+    bool ready = ctx && packet && frame;
+    if (ready) {
+        ctx->sample_rate = format.sampleRate;
+        av_channel_layout_default(&ctx->ch_layout, format.channels);
+        if (!format.extradata.isEmpty()) {
+            ctx->extradata = static_cast<uint8_t*>(av_mallocz(format.extradata.size() + AV_INPUT_BUFFER_PADDING_SIZE));
+            if (ctx->extradata) {
+                memcpy(ctx->extradata, format.extradata.constData(), format.extradata.size());
+                ctx->extradata_size = format.extradata.size();
+            }
+        }
+        ready = avcodec_open2(ctx, decoder, nullptr) >= 0;
+    }
+    if (!ready) {
+        qDebug() << "[AudioPacketRing] Could not open a decoder for the snapshot";
+        av_frame_free(&frame);
+        av_packet_free(&packet);
+        avcodec_free_context(&ctx);
+        return snapshot;
+    }
+
+    // Decoders give one frame per packet; each takes its packet's end time
+    std::deque<std::pair<double, bool>> stamps;   // timestamp, keep
+    std::vector<AudioSample>& out = snapshot.m_chunks;
+    out.reserve(window.size() - preroll);
+    auto receive = [&]() {
+        while (avcodec_receive_frame(ctx, frame) == 0) {
+            if (!stamps.empty()) {
+                const std::pair<double, bool> stamp = stamps.front();
+                stamps.pop_front();
+                if (stamp.second && frame->nb_samples > 0) {
+                    const int channels = frame->ch_layout.nb_channels;
+                    AudioSample sample;
+                    sample.channels = channels;
+                    sample.sampleRate = frame->sample_rate;
+                    sample.timestamp = stamp.first;
+                    sample.data.resize((size_t)frame->nb_samples * channels);
+                    for (int i = 0; i < frame->nb_samples; i++) {
+                        for (int c = 0; c < channels; c++) {
+                            sample.data[(size_t)i * channels + c] = sampleAt(frame, channels, c, i);
+                        }
+                    }
+                    out.push_back(std::move(sample));
+                }
+            }
+            av_frame_unref(frame);
+        }
+    };
+
+    for (size_t i = 0; i < window.size(); i++) {
+        const AudioPacketBlock::Slot& slot = *window[i];
+        if (av_new_packet(packet, (int)slot.size) < 0) {
+            break;
+        }
+        memcpy(packet->data, owners[i]->bytes.get() + slot.offset, slot.size);
+        const int ret = avcodec_send_packet(ctx, packet);
+        av_packet_unref(packet);
+        if (ret < 0) {
+            continue;
+        }
+        stamps.emplace_back(slot.timestamp, i >= preroll);
+        receive();
+    }
+    avcodec_send_packet(ctx, nullptr);
+    receive();
+
+    av_frame_free(&frame);
+    av_packet_free(&packet);
+    avcodec_free_context(&ctx);
+
+    qDebug() << "[AudioPacketRing] Decoded" << out.size() << "packets (" << (newest - begin) << "seconds) for a snapshot";
+    return snapshot;
+}
+
+void AudioPacketRing::clear() {
+    // Hides everything captured so far; the blocks age out as usual
+    m_clearedBefore = MediaClock::nowSeconds();
+}
+
+double AudioPacketRing::bufferedSeconds() const {
+    QMutexLocker locker(&m_mutex);
+    if (m_blocks.empty()) {
+        return 0.0;
+    }
+    const AudioPacketBlock& oldest = *m_blocks.front();
+    const AudioPacketBlock& newest = *m_blocks.back();
+    const size_t oldestCount = oldest.count.load(std::memory_order_acquire);
+    const size_t newestCount = newest.count.load(std::memory_order_acquire);
+    if (oldestCount == 0 || newestCount == 0) {
+        return 0.0;
+    }
+    const double last = newest.slots[newestCount - 1].timestamp;
+    const double first = std::max(oldest.slots[0].timestamp, m_clearedBefore.load());
+    return std::max(0.0, last - first);
+}
+
+size_t AudioPacketRing::memoryBytes() const {
+    QMutexLocker locker(&m_mutex);
+    return (m_blocks.size() + m_spare.size()) * (BLOCK_BYTES + BLOCK_SLOTS * sizeof(AudioPacketBlock::Slot));
+}
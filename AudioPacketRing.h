@@ -0,0 +1,117 @@
+#ifndef AUDIOPACKETRING_H
+#define AUDIOPACKETRING_H
+
+#include "AudioRing.h"
+#include <QByteArray>
+#include <QMutex>
+#include <QString>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <vector>
+#include <cstdint>
+
+struct AVCodecContext;
+struct AVFrame;
+struct AVPacket;
+struct AudioPacketBlock;
+
+/*
+ * AudioPacketRing
+ *
+ * Purpose
+ * - Alternative to `AudioRing` for long replay buffers: the capture thread
+ *   encodes its audio into Opus or AAC packets as it arrives and only the
+ *   packets are kept. At 96 kbps that is 1/30 of the raw float stereo, so
+ *   half an hour of audio takes about 20 MB per device.
+ *
+ * Behaviour
+ * - Same producer interface as `AudioRing`. Samples collect until one
+ *   codec frame is full (20 ms for Opus, 1024 samples for AAC) and are
+ *   then encoded. More than two channels keep the first two.
+ * - Packets are appended to fixed-size blocks. Blocks older than the
+ *   window are evicted whole and reused once no snapshot references them.
+ * - `snapshot()` decodes only the newest `seconds` (plus a few packets of
+ *   decoder pre-roll, thrown away) into an `AudioSnapshot`, so everything
+ *   downstream still sees plain float chunks with the usual end-of-chunk
+ *   timestamps.
+ * - Opus needs libavcodec built with libopus and a rate it supports;
+ *   otherwise `open()` falls back to AAC.
+ *
+ * Threading
+ * - Single producer: `open()`, `close()` and the `write*` calls come from
+ *   the capture thread. It takes the lock only to open or evict a block
+ *   (every few seconds), never per packet. Other methods may be called
+ *   from any thread.
+ */
+class AudioPacketRing {
+public:
+    enum Codec {
+        Opus,
+        Aac
+    };
+
+    AudioPacketRing();
+    ~AudioPacketRing();
+
+    AudioPacketRing(const AudioPacketRing&) = delete;
+    AudioPacketRing& operator=(const AudioPacketRing&) = delete;
+
+    // Drops what was buffered before
+    bool open(Codec codec, int bitrate, int seconds, int sampleRate, int channels);
+    // Stops encoding; buffered packets stay readable
+    void close();
+    bool isOpen() const { return m_encoder != nullptr; }
+    Codec codec() const { return m_codec; }
+
+    // Producer side
+    void write(const float* samples, size_t frames, double timestamp);
+    void writeInt16(const int16_t* samples, size_t frames, double timestamp);
+    void writeSilence(size_t frames, double timestamp);
+
+    // Consumer side
+    AudioSnapshot snapshot(double seconds) const;
+    void clear();
+    double bufferedSeconds() const;
+    size_t memoryBytes() const;
+
+    static QString codecName(Codec codec);
+
+private:
+    // What a decoder needs; copied by snapshots along with the blocks
+    struct Format {
+        int codecId = 0;
+        int sampleRate = 0;
+        int channels = 0;
+        QByteArray extradata;
+    };
+
+    template <typename Fill>
+    void writeWith(size_t frames, double timestamp, Fill fill);
+    void encodePending();
+    void storePacket(const AVPacket* packet);
+    bool openBlock();
+
+    // Encoder state, producer only
+    Codec m_codec;
+    AVCodecContext* m_encoder;
+    AVFrame* m_frame;
+    AVPacket* m_packet;
+    int m_inputChannels;
+    int m_frameSize;
+    std::vector<float> m_pending;   // one codec frame, interleaved
+    size_t m_pendingFrames;
+    int64_t m_inputFrames;          // frames taken in so far
+    int64_t m_lastIndex;            // input frame at m_lastTimestamp
+    double m_lastTimestamp;
+    double m_windowSeconds;
+
+    // Guards the block list and the format, not the block contents
+    mutable QMutex m_mutex;
+    Format m_format;
+    std::deque<std::shared_ptr<AudioPacketBlock>> m_blocks;   // oldest first
+    std::vector<std::shared_ptr<AudioPacketBlock>> m_spare;
+    std::atomic<double> m_clearedBefore;   // packets ending earlier are hidden
+};
+
+#endif // AUDIOPACKETRING_H
@@ -0,0 +1,231 @@
+/*
+ * AudioRing.cpp
+ *
+ * Lock-free single-producer audio ring. The writer announces how far it
+ * is about to write (the reserved counters), writes, then publishes the
+ * new totals. Readers copy what was published and afterwards discard
+ * whatever the reserved counters say may have been overwritten meanwhile.
+ */
+
+#include "AudioRing.h"
+#include <QDebug>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <new>
+
+struct AudioRing::Storage {
+    struct Chunk {
+        uint64_t startFrame;
+        uint32_t frames;
+        double timestamp;
+    };
+
+    int sampleRate = 0;
+    int channels = 0;
+    size_t capacityFrames = 0;
+    size_t chunkCapacity = 0;
+    std::unique_ptr<float[]> samples;
+    std::unique_ptr<Chunk[]> chunks;
+
+    // Totals published after a chunk is complete
+    std::atomic<uint64_t> writtenFrames{0};
+    std::atomic<uint64_t> writtenChunks{0};
+    // Totals announced before a chunk is written
+    std::atomic<uint64_t> reservedFrames{0};
+    std::atomic<uint64_t> reservedChunks{0};
+    // Everything before these was cleared
+    std::atomic<uint64_t> clearedFrames{0};
+    std::atomic<uint64_t> clearedChunks{0};
+};
+
+AudioRing::AudioRing()
+    : m_writer(nullptr)
+{
+}
+
+AudioRing::~AudioRing() = default;
+
+bool AudioRing::allocate(int seconds, int sampleRate, int channels) {
+    if (seconds <= 0 || sampleRate <= 0 || channels <= 0) {
+        return false;
+    }
+    if (m_writer && m_writer->sampleRate == sampleRate && m_writer->channels == channels) {
+        return true;
+    }
+
+    auto storage = std::make_shared<Storage>();
+    storage->sampleRate = sampleRate;
+    storage->channels = channels;
+    storage->capacityFrames = (size_t)seconds * sampleRate;
+    // Room for 5 ms chunks; devices deliver 10 ms or more
+    storage->chunkCapacity = (size_t)seconds * 200;
+    storage->samples.reset(new (std::nothrow) float[storage->capacityFrames * channels]);
+    storage->chunks.reset(new (std::nothrow) Storage::Chunk[storage->chunkCapacity]);
+    if (!storage->samples || !storage->chunks) {
+        qDebug() << "[AudioRing] Could not allocate" << seconds << "seconds of" << channels << "channel audio";
+        return false;
+    }
+
+    qDebug() << "[AudioRing] Allocated" << seconds << "seconds at" << sampleRate << "Hz," << channels << "channels ("
+             << (storage->capacityFrames * channels * sizeof(float)) / (1024 * 1024) << "MB)";
+
+    QMutexLocker locker(&m_storageMutex);
+    m_storage = storage;
+    m_writer = storage.get();
+    return true;
+}
+
+std::shared_ptr<AudioRing::Storage> AudioRing::storage() const {
+    QMutexLocker locker(&m_storageMutex);
+    return m_storage;
+}
+
+template <typename Fill>
+void AudioRing::writeWith(size_t frames, double timestamp, Fill fill) {
+    Storage* storage = m_writer;
+    if (!storage || frames == 0) {
+        return;
+    }
+
+    // A chunk longer than the whole ring keeps only its newest part
+    size_t skip = 0;
+    if (frames > storage->capacityFrames) {
+        skip = frames - storage->capacityFrames;
+        frames = storage->capacityFrames;
+    }
+
+    const uint64_t start = storage->writtenFrames.load(std::memory_order_relaxed);
+    const uint64_t index = storage->writtenChunks.load(std::memory_order_relaxed);
+    storage->reservedFrames.store(start + frames, std::memory_order_relaxed);
+    storage->reservedChunks.store(index + 1, std::memory_order_relaxed);
+    // Readers that see any of the writes below also see the reservation
+    std::atomic_thread_fence(std::memory_order_release);
+
+    const size_t channels = storage->channels;
+    const size_t position = start % storage->capacityFrames;
+    const size_t first = (std::min)(frames, storage->capacityFrames - position);
+    fill(storage->samples.get() + position * channels, skip, first * channels);
+    if (first < frames) {
+        fill(storage->samples.get(), skip + first, (frames - first) * channels);
+    }
+
+    Storage::Chunk& chunk = storage->chunks[index % storage->chunkCapacity];
+    chunk.startFrame = start;
+    chunk.frames = (uint32_t)frames;
+    chunk.timestamp = timestamp;
+
+    storage->writtenFrames.store(start + frames, std::memory_order_release);
+    storage->writtenChunks.store(index + 1, std::memory_order_release);
+}
+
+void AudioRing::write(const float* samples, size_t frames, double timestamp) {
+    const size_t channels = m_writer ? m_writer->channels : 0;
+    writeWith(frames, timestamp, [samples, channels](float* dst, size_t fromFrame, size_t count) {
+        memcpy(dst, samples + fromFrame * channels, count * sizeof(float));
+    });
+}
+
+void AudioRing::writeInt16(const int16_t* samples, size_t frames, double timestamp) {
+    const size_t channels = m_writer ? m_writer->channels : 0;
+    writeWith(frames, timestamp, [samples, channels](float* dst, size_t fromFrame, size_t count) {
+        // 16-bit PCM to [-1.0, 1.0)
+        const int16_t* src = samples + fromFrame * channels;
+        for (size_t i = 0; i < count; i++) {
+            dst[i] = src[i] / 32768.0f;
+        }
+    });
+}
+
+void AudioRing::writeSilence(size_t frames, double timestamp) {
+    writeWith(frames, timestamp, [](float* dst, size_t, size_t count) {
+        std::fill(dst, dst + count, 0.0f);
+    });
+}
+
+AudioSnapshot AudioRing::snapshot(double seconds) const {
+    AudioSnapshot snapshot;
+    const std::shared_ptr<Storage> storage = this->storage();
+    if (!storage || seconds <= 0) {
+        return snapshot;
+    }
+
+    const uint64_t published = storage->writtenChunks.load(std::memory_order_acquire);
+    const uint64_t cleared = storage->clearedChunks.load(std::memory_order_acquire);
+    const uint64_t capacity = storage->chunkCapacity;
+    const uint64_t oldest = (std::max)(cleared, published > capacity ? published - capacity : 0);
+    const uint64_t wanted = (uint64_t)std::ceil(seconds * storage->sampleRate);
+
+    // Newest first, until at least `seconds` are covered
+    std::vector<Storage::Chunk> chunks;
+    uint64_t covered = 0;
+    for (uint64_t i = published; i > oldest && covered < wanted; ) {
+        i--;
+        chunks.push_back(storage->chunks[i % capacity]);
+        covered += chunks.back().frames;
+    }
+
+    // Drop records the writer may have reused while they were read
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const uint64_t reservedChunks = storage->reservedChunks.load(std::memory_order_relaxed);
+    while (!chunks.empty() && published - chunks.size() + capacity < reservedChunks) {
+        chunks.pop_back();
+    }
+    std::reverse(chunks.begin(), chunks.end());
+
+    const size_t channels = storage->channels;
+    std::vector<AudioSample>& out = snapshot.m_chunks;
+    out.reserve(chunks.size());
+    for (const Storage::Chunk& chunk : chunks) {
+        AudioSample sample;
+        sample.channels = storage->channels;
+        sample.sampleRate = storage->sampleRate;
+        sample.timestamp = chunk.timestamp;
+        sample.data.resize((size_t)chunk.frames * channels);
+
+        const size_t position = chunk.startFrame % storage->capacityFrames;
+        const size_t first = (std::min)((size_t)chunk.frames, storage->capacityFrames - position);
+        memcpy(sample.data.data(), storage->samples.get() + position * channels, first * channels * sizeof(float));
+        if (first < chunk.frames) {
+            memcpy(sample.data.data() + first * channels, storage->samples.get(),
+                   (chunk.frames - first) * channels * sizeof(float));
+        }
+        out.push_back(std::move(sample));
+    }
+
+    // Audio the writer overwrote during the copy is always at the oldest
+    // end; cut it off. A partly kept chunk still ends at its timestamp.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const uint64_t reservedFrames = storage->reservedFrames.load(std::memory_order_relaxed);
+    const uint64_t limit = reservedFrames > storage->capacityFrames ? reservedFrames - storage->capacityFrames : 0;
+    size_t dropped = 0;
+    while (dropped < chunks.size() && chunks[dropped].startFrame + chunks[dropped].frames <= limit) {
+        dropped++;
+    }
+    out.erase(out.begin(), out.begin() + dropped);
+    if (!out.empty() && chunks[dropped].startFrame < limit) {
+        const size_t stale = (size_t)(limit - chunks[dropped].startFrame) * channels;
+        out.front().data.erase(out.front().data.begin(), out.front().data.begin() + stale);
+    }
+    return snapshot;
+}
+
+void AudioRing::clear() {
+    const std::shared_ptr<Storage> storage = this->storage();
+    if (!storage) {
+        return;
+    }
+    storage->clearedFrames.store(storage->writtenFrames.load(std::memory_order_acquire), std::memory_order_release);
+    storage->clearedChunks.store(storage->writtenChunks.load(std::memory_order_acquire), std::memory_order_release);
+}
+
+double AudioRing::bufferedSeconds() const {
+    const std::shared_ptr<Storage> storage = this->storage();
+    if (!storage) {
+        return 0.0;
+    }
+    const uint64_t written = storage->writtenFrames.load(std::memory_order_acquire);
+    const uint64_t cleared = storage->clearedFrames.load(std::memory_order_acquire);
+    const uint64_t held = std::min<uint64_t>(written - (std::min)(written, cleared), storage->capacityFrames);
+    return held / (double)storage->sampleRate;
+}
@@ -0,0 +1,104 @@
+#ifndef AUDIORING_H
+#define AUDIORING_H
+
+#include <QMutex>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cstdint>
+
+/*
+ * AudioSample
+ * - One chunk of interleaved float samples as delivered by the device.
+ *   `timestamp` is `MediaClock` time in seconds (the clock video frames
+ *   are stamped with) at which the chunk's last frame was captured. It is
+ *   derived from the device's own capture time - the WASAPI QPC position,
+ *   the Audio Queue host time, the PulseAudio latency - so it does not
+ *   depend on when the capture thread got round to reading it.
+ */
+struct AudioSample {
+    std::vector<float> data;
+    int channels;
+    int sampleRate;
+    double timestamp;
+};
+
+/*
+ * AudioSnapshot
+ * - The newest chunks of an `AudioRing`, copied out so they stay valid
+ *   while capture keeps overwriting the ring. Oldest chunk first.
+ * - Cheap to move and safe to hand to another thread.
+ */
+class AudioSnapshot {
+public:
+    size_t size() const { return m_chunks.size(); }
+    bool empty() const { return m_chunks.empty(); }
+    const AudioSample& operator[](size_t index) const { return m_chunks[index]; }
+
+private:
+    friend class AudioRing;
+    friend class AudioPacketRing;
+
+    std::vector<AudioSample> m_chunks;
+};
+
+/*
+ * AudioRing
+ *
+ * Purpose
+ * - Fixed-capacity store for the most recent audio of one capture device:
+ *   interleaved float samples in one preallocated ring, plus a ring of
+ *   chunk records (start frame, length, timestamp). The capture thread
+ *   writes without locking or allocating, so a busy GUI thread or a clip
+ *   being saved can no longer delay it into an overrun.
+ *
+ * Behaviour
+ * - Writes overwrite the oldest audio once the ring is full, so it always
+ *   holds the newest `seconds` given to `allocate()`. How much is buffered
+ *   is a counter, never a scan.
+ * - `snapshot()` copies chunks out without stopping the writer. Before
+ *   and after copying it checks how far the writer has got (sequence-lock
+ *   style) and drops the oldest audio if it was overwritten mid-copy, so a
+ *   snapshot never contains torn samples.
+ * - `clear()` only moves a marker, so it is safe while capturing.
+ *
+ * Threading
+ * - Single producer: the `write*` calls must come from one thread at a
+ *   time. `allocate()` belongs to that thread too, before it starts
+ *   writing. All other methods may be called from any thread.
+ */
+class AudioRing {
+public:
+    AudioRing();
+    ~AudioRing();
+
+    AudioRing(const AudioRing&) = delete;
+    AudioRing& operator=(const AudioRing&) = delete;
+
+    // Keeps the buffered audio when the format is unchanged
+    bool allocate(int seconds, int sampleRate, int channels);
+
+    // Producer side
+    void write(const float* samples, size_t frames, double timestamp);
+    void writeInt16(const int16_t* samples, size_t frames, double timestamp);
+    void writeSilence(size_t frames, double timestamp);
+
+    // Consumer side
+    AudioSnapshot snapshot(double seconds) const;
+    void clear();
+    double bufferedSeconds() const;
+
+private:
+    struct Storage;
+
+    template <typename Fill>
+    void writeWith(size_t frames, double timestamp, Fill fill);
+    std::shared_ptr<Storage> storage() const;
+
+    // Taken only to swap or grab the storage, never on the write path
+    mutable QMutex m_storageMutex;
+    std::shared_ptr<Storage> m_storage;
+    Storage* m_writer;   // producer's pointer to m_storage
+};
+
+#endif // AUDIORING_H
@@ -0,0 +1,382 @@
+/*
+ * ClipIndex.cpp
+ *
+ * Reading, writing and building the per-clip index sidecar. The file is
+ * a QDataStream: a stamp of the clip it describes, the metadata, the
+ * keyframe and thumbnail times, the quality timeline (from version 2),
+ * and last the thumbnail strip as a JPEG.
+ */
+
+#include "ClipIndex.h"
+#include <QBuffer>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDebug>
+#include <QFile>
+#include <QFileInfo>
+#include <QPainter>
+#include <QSaveFile>
+#include <algorithm>
+#include <cmath>
+
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libswscale/swscale.h>
+}
+
+static const quint32 INDEX_MAGIC = 0x43494458; // "CIDX"
+static const quint32 INDEX_VERSION = 2;
+static const int STRIP_JPEG_QUALITY = 80;
+
+QString ClipIndex::sidecarPath(const QString& clipPath) {
+    return clipPath + ".clipidx";
+}
+
+void ClipIndex::remove(const QString& clipPath) {
+    QFile::remove(sidecarPath(clipPath));
+}
+
+std::vector<int64_t> ClipIndex::thumbnailTimes(int64_t durationUs) {
+    const int64_t count = std::clamp<int64_t>(durationUs / MIN_THUMBNAIL_SPACING_US, 1, MAX_THUMBNAILS);
+    std::vector<int64_t> times;
+    times.reserve(static_cast<size_t>(count));
+    for (int64_t i = 0; i < count; i++) {
+        times.push_back(durationUs * i / count);
+    }
+    return times;
+}
+
+bool ClipIndex::setError(const QString& error) {
+    m_lastError = error;
+    qDebug() << "[ClipIndex]" << error;
+    return false;
+}
+
+void ClipIndex::addThumbnail(int64_t timeUs, const QImage& frame) {
+    if (frame.isNull()) {
+        return;
+    }
+    // Every thumbnail has the size of the first, so the strip is a grid
+    QSize size(static_cast<int>(std::lround(THUMBNAIL_HEIGHT * frame.width() / double(frame.height()))),
+               THUMBNAIL_HEIGHT);
+    if (!m_thumbnails.empty()) {
+        size = m_thumbnails.front().size();
+    }
+    QImage thumbnail = frame.size() == size
+        ? frame : frame.scaled(size, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+    if (thumbnail.format() != QImage::Format_RGB32) {
+        thumbnail = thumbnail.convertToFormat(QImage::Format_RGB32);
+    }
+
+    auto it = std::lower_bound(m_thumbnailUs.begin(), m_thumbnailUs.end(), timeUs);
+    const auto offset = it - m_thumbnailUs.begin();
+    m_thumbnailUs.insert(it, timeUs);
+    m_thumbnails.insert(m_thumbnails.begin() + offset, thumbnail);
+}
+
+QImage ClipIndex::thumbnailAt(int64_t timeUs) const {
+    if (m_thumbnails.empty()) {
+        return QImage();
+    }
+    auto it = std::lower_bound(m_thumbnailUs.begin(), m_thumbnailUs.end(), timeUs);
+    size_t i = static_cast<size_t>(it - m_thumbnailUs.begin());
+    if (i == m_thumbnailUs.size() || (i > 0 && timeUs - m_thumbnailUs[i - 1] < m_thumbnailUs[i] - timeUs)) {
+        i--;
+    }
+    return m_thumbnails[i];
+}
+
+bool ClipIndex::save(const QString& clipPath) {
+    const QFileInfo clip(clipPath);
+    if (!clip.exists()) {
+        return setError("Clip does not exist: " + clipPath);
+    }
+
+    QByteArray strip;
+    if (!m_thumbnails.empty()) {
+        const QSize cell = m_thumbnails.front().size();
+        QImage image(cell.width() * static_cast<int>(m_thumbnails.size()), cell.height(), QImage::Format_RGB32);
+        QPainter painter(&image);
+        for (size_t i = 0; i < m_thumbnails.size(); i++) {
+            painter.drawImage(static_cast<int>(i) * cell.width(), 0, m_thumbnails[i]);
+        }
+        painter.end();
+        QBuffer buffer(&strip);
+        buffer.open(QIODevice::WriteOnly);
+        image.save(&buffer, "JPEG", STRIP_JPEG_QUALITY);
+    }
+
+    QSaveFile file(sidecarPath(clipPath));
+    if (!file.open(QIODevice::WriteOnly)) {
+        return setError("Cannot write " + file.fileName());
+    }
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_6_0);
+    out << INDEX_MAGIC << INDEX_VERSION
+        << static_cast<qint64>(clip.size()) << clip.lastModified().toMSecsSinceEpoch()
+        << static_cast<qint64>(m_info.durationUs) << m_info.fps
+        << static_cast<qint32>(m_info.width) << static_cast<qint32>(m_info.height)
+        << static_cast<qint32>(m_info.frameCount);
+
+    out << static_cast<quint32>(m_keyframesUs.size());
+    for (int64_t us : m_keyframesUs) {
+        out << static_cast<qint64>(us);
+    }
+    out << static_cast<quint32>(m_thumbnailUs.size());
+    for (int64_t us : m_thumbnailUs) {
+        out << static_cast<qint64>(us);
+    }
+    out << static_cast<quint32>(m_qualityTimeline.size());
+    for (const std::pair<int64_t, int>& change : m_qualityTimeline) {
+        out << static_cast<qint64>(change.first) << static_cast<qint32>(change.second);
+    }
+    out << strip;
+
+    if (out.status() != QDataStream::Ok || !file.commit()) {
+        return setError("Failed to write " + file.fileName());
+    }
+    return true;
+}
+
+bool ClipIndex::load(const QString& clipPath, bool withThumbnails) {
+    *this = ClipIndex();
+
+    const QFileInfo clip(clipPath);
+    QFile file(sidecarPath(clipPath));
+    if (!clip.exists() || !file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_6_0);
+
+    quint32 magic = 0;
+    quint32 version = 0;
+    qint64 clipSize = 0;
+    qint64 clipModified = 0;
+    in >> magic >> version >> clipSize >> clipModified;
+    // Version 1 is version 2 without the quality timeline
+    if (magic != INDEX_MAGIC || version < 1 || version > INDEX_VERSION) {
+        return setError("Unrecognised index " + file.fileName());
+    }
+    // Re-encoded or replaced since the index was written
+    if (clipSize != clip.size() || clipModified != clip.lastModified().toMSecsSinceEpoch()) {
+        return false;
+    }
+
+    Info info;
+    qint64 durationUs = 0;
+    qint32 width = 0;
+    qint32 height = 0;
+    qint32 frameCount = 0;
+    in >> durationUs >> info.fps >> width >> height >> frameCount;
+    info.durationUs = durationUs;
+    info.width = width;
+    info.height = height;
+    info.frameCount = frameCount;
+
+    quint32 keyframes = 0;
+    in >> keyframes;
+    for (quint32 i = 0; i < keyframes && in.status() == QDataStream::Ok; i++) {
+        qint64 us = 0;
+        in >> us;
+        m_keyframesUs.push_back(us);
+    }
+    quint32 thumbnails = 0;
+    in >> thumbnails;
+    std::vector<int64_t> thumbnailUs;
+    for (quint32 i = 0; i < thumbnails && in.status() == QDataStream::Ok; i++) {
+        qint64 us = 0;
+        in >> us;
+        thumbnailUs.push_back(us);
+    }
+    quint32 qualityChanges = 0;
+    if (version >= 2) {
+        in >> qualityChanges;
+    }
+    for (quint32 i = 0; i < qualityChanges && in.status() == QDataStream::Ok; i++) {
+        qint64 us = 0;
+        qint32 level = 0;
+        in >> us >> level;
+        m_qualityTimeline.emplace_back(us, level);
+    }
+    if (in.status() != QDataStream::Ok || info.frameCount <= 0 || info.fps <= 0) {
+        m_keyframesUs.clear();
+        m_qualityTimeline.clear();
+        return setError("Truncated index " + file.fileName());
+    }
+    info.valid = true;
+    m_info = info;
+
+    if (withThumbnails && !thumbnailUs.empty()) {
+        QByteArray strip;
+        in >> strip;
+        const QImage image = QImage::fromData(strip, "JPEG");
+        const int cellWidth = image.width() / static_cast<int>(thumbnailUs.size());
+        if (!image.isNull() && cellWidth > 0) {
+            for (size_t i = 0; i < thumbnailUs.size(); i++) {
+                m_thumbnails.push_back(image.copy(static_cast<int>(i) * cellWidth, 0, cellWidth, image.height())
+                                           .convertToFormat(QImage::Format_RGB32));
+            }
+            m_thumbnailUs = std::move(thumbnailUs);
+        }
+    }
+    return true;
+}
+
+// Decodes the keyframe at or before each thumbnail time. Only keyframes
+// are read into the decoder, so this costs one picture per thumbnail.
+static bool decodeThumbnails(AVFormatContext* format, int streamIndex, ClipIndex& index) {
+    AVStream* stream = format->streams[streamIndex];
+    const AVCodec* codec = avcodec_find_decoder(stream->codecpar->codec_id);
+    if (!codec) {
+        return false;
+    }
+    AVCodecContext* decoder = avcodec_alloc_context3(codec);
+    if (!decoder || avcodec_parameters_to_context(decoder, stream->codecpar) < 0) {
+        avcodec_free_context(&decoder);
+        return false;
+    }
+    decoder->skip_frame = AVDISCARD_NONKEY;
+    // Frame threads would hold each picture back by a frame per thread
+    decoder->thread_type = FF_THREAD_SLICE;
+    if (avcodec_open2(decoder, codec, nullptr) < 0) {
+        avcodec_free_context(&decoder);
+        return false;
+    }
+
+    AVFrame* frame = av_frame_alloc();
+    AVPacket* packet = av_packet_alloc();
+    SwsContext* sws = nullptr;
+
+    const int64_t startPts = stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+    int64_t lastKeyPts = AV_NOPTS_VALUE;
+    QImage lastThumbnail;
+
+    for (int64_t timeUs : ClipIndex::thumbnailTimes(index.info().durationUs)) {
+        const int64_t ts = startPts + av_rescale_q(timeUs, AV_TIME_BASE_Q, stream->time_base);
+        if (av_seek_frame(format, streamIndex, ts, AVSEEK_FLAG_BACKWARD) < 0) {
+            continue;
+        }
+
+        QImage thumbnail;
+        while (av_read_frame(format, packet) >= 0) {
+            if (packet->stream_index != streamIndex || !(packet->flags & AV_PKT_FLAG_KEY)) {
+                av_packet_unref(packet);
+                continue;
+            }
+            // Several thumbnails inside one GOP share its keyframe
+            if (packet->pts == lastKeyPts && !lastThumbnail.isNull()) {
+                av_packet_unref(packet);
+                thumbnail = lastThumbnail;
+                break;
+            }
+            lastKeyPts = packet->pts;
+
+            // Send the keyframe alone and drain, so it comes out at once
+            avcodec_flush_buffers(decoder);
+            avcodec_send_packet(decoder, packet);
+            av_packet_unref(packet);
+            avcodec_send_packet(decoder, nullptr);
+            if (avcodec_receive_frame(decoder, frame) == 0) {
+                const int height = ClipIndex::THUMBNAIL_HEIGHT;
+                const int width = std::max(1, static_cast<int>(std::lround(height * frame->width / double(frame->height))));
+                sws = sws_getCachedContext(sws, frame->width, frame->height, static_cast<AVPixelFormat>(frame->format),
+                                           width, height, AV_PIX_FMT_RGB32, SWS_AREA, nullptr, nullptr, nullptr);
+                if (sws) {
+                    thumbnail = QImage(width, height, QImage::Format_RGB32);
+                    uint8_t* dst[4] = { thumbnail.bits(), nullptr, nullptr, nullptr };
+                    int dstStride[4] = { static_cast<int>(thumbnail.bytesPerLine()), 0, 0, 0 };
+                    sws_scale(sws, frame->data, frame->linesize, 0, frame->height, dst, dstStride);
+                }
+                av_frame_unref(frame);
+            }
+            break;
+        }
+
+        if (!thumbnail.isNull()) {
+            index.addThumbnail(timeUs, thumbnail);
+            lastThumbnail = thumbnail;
+        }
+    }
+
+    sws_freeContext(sws);
+    av_packet_free(&packet);
+    av_frame_free(&frame);
+    avcodec_free_context(&decoder);
+    return index.hasThumbnails();
+}
+
+bool ClipIndex::buildThumbnails(const QString& clipPath) {
+    m_thumbnailUs.clear();
+    m_thumbnails.clear();
+
+    AVFormatContext* format = nullptr;
+    const QByteArray file = clipPath.toUtf8();
+    if (avformat_open_input(&format, file.constData(), nullptr, nullptr) < 0) {
+        return setError("Cannot open " + clipPath);
+    }
+    // Clips this app writes are MP4, whose header has all the decoder
+    // needs; skipping the stream probe keeps this to the keyframes
+    const int streamIndex = av_find_best_stream(format, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+    const bool ok = streamIndex >= 0 && decodeThumbnails(format, streamIndex, *this);
+    avformat_close_input(&format);
+    return ok ? true : setError("No thumbnails decoded from " + clipPath);
+}
+
+bool ClipIndex::build(const QString& clipPath) {
+    *this = ClipIndex();
+
+    AVFormatContext* format = nullptr;
+    const QByteArray file = clipPath.toUtf8();
+    if (avformat_open_input(&format, file.constData(), nullptr, nullptr) < 0) {
+        return setError("Cannot open " + clipPath);
+    }
+    if (avformat_find_stream_info(format, nullptr) < 0) {
+        avformat_close_input(&format);
+        return setError("No stream info in " + clipPath);
+    }
+    const int streamIndex = av_find_best_stream(format, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+    if (streamIndex < 0) {
+        avformat_close_input(&format);
+        return setError("No video stream in " + clipPath);
+    }
+    AVStream* stream = format->streams[streamIndex];
+
+    Info info;
+    const AVRational rate = av_guess_frame_rate(format, stream, nullptr);
+    if (rate.num > 0 && rate.den > 0) {
+        info.fps = av_q2d(rate);
+    }
+    info.width = stream->codecpar->width;
+    info.height = stream->codecpar->height;
+    if (stream->duration != AV_NOPTS_VALUE) {
+        info.durationUs = av_rescale_q(stream->duration, stream->time_base, AV_TIME_BASE_Q);
+    } else if (format->duration != AV_NOPTS_VALUE) {
+        info.durationUs = format->duration;
+    }
+    info.frameCount = stream->nb_frames > 0
+        ? static_cast<int>(stream->nb_frames)
+        : static_cast<int>(std::llround(info.durationUs / 1e6 * info.fps));
+    if (info.frameCount <= 0) {
+        avformat_close_input(&format);
+        return setError("No frames in " + clipPath);
+    }
+    info.valid = true;
+    m_info = info;
+
+    const int64_t startPts = stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+    const int entries = avformat_index_get_entries_count(stream);
+    for (int i = 0; i < entries; i++) {
+        const AVIndexEntry* entry = avformat_index_get_entry(stream, i);
+        if (entry && (entry->flags & AVINDEX_KEYFRAME)) {
+            m_keyframesUs.push_back(av_rescale_q(entry->timestamp - startPts, stream->time_base, AV_TIME_BASE_Q));
+        }
+    }
+    std::sort(m_keyframesUs.begin(), m_keyframesUs.end());
+
+    // An index without thumbnails still saves the probe
+    decodeThumbnails(format, streamIndex, *this);
+    avformat_close_input(&format);
+    return true;
+}
@@ -0,0 +1,97 @@
+#ifndef CLIPINDEX_H
+#define CLIPINDEX_H
+
+#include <QString>
+#include <QImage>
+#include <vector>
+#include <utility>
+#include <cstdint>
+
+/*
+ * ClipIndex
+ *
+ * Purpose
+ * - A small sidecar file next to each clip (`<clip>.clipidx`) holding what
+ *   the clips list, the viewer and the trim dialog would otherwise probe
+ *   from the video every time: duration, fps, resolution, frame count,
+ *   keyframe times, the capture quality timeline and a strip of small
+ *   thumbnails.
+ *
+ * Behaviour
+ * - Saves write it from what the encoder already has: the frames being
+ *   encoded supply the thumbnails and the muxed packets the keyframes.
+ *   `build()` makes one from the file instead (clips saved by the ffmpeg
+ *   binary, trimmed clips, clips from older versions), decoding only the
+ *   keyframes the thumbnails need.
+ * - The sidecar records the clip's size and modification time; `load()`
+ *   treats an index that no longer matches its clip as missing.
+ * - Thumbnails are `THUMBNAIL_HEIGHT` pixels high, at most
+ *   `MAX_THUMBNAILS` of them spread evenly over the clip, stored as one
+ *   JPEG strip. `load(path, false)` stops before the strip, which is all
+ *   the clips list needs.
+ *
+ * Error handling
+ * - `load()`, `save()` and `build()` return false and set `lastError()`.
+ *   A missing index is never fatal: callers probe the clip instead.
+ *
+ * Threading
+ * - An instance is used by one thread at a time; `build()` belongs on a
+ *   worker thread.
+ */
+class ClipIndex {
+public:
+    struct Info {
+        bool valid = false;
+        int64_t durationUs = 0;
+        double fps = 30.0;
+        int width = 0;
+        int height = 0;
+        int frameCount = 0;
+    };
+
+    static constexpr int THUMBNAIL_HEIGHT = 90;
+    static constexpr int MAX_THUMBNAILS = 60;
+    static constexpr int64_t MIN_THUMBNAIL_SPACING_US = 500000;
+
+    static QString sidecarPath(const QString& clipPath);
+    // Deletes the sidecar of a clip that is being deleted
+    static void remove(const QString& clipPath);
+    // Times at which a clip of `durationUs` gets its thumbnails
+    static std::vector<int64_t> thumbnailTimes(int64_t durationUs);
+
+    bool load(const QString& clipPath, bool withThumbnails = true);
+    bool save(const QString& clipPath);
+    bool build(const QString& clipPath);
+
+    // Filled in while a clip is written; times are relative to its start
+    void setInfo(const Info& info) { m_info = info; }
+    void setKeyframes(std::vector<int64_t> keyframesUs) { m_keyframesUs = std::move(keyframesUs); }
+    // (time, level) pairs, level as in `QualityController` (0 = full
+    // quality), the first at 0; empty when the whole clip was full quality
+    void setQualityTimeline(std::vector<std::pair<int64_t, int>> changes) { m_qualityTimeline = std::move(changes); }
+    // Downscales `frame` and stores it as the thumbnail for `timeUs`
+    void addThumbnail(int64_t timeUs, const QImage& frame);
+    // Decodes the keyframes nearest to `thumbnailTimes()` from the clip
+    bool buildThumbnails(const QString& clipPath);
+
+    const Info& info() const { return m_info; }
+    const std::vector<int64_t>& keyframesUs() const { return m_keyframesUs; }
+    const std::vector<std::pair<int64_t, int>>& qualityTimeline() const { return m_qualityTimeline; }
+    bool hasThumbnails() const { return !m_thumbnails.empty(); }
+    // The thumbnail closest to `timeUs`; null if there are none
+    QImage thumbnailAt(int64_t timeUs) const;
+
+    QString lastError() const { return m_lastError; }
+
+private:
+    bool setError(const QString& error);
+
+    Info m_info;
+    std::vector<int64_t> m_keyframesUs;
+    std::vector<std::pair<int64_t, int>> m_qualityTimeline;
+    std::vector<int64_t> m_thumbnailUs;   // ascending
+    std::vector<QImage> m_thumbnails;
+    QString m_lastError;
+};
+
+#endif // CLIPINDEX_H
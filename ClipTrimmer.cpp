@@ -0,0 +1,727 @@
+/*
+ * ClipTrimmer.cpp
+ *
+ * Stream-copy trimming of saved clips, re-encoding only the frames
+ * between the requested start and the next keyframe. The rules for what
+ * is copied, re-encoded or held back are in ClipTrimmer.h.
+ */
+
+#include "ClipTrimmer.h"
+#include "EncoderBackend.h"
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <algorithm>
+#include <cstring>
+
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libswscale/swscale.h>
+}
+
+static QString avErrorString(int errnum) {
+    char buf[AV_ERROR_MAX_STRING_SIZE] = {0};
+    av_strerror(errnum, buf, sizeof(buf));
+    return QString::fromUtf8(buf);
+}
+
+ClipTrimmer::ClipTrimmer()
+    : m_smartCut(true)
+    , m_input(nullptr)
+    , m_output(nullptr)
+    , m_videoIndex(-1)
+    , m_audioIndex(-1)
+    , m_videoOut(nullptr)
+    , m_audioOut(nullptr)
+    , m_packet(nullptr)
+    , m_startTs(0)
+    , m_endTs(0)
+    , m_audioStartTs(0)
+    , m_audioEndTs(0)
+    , m_injectParameterSets(false)
+    , m_nalLengthSize(0)
+    , m_decoder(nullptr)
+    , m_encoder(nullptr)
+    , m_swsCtx(nullptr)
+    , m_scaledFrame(nullptr)
+{
+}
+
+ClipTrimmer::~ClipTrimmer() {
+    cleanup();
+}
+
+bool ClipTrimmer::setError(const QString& context, int avError) {
+    m_lastError = avError ? QString("%1: %2").arg(context, avErrorString(avError)) : context;
+    qDebug() << "[ClipTrimmer]" << m_lastError;
+    return false;
+}
+
+void ClipTrimmer::clearPackets(std::vector<AVPacket*>& packets) {
+    for (AVPacket* packet : packets) {
+        av_packet_free(&packet);
+    }
+    packets.clear();
+}
+
+void ClipTrimmer::cleanup() {
+    clearPackets(m_startGop);
+    clearPackets(m_held);
+    m_reencodedPts.clear();
+    m_parameterSets.clear();
+    m_nalLengthSize = 0;
+    m_injectParameterSets = false;
+
+    if (m_output) {
+        if (m_output->pb && !(m_output->oformat->flags & AVFMT_NOFILE)) {
+            avio_closep(&m_output->pb);
+        }
+        avformat_free_context(m_output);
+        m_output = nullptr;
+    }
+    if (m_input) {
+        avformat_close_input(&m_input);
+    }
+    av_packet_free(&m_packet);
+    avcodec_free_context(&m_decoder);
+    avcodec_free_context(&m_encoder);
+    sws_freeContext(m_swsCtx);
+    m_swsCtx = nullptr;
+    av_frame_free(&m_scaledFrame);
+
+    m_videoIndex = -1;
+    m_audioIndex = -1;
+    m_videoOut = nullptr;
+    m_audioOut = nullptr;
+}
+
+bool ClipTrimmer::trim(const QString& inputPath, const QString& outputPath,
+                       int64_t startUs, int64_t endUs)
+{
+    QElapsedTimer timer;
+    timer.start();
+    m_result = Result();
+    m_lastError.clear();
+
+    const bool ok = run(inputPath, outputPath, startUs, endUs);
+    cleanup();
+    if (!ok) {
+        QFile::remove(outputPath);
+        return false;
+    }
+
+    m_result.seconds = timer.nsecsElapsed() / 1e9;
+    qDebug() << "[ClipTrimmer] Trimmed" << QFileInfo(inputPath).fileName() << "to"
+             << QFileInfo(outputPath).fileName() << "-" << m_result.copiedPackets << "packets copied,"
+             << m_result.reencodedFrames << "frames re-encoded in" << m_result.seconds << "s";
+    return true;
+}
+
+bool ClipTrimmer::run(const QString& inputPath, const QString& outputPath,
+                      int64_t startUs, int64_t endUs)
+{
+    if (endUs <= startUs) {
+        return setError("The trim range is empty");
+    }
+    if (QFileInfo(inputPath).absoluteFilePath() == QFileInfo(outputPath).absoluteFilePath()) {
+        return setError("Cannot trim a clip onto itself");
+    }
+    if (!openInput(inputPath)) {
+        return false;
+    }
+
+    const AVStream* video = m_input->streams[m_videoIndex];
+    const int64_t videoStart = video->start_time != AV_NOPTS_VALUE ? video->start_time : 0;
+    m_startTs = videoStart + av_rescale_q(std::max<int64_t>(0, startUs), AV_TIME_BASE_Q, video->time_base);
+    m_endTs = videoStart + av_rescale_q(endUs, AV_TIME_BASE_Q, video->time_base);
+    if (m_audioIndex >= 0) {
+        const AVStream* audio = m_input->streams[m_audioIndex];
+        m_audioStartTs = av_rescale_q(m_startTs, video->time_base, audio->time_base);
+        m_audioEndTs = av_rescale_q(m_endTs, video->time_base, audio->time_base);
+    }
+
+    if (m_smartCut && !parseParameterSets()) {
+        qDebug() << "[ClipTrimmer] No avcC/hvcC parameter sets; the start GOP is copied whole";
+    }
+    if (!openOutput(outputPath)) {
+        return false;
+    }
+
+    m_packet = av_packet_alloc();
+    if (!m_packet) {
+        return setError("Failed to allocate packet");
+    }
+
+    // Straight to the keyframe at or before the start
+    int ret = av_seek_frame(m_input, m_videoIndex, m_startTs, AVSEEK_FLAG_BACKWARD);
+    if (ret < 0) {
+        qDebug() << "[ClipTrimmer] Seek failed (" << avErrorString(ret) << "), reading from the start";
+    }
+
+    enum { Seeking, Copying, Done } state = Seeking;
+    bool audioDone = m_audioIndex < 0;
+
+    while (state != Done || !audioDone) {
+        ret = av_read_frame(m_input, m_packet);
+        if (ret == AVERROR_EOF) {
+            break;
+        }
+        if (ret < 0) {
+            return setError("Failed to read clip", ret);
+        }
+
+        if (m_packet->stream_index == m_audioIndex) {
+            const int64_t pts = m_packet->pts;
+            if (pts == AV_NOPTS_VALUE || pts + m_packet->duration <= m_audioStartTs || audioDone) {
+                av_packet_unref(m_packet);
+            } else if (pts >= m_audioEndTs) {
+                audioDone = true;
+                av_packet_unref(m_packet);
+            } else if (!writePacket(m_packet, m_audioIndex)) {
+                return false;
+            }
+            continue;
+        }
+        if (m_packet->stream_index != m_videoIndex || state == Done) {
+            av_packet_unref(m_packet);
+            continue;
+        }
+
+        const bool keyframe = (m_packet->flags & AV_PKT_FLAG_KEY) != 0;
+        const int64_t pts = m_packet->pts != AV_NOPTS_VALUE ? m_packet->pts : m_packet->dts;
+
+        if (state == Seeking) {
+            if (!keyframe || pts < m_startTs) {
+                // Packets before the first keyframe cannot be decoded
+                if (keyframe) {
+                    clearPackets(m_startGop);
+                }
+                if (keyframe || !m_startGop.empty()) {
+                    m_startGop.push_back(av_packet_clone(m_packet));
+                }
+                av_packet_unref(m_packet);
+                continue;
+            }
+            // The first keyframe at or after the start
+            const int64_t dts = m_packet->dts != AV_NOPTS_VALUE ? m_packet->dts : pts;
+            if (!finishStartGop(dts)) {
+                return false;
+            }
+            state = Copying;
+        }
+
+        if (keyframe && pts >= m_endTs) {
+            state = Done;
+            clearPackets(m_held);
+            av_packet_unref(m_packet);
+            continue;
+        }
+        if (!copyVideoPacket(m_packet)) {
+            return false;
+        }
+    }
+
+    // The range ended inside the GOP the start is in
+    if (state == Seeking && !finishStartGop(INT64_MAX)) {
+        return false;
+    }
+    clearPackets(m_held);
+
+    if (m_result.copiedPackets + m_result.reencodedFrames == 0) {
+        return setError("No video in the trim range");
+    }
+
+    ret = av_write_trailer(m_output);
+    if (ret < 0) {
+        return setError("Failed to write container trailer", ret);
+    }
+    return true;
+}
+
+bool ClipTrimmer::openInput(const QString& path) {
+    const QByteArray file = path.toUtf8();
+    int ret = avformat_open_input(&m_input, file.constData(), nullptr, nullptr);
+    if (ret < 0) {
+        return setError("Failed to open clip", ret);
+    }
+    ret = avformat_find_stream_info(m_input, nullptr);
+    if (ret < 0) {
+        return setError("Failed to read clip streams", ret);
+    }
+
+    m_videoIndex = av_find_best_stream(m_input, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+    if (m_videoIndex < 0) {
+        return setError("Clip has no video stream");
+    }
+    m_audioIndex = av_find_best_stream(m_input, AVMEDIA_TYPE_AUDIO, -1, m_videoIndex, nullptr, 0);
+    if (m_audioIndex < 0) {
+        m_audioIndex = -1;
+    }
+    return true;
+}
+
+bool ClipTrimmer::openOutput(const QString& path) {
+    const QByteArray file = path.toUtf8();
+    int ret = avformat_alloc_output_context2(&m_output, nullptr, nullptr, file.constData());
+    if (ret < 0 || !m_output) {
+        return setError("Failed to allocate output context", ret);
+    }
+
+    auto addStream = [this](int index) -> AVStream* {
+        const AVStream* in = m_input->streams[index];
+        AVStream* out = avformat_new_stream(m_output, nullptr);
+        if (!out || avcodec_parameters_copy(out->codecpar, in->codecpar) < 0) {
+            return nullptr;
+        }
+        // Keep the sample entry (avc1/hvc1, ...) when the container allows it
+        if (av_codec_get_id(m_output->oformat->codec_tag, in->codecpar->codec_tag) != in->codecpar->codec_id) {
+            out->codecpar->codec_tag = 0;
+        }
+        // A smart cut puts the re-encoded head's parameter sets in band and
+        // re-injects the source's after it, which avc1/hvc1 do not allow
+        if (index == m_videoIndex && m_smartCut && m_nalLengthSize > 0) {
+            const uint32_t inBand = in->codecpar->codec_id == AV_CODEC_ID_HEVC
+                ? MKTAG('h', 'e', 'v', '1') : MKTAG('a', 'v', 'c', '3');
+            if (av_codec_get_id(m_output->oformat->codec_tag, inBand) == in->codecpar->codec_id) {
+                out->codecpar->codec_tag = inBand;
+            }
+        }
+        out->time_base = in->time_base;
+        return out;
+    };
+
+    m_videoOut = addStream(m_videoIndex);
+    if (!m_videoOut) {
+        return setError("Failed to create video stream");
+    }
+    if (m_audioIndex >= 0) {
+        m_audioOut = addStream(m_audioIndex);
+        if (!m_audioOut) {
+            return setError("Failed to create audio stream");
+        }
+    }
+
+    if (!(m_output->oformat->flags & AVFMT_NOFILE)) {
+        ret = avio_open(&m_output->pb, file.constData(), AVIO_FLAG_WRITE);
+        if (ret < 0) {
+            return setError("Failed to open output file", ret);
+        }
+    }
+
+    AVDictionary* muxOpts = nullptr;
+    av_dict_set(&muxOpts, "movflags", "+faststart", 0);
+    ret = avformat_write_header(m_output, &muxOpts);
+    av_dict_free(&muxOpts);
+    if (ret < 0) {
+        return setError("Failed to write container header", ret);
+    }
+    return true;
+}
+
+bool ClipTrimmer::parseParameterSets() {
+    m_parameterSets.clear();
+    m_nalLengthSize = 0;
+
+    const AVCodecParameters* par = m_input->streams[m_videoIndex]->codecpar;
+    const uint8_t* p = par->extradata;
+    const int size = par->extradata_size;
+    // Annex B extradata (or none) starts with a start code, not version 1
+    if (!p || size < 7 || p[0] != 1) {
+        return false;
+    }
+
+    int lengthSize = 0;
+    QByteArray sets;
+    auto append = [&](int pos, int len) {
+        for (int shift = (lengthSize - 1) * 8; shift >= 0; shift -= 8) {
+            sets.append(static_cast<char>((len >> shift) & 0xFF));
+        }
+        sets.append(reinterpret_cast<const char*>(p + pos), len);
+    };
+    // Reads `count` NAL units, each preceded by a 16-bit length
+    auto readUnits = [&](int& pos, int count) {
+        for (int i = 0; i < count; i++) {
+            if (pos + 2 > size) {
+                return false;
+            }
+            const int len = (p[pos] << 8) | p[pos + 1];
+            pos += 2;
+            if (pos + len > size) {
+                return false;
+            }
+            append(pos, len);
+            pos += len;
+        }
+        return true;
+    };
+
+    if (par->codec_id == AV_CODEC_ID_H264) {
+        // avcC: ..., lengthSizeMinusOne, SPS count + SPSs, PPS count + PPSs
+        lengthSize = (p[4] & 3) + 1;
+        int pos = 5;
+        const int spsCount = p[pos++] & 0x1F;
+        if (!readUnits(pos, spsCount) || pos >= size) {
+            return false;
+        }
+        const int ppsCount = p[pos++];
+        if (!readUnits(pos, ppsCount)) {
+            return false;
+        }
+    } else if (par->codec_id == AV_CODEC_ID_HEVC) {
+        // hvcC: 21 bytes of profile data, lengthSizeMinusOne, then arrays
+        // of (type, count, NAL units) for VPS/SPS/PPS/SEI
+        if (size < 23) {
+            return false;
+        }
+        lengthSize = (p[21] & 3) + 1;
+        const int arrays = p[22];
+        int pos = 23;
+        for (int a = 0; a < arrays; a++) {
+            if (pos + 3 > size) {
+                return false;
+            }
+            const int count = (p[pos + 1] << 8) | p[pos + 2];
+            pos += 3;
+            if (!readUnits(pos, count)) {
+                return false;
+            }
+        }
+    } else {
+        return false;
+    }
+
+    if (sets.isEmpty()) {
+        return false;
+    }
+    m_parameterSets = sets;
+    m_nalLengthSize = lengthSize;
+    return true;
+}
+
+QByteArray ClipTrimmer::toLengthPrefixed(const uint8_t* data, int size) const {
+    // Split on 00 00 01 start codes (the leading zero of a 4-byte code is
+    // trimmed from the previous unit)
+    std::vector<std::pair<int, int>> units;
+    int unitStart = -1;
+    int pos = 0;
+    while (pos + 2 < size) {
+        if (data[pos] == 0 && data[pos + 1] == 0 && data[pos + 2] == 1) {
+            if (unitStart >= 0) {
+                int end = pos;
+                while (end > unitStart && data[end - 1] == 0) {
+                    end--;
+                }
+                units.push_back({ unitStart, end });
+            }
+            pos += 3;
+            unitStart = pos;
+        } else {
+            pos++;
+        }
+    }
+    if (unitStart < 0) {
+        // No start codes: already length-prefixed
+        return QByteArray(reinterpret_cast<const char*>(data), size);
+    }
+    units.push_back({ unitStart, size });
+
+    QByteArray out;
+    out.reserve(size + static_cast<int>(units.size()) * m_nalLengthSize);
+    for (const auto& unit : units) {
+        const int len = unit.second - unit.first;
+        for (int shift = (m_nalLengthSize - 1) * 8; shift >= 0; shift -= 8) {
+            out.append(static_cast<char>((len >> shift) & 0xFF));
+        }
+        out.append(reinterpret_cast<const char*>(data + unit.first), len);
+    }
+    return out;
+}
+
+bool ClipTrimmer::writePacket(AVPacket* packet, int inputStream) {
+    const AVStream* in = m_input->streams[inputStream];
+    AVStream* out = inputStream == m_videoIndex ? m_videoOut : m_audioOut;
+    const int64_t offset = inputStream == m_videoIndex ? m_startTs : m_audioStartTs;
+
+    if (packet->pts != AV_NOPTS_VALUE) {
+        packet->pts -= offset;
+    }
+    if (packet->dts != AV_NOPTS_VALUE) {
+        packet->dts -= offset;
+    }
+    av_packet_rescale_ts(packet, in->time_base, out->time_base);
+    packet->stream_index = out->index;
+    packet->pos = -1;
+
+    // Takes the packet's reference
+    const int ret = av_interleaved_write_frame(m_output, packet);
+    if (ret < 0) {
+        return setError("Failed to write packet", ret);
+    }
+    return true;
+}
+
+bool ClipTrimmer::copyVideoPacket(AVPacket* packet) {
+    const int64_t pts = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+    if (pts >= m_endTs) {
+        m_held.push_back(av_packet_clone(packet));
+        av_packet_unref(packet);
+        return true;
+    }
+
+    // A frame shown before the end follows the held ones in decode order,
+    // so it may reference them
+    for (AVPacket* held : m_held) {
+        if (!writePacket(held, m_videoIndex)) {
+            return false;
+        }
+        m_result.copiedPackets++;
+    }
+    clearPackets(m_held);
+
+    // Switch the decoder back from the re-encoded frames' parameter sets
+    if (m_injectParameterSets && (packet->flags & AV_PKT_FLAG_KEY)) {
+        m_injectParameterSets = false;
+        AVPacket* withSets = av_packet_alloc();
+        if (!withSets || av_new_packet(withSets, m_parameterSets.size() + packet->size) < 0) {
+            av_packet_free(&withSets);
+            return setError("Failed to allocate packet");
+        }
+        memcpy(withSets->data, m_parameterSets.constData(), m_parameterSets.size());
+        memcpy(withSets->data + m_parameterSets.size(), packet->data, packet->size);
+        av_packet_copy_props(withSets, packet);
+        av_packet_unref(packet);
+        av_packet_move_ref(packet, withSets);
+        av_packet_free(&withSets);
+    }
+
+    m_result.copiedPackets++;
+    return writePacket(packet, m_videoIndex);
+}
+
+bool ClipTrimmer::finishStartGop(int64_t nextKeyframeDts) {
+    if (m_startGop.empty()) {
+        return true;
+    }
+
+    if (m_smartCut && m_nalLengthSize > 0) {
+        std::vector<AVPacket*> encoded;
+        if (reencodeStartGop(nextKeyframeDts, encoded)) {
+            for (AVPacket* packet : encoded) {
+                if (!writePacket(packet, m_videoIndex)) {
+                    clearPackets(encoded);
+                    return false;
+                }
+            }
+            m_result.smartCut = true;
+            m_result.reencodedFrames = static_cast<int>(encoded.size());
+            m_injectParameterSets = !encoded.empty();
+            clearPackets(encoded);
+            clearPackets(m_startGop);
+            return true;
+        }
+        // Nothing was written yet, so copying is still possible
+        qDebug() << "[ClipTrimmer] Smart cut failed (" << m_lastError << "), copying the start GOP whole";
+        m_lastError.clear();
+        clearPackets(encoded);
+    }
+
+    for (AVPacket* packet : m_startGop) {
+        if (!copyVideoPacket(packet)) {
+            return false;
+        }
+    }
+    clearPackets(m_startGop);
+    return true;
+}
+
+bool ClipTrimmer::reencodeStartGop(int64_t nextKeyframeDts, std::vector<AVPacket*>& encoded) {
+    AVStream* in = m_input->streams[m_videoIndex];
+
+    const AVCodec* codec = avcodec_find_decoder(in->codecpar->codec_id);
+    if (!codec) {
+        return setError("No decoder for the clip's video");
+    }
+    m_decoder = avcodec_alloc_context3(codec);
+    if (!m_decoder || avcodec_parameters_to_context(m_decoder, in->codecpar) < 0) {
+        return setError("Failed to set up decoder");
+    }
+    m_decoder->pkt_timebase = in->time_base;
+    int ret = avcodec_open2(m_decoder, codec, nullptr);
+    if (ret < 0) {
+        return setError("Failed to open decoder", ret);
+    }
+
+    AVFrame* frame = av_frame_alloc();
+    if (!frame) {
+        return setError("Failed to allocate frame");
+    }
+
+    // Frames inside the range go to the encoder as they come out
+    auto drainDecoder = [&]() {
+        while (true) {
+            ret = avcodec_receive_frame(m_decoder, frame);
+            if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+                return true;
+            }
+            if (ret < 0) {
+                return setError("Failed to decode", ret);
+            }
+            const int64_t pts = frame->best_effort_timestamp;
+            if (pts != AV_NOPTS_VALUE && pts >= m_startTs && pts < m_endTs) {
+                if (!m_encoder && !openReencoder(frame)) {
+                    return false;
+                }
+                m_reencodedPts.push_back(pts);
+                frame->pts = static_cast<int64_t>(m_reencodedPts.size()) - 1;
+                if (!encodeFrame(frame, encoded)) {
+                    return false;
+                }
+            }
+            av_frame_unref(frame);
+        }
+    };
+
+    bool ok = true;
+    for (AVPacket* packet : m_startGop) {
+        ret = avcodec_send_packet(m_decoder, packet);
+        if (ret < 0) {
+            ok = setError("Failed to send packet to decoder", ret);
+            break;
+        }
+        if (!(ok = drainDecoder())) {
+            break;
+        }
+    }
+    if (ok) {
+        avcodec_send_packet(m_decoder, nullptr);
+        ok = drainDecoder();
+    }
+    if (ok && m_encoder) {
+        ok = encodeFrame(nullptr, encoded);
+    }
+    av_frame_free(&frame);
+    if (!ok) {
+        return false;
+    }
+
+    // No B-frames, so packets come out in presentation order. Decode
+    // timestamps step by a frame up to just below the first copied
+    // keyframe's, and never past the presentation time.
+    if (encoded.size() != m_reencodedPts.size()) {
+        return setError(QString("Re-encoder returned %1 packets for %2 frames")
+            .arg(encoded.size()).arg(m_reencodedPts.size()));
+    }
+    const AVRational rate = av_guess_frame_rate(m_input, in, nullptr);
+    const int64_t duration = (rate.num > 0 && rate.den > 0) ? av_rescale_q(1, av_inv_q(rate), in->time_base) : 0;
+    const int64_t step = std::max<int64_t>(1, duration);
+    const int64_t count = static_cast<int64_t>(encoded.size());
+
+    for (int64_t i = 0; i < count; i++) {
+        AVPacket* packet = encoded[i];
+        const QByteArray data = toLengthPrefixed(packet->data, packet->size);
+        const bool keyframe = (packet->flags & AV_PKT_FLAG_KEY) != 0;
+        av_packet_unref(packet);
+        if (av_new_packet(packet, data.size()) < 0) {
+            return setError("Failed to allocate packet");
+        }
+        memcpy(packet->data, data.constData(), data.size());
+
+        packet->pts = m_reencodedPts[i];
+        packet->dts = nextKeyframeDts == INT64_MAX ? packet->pts
+                                                   : std::min(packet->pts, nextKeyframeDts - (count - i) * step);
+        packet->duration = duration;
+        packet->flags = keyframe ? AV_PKT_FLAG_KEY : 0;
+    }
+    return true;
+}
+
+bool ClipTrimmer::openReencoder(const AVFrame* frame) {
+    AVStream* in = m_input->streams[m_videoIndex];
+    const AVRational rate = av_guess_frame_rate(m_input, in, nullptr);
+
+    // In-band parameter sets (no global header) so the re-encoded frames
+    // can sit in front of the copied ones in the same track
+    EncoderBackends::Settings settings;
+    settings.backend = EncoderBackend::Software;
+    settings.hevc = in->codecpar->codec_id == AV_CODEC_ID_HEVC;
+    settings.width = frame->width;
+    settings.height = frame->height;
+    settings.fps = (rate.num > 0 && rate.den > 0) ? std::max(1, static_cast<int>(av_q2d(rate) + 0.5)) : 30;
+    settings.gopSize = 600;
+    settings.maxBFrames = 0;
+    settings.crf = 18;
+    settings.lowLatency = true;
+    settings.globalHeader = false;
+    settings.softwarePreset = "veryfast";
+
+    QString error;
+    m_encoder = EncoderBackends::openVideoEncoder(settings, nullptr, &error);
+    if (!m_encoder) {
+        return setError("Failed to open encoder: " + error);
+    }
+
+    const int format = EncoderBackends::inputPixelFormat(m_encoder);
+    if (frame->format != format || frame->width != m_encoder->width || frame->height != m_encoder->height) {
+        m_scaledFrame = av_frame_alloc();
+        if (!m_scaledFrame) {
+            return setError("Failed to allocate frame");
+        }
+        m_scaledFrame->format = format;
+        m_scaledFrame->width = m_encoder->width;
+        m_scaledFrame->height = m_encoder->height;
+        const int ret = av_frame_get_buffer(m_scaledFrame, 0);
+        if (ret < 0) {
+            return setError("Failed to allocate frame buffer", ret);
+        }
+    }
+    return true;
+}
+
+bool ClipTrimmer::encodeFrame(AVFrame* frame, std::vector<AVPacket*>& out) {
+    AVFrame* input = frame;
+    if (frame) {
+        if (m_scaledFrame) {
+            m_swsCtx = sws_getCachedContext(m_swsCtx, frame->width, frame->height,
+                                            static_cast<AVPixelFormat>(frame->format),
+                                            m_scaledFrame->width, m_scaledFrame->height,
+                                            static_cast<AVPixelFormat>(m_scaledFrame->format),
+                                            SWS_BILINEAR, nullptr, nullptr, nullptr);
+            if (!m_swsCtx) {
+                return setError("Failed to create swscale context");
+            }
+            const int ret = av_frame_make_writable(m_scaledFrame);
+            if (ret < 0) {
+                return setError("Frame not writable", ret);
+            }
+            sws_scale(m_swsCtx, frame->data, frame->linesize, 0, frame->height,
+                      m_scaledFrame->data, m_scaledFrame->linesize);
+            m_scaledFrame->pts = frame->pts;
+            input = m_scaledFrame;
+        }
+        // The decoder's picture types would otherwise force keyframes
+        input->pict_type = AV_PICTURE_TYPE_NONE;
+    }
+
+    int ret = EncoderBackends::sendFrame(m_encoder, input);
+    if (ret < 0) {
+        return setError("Failed to send frame to encoder", ret);
+    }
+    while (true) {
+        AVPacket* packet = av_packet_alloc();
+        if (!packet) {
+            return setError("Failed to allocate packet");
+        }
+        ret = avcodec_receive_packet(m_encoder, packet);
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+            av_packet_free(&packet);
+            return true;
+        }
+        if (ret < 0) {
+            av_packet_free(&packet);
+            return setError("Failed to encode", ret);
+        }
+        out.push_back(packet);
+    }
+}
@@ -0,0 +1,134 @@
+#ifndef CLIPTRIMMER_H
+#define CLIPTRIMMER_H
+
+#include <QString>
+#include <QByteArray>
+#include <vector>
+#include <deque>
+#include <cstdint>
+
+struct AVFormatContext;
+struct AVCodecContext;
+struct AVStream;
+struct AVFrame;
+struct AVPacket;
+struct SwsContext;
+
+/*
+ * ClipTrimmer
+ *
+ * Purpose
+ * - Cuts a saved clip to [start, end) without re-encoding it: packets are
+ *   copied from the source file into a new MP4 through libavformat, so a
+ *   trim costs about as much as reading the kept part of the file.
+ *
+ * Behaviour ("smart cut")
+ * - The demuxer seeks straight to the keyframe at or before `start`;
+ *   nothing before it is read.
+ * - From the first keyframe at or after `start` on, every packet is
+ *   copied unchanged. Only the frames between `start` and that keyframe
+ *   (less than one GOP) are decoded and re-encoded, so the kept part
+ *   starts exactly on the requested frame.
+ * - The re-encoded frames carry their own parameter sets; the source's
+ *   parameter sets are put back in front of the first copied keyframe so
+ *   a decoder switches back cleanly. This needs H.264 or HEVC in MP4
+ *   (avcC/hvcC) form, which is what clips from this app are.
+ * - Otherwise, or with `setSmartCut(false)`, the GOP holding `start` is
+ *   copied whole, with the frames before `start` given negative
+ *   timestamps; the MP4 edit list hides them, so playback still starts on
+ *   the requested frame.
+ * - Audio packets are copied when they overlap [start, end).
+ * - The end is cut after the last packet in decode order that is shown
+ *   before `end`, which is exact for streams without B-frames (all clips
+ *   this app writes).
+ *
+ * Error handling
+ * - `trim()` returns false and sets `lastError()`; the partial output is
+ *   removed.
+ *
+ * Threading
+ * - A ClipTrimmer is used by one thread at a time; separate instances are
+ *   independent.
+ */
+class ClipTrimmer {
+public:
+    struct Result {
+        int copiedPackets = 0;
+        int reencodedFrames = 0;
+        bool smartCut = false;    // false: the start GOP was copied whole
+        double seconds = 0;       // wall time of the trim
+    };
+
+    ClipTrimmer();
+    ~ClipTrimmer();
+
+    ClipTrimmer(const ClipTrimmer&) = delete;
+    ClipTrimmer& operator=(const ClipTrimmer&) = delete;
+
+    void setSmartCut(bool enabled) { m_smartCut = enabled; }
+
+    // Times are relative to the start of the clip
+    bool trim(const QString& inputPath, const QString& outputPath,
+              int64_t startUs, int64_t endUs);
+
+    const Result& result() const { return m_result; }
+    QString lastError() const { return m_lastError; }
+
+private:
+    bool setError(const QString& context, int avError = 0);
+    void cleanup();
+    bool run(const QString& inputPath, const QString& outputPath,
+             int64_t startUs, int64_t endUs);
+
+    bool openInput(const QString& path);
+    bool openOutput(const QString& path);
+    bool parseParameterSets();
+
+    // Decodes the buffered start GOP and re-encodes what is inside the
+    // range, or copies the GOP whole when smart cut is not possible
+    bool finishStartGop(int64_t nextKeyframeDts);
+    bool reencodeStartGop(int64_t nextKeyframeDts, std::vector<AVPacket*>& encoded);
+    bool openReencoder(const AVFrame* frame);
+    bool encodeFrame(AVFrame* frame, std::vector<AVPacket*>& out);
+
+    // Copies a video packet, holding back those shown after `end` until a
+    // later packet shows they are needed
+    bool copyVideoPacket(AVPacket* packet);
+    bool writePacket(AVPacket* packet, int inputStream);
+    QByteArray toLengthPrefixed(const uint8_t* data, int size) const;
+    void clearPackets(std::vector<AVPacket*>& packets);
+
+    bool m_smartCut;
+    Result m_result;
+    QString m_lastError;
+
+    AVFormatContext* m_input;
+    AVFormatContext* m_output;
+    int m_videoIndex;
+    int m_audioIndex;
+    AVStream* m_videoOut;
+    AVStream* m_audioOut;
+    AVPacket* m_packet;
+
+    // Range in the video stream's time base, audio start/end in its own
+    int64_t m_startTs;
+    int64_t m_endTs;
+    int64_t m_audioStartTs;
+    int64_t m_audioEndTs;
+
+    std::vector<AVPacket*> m_startGop;   // keyframe before `start` onwards
+    std::vector<AVPacket*> m_held;       // shown at or after `end`
+    bool m_injectParameterSets;
+
+    // Source parameter sets, each NAL length-prefixed like the samples
+    QByteArray m_parameterSets;
+    int m_nalLengthSize;
+
+    AVCodecContext* m_decoder;
+    AVCodecContext* m_encoder;
+    SwsContext* m_swsCtx;
+    AVFrame* m_scaledFrame;
+    std::deque<int64_t> m_reencodedPts;
+};
+
+#endif // CLIPTRIMMER_H
@@ -0,0 +1,167 @@
+/*
+ * ClipUploader.cpp
+ *
+ * Upload scheduling. Each session runs on a QThread of its own; progress
+ * and the result come back to the uploader as queued calls.
+ */
+
+#include "ClipUploader.h"
+#include <QDebug>
+#include <QMetaObject>
+#include <algorithm>
+
+ClipUploader::ClipUploader(QObject* parent)
+    : QObject(parent)
+    , m_nextId(1)
+{
+}
+
+ClipUploader::~ClipUploader() {
+    m_pending.clear();
+    for (const auto& job : m_running) {
+        job->session->cancel();
+    }
+    // The sessions must outlive the threads using them
+    for (const auto& job : m_running) {
+        if (job->thread) {
+            job->thread->wait();
+        }
+    }
+}
+
+bool ClipUploader::isUploading(const QString& path) const {
+    auto matches = [&path](const std::unique_ptr<Job>& job) { return job->path == path; };
+    return std::any_of(m_pending.begin(), m_pending.end(), matches) ||
+           std::any_of(m_running.begin(), m_running.end(), matches);
+}
+
+int ClipUploader::upload(const QString& path, bool growing) {
+    auto job = std::make_unique<Job>();
+    job->id = m_nextId++;
+    job->path = path;
+    job->growing = growing;
+    const int id = job->id;
+
+    qDebug() << "[Upload] Job" << id << "queued:" << path << (growing ? "(growing)" : "");
+    emit uploadQueued(id, path);
+    if (growing) {
+        // Waiting would let the writer run ahead of the upload
+        start(std::move(job));
+    } else {
+        m_pending.push_back(std::move(job));
+        startPending();
+    }
+    return id;
+}
+
+void ClipUploader::finishSource(int uploadId, int64_t finalSize) {
+    for (const auto& job : m_running) {
+        if (job->id == uploadId) {
+            job->session->finishSource(finalSize);
+            return;
+        }
+    }
+}
+
+void ClipUploader::cancel(int uploadId) {
+    for (auto it = m_pending.begin(); it != m_pending.end(); ++it) {
+        if ((*it)->id == uploadId) {
+            const QString path = (*it)->path;
+            m_pending.erase(it);
+            emit uploadFinished(uploadId, false, path, "Upload canceled");
+            return;
+        }
+    }
+    // A running upload reports back through onDone
+    for (const auto& job : m_running) {
+        if (job->id == uploadId) {
+            job->session->cancel();
+            return;
+        }
+    }
+}
+
+void ClipUploader::cancel(const QString& path) {
+    std::vector<int> ids;
+    for (const auto& job : m_pending) {
+        if (job->path == path) {
+            ids.push_back(job->id);
+        }
+    }
+    for (const auto& job : m_running) {
+        if (job->path == path) {
+            ids.push_back(job->id);
+        }
+    }
+    for (int id : ids) {
+        cancel(id);
+    }
+}
+
+void ClipUploader::cancelAll() {
+    while (!m_pending.empty()) {
+        cancel(m_pending.back()->id);
+    }
+    for (const auto& job : m_running) {
+        job->session->cancel();
+    }
+}
+
+void ClipUploader::startPending() {
+    const bool busy = std::any_of(m_running.begin(), m_running.end(),
+                                  [](const std::unique_ptr<Job>& job) { return !job->growing; });
+    if (busy || m_pending.empty()) {
+        return;
+    }
+    std::unique_ptr<Job> job = std::move(m_pending.front());
+    m_pending.pop_front();
+    start(std::move(job));
+}
+
+void ClipUploader::start(std::unique_ptr<Job> job) {
+    job->session = std::make_unique<UploadSession>(job->path, m_settings, job->growing);
+    UploadSession* session = job->session.get();
+    const int id = job->id;
+
+    // Called on the upload thread; the lambdas run on this one
+    session->setProgressCallback([this, id](const UploadSession::Progress& progress) {
+        QMetaObject::invokeMethod(this, [this, id, progress]() {
+            emit uploadProgress(id, progress.sentBytes, progress.totalBytes, progress.bytesPerSecond);
+        }, Qt::QueuedConnection);
+    });
+
+    QThread* thread = QThread::create([this, session, id]() {
+        const bool ok = session->run();
+        QMetaObject::invokeMethod(this, [this, id, ok]() { onDone(id, ok); }, Qt::QueuedConnection);
+    });
+    thread->setObjectName(QString("Upload%1").arg(id));
+    connect(thread, &QThread::finished, thread, &QObject::deleteLater);
+    job->thread = thread;
+
+    const QString path = job->path;
+    m_running.push_back(std::move(job));
+    // Uploading must not take CPU from capture any more than saving does
+    thread->start(QThread::LowPriority);
+
+    qDebug() << "[Upload] Job" << id << "started";
+    emit uploadStarted(id, path);
+}
+
+void ClipUploader::onDone(int uploadId, bool success) {
+    auto it = std::find_if(m_running.begin(), m_running.end(),
+                           [uploadId](const std::unique_ptr<Job>& job) { return job->id == uploadId; });
+    if (it == m_running.end()) {
+        return;
+    }
+    // The session is done; its thread is about to finish
+    std::unique_ptr<Job> job = std::move(*it);
+    m_running.erase(it);
+    if (job->thread) {
+        job->thread->wait();
+    }
+
+    const QString message = success ? job->session->url() : job->session->lastError();
+    qDebug() << "[Upload] Job" << uploadId << (success ? "done:" : "failed:") << message;
+    emit uploadFinished(uploadId, success, job->path, message);
+    startPending();
+}
@@ -0,0 +1,92 @@
+#ifndef CLIPUPLOADER_H
+#define CLIPUPLOADER_H
+
+#include <QObject>
+#include <QPointer>
+#include <QString>
+#include <QThread>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <vector>
+#include "UploadSession.h"
+
+/*
+ * ClipUploader
+ *
+ * Purpose
+ * - Runs clip uploads for the main window. Each upload is an
+ *   `UploadSession` on its own low-priority QThread; the uploader turns
+ *   its progress and result into signals on the owning thread.
+ *
+ * Behaviour
+ * - Uploads run one at a time in the order they were requested; one
+ *   session already keeps several chunks in flight, and a single upload
+ *   finishing sooner is worth more than several finishing together.
+ * - `upload(path, true)` starts on a file that is still being written.
+ *   The writer calls `finishSource()` with the final size (or -1 if the
+ *   save failed) when it is done; until then only whole chunks are sent.
+ *   A growing upload is started right away, ahead of the queue, so it
+ *   keeps up with the writer.
+ * - Settings apply to uploads started after `setSettings()`.
+ *
+ * Error handling
+ * - A failed upload reports its error through `uploadFinished`. The
+ *   session's sidecar stays, so uploading the clip again resumes it.
+ *
+ * Threading
+ * - All methods and signals belong to the owning (GUI) thread.
+ *   Destroying the uploader cancels every upload and waits for the
+ *   running one to stop.
+ */
+class ClipUploader : public QObject {
+    Q_OBJECT
+
+public:
+    explicit ClipUploader(QObject* parent = nullptr);
+    ~ClipUploader();
+
+    void setSettings(const UploadSession::Settings& settings) { m_settings = settings; }
+    const UploadSession::Settings& settings() const { return m_settings; }
+
+    // Returns the upload id
+    int upload(const QString& path, bool growing = false);
+    void finishSource(int uploadId, int64_t finalSize);
+    void cancel(int uploadId);
+    // Every upload of `path`. A queued one reports right away, a running
+    // one once its session has stopped and let go of the file.
+    void cancel(const QString& path);
+    void cancelAll();
+
+    bool isUploading(const QString& path) const;
+    int depth() const { return static_cast<int>(m_pending.size() + m_running.size()); }
+
+signals:
+    void uploadQueued(int uploadId, const QString& path);
+    void uploadStarted(int uploadId, const QString& path);
+    // totalBytes is -1 while the file is still growing
+    void uploadProgress(int uploadId, qint64 sentBytes, qint64 totalBytes, double bytesPerSecond);
+    // The clip's URL on success, the error otherwise
+    void uploadFinished(int uploadId, bool success, const QString& path, const QString& message);
+
+private:
+    struct Job {
+        int id = 0;
+        QString path;
+        bool growing = false;
+        std::unique_ptr<UploadSession> session;
+        QPointer<QThread> thread;
+    };
+
+    void startPending();
+    void start(std::unique_ptr<Job> job);
+    void onDone(int uploadId, bool success);
+
+    UploadSession::Settings m_settings;
+    int m_nextId;
+    std::deque<std::unique_ptr<Job>> m_pending;
+    // At most one finished file, plus any growing ones
+    std::vector<std::unique_ptr<Job>> m_running;
+};
+
+#endif // CLIPUPLOADER_H
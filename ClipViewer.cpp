@@ -1,24 +1,34 @@
 /*
  * ClipViewer.cpp
  *
- * Widget that provides simple playback controls for a saved clip. It uses
- * OpenCV's decoding APIs to read frames and Qt to render them. The code
- * keeps rendering on the GUI thread for simplicity.
+ * Widget that provides simple playback controls for a saved clip. Frames
+ * are decoded and scaled by `FrameDecoder` off the GUI thread; this file
+ * only drives playback and paints what comes back.
  */
 
 #include "ClipViewer.h"
 #include <QVBoxLayout>
 #include <QHBoxLayout>
-#include <QImage>
 #include <QPixmap>
+#include <QResizeEvent>
+#include <QMouseEvent>
+#include <QStyle>
+#include <QThread>
+#include <QCoreApplication>
+#include <QPointer>
 
 ClipViewer::ClipViewer(QWidget *parent)
     : QWidget(parent)
     , m_isPlaying(false)
     , m_totalFrames(0)
     , m_fps(30.0)
+    , m_currentFrame(0)
+    , m_requestedFrame(-1)
 {
     setupUI();
+
+    m_decoder = new FrameDecoder(this);
+    connect(m_decoder, &FrameDecoder::frameReady, this, &ClipViewer::onFrameReady);
 }
 
 ClipViewer::~ClipViewer() {
@@ -50,9 +60,17 @@ void ClipViewer::setupUI() {
     
     m_positionSlider = new QSlider(Qt::Horizontal);
     m_positionSlider->setEnabled(false);
+    m_positionSlider->setMouseTracking(true);
+    m_positionSlider->installEventFilter(this);
     connect(m_positionSlider, &QSlider::sliderMoved, this, &ClipViewer::onSliderMoved);
     controlsLayout->addWidget(m_positionSlider);
     
+    // Thumbnail over the slider, from the clip index
+    m_thumbnailPopup = new QLabel(this, Qt::ToolTip);
+    m_thumbnailPopup->setStyleSheet("border: 1px solid white; background-color: black;");
+    m_thumbnailPopup->hide();
+    connect(m_positionSlider, &QSlider::sliderReleased, m_thumbnailPopup, &QLabel::hide);
+    
     mainLayout->addLayout(controlsLayout);
     
     // Playback timer
@@ -64,11 +82,17 @@ void ClipViewer::loadClip(const QString& filepath) {
     releaseCurrentClip();
     
     m_currentClipPath = filepath;
-    m_capture.open(filepath.toStdString());
+    m_decoder->setDisplaySize(m_videoLabel->size());
+    
+    const bool indexed = m_index.load(filepath);
+    if (!indexed) {
+        buildIndex(filepath);
+    }
     
-    if (m_capture.isOpened()) {
-        m_totalFrames = static_cast<int>(m_capture.get(cv::CAP_PROP_FRAME_COUNT));
-        m_fps = m_capture.get(cv::CAP_PROP_FPS);
+    if (m_decoder->open(filepath, indexed ? &m_index : nullptr)) {
+        m_totalFrames = m_decoder->info().frameCount;
+        m_fps = m_decoder->info().fps;
+        m_currentFrame = 0;
         
         m_playPauseBtn->setEnabled(true);
         m_positionSlider->setEnabled(true);
@@ -80,15 +104,14 @@ void ClipViewer::loadClip(const QString& filepath) {
 }
 
 void ClipViewer::releaseCurrentClip() {
-    if (m_isPlaying) {
-        m_isPlaying = false;
-        m_playbackTimer->stop();
-        m_playPauseBtn->setText("Play");
-    }
+    stopPlayback();
     
-    if (m_capture.isOpened()) {
-        m_capture.release();
-    }
+    // Closes the file, so it can be deleted or renamed right after
+    m_decoder->close();
+    m_requestedFrame = -1;
+    m_currentFrame = 0;
+    m_index = ClipIndex();
+    m_thumbnailPopup->hide();
     
     m_videoLabel->clear();
     m_videoLabel->setText("No clip loaded");
@@ -101,73 +124,141 @@ void ClipViewer::releaseCurrentClip() {
 }
 
 void ClipViewer::onPlayPauseClicked() {
-    if (!m_capture.isOpened()) return;
+    if (!m_decoder->isOpen()) return;
     
     m_isPlaying = !m_isPlaying;
     
     if (m_isPlaying) {
         m_playPauseBtn->setText("Pause");
+        m_decoder->setPlaying(true);
         int interval = static_cast<int>(1000.0 / m_fps);
         m_playbackTimer->start(interval);
     } else {
-        m_playPauseBtn->setText("Play");
-        m_playbackTimer->stop();
+        stopPlayback();
     }
 }
 
+void ClipViewer::stopPlayback() {
+    m_isPlaying = false;
+    m_playbackTimer->stop();
+    m_decoder->setPlaying(false);
+    m_playPauseBtn->setText("Play");
+}
+
 void ClipViewer::onSliderMoved(int position) {
     showFrame(position);
-    updateTimeDisplay();
+    showThumbnail(position, QStyle::sliderPositionFromValue(m_positionSlider->minimum(),
+        m_positionSlider->maximum(), position, m_positionSlider->width()));
+}
+
+bool ClipViewer::eventFilter(QObject* watched, QEvent* event) {
+    if (watched == m_positionSlider && m_positionSlider->isEnabled()) {
+        if (event->type() == QEvent::MouseMove) {
+            const int x = static_cast<QMouseEvent*>(event)->position().toPoint().x();
+            showThumbnail(QStyle::sliderValueFromPosition(m_positionSlider->minimum(),
+                m_positionSlider->maximum(), x, m_positionSlider->width()), x);
+        } else if (event->type() == QEvent::Leave && !m_positionSlider->isSliderDown()) {
+            m_thumbnailPopup->hide();
+        }
+    }
+    return QWidget::eventFilter(watched, event);
+}
+
+void ClipViewer::showThumbnail(int frameNum, int sliderX) {
+    const QImage thumbnail = m_index.thumbnailAt(static_cast<int64_t>(frameNum * 1000000.0 / m_fps));
+    if (thumbnail.isNull()) {
+        m_thumbnailPopup->hide();
+        return;
+    }
+    m_thumbnailPopup->setPixmap(QPixmap::fromImage(thumbnail));
+    m_thumbnailPopup->adjustSize();
+    m_thumbnailPopup->move(m_positionSlider->mapToGlobal(
+        QPoint(sliderX - m_thumbnailPopup->width() / 2, -m_thumbnailPopup->height() - 4)));
+    m_thumbnailPopup->show();
+}
+
+void ClipViewer::buildIndex(const QString& filepath) {
+    // A clip saved before indexes existed, or by the ffmpeg binary. The
+    // viewer may be gone by the time it is built: the result is posted to
+    // the application and only checked against the viewer on the GUI thread.
+    QPointer<ClipViewer> self(this);
+    QThread* indexThread = QThread::create([self, filepath]() {
+        ClipIndex index;
+        if (!index.build(filepath) || !index.save(filepath)) {
+            return;
+        }
+        QMetaObject::invokeMethod(QCoreApplication::instance(), [self, filepath, index]() {
+            // Only the thumbnails are new; the decoder already probed the rest
+            if (self && self->m_currentClipPath == filepath) {
+                self->m_index = index;
+            }
+        }, Qt::QueuedConnection);
+    });
+    connect(indexThread, &QThread::finished, indexThread, &QObject::deleteLater);
+    indexThread->start(QThread::LowPriority);
 }
 
 void ClipViewer::updateFrame() {
-    if (!m_capture.isOpened()) return;
+    if (!m_decoder->isOpen()) return;
     
-    cv::Mat frame;
-    if (m_capture.read(frame)) {
-        displayFrame(frame);
-        
-        int currentPos = static_cast<int>(m_capture.get(cv::CAP_PROP_POS_FRAMES));
-        m_positionSlider->setValue(currentPos);
-        updateTimeDisplay();
-    } else {
+    // Still waiting for the last one; let playback fall behind the clock
+    // rather than pile up requests
+    if (m_requestedFrame >= 0) return;
+    
+    if (m_currentFrame + 1 >= m_totalFrames) {
         // End of video
-        m_isPlaying = false;
-        m_playPauseBtn->setText("Play");
-        m_playbackTimer->stop();
-        m_capture.set(cv::CAP_PROP_POS_FRAMES, 0);
-        m_positionSlider->setValue(0);
+        stopPlayback();
+        showFrame(0);
+        return;
     }
+    showFrame(m_currentFrame + 1);
 }
 
 void ClipViewer::showFrame(int frameNum) {
-    if (!m_capture.isOpened()) return;
+    if (!m_decoder->isOpen()) return;
     
-    m_capture.set(cv::CAP_PROP_POS_FRAMES, frameNum);
-    cv::Mat frame;
-    if (m_capture.read(frame)) {
-        displayFrame(frame);
-    }
+    // Set first: a cached frame comes back before requestFrame returns
+    m_requestedFrame = frameNum;
+    m_decoder->requestFrame(frameNum);
 }
 
-void ClipViewer::displayFrame(const cv::Mat& frame) {
-    cv::Mat rgb;
-    cv::cvtColor(frame, rgb, cv::COLOR_BGR2RGB);
+void ClipViewer::onFrameReady(int request, int index, const QImage& image) {
+    if (!m_decoder->isOpen()) return;
     
-    QImage img(rgb.data, rgb.cols, rgb.rows, rgb.step, QImage::Format_RGB888);
-    QPixmap pixmap = QPixmap::fromImage(img);
+    // Finished after a newer request was answered, or from the last clip;
+    // showing it would move the slider and playback back
+    if (request != m_decoder->lastRequest()) return;
+    m_requestedFrame = -1;
+    if (image.isNull()) {
+        // Past the last frame the file really has
+        if (m_isPlaying) {
+            stopPlayback();
+        }
+        return;
+    }
     
-    QPixmap scaled = pixmap.scaled(m_videoLabel->size(), 
-                                   Qt::KeepAspectRatio, 
-                                   Qt::SmoothTransformation);
-    m_videoLabel->setPixmap(scaled);
+    m_videoLabel->setPixmap(QPixmap::fromImage(image));
+    m_currentFrame = index;
+    if (!m_positionSlider->isSliderDown()) {
+        m_positionSlider->setValue(index);
+    }
+    updateTimeDisplay();
+}
+
+void ClipViewer::resizeEvent(QResizeEvent* event) {
+    QWidget::resizeEvent(event);
+    
+    // Frames are decoded at display size; ask again at the new one
+    m_decoder->setDisplaySize(m_videoLabel->size());
+    if (m_decoder->isOpen() && m_requestedFrame < 0) {
+        showFrame(m_currentFrame);
+    }
 }
 
 void ClipViewer::updateTimeDisplay() {
-    if (!m_capture.isOpened()) return;
+    if (!m_decoder->isOpen()) return;
     
-    int currentFrame = static_cast<int>(m_capture.get(cv::CAP_PROP_POS_FRAMES));
-    double currentTime = currentFrame / m_fps;
+    double currentTime = m_currentFrame / m_fps;
     double totalTime = m_totalFrames / m_fps;
     
     int currentMin = static_cast<int>(currentTime / 60);
@@ -6,28 +6,33 @@
 #include <QPushButton>
 #include <QSlider>
 #include <QTimer>
-#include <opencv2/opencv.hpp>
+#include <QImage>
+#include "FrameDecoder.h"
+#include "ClipIndex.h"
 
 /*
  * ClipViewer
  *
  * Purpose
  * - A lightweight widget that provides basic playback controls for a saved
- *   clip. It uses OpenCV's `VideoCapture` to decode frames and displays them
- *   via Qt widgets. This component is intentionally simple: it is a viewer
- *   (not an editor) and is optimized for responsiveness rather than feature
+ *   clip. Frames come from a `FrameDecoder`, already scaled to the video
+ *   area. This component is intentionally simple: it is a viewer (not an
+ *   editor) and is optimized for responsiveness rather than feature
  *   completeness.
  *
  * Responsibilities
  * - Load a file path and probe the video for frame count and FPS.
  * - Provide play/pause, position seeking and a textual time display.
- * - Convert OpenCV BGR frames into Qt-friendly RGB images and scale them
- *   for display while keeping aspect ratio.
+ * - Open from the clip's `ClipIndex` when it has one, and show its
+ *   thumbnails above the position slider while hovering or dragging.
+ *   A clip without an index gets one built in the background.
  *
  * Threading and performance
- * - All operations run on the GUI thread. Decoding is performed using
- *   OpenCV's synchronous API; for very large files or slow codecs consider
- *   moving decoding to a worker thread.
+ * - Decoding, colour conversion and scaling run on the decoder's worker
+ *   thread; the GUI thread only paints the frames it is handed.
+ * - Playback asks for one frame per timer tick and waits for it, so a slow
+ *   decode slows playback down instead of queueing work. Slider moves only
+ *   replace the pending request.
  */
 
 class ClipViewer : public QWidget {
@@ -41,29 +46,40 @@ public:
     void releaseCurrentClip();
     QString currentClipPath() const { return m_currentClipPath; }
 
+protected:
+    void resizeEvent(QResizeEvent* event) override;
+    bool eventFilter(QObject* watched, QEvent* event) override;
+
 private slots:
     void onPlayPauseClicked();
     void onSliderMoved(int position);
     void updateFrame();
+    void onFrameReady(int request, int index, const QImage& image);
 
 private:
     void setupUI();
     void showFrame(int frameNum);
-    void displayFrame(const cv::Mat& frame);
+    void stopPlayback();
     void updateTimeDisplay();
+    void buildIndex(const QString& filepath);
+    void showThumbnail(int frameNum, int sliderX);
 
     QLabel* m_videoLabel;
     QLabel* m_timeLabel;
     QPushButton* m_playPauseBtn;
     QSlider* m_positionSlider;
+    QLabel* m_thumbnailPopup;
     
     QTimer* m_playbackTimer;
-    cv::VideoCapture m_capture;
+    FrameDecoder* m_decoder;
+    ClipIndex m_index;
     
     QString m_currentClipPath;
     bool m_isPlaying;
     int m_totalFrames;
     double m_fps;
+    int m_currentFrame;     // frame on screen
+    int m_requestedFrame;   // asked of the decoder and not shown yet, or -1
 };
 
 #endif // CLIPVIEWER_H
\ No newline at end of file
@@ -0,0 +1,494 @@
+/*
+ * ClipperBench.cpp
+ *
+ * Entry point of `clipper_bench`, the headless benchmark harness.
+ *
+ * Behaviour:
+ * - Runs the capture and save pipelines against `SyntheticFrameSource`
+ *   and `SyntheticAudioSource` instead of the screen and audio devices, so
+ *   results do not depend on what is on the desktop and the same numbers
+ *   come out of a build machine without a display.
+ * - Benchmarks, in order:
+ *   - `capture`: a `ScreenRecorder` running its real capture loop (pacing,
+ *     compression workers, replay buffer) for `--seconds`, with a
+ *     synthetic `AudioCapture` pair beside it. Reports the stored frame
+ *     rate against `--fps` and the share of slots missed or dropped.
+ *   - `snapshot`: `getFrames()` / `getPackets()` and `getBuffer()` called
+ *     every SNAPSHOT_INTERVAL_MS while that capture runs.
+ *   - `compress`: `CompressionPipeline` fed as fast as it will take frames,
+ *     with one worker and with the default worker count.
+ *   - `mix`: `AudioMixer` mixing a 48 kHz microphone with 44.1 kHz
+ *     desktop audio, so resampling is included.
+ *   - `save_<N>s`: `VideoEncoder::encode()` of an N second JPEG clip with
+ *     mixed audio, for each of `--clips`.
+ * - Results are written as JSON (`--output`, default stdout): the
+ *   configuration, one `{name, value, unit, better}` entry per measurement
+ *   and a final `Telemetry` snapshot in the `/metrics.json` layout.
+ * - With `--baseline <file>` the results are compared with an earlier run;
+ *   any measurement more than `--tolerance` percent worse is listed on
+ *   stderr and the exit code is 2.
+ *
+ * Notes:
+ * - Save clips cycle through one second of distinct compressed frames, with
+ *   repeats where the synthetic screen was static, so a five minute clip
+ *   does not need five minutes of JPEGs in memory. The encoder still
+ *   decodes and encodes every frame.
+ */
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTemporaryDir>
+#include <QThread>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <vector>
+#include "AudioCapture.h"
+#include "AudioMixer.h"
+#include "AudioRing.h"
+#include "CompressionPipeline.h"
+#include "MediaClock.h"
+#include "MetricsServer.h"
+#include "ReplayBuffer.h"
+#include "ScreenRecorder.h"
+#include "SyntheticSource.h"
+#include "Telemetry.h"
+#include "VideoEncoder.h"
+
+static constexpr int SNAPSHOT_INTERVAL_MS = 250;
+static constexpr int COMPRESS_FRAMES = 300;
+static constexpr int COMPRESS_DISTINCT_FRAMES = 8;
+static constexpr int MIX_SECONDS = 60;
+
+struct BenchConfig {
+    SyntheticFrameSource::Config frames;
+    int fps = 60;
+    int captureSeconds = 10;
+    ScreenRecorder::CaptureMode captureMode = ScreenRecorder::JpegFrames;
+    std::vector<int> clipSeconds = { 30, 120, 300 };
+    QString only;   // comma-separated benchmark names; empty = all
+};
+
+class BenchResults {
+public:
+    void add(const QString& name, double value, const QString& unit, bool higherIsBetter) {
+        QJsonObject result;
+        result["name"] = name;
+        result["value"] = value;
+        result["unit"] = unit;
+        result["better"] = higherIsBetter ? "higher" : "lower";
+        m_results.append(result);
+        fprintf(stderr, "  %-32s %12.3f %s\n", qPrintable(name), value, qPrintable(unit));
+    }
+
+    const QJsonArray& results() const { return m_results; }
+
+private:
+    QJsonArray m_results;
+};
+
+static double percentile(std::vector<double> values, double p) {
+    if (values.empty()) {
+        return 0.0;
+    }
+    std::sort(values.begin(), values.end());
+    const size_t index = (size_t)((values.size() - 1) * p / 100.0 + 0.5);
+    return values[(std::min)(index, values.size() - 1)];
+}
+
+static bool wanted(const BenchConfig& config, const QString& name) {
+    return config.only.isEmpty() || config.only.split(',').contains(name);
+}
+
+static double elapsedMs(const QElapsedTimer& timer) {
+    return timer.nsecsElapsed() / 1e6;
+}
+
+// Writes `seconds` of synthetic audio into `ring`, the last frame stamped
+// `endSeconds`, in 10 ms chunks as a device would deliver them
+static void fillAudio(AudioRing& ring, SyntheticAudioSource& source, double seconds, double endSeconds) {
+    const SyntheticAudioSource::Config& config = source.config();
+    const size_t chunkFrames = config.sampleRate / 100;
+    const size_t chunks = (size_t)(seconds * 100);
+    std::vector<float> chunk(chunkFrames * config.channels);
+    for (size_t i = 0; i < chunks; ++i) {
+        source.generate(chunk.data(), chunkFrames);
+        ring.write(chunk.data(), chunkFrames, endSeconds - (chunks - 1 - i) / 100.0);
+    }
+}
+
+static void benchCapture(const BenchConfig& config, BenchResults& results) {
+    fprintf(stderr, "capture: %dx%d at %d fps for %d s\n", config.frames.size.width(),
+            config.frames.size.height(), config.fps, config.captureSeconds);
+
+    ScreenRecorder recorder(config.fps);
+    recorder.setCaptureMode(config.captureMode);
+    recorder.setBufferSeconds(config.captureSeconds + 5);
+    recorder.setSyntheticSource(std::make_shared<SyntheticFrameSource>(config.frames));
+
+    AudioCapture mic(AudioCapture::Microphone);
+    AudioCapture desktop(AudioCapture::DesktopAudio);
+    SyntheticAudioSource::Config micConfig;
+    SyntheticAudioSource::Config desktopConfig;
+    desktopConfig.frequency = 660.0;
+    desktopConfig.seed = 2;
+    mic.setSyntheticSource(std::make_shared<SyntheticAudioSource>(micConfig));
+    desktop.setSyntheticSource(std::make_shared<SyntheticAudioSource>(desktopConfig));
+
+    const Telemetry::Snapshot before = Telemetry::snapshot();
+    mic.startCapture();
+    desktop.startCapture();
+    recorder.startRecording();
+    while (!recorder.isRecording() && recorder.isRunning()) {
+        QThread::msleep(1);
+    }
+
+    // Saves take their snapshots while capture carries on; so do we
+    std::vector<double> videoSnapshotMs;
+    std::vector<double> audioSnapshotMs;
+    QElapsedTimer wall;
+    wall.start();
+    while (wall.elapsed() < config.captureSeconds * 1000LL) {
+        QThread::msleep(SNAPSHOT_INTERVAL_MS);
+        QElapsedTimer timer;
+        timer.start();
+        if (recorder.isEncodedMode()) {
+            recorder.getPackets(config.captureSeconds);
+        } else {
+            recorder.getFrames(config.captureSeconds);
+        }
+        videoSnapshotMs.push_back(elapsedMs(timer));
+        timer.restart();
+        mic.getBuffer(config.captureSeconds);
+        desktop.getBuffer(config.captureSeconds);
+        audioSnapshotMs.push_back(elapsedMs(timer) / 2.0);
+    }
+    const double seconds = wall.nsecsElapsed() / 1e9;
+
+    recorder.stopRecording();
+    mic.stopCapture();
+    desktop.stopCapture();
+    const Telemetry::Snapshot after = Telemetry::snapshot();
+
+    auto counter = [&](Telemetry::Counter c) {
+        return (double)(after.counters[c] - before.counters[c]);
+    };
+    const double slots = counter(Telemetry::FramesCaptured) + counter(Telemetry::FramesRepeated)
+                       + counter(Telemetry::FramesMissed);
+    const Telemetry::Histogram& capture = after.stages[Telemetry::Capture];
+
+    if (wanted(config, "capture")) {
+        results.add("capture_fps", (counter(Telemetry::FramesCaptured) + counter(Telemetry::FramesRepeated)) / seconds,
+                    "fps", true);
+        results.add("capture_missed", slots > 0 ? counter(Telemetry::FramesMissed) * 100.0 / slots : 0.0,
+                    "%", false);
+        results.add("capture_dropped", slots > 0 ? counter(Telemetry::FramesDropped) * 100.0 / slots : 0.0,
+                    "%", false);
+        results.add("capture_grab_p99", capture.percentileNs(99) / 1e6, "ms", false);
+        if (!recorder.isEncodedMode()) {
+            results.add("capture_buffer", recorder.replayStats().usedBytes / (1024.0 * 1024.0), "MB", false);
+        }
+    }
+    if (wanted(config, "snapshot")) {
+        results.add("snapshot_video_p50", percentile(videoSnapshotMs, 50), "ms", false);
+        results.add("snapshot_video_max", percentile(videoSnapshotMs, 100), "ms", false);
+        results.add("snapshot_audio_p50", percentile(audioSnapshotMs, 50), "ms", false);
+        results.add("snapshot_audio_max", percentile(audioSnapshotMs, 100), "ms", false);
+    }
+}
+
+static void benchCompress(const BenchConfig& config, BenchResults& results) {
+    // Distinct frames made up front, so the source is not what is measured
+    SyntheticFrameSource::Config frameConfig = config.frames;
+    frameConfig.staticRatio = 0.0;
+    SyntheticFrameSource source(frameConfig);
+    std::vector<QImage> images;
+    for (int i = 0; i < COMPRESS_DISTINCT_FRAMES; ++i) {
+        QImage image;
+        source.next(image);
+        images.push_back(image.copy());
+    }
+
+    const int workerCounts[] = { 1, CompressionPipeline::defaultWorkerCount() };
+    for (int workers : workerCounts) {
+        std::atomic<quint64> bytes{ 0 };
+        // A queue as long as the run: nothing is dropped, so this is the
+        // rate the workers can sustain
+        CompressionPipeline pipeline(workers, COMPRESS_FRAMES, CompressionPipeline::DropNewest,
+                                     [&bytes](const VideoFrame& frame) { bytes += frame.jpegData.size(); });
+        QElapsedTimer timer;
+        timer.start();
+        pipeline.start();
+        for (int i = 0; i < COMPRESS_FRAMES; ++i) {
+            pipeline.submit(images[i % images.size()], i * 1000000LL / config.fps);
+        }
+        pipeline.stop();
+        const double seconds = timer.nsecsElapsed() / 1e9;
+        const CompressionPipeline::Stats stats = pipeline.stats();
+
+        const QString name = QString("compress_%1w").arg(workers);
+        fprintf(stderr, "%s: %d frames\n", qPrintable(name), COMPRESS_FRAMES);
+        results.add(name + "_fps", stats.compressed / seconds, "fps", true);
+        results.add(name + "_jpeg_kb", stats.compressed > 0 ? bytes.load() / 1024.0 / stats.compressed : 0.0,
+                    "KB", false);
+        if (workers == 1 && CompressionPipeline::defaultWorkerCount() == 1) {
+            break;
+        }
+    }
+}
+
+static void benchMix(BenchResults& results) {
+    fprintf(stderr, "mix: %d s of 48 kHz + 44.1 kHz audio\n", MIX_SECONDS);
+    SyntheticAudioSource::Config micConfig;
+    SyntheticAudioSource::Config desktopConfig;
+    desktopConfig.sampleRate = 44100;
+    desktopConfig.frequency = 660.0;
+    desktopConfig.seed = 2;
+    SyntheticAudioSource micSource(micConfig);
+    SyntheticAudioSource desktopSource(desktopConfig);
+
+    AudioRing micRing;
+    AudioRing desktopRing;
+    micRing.allocate(MIX_SECONDS + 1, micConfig.sampleRate, micConfig.channels);
+    desktopRing.allocate(MIX_SECONDS + 1, desktopConfig.sampleRate, desktopConfig.channels);
+    const double end = MediaClock::nowSeconds();
+    fillAudio(micRing, micSource, MIX_SECONDS, end);
+    fillAudio(desktopRing, desktopSource, MIX_SECONDS, end);
+    const AudioSnapshot mic = micRing.snapshot(MIX_SECONDS);
+    const AudioSnapshot desktop = desktopRing.snapshot(MIX_SECONDS);
+
+    QElapsedTimer timer;
+    timer.start();
+    AudioMixer mixer(mic, desktop, 48000);
+    std::vector<float> block(AudioMixer::BLOCK_FRAMES * 2);
+    size_t frames = 0;
+    while (size_t read = mixer.read(block.data(), AudioMixer::BLOCK_FRAMES)) {
+        frames += read;
+    }
+    const double seconds = timer.nsecsElapsed() / 1e9;
+
+    results.add("mix_realtime", seconds > 0 ? frames / 48000.0 / seconds : 0.0, "x", true);
+    results.add("mix_frames", seconds > 0 ? frames / seconds / 1e6 : 0.0, "Mframes/s", true);
+}
+
+static void benchSave(const BenchConfig& config, int clipSeconds, const QString& directory,
+                      BenchResults& results) {
+    fprintf(stderr, "save_%ds: %dx%d at %d fps\n", clipSeconds, config.frames.size.width(),
+            config.frames.size.height(), config.fps);
+
+    // One second of distinct JPEGs, compressed the way capture does it
+    std::vector<VideoFrame> distinct;
+    {
+        SyntheticFrameSource::Config frameConfig = config.frames;
+        frameConfig.staticRatio = 0.0;
+        SyntheticFrameSource source(frameConfig);
+        CompressionPipeline pipeline(CompressionPipeline::defaultWorkerCount(), config.fps,
+                                     CompressionPipeline::DropNewest,
+                                     [&distinct](const VideoFrame& frame) { distinct.push_back(frame); });
+        pipeline.start();
+        QImage image;
+        for (int i = 0; i < config.fps; ++i) {
+            source.next(image);
+            pipeline.submit(image.copy(), 0);
+        }
+        pipeline.stop();
+    }
+    if (distinct.empty()) {
+        fprintf(stderr, "  no frames compressed, skipped\n");
+        return;
+    }
+
+    // The clip, with repeats where the synthetic screen stood still
+    SyntheticFrameSource timing(config.frames);
+    QImage unused;
+    const int total = clipSeconds * config.fps;
+    const int64_t startUs = MediaClock::nowUs() - (int64_t)clipSeconds * 1000000;
+    std::vector<VideoFrame> frames;
+    frames.reserve(total);
+    for (int i = 0; i < total; ++i) {
+        const bool changed = timing.next(unused) || frames.empty();
+        VideoFrame frame = changed ? distinct[i % distinct.size()] : frames.back();
+        frame.repeat = !changed;
+        frame.timestampUs = startUs + (int64_t)i * 1000000 / config.fps;
+        frames.push_back(frame);
+    }
+
+    SyntheticAudioSource::Config micConfig;
+    SyntheticAudioSource::Config desktopConfig;
+    desktopConfig.frequency = 660.0;
+    desktopConfig.seed = 2;
+    SyntheticAudioSource micSource(micConfig);
+    SyntheticAudioSource desktopSource(desktopConfig);
+    AudioRing micRing;
+    AudioRing desktopRing;
+    micRing.allocate(clipSeconds + 1, micConfig.sampleRate, micConfig.channels);
+    desktopRing.allocate(clipSeconds + 1, desktopConfig.sampleRate, desktopConfig.channels);
+    const double endSeconds = frames.back().timestampUs / 1000000.0;
+    fillAudio(micRing, micSource, clipSeconds, endSeconds);
+    fillAudio(desktopRing, desktopSource, clipSeconds, endSeconds);
+
+    VideoEncoder encoder;
+    VideoEncoder::EncodeOptions options;
+    options.outputPath = QDir(directory).filePath(QString("save_%1s.mp4").arg(clipSeconds));
+    options.fps = config.fps;
+
+    QElapsedTimer timer;
+    timer.start();
+    const bool ok = encoder.encode(frames, micRing.snapshot(clipSeconds), desktopRing.snapshot(clipSeconds), options);
+    const double seconds = timer.nsecsElapsed() / 1e9;
+    if (!ok) {
+        fprintf(stderr, "  encode failed, skipped\n");
+        return;
+    }
+
+    const QString name = QString("save_%1s").arg(clipSeconds);
+    results.add(name, seconds, "s", false);
+    results.add(name + "_realtime", seconds > 0 ? clipSeconds / seconds : 0.0, "x", true);
+    results.add(name + "_file_mb", QFileInfo(options.outputPath).size() / (1024.0 * 1024.0), "MB", false);
+    QFile::remove(options.outputPath);
+}
+
+// Measurements more than `tolerance` percent worse than the baseline
+static QStringList regressions(const QJsonArray& results, const QJsonArray& baseline, double tolerance) {
+    QStringList found;
+    for (const QJsonValue& value : results) {
+        const QJsonObject result = value.toObject();
+        for (const QJsonValue& old : baseline) {
+            const QJsonObject previous = old.toObject();
+            if (previous["name"] != result["name"] || previous["value"].toDouble() == 0.0) {
+                continue;
+            }
+            const double before = previous["value"].toDouble();
+            const double now = result["value"].toDouble();
+            const double change = (now - before) * 100.0 / before;
+            const bool higherIsBetter = result["better"].toString() == "higher";
+            if (higherIsBetter ? change < -tolerance : change > tolerance) {
+                found << QString("%1: %2 -> %3 %4 (%5%6%)").arg(result["name"].toString())
+                    .arg(before, 0, 'f', 3).arg(now, 0, 'f', 3).arg(result["unit"].toString())
+                    .arg(change > 0 ? "+" : "").arg(change, 0, 'f', 1);
+            }
+        }
+    }
+    return found;
+}
+
+int main(int argc, char* argv[]) {
+    QCoreApplication app(argc, argv);
+    app.setApplicationName("clipper_bench");
+    app.setOrganizationName("ScreenClip");
+    app.setApplicationVersion("1.0");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Headless capture and save benchmarks on synthetic input.");
+    parser.addHelpOption();
+    parser.addVersionOption();
+    parser.addOption({ "resolution", "Synthetic screen size.", "WxH", "1920x1080" });
+    parser.addOption({ "motion", "Share of the frame that moves (0-1).", "ratio", "0.25" });
+    parser.addOption({ "static", "Share of frames the screen is unchanged (0-1).", "ratio", "0.0" });
+    parser.addOption({ "fps", "Capture and clip frame rate.", "fps", "60" });
+    parser.addOption({ "seconds", "Length of the capture benchmark.", "seconds", "10" });
+    parser.addOption({ "mode", "Capture mode: jpeg, h264 or hevc.", "mode", "jpeg" });
+    parser.addOption({ "clips", "Clip lengths for the save benchmark.", "seconds,...", "30,120,300" });
+    parser.addOption({ "only", "Run only these benchmarks (capture, snapshot, compress, mix, save).", "names" });
+    parser.addOption({ "output", "Write the JSON results here instead of stdout.", "file" });
+    parser.addOption({ "baseline", "Compare with the results of an earlier run.", "file" });
+    parser.addOption({ "tolerance", "Allowed regression against the baseline.", "percent", "10" });
+    parser.process(app);
+
+    BenchConfig config;
+    const QStringList size = parser.value("resolution").split('x');
+    config.frames.size = QSize(size.value(0).toInt(), size.value(1).toInt());
+    if (config.frames.size.width() <= 0 || config.frames.size.height() <= 0) {
+        fprintf(stderr, "Invalid resolution: %s\n", qPrintable(parser.value("resolution")));
+        return 1;
+    }
+    config.frames.motionRatio = parser.value("motion").toDouble();
+    config.frames.staticRatio = parser.value("static").toDouble();
+    config.fps = (std::max)(1, parser.value("fps").toInt());
+    config.captureSeconds = (std::max)(1, parser.value("seconds").toInt());
+    const QString mode = parser.value("mode");
+    config.captureMode = mode == "h264" ? ScreenRecorder::EncodedH264
+                       : mode == "hevc" ? ScreenRecorder::EncodedHEVC
+                       : ScreenRecorder::JpegFrames;
+    config.clipSeconds.clear();
+    for (const QString& clip : parser.value("clips").split(',', Qt::SkipEmptyParts)) {
+        if (clip.toInt() > 0) {
+            config.clipSeconds.push_back(clip.toInt());
+        }
+    }
+    config.only = parser.value("only");
+
+    QTemporaryDir directory;
+    if (!directory.isValid()) {
+        fprintf(stderr, "Cannot create a temporary directory\n");
+        return 1;
+    }
+
+    BenchResults results;
+    if (wanted(config, "capture") || wanted(config, "snapshot")) {
+        benchCapture(config, results);
+    }
+    if (wanted(config, "compress")) {
+        benchCompress(config, results);
+    }
+    if (wanted(config, "mix")) {
+        benchMix(results);
+    }
+    if (wanted(config, "save")) {
+        for (int clipSeconds : config.clipSeconds) {
+            benchSave(config, clipSeconds, directory.path(), results);
+        }
+    }
+
+    QJsonObject configJson;
+    configJson["width"] = config.frames.size.width();
+    configJson["height"] = config.frames.size.height();
+    configJson["motion"] = config.frames.motionRatio;
+    configJson["static"] = config.frames.staticRatio;
+    configJson["fps"] = config.fps;
+    configJson["capture_seconds"] = config.captureSeconds;
+    configJson["mode"] = mode;
+    configJson["compression_workers"] = CompressionPipeline::defaultWorkerCount();
+
+    QJsonObject root;
+    root["version"] = app.applicationVersion();
+    root["config"] = configJson;
+    root["results"] = results.results();
+    root["telemetry"] = QJsonDocument::fromJson(MetricsServer::json(Telemetry::snapshot())).object();
+    const QByteArray json = QJsonDocument(root).toJson(QJsonDocument::Indented);
+
+    if (parser.isSet("output")) {
+        QFile file(parser.value("output"));
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(json) != json.size()) {
+            fprintf(stderr, "Cannot write %s\n", qPrintable(parser.value("output")));
+            return 1;
+        }
+    } else {
+        fwrite(json.constData(), 1, json.size(), stdout);
+    }
+
+    if (parser.isSet("baseline")) {
+        QFile file(parser.value("baseline"));
+        if (!file.open(QIODevice::ReadOnly)) {
+            fprintf(stderr, "Cannot read %s\n", qPrintable(parser.value("baseline")));
+            return 1;
+        }
+        const QJsonArray baseline = QJsonDocument::fromJson(file.readAll()).object()["results"].toArray();
+        const QStringList found = regressions(results.results(), baseline, parser.value("tolerance").toDouble());
+        for (const QString& line : found) {
+            fprintf(stderr, "REGRESSION %s\n", qPrintable(line));
+        }
+        if (!found.isEmpty()) {
+            return 2;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,373 @@
+/*
+ * CompressionPipeline.cpp
+ *
+ * Bounded producer/consumer queue between the capture loop and JPEG
+ * compression. Workers take frames in FIFO order and tag them with a
+ * sequence number; finished frames are parked in a reorder map and
+ * released to the sink strictly in sequence, so the replay buffer sees
+ * frames in capture order.
+ */
+
+#include "CompressionPipeline.h"
+#include "ScreenRecorder.h"
+#include "Telemetry.h"
+#include <QBuffer>
+#include <QDebug>
+#include <algorithm>
+#include <atomic>
+
+#ifdef CLIPPER_HAVE_TURBOJPEG
+#include <turbojpeg.h>
+#endif
+
+// Quality steps used by DegradeQuality, starting at BASE_QUALITY
+static const int QUALITY_LEVELS[] = { CompressionPipeline::BASE_QUALITY, 60, 45, 35 };
+static const int QUALITY_LEVEL_COUNT = sizeof(QUALITY_LEVELS) / sizeof(QUALITY_LEVELS[0]);
+
+// Submissions with a near-empty queue before quality steps back up
+static const int QUALITY_RECOVERY_STREAK = 30;
+
+CompressionPipeline::CompressionPipeline(int workers, int maxQueue, BackpressurePolicy policy,
+                                         Sink sink, QObject* parent)
+    : QObject(parent)
+    , m_workerCount((std::max)(1, workers))
+    , m_maxQueue((std::max)(1, maxQueue))
+    , m_policy(policy)
+    , m_sink(std::move(sink))
+    , m_pendingImages(0)
+    , m_nextSequence(0)
+    , m_running(false)
+    , m_hasSubmitted(false)
+    , m_qualityLevel(0)
+    , m_lowDepthStreak(0)
+    , m_qualityCap(BASE_QUALITY)
+    , m_nextOutput(0)
+{
+    m_stats.quality = BASE_QUALITY;
+}
+
+CompressionPipeline::~CompressionPipeline() {
+    stop();
+}
+
+int CompressionPipeline::defaultWorkerCount() {
+    return (std::min)(4, (std::max)(1, QThread::idealThreadCount() / 2));
+}
+
+QString CompressionPipeline::policyName(BackpressurePolicy policy) {
+    switch (policy) {
+        case DropOldest: return "drop oldest";
+        case DropNewest: return "drop newest";
+        case DegradeQuality: return "degrade quality";
+    }
+    return "unknown";
+}
+
+void CompressionPipeline::start() {
+    QMutexLocker locker(&m_queueMutex);
+    if (m_running) {
+        return;
+    }
+    m_running = true;
+    locker.unlock();
+
+    for (int i = 0; i < m_workerCount; i++) {
+        QThread* worker = QThread::create([this]() { workerLoop(); });
+        worker->setObjectName(QString("JpegWorker%1").arg(i));
+        worker->start(QThread::LowPriority);
+        m_workers.push_back(worker);
+    }
+
+#ifdef CLIPPER_HAVE_TURBOJPEG
+    const char* encoder = "libjpeg-turbo";
+#else
+    const char* encoder = "Qt JPEG writer";
+#endif
+    emit debugLog(QString("✓ [Compress] %1 worker(s), queue %2, %3, %4")
+        .arg(m_workerCount).arg(m_maxQueue).arg(policyName(m_policy)).arg(encoder));
+}
+
+void CompressionPipeline::stop() {
+    {
+        QMutexLocker locker(&m_queueMutex);
+        if (!m_running) {
+            return;
+        }
+        m_running = false;
+        m_queueCond.wakeAll();
+    }
+
+    // Workers drain the queue before exiting
+    for (QThread* worker : m_workers) {
+        worker->wait();
+        delete worker;
+    }
+    m_workers.clear();
+}
+
+int CompressionPipeline::currentQualityLocked() {
+    if (m_policy != DegradeQuality) {
+        return BASE_QUALITY;
+    }
+
+    if (m_pendingImages >= m_maxQueue) {
+        m_lowDepthStreak = 0;
+        if (m_qualityLevel < QUALITY_LEVEL_COUNT - 1) {
+            m_qualityLevel++;
+        }
+    } else if (m_pendingImages <= m_maxQueue / 4) {
+        if (m_qualityLevel > 0 && ++m_lowDepthStreak >= QUALITY_RECOVERY_STREAK) {
+            m_qualityLevel--;
+            m_lowDepthStreak = 0;
+        }
+    } else {
+        m_lowDepthStreak = 0;
+    }
+
+    m_stats.quality = QUALITY_LEVELS[m_qualityLevel];
+    return m_stats.quality;
+}
+
+void CompressionPipeline::enqueueLocked(Job&& job) {
+    if (!job.image.isNull()) {
+        m_pendingImages++;
+    }
+    m_queue.push_back(std::move(job));
+    m_queueCond.wakeOne();
+}
+
+bool CompressionPipeline::submit(const QImage& image, int64_t timestampUs) {
+    if (image.isNull()) {
+        return false;
+    }
+
+    QMutexLocker locker(&m_queueMutex);
+    if (!m_running) {
+        return false;
+    }
+    m_stats.submitted++;
+    m_hasSubmitted = true;
+
+    const int previousQuality = m_stats.quality;
+    Job job;
+    job.image = image;
+    job.timestampUs = timestampUs;
+    job.quality = (std::min)(currentQualityLocked(), m_qualityCap);
+
+    bool accepted = true;
+    const int limit = (m_policy == DegradeQuality) ? m_maxQueue * 2 : m_maxQueue;
+    if (m_pendingImages >= limit) {
+        m_stats.dropped++;
+        Telemetry::add(Telemetry::FramesDropped);
+        if (m_policy == DropNewest) {
+            job.image = QImage();
+            accepted = false;
+        } else {
+            // Oldest frame nobody has picked up yet gives way to the new one
+            for (Job& queued : m_queue) {
+                if (!queued.image.isNull()) {
+                    queued.image = QImage();
+                    m_pendingImages--;
+                    break;
+                }
+            }
+        }
+    }
+    enqueueLocked(std::move(job));
+
+    const int quality = m_stats.quality;
+    const int depth = m_pendingImages;
+    locker.unlock();
+
+    if (quality != previousQuality) {
+        emit debugLog(QString("⚠️ [Compress] Queue depth %1: JPEG quality %2 -> %3")
+            .arg(depth).arg(previousQuality).arg(quality));
+    }
+    return accepted;
+}
+
+bool CompressionPipeline::submitRepeat(int64_t timestampUs) {
+    QMutexLocker locker(&m_queueMutex);
+    if (!m_running || !m_hasSubmitted) {
+        return false;
+    }
+
+    // Repeats carry no pixels, so they never count against the limit
+    Job job;
+    job.timestampUs = timestampUs;
+    enqueueLocked(std::move(job));
+    return true;
+}
+
+CompressionPipeline::Stats CompressionPipeline::stats() const {
+    QMutexLocker locker(&m_queueMutex);
+    Stats stats = m_stats;
+    stats.queueDepth = m_pendingImages;
+    stats.quality = (std::min)(stats.quality, m_qualityCap);
+    return stats;
+}
+
+void CompressionPipeline::setQualityCap(int quality) {
+    QMutexLocker locker(&m_queueMutex);
+    m_qualityCap = (std::max)(1, (std::min)(quality, (int)BASE_QUALITY));
+}
+
+void CompressionPipeline::workerLoop() {
+    void* jpegHandle = nullptr;
+#ifdef CLIPPER_HAVE_TURBOJPEG
+    jpegHandle = tjInitCompress();
+    if (!jpegHandle) {
+        emit debugLog(QString("⚠️ [Compress] tjInitCompress failed (%1), using Qt JPEG writer")
+            .arg(tjGetErrorStr()));
+    }
+#endif
+
+    while (true) {
+        Job job;
+        quint64 sequence = 0;
+        {
+            QMutexLocker locker(&m_queueMutex);
+            while (m_running && m_queue.empty()) {
+                m_queueCond.wait(&m_queueMutex);
+            }
+            if (m_queue.empty()) {
+                break;
+            }
+            job = std::move(m_queue.front());
+            m_queue.pop_front();
+            if (!job.image.isNull()) {
+                m_pendingImages--;
+            }
+            sequence = m_nextSequence++;
+        }
+
+        Result result;
+        result.timestampUs = job.timestampUs;
+        bool compressed = false;
+        if (!job.image.isNull()) {
+            Telemetry::Timer timer(Telemetry::Compress);
+            compressed = compress(job, jpegHandle, result);
+        }
+        if (!compressed) {
+            // Dropped, repeat, or failed: becomes a repeat of the previous frame
+            result.repeat = true;
+        }
+        // Release the pixels before waiting on the output side
+        job.image = QImage();
+
+        deliver(sequence, std::move(result));
+    }
+
+#ifdef CLIPPER_HAVE_TURBOJPEG
+    if (jpegHandle) {
+        tjDestroy(static_cast<tjhandle>(jpegHandle));
+    }
+#endif
+}
+
+void CompressionPipeline::deliver(quint64 sequence, Result&& result) {
+    QMutexLocker locker(&m_outputMutex);
+    m_completed.emplace(sequence, std::move(result));
+
+    while (!m_completed.empty() && m_completed.begin()->first == m_nextOutput) {
+        Result next = std::move(m_completed.begin()->second);
+        m_completed.erase(m_completed.begin());
+        m_nextOutput++;
+
+        if (next.repeat) {
+            if (m_lastOutput.data.isEmpty()) {
+                continue; // nothing to repeat yet
+            }
+            const int64_t timestampUs = next.timestampUs;
+            next = m_lastOutput;
+            next.timestampUs = timestampUs;
+            next.repeat = true;
+        } else {
+            m_lastOutput = next;
+            m_lastOutput.repeat = false;
+
+            QMutexLocker statsLocker(&m_queueMutex);
+            m_stats.compressed++;
+        }
+
+        VideoFrame frame;
+        frame.jpegData = next.data;
+        frame.originalSize = next.size;
+        frame.format = next.format;
+        frame.timestampUs = next.timestampUs;
+        frame.repeat = next.repeat;
+        m_sink(frame);
+    }
+}
+
+bool CompressionPipeline::compress(const Job& job, void* jpegHandle, Result& out) {
+    const QImage& raw = job.image;
+    out.size = raw.size();
+    out.format = raw.format();
+
+    if (job.quality < BASE_QUALITY) {
+        QMutexLocker locker(&m_queueMutex);
+        m_stats.degraded++;
+    }
+
+#ifdef CLIPPER_HAVE_TURBOJPEG
+    if (jpegHandle) {
+        // Captured frames are 32-bit BGRX in memory on little-endian hosts,
+        // which TurboJPEG reads directly: no RGB888 conversion pass.
+        const bool direct = raw.format() == QImage::Format_RGB32 ||
+                            raw.format() == QImage::Format_ARGB32 ||
+                            raw.format() == QImage::Format_ARGB32_Premultiplied;
+        const QImage src = direct ? raw : raw.convertToFormat(QImage::Format_RGB32);
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+        const int pixelFormat = TJPF_BGRX;
+#else
+        const int pixelFormat = TJPF_XRGB;
+#endif
+        unsigned char* jpegBuf = nullptr;
+        unsigned long jpegSize = 0;
+        int ret = tjCompress2(static_cast<tjhandle>(jpegHandle), src.constBits(),
+                              src.width(), static_cast<int>(src.bytesPerLine()), src.height(),
+                              pixelFormat, &jpegBuf, &jpegSize, TJSAMP_420, job.quality,
+                              TJFLAG_FASTDCT);
+        if (ret == 0 && jpegBuf && jpegSize > 0) {
+            out.data = QByteArray(reinterpret_cast<const char*>(jpegBuf), static_cast<int>(jpegSize));
+            tjFree(jpegBuf);
+            return true;
+        }
+        qDebug() << "[CompressionPipeline] tjCompress2 failed:"
+                 << tjGetErrorStr2(static_cast<tjhandle>(jpegHandle)) << "- using Qt JPEG writer";
+        tjFree(jpegBuf);
+    }
+#else
+    Q_UNUSED(jpegHandle);
+#endif
+
+    // JPEG has no alpha channel; RGB888 is what Qt's writer handles best
+    QImage frameToSave = raw.convertToFormat(QImage::Format_RGB888);
+
+    QBuffer buffer(&out.data);
+    if (!buffer.open(QIODevice::WriteOnly)) {
+        qDebug() << "[CompressionPipeline] Failed to open QBuffer for writing";
+        return false;
+    }
+
+    bool saved = frameToSave.save(&buffer, "JPG", job.quality);
+
+    // Fallback: PNG is always built into Qt, JPEG needs the imageformats plugin
+    if (!saved) {
+        static std::atomic<bool> pngWarned(false);
+        if (!pngWarned.exchange(true)) {
+            qDebug() << "[CompressionPipeline] JPG save failed (missing plugin?), saving PNG instead";
+        }
+        buffer.seek(0);
+        out.data.clear();
+        saved = frameToSave.save(&buffer, "PNG");
+    }
+    buffer.close();
+
+    if (!saved) {
+        qDebug() << "[CompressionPipeline] Failed to compress frame (input format" << raw.format() << ")";
+        out.data.clear();
+    }
+    return saved && !out.data.isEmpty();
+}
@@ -0,0 +1,159 @@
+#ifndef COMPRESSIONPIPELINE_H
+#define COMPRESSIONPIPELINE_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QImage>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QThread>
+#include <deque>
+#include <map>
+#include <vector>
+#include <functional>
+#include <cstdint>
+
+struct VideoFrame;
+
+/*
+ * CompressionPipeline
+ *
+ * Purpose
+ * - Takes JPEG compression off the capture thread. The capture loop hands
+ *   raw frames to `submit()` and goes straight back to capturing; a small
+ *   pool of worker threads compresses them and hands the results to the
+ *   sink in submission order, so the replay buffer stays sorted by
+ *   timestamp no matter which worker finishes first.
+ *
+ * Backpressure
+ * - The queue of frames waiting for a worker is bounded. When compression
+ *   cannot keep up, the policy decides what gives:
+ *   - `DropOldest`: the oldest frame no worker has started is replaced by a
+ *     repeat of its predecessor; the newest picture is always kept.
+ *   - `DropNewest`: the incoming frame becomes a repeat record.
+ *   - `DegradeQuality`: nothing is dropped; JPEG quality steps down while
+ *     the queue stays full and recovers once it drains. At twice the queue
+ *     limit it falls back to `DropOldest` so memory stays bounded.
+ *   Dropped frames keep their slot as repeat records, so the buffer still
+ *   holds one entry per captured frame and clip timing is unaffected.
+ *
+ * Encoder
+ * - Uses libjpeg-turbo's TurboJPEG API (SIMD DCT and colour conversion,
+ *   straight from the captured BGRX pixels) when built with
+ *   `CLIPPER_HAVE_TURBOJPEG`; otherwise QImage's JPEG writer.
+ *
+ * Threading
+ * - `submit`/`submitRepeat` are called from one producer (the capture
+ *   thread). The sink is called from worker threads, one call at a time
+ *   and in order; it must not call back into the pipeline.
+ */
+class CompressionPipeline : public QObject {
+    Q_OBJECT
+
+public:
+    enum BackpressurePolicy {
+        DropOldest,
+        DropNewest,
+        DegradeQuality
+    };
+
+    struct Stats {
+        quint64 submitted = 0;    // frames passed to submit()
+        quint64 compressed = 0;   // frames that reached the sink with a new payload
+        quint64 dropped = 0;      // frames turned into repeats by backpressure
+        quint64 degraded = 0;     // frames compressed below the base quality
+        int queueDepth = 0;       // frames waiting for a worker
+        int quality = 0;          // current JPEG quality
+    };
+
+    using Sink = std::function<void(const VideoFrame&)>;
+
+    static const int BASE_QUALITY = 75;
+
+    CompressionPipeline(int workers, int maxQueue, BackpressurePolicy policy,
+                        Sink sink, QObject* parent = nullptr);
+    ~CompressionPipeline();
+
+    void start();
+    // Compresses everything still queued, then joins the workers
+    void stop();
+
+    /*
+     * submit / submitRepeat
+     * - `submit` queues a frame (a shallow QImage copy; the capture thread
+     *   must not write into the same buffer, see QImage::isDetached()).
+     *   Returns false if the frame was dropped by backpressure.
+     * - `submitRepeat` queues a repeat of whatever frame precedes it.
+     *   Returns false when nothing has been submitted yet.
+     */
+    bool submit(const QImage& image, int64_t timestampUs);
+    bool submitRepeat(int64_t timestampUs);
+
+    /*
+     * Quality cap
+     * - Frames submitted from now on are compressed at no more than
+     *   `quality` (clamped to 1..BASE_QUALITY), whatever the policy would
+     *   pick. `ScreenRecorder`'s quality controller lowers it under load.
+     */
+    void setQualityCap(int quality);
+
+    Stats stats() const;
+    int maxQueue() const { return m_maxQueue; }
+
+    // Half the cores, between 1 and 4: capture and the game need the rest
+    static int defaultWorkerCount();
+    static QString policyName(BackpressurePolicy policy);
+
+signals:
+    void debugLog(const QString& message);
+
+private:
+    struct Job {
+        QImage image;             // null for repeat records
+        int64_t timestampUs = 0;
+        int quality = BASE_QUALITY;
+    };
+
+    struct Result {
+        QByteArray data;
+        QSize size;
+        QImage::Format format = QImage::Format_Invalid;
+        int64_t timestampUs = 0;
+        bool repeat = false;
+    };
+
+    void workerLoop();
+    void enqueueLocked(Job&& job);
+    void deliver(quint64 sequence, Result&& result);
+    bool compress(const Job& job, void* jpegHandle, Result& out);
+    int currentQualityLocked();
+
+    const int m_workerCount;
+    const int m_maxQueue;
+    const BackpressurePolicy m_policy;
+    Sink m_sink;
+
+    std::vector<QThread*> m_workers;
+
+    // Input side, guarded by m_queueMutex
+    mutable QMutex m_queueMutex;
+    QWaitCondition m_queueCond;
+    std::deque<Job> m_queue;
+    int m_pendingImages;
+    quint64 m_nextSequence;
+    bool m_running;
+    bool m_hasSubmitted;
+    int m_qualityLevel;
+    int m_lowDepthStreak;
+    int m_qualityCap;
+    Stats m_stats;
+
+    // Output side, guarded by m_outputMutex: results wait here until every
+    // earlier sequence number has been delivered
+    QMutex m_outputMutex;
+    std::map<quint64, Result> m_completed;
+    quint64 m_nextOutput;
+    Result m_lastOutput;
+};
+
+#endif // COMPRESSIONPIPELINE_H
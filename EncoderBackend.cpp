@@ -0,0 +1,580 @@
+/*
+ * EncoderBackend.cpp
+ *
+ * Hardware/software video encoder selection. Probing opens each candidate
+ * encoder with a small test stream and pushes one frame through it, which
+ * catches the common failure modes (encoder compiled in but no driver, no
+ * supported GPU, session limit reached) before the app relies on it.
+ */
+
+#include "EncoderBackend.h"
+#include <QDebug>
+#include <QMutex>
+#include <QMutexLocker>
+#include <algorithm>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/opt.h>
+#include <libavutil/hwcontext.h>
+#include <libavutil/imgutils.h>
+#ifdef _WIN32
+#include <libavutil/hwcontext_d3d11va.h>
+#endif
+}
+
+#ifdef _WIN32
+#include <d3d11.h>
+#endif
+
+static QString backendAvErrorString(int errnum) {
+    char buf[AV_ERROR_MAX_STRING_SIZE] = {0};
+    av_strerror(errnum, buf, sizeof(buf));
+    return QString::fromUtf8(buf);
+}
+
+// Roughly 0.08 bits per pixel per frame, which is visually close to
+// x264 crf 23 for desktop/game content on hardware encoders.
+static int defaultBitrate(int width, int height, int fps) {
+    double bits = width * (double)height * fps * 0.08;
+    return static_cast<int>(std::clamp(bits, 2.0e6, 80.0e6));
+}
+
+#ifdef _WIN32
+// Wraps the capture device in a D3D11VA hw device and gives the encoder an
+// NV12 texture pool on it. Textures are allocated on demand and recycled.
+static bool attachD3D11Frames(AVCodecContext* ctx, void* d3d11Device, QString* error) {
+    AVBufferRef* device = av_hwdevice_ctx_alloc(AV_HWDEVICE_TYPE_D3D11VA);
+    if (!device) {
+        if (error) *error = "D3D11VA device allocation failed";
+        return false;
+    }
+    AVHWDeviceContext* deviceCtx = reinterpret_cast<AVHWDeviceContext*>(device->data);
+    AVD3D11VADeviceContext* d3dCtx = static_cast<AVD3D11VADeviceContext*>(deviceCtx->hwctx);
+    d3dCtx->device = static_cast<ID3D11Device*>(d3d11Device);
+    d3dCtx->device->AddRef();
+
+    int ret = av_hwdevice_ctx_init(device);
+    if (ret < 0) {
+        if (error) *error = QString("D3D11VA device: %1").arg(backendAvErrorString(ret));
+        av_buffer_unref(&device);
+        return false;
+    }
+
+    AVBufferRef* frames = av_hwframe_ctx_alloc(device);
+    av_buffer_unref(&device);
+    if (!frames) {
+        if (error) *error = "D3D11 frame pool allocation failed";
+        return false;
+    }
+    AVHWFramesContext* framesCtx = reinterpret_cast<AVHWFramesContext*>(frames->data);
+    framesCtx->format = AV_PIX_FMT_D3D11;
+    framesCtx->sw_format = AV_PIX_FMT_NV12;
+    framesCtx->width = ctx->width;
+    framesCtx->height = ctx->height;
+    framesCtx->initial_pool_size = 0;
+    AVD3D11VAFramesContext* d3dFrames = static_cast<AVD3D11VAFramesContext*>(framesCtx->hwctx);
+    d3dFrames->BindFlags = D3D11_BIND_RENDER_TARGET;
+
+    ret = av_hwframe_ctx_init(frames);
+    if (ret < 0) {
+        if (error) *error = QString("D3D11 frame pool: %1").arg(backendAvErrorString(ret));
+        av_buffer_unref(&frames);
+        return false;
+    }
+    ctx->hw_frames_ctx = frames;
+    ctx->pix_fmt = AV_PIX_FMT_D3D11;
+    ctx->sw_pix_fmt = AV_PIX_FMT_NV12;
+    return true;
+}
+#endif
+
+#ifdef __APPLE__
+// Gives VideoToolbox an NV12 CVPixelBuffer pool. Captured buffers are sent
+// as AV_PIX_FMT_VIDEOTOOLBOX frames and bypass the pool; it only backs the
+// uploads of system-memory frames in sendFrame().
+static bool attachVideoToolboxFrames(AVCodecContext* ctx, QString* error) {
+    AVBufferRef* device = nullptr;
+    int ret = av_hwdevice_ctx_create(&device, AV_HWDEVICE_TYPE_VIDEOTOOLBOX, nullptr, nullptr, 0);
+    if (ret < 0) {
+        if (error) *error = QString("VideoToolbox device: %1").arg(backendAvErrorString(ret));
+        return false;
+    }
+
+    AVBufferRef* frames = av_hwframe_ctx_alloc(device);
+    av_buffer_unref(&device);
+    if (!frames) {
+        if (error) *error = "VideoToolbox frame pool allocation failed";
+        return false;
+    }
+    AVHWFramesContext* framesCtx = reinterpret_cast<AVHWFramesContext*>(frames->data);
+    framesCtx->format = AV_PIX_FMT_VIDEOTOOLBOX;
+    framesCtx->sw_format = AV_PIX_FMT_NV12;
+    framesCtx->width = ctx->width;
+    framesCtx->height = ctx->height;
+    framesCtx->initial_pool_size = 0;
+
+    ret = av_hwframe_ctx_init(frames);
+    if (ret < 0) {
+        if (error) *error = QString("VideoToolbox frame pool: %1").arg(backendAvErrorString(ret));
+        av_buffer_unref(&frames);
+        return false;
+    }
+    ctx->hw_frames_ctx = frames;
+    ctx->pix_fmt = AV_PIX_FMT_VIDEOTOOLBOX;
+    ctx->sw_pix_fmt = AV_PIX_FMT_NV12;
+    return true;
+}
+#endif
+
+QList<EncoderBackend> EncoderBackends::candidateOrder() {
+    QList<EncoderBackend> order;
+#ifdef _WIN32
+    order << EncoderBackend::NVENC << EncoderBackend::AMF << EncoderBackend::QuickSync;
+#elif __APPLE__
+    order << EncoderBackend::VideoToolbox;
+#else
+    order << EncoderBackend::NVENC << EncoderBackend::VAAPI << EncoderBackend::QuickSync;
+#endif
+    order << EncoderBackend::Software;
+    return order;
+}
+
+QString EncoderBackends::displayName(EncoderBackend backend) {
+    switch (backend) {
+    case EncoderBackend::Auto:         return "Auto (best available)";
+    case EncoderBackend::NVENC:        return "NVIDIA NVENC";
+    case EncoderBackend::AMF:          return "AMD AMF";
+    case EncoderBackend::QuickSync:    return "Intel QuickSync";
+    case EncoderBackend::VideoToolbox: return "Apple VideoToolbox";
+    case EncoderBackend::VAAPI:        return "VA-API";
+    case EncoderBackend::Software:     return "Software (x264/x265)";
+    }
+    return "Unknown";
+}
+
+QString EncoderBackends::settingsKey(EncoderBackend backend) {
+    switch (backend) {
+    case EncoderBackend::Auto:         return "auto";
+    case EncoderBackend::NVENC:        return "nvenc";
+    case EncoderBackend::AMF:          return "amf";
+    case EncoderBackend::QuickSync:    return "qsv";
+    case EncoderBackend::VideoToolbox: return "videotoolbox";
+    case EncoderBackend::VAAPI:        return "vaapi";
+    case EncoderBackend::Software:     return "software";
+    }
+    return "auto";
+}
+
+EncoderBackend EncoderBackends::fromSettingsKey(const QString& key) {
+    const EncoderBackend all[] = {
+        EncoderBackend::NVENC, EncoderBackend::AMF, EncoderBackend::QuickSync,
+        EncoderBackend::VideoToolbox, EncoderBackend::VAAPI, EncoderBackend::Software
+    };
+    for (EncoderBackend backend : all) {
+        if (settingsKey(backend) == key) {
+            return backend;
+        }
+    }
+    return EncoderBackend::Auto;
+}
+
+const char* EncoderBackends::codecName(EncoderBackend backend, bool hevc) {
+    switch (backend) {
+    case EncoderBackend::NVENC:        return hevc ? "hevc_nvenc" : "h264_nvenc";
+    case EncoderBackend::AMF:          return hevc ? "hevc_amf" : "h264_amf";
+    case EncoderBackend::QuickSync:    return hevc ? "hevc_qsv" : "h264_qsv";
+    case EncoderBackend::VideoToolbox: return hevc ? "hevc_videotoolbox" : "h264_videotoolbox";
+    case EncoderBackend::VAAPI:        return hevc ? "hevc_vaapi" : "h264_vaapi";
+    case EncoderBackend::Auto:
+    case EncoderBackend::Software:     break;
+    }
+    return hevc ? "libx265" : "libx264";
+}
+
+QList<EncoderBackend> EncoderBackends::probe() {
+    static QMutex probeMutex;
+    static bool probed = false;
+    static QList<EncoderBackend> available;
+
+    QMutexLocker locker(&probeMutex);
+    if (probed) {
+        return available;
+    }
+
+    qDebug() << "[EncoderBackends] Probing video encoders...";
+
+    for (EncoderBackend backend : candidateOrder()) {
+        Settings settings;
+        settings.backend = backend;
+        settings.width = 640;
+        settings.height = 360;
+        settings.fps = 30;
+        settings.gopSize = 30;
+        settings.softwarePreset = "ultrafast";
+
+        QString error;
+        AVCodecContext* ctx = tryOpen(backend, settings, &error);
+        bool ok = ctx != nullptr;
+
+        // Push a single black frame through; several drivers only fail here.
+        if (ctx) {
+            AVFrame* frame = av_frame_alloc();
+            AVPacket* packet = av_packet_alloc();
+            ok = frame && packet;
+            if (ok) {
+                frame->format = inputPixelFormat(ctx);
+                frame->width = ctx->width;
+                frame->height = ctx->height;
+                ok = av_frame_get_buffer(frame, 0) >= 0;
+            }
+            if (ok) {
+                const AVPixelFormat fmt = static_cast<AVPixelFormat>(frame->format);
+                ptrdiff_t linesizes[4] = { frame->linesize[0], frame->linesize[1],
+                                           frame->linesize[2], frame->linesize[3] };
+                av_image_fill_black(frame->data, linesizes, fmt, AVCOL_RANGE_MPEG,
+                                    frame->width, frame->height);
+                frame->pts = 0;
+                ok = sendFrame(ctx, frame) >= 0 && sendFrame(ctx, nullptr) >= 0;
+                while (ok) {
+                    int ret = avcodec_receive_packet(ctx, packet);
+                    if (ret == AVERROR_EOF || ret == AVERROR(EAGAIN)) {
+                        break;
+                    }
+                    if (ret < 0) {
+                        error = backendAvErrorString(ret);
+                        ok = false;
+                    }
+                    av_packet_unref(packet);
+                }
+            }
+            av_packet_free(&packet);
+            av_frame_free(&frame);
+            avcodec_free_context(&ctx);
+        }
+
+        qDebug() << "[EncoderBackends]" << displayName(backend) << ":"
+                 << (ok ? "available" : QString("unavailable (%1)").arg(error));
+        if (ok) {
+            available << backend;
+        }
+    }
+
+    probed = true;
+    return available;
+}
+
+bool EncoderBackends::isAvailable(EncoderBackend backend) {
+    return probe().contains(backend);
+}
+
+EncoderBackend EncoderBackends::resolve(EncoderBackend requested) {
+    QList<EncoderBackend> available = probe();
+    if (requested != EncoderBackend::Auto && available.contains(requested)) {
+        return requested;
+    }
+    return available.isEmpty() ? EncoderBackend::Software : available.first();
+}
+
+AVCodecContext* EncoderBackends::openVideoEncoder(const Settings& settings,
+                                                  EncoderBackend* usedBackend,
+                                                  QString* error)
+{
+    // Requested backend first, then everything after it in fallback order.
+    QList<EncoderBackend> order = candidateOrder();
+    EncoderBackend first = resolve(settings.backend);
+    int start = std::max<int>(0, order.indexOf(first));
+
+    QString lastError;
+    for (int i = start; i < order.size(); i++) {
+        EncoderBackend backend = order[i];
+        if (backend != EncoderBackend::Software && !isAvailable(backend)) {
+            continue;
+        }
+        AVCodecContext* ctx = tryOpen(backend, settings, &lastError);
+        if (ctx) {
+            if (usedBackend) {
+                *usedBackend = backend;
+            }
+            if (backend != first) {
+                qDebug() << "[EncoderBackends]" << displayName(first)
+                         << "failed, fell back to" << displayName(backend);
+            }
+            return ctx;
+        }
+    }
+
+    if (error) {
+        *error = lastError.isEmpty() ? QString("No usable video encoder") : lastError;
+    }
+    return nullptr;
+}
+
+AVCodecContext* EncoderBackends::tryOpen(EncoderBackend backend, const Settings& settings, QString* error) {
+    const char* name = codecName(backend, settings.hevc);
+    const AVCodec* codec = avcodec_find_encoder_by_name(name);
+    if (!codec && backend == EncoderBackend::Software) {
+        codec = avcodec_find_encoder(settings.hevc ? AV_CODEC_ID_HEVC : AV_CODEC_ID_H264);
+    }
+    if (!codec) {
+        if (error) *error = QString("%1 not compiled into libavcodec").arg(name);
+        return nullptr;
+    }
+
+    AVCodecContext* ctx = avcodec_alloc_context3(codec);
+    if (!ctx) {
+        if (error) *error = "Failed to allocate encoder context";
+        return nullptr;
+    }
+
+    ctx->width = settings.width & ~1;
+    ctx->height = settings.height & ~1;
+    ctx->time_base = AVRational{1, settings.fps};
+    ctx->framerate = AVRational{settings.fps, 1};
+    ctx->gop_size = settings.gopSize;
+    ctx->max_b_frames = settings.maxBFrames;
+    if (settings.lowLatency) {
+        ctx->keyint_min = settings.gopSize;
+    }
+    if (settings.globalHeader) {
+        ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    }
+
+    const int bitrate = settings.bitrate > 0 ? settings.bitrate
+                                             : defaultBitrate(ctx->width, ctx->height, settings.fps);
+    const QByteArray crf = QByteArray::number(settings.crf);
+    void* priv = ctx->priv_data;
+
+    // Pick the first of yuv420p/nv12 the encoder accepts.
+    ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+    if (codec->pix_fmts) {
+        bool hasYuv420p = false;
+        bool hasNv12 = false;
+        for (const AVPixelFormat* f = codec->pix_fmts; *f != AV_PIX_FMT_NONE; f++) {
+            hasYuv420p |= (*f == AV_PIX_FMT_YUV420P);
+            hasNv12 |= (*f == AV_PIX_FMT_NV12);
+        }
+        if (!hasYuv420p && hasNv12) {
+            ctx->pix_fmt = AV_PIX_FMT_NV12;
+        }
+    }
+
+#ifdef _WIN32
+    // QuickSync would need a QSV frames context derived from D3D11; it
+    // keeps using system-memory input.
+    if (settings.d3d11Device &&
+        (backend == EncoderBackend::NVENC || backend == EncoderBackend::AMF)) {
+        QString d3dError;
+        if (!attachD3D11Frames(ctx, settings.d3d11Device, &d3dError)) {
+            qDebug() << "[EncoderBackends] Zero-copy input unavailable:" << d3dError;
+        }
+    }
+#elif __APPLE__
+    if (settings.pixelBufferInput && backend == EncoderBackend::VideoToolbox) {
+        QString vtError;
+        if (!attachVideoToolboxFrames(ctx, &vtError)) {
+            qDebug() << "[EncoderBackends] Zero-copy input unavailable:" << vtError;
+        }
+    }
+#endif
+
+    switch (backend) {
+    case EncoderBackend::NVENC:
+        av_opt_set(priv, "preset", settings.lowLatency ? "p2" : "p4", 0);
+        av_opt_set(priv, "tune", settings.lowLatency ? "ll" : "hq", 0);
+        av_opt_set(priv, "rc", "vbr", 0);
+        if (settings.bitrate > 0) {
+            ctx->bit_rate = settings.bitrate;
+        } else {
+            av_opt_set(priv, "cq", crf.constData(), 0);
+            ctx->bit_rate = 0;
+        }
+        if (settings.lowLatency) {
+            av_opt_set(priv, "zerolatency", "1", 0);
+            av_opt_set(priv, "delay", "0", 0);
+            av_opt_set(priv, "no-scenecut", "1", 0);
+        }
+        break;
+
+    case EncoderBackend::AMF:
+        av_opt_set(priv, "usage", settings.lowLatency ? "lowlatency" : "transcoding", 0);
+        av_opt_set(priv, "quality", settings.lowLatency ? "speed" : "balanced", 0);
+        if (settings.bitrate > 0) {
+            av_opt_set(priv, "rc", "vbr_peak", 0);
+            ctx->bit_rate = settings.bitrate;
+        } else {
+            av_opt_set(priv, "rc", "cqp", 0);
+            av_opt_set(priv, "qp_i", crf.constData(), 0);
+            av_opt_set(priv, "qp_p", crf.constData(), 0);
+        }
+        break;
+
+    case EncoderBackend::QuickSync:
+        av_opt_set(priv, "preset", settings.lowLatency ? "veryfast" : "medium", 0);
+        if (settings.bitrate > 0) {
+            ctx->bit_rate = settings.bitrate;
+        } else {
+            ctx->global_quality = settings.crf;
+        }
+        if (settings.lowLatency) {
+            av_opt_set(priv, "async_depth", "1", 0);
+        }
+        break;
+
+    case EncoderBackend::VideoToolbox:
+        ctx->bit_rate = bitrate;
+        av_opt_set(priv, "allow_sw", "0", 0);
+        if (settings.lowLatency) {
+            av_opt_set(priv, "realtime", "1", 0);
+            av_opt_set(priv, "prio_speed", "1", 0);
+        }
+        break;
+
+    case EncoderBackend::VAAPI: {
+        // VAAPI only takes GPU surfaces: create a device and a frame pool,
+        // frames are uploaded from NV12 in sendFrame().
+        AVBufferRef* device = nullptr;
+        int ret = av_hwdevice_ctx_create(&device, AV_HWDEVICE_TYPE_VAAPI, nullptr, nullptr, 0);
+        if (ret < 0) {
+            if (error) *error = QString("VAAPI device: %1").arg(backendAvErrorString(ret));
+            avcodec_free_context(&ctx);
+            return nullptr;
+        }
+        AVBufferRef* frames = av_hwframe_ctx_alloc(device);
+        av_buffer_unref(&device);
+        if (!frames) {
+            if (error) *error = "VAAPI frame pool allocation failed";
+            avcodec_free_context(&ctx);
+            return nullptr;
+        }
+        AVHWFramesContext* framesCtx = reinterpret_cast<AVHWFramesContext*>(frames->data);
+        framesCtx->format = AV_PIX_FMT_VAAPI;
+        framesCtx->sw_format = AV_PIX_FMT_NV12;
+        framesCtx->width = ctx->width;
+        framesCtx->height = ctx->height;
+        framesCtx->initial_pool_size = 8;
+        ret = av_hwframe_ctx_init(frames);
+        if (ret < 0) {
+            if (error) *error = QString("VAAPI frame pool: %1").arg(backendAvErrorString(ret));
+            av_buffer_unref(&frames);
+            avcodec_free_context(&ctx);
+            return nullptr;
+        }
+        ctx->hw_frames_ctx = frames;
+        ctx->pix_fmt = AV_PIX_FMT_VAAPI;
+        if (settings.bitrate > 0) {
+            av_opt_set(priv, "rc_mode", "VBR", 0);
+            ctx->bit_rate = settings.bitrate;
+        } else {
+            av_opt_set(priv, "rc_mode", "CQP", 0);
+            ctx->global_quality = settings.crf;
+        }
+        break;
+    }
+
+    case EncoderBackend::Auto:
+    case EncoderBackend::Software:
+        av_opt_set(priv, "preset", settings.softwarePreset.toUtf8().constData(), 0);
+        if (settings.lowLatency) {
+            av_opt_set(priv, "tune", "zerolatency", 0);
+            if (settings.hevc) {
+                av_opt_set(priv, "x265-params", "scenecut=0:log-level=error", 0);
+            } else {
+                av_opt_set(priv, "x264-params", "scenecut=0", 0);
+            }
+        }
+        if (settings.bitrate > 0) {
+            ctx->bit_rate = settings.bitrate;
+            ctx->rc_max_rate = settings.bitrate;
+            ctx->rc_buffer_size = settings.bitrate;
+        } else {
+            av_opt_set(priv, "crf", crf.constData(), 0);
+        }
+        break;
+    }
+
+    int ret = avcodec_open2(ctx, codec, nullptr);
+    if (ret < 0) {
+        if (error) *error = QString("%1: %2").arg(name, backendAvErrorString(ret));
+        avcodec_free_context(&ctx);
+        return nullptr;
+    }
+    return ctx;
+}
+
+int EncoderBackends::inputPixelFormat(const AVCodecContext* ctx) {
+    if (ctx->hw_frames_ctx) {
+        const AVHWFramesContext* frames = reinterpret_cast<const AVHWFramesContext*>(ctx->hw_frames_ctx->data);
+        return frames->sw_format;
+    }
+    return ctx->pix_fmt;
+}
+
+bool EncoderBackends::isD3D11Input(const AVCodecContext* ctx) {
+    return ctx && ctx->pix_fmt == AV_PIX_FMT_D3D11;
+}
+
+bool EncoderBackends::isPixelBufferInput(const AVCodecContext* ctx) {
+    return ctx && ctx->pix_fmt == AV_PIX_FMT_VIDEOTOOLBOX;
+}
+
+int EncoderBackends::sendFrame(AVCodecContext* ctx, AVFrame* frame) {
+    if (!frame || !ctx->hw_frames_ctx || frame->format == ctx->pix_fmt) {
+        return avcodec_send_frame(ctx, frame);
+    }
+
+    AVFrame* hwFrame = av_frame_alloc();
+    if (!hwFrame) {
+        return AVERROR(ENOMEM);
+    }
+    int ret = av_hwframe_get_buffer(ctx->hw_frames_ctx, hwFrame, 0);
+    if (ret >= 0) {
+        ret = av_hwframe_transfer_data(hwFrame, frame, 0);
+    }
+    if (ret >= 0) {
+        hwFrame->pts = frame->pts;
+        ret = avcodec_send_frame(ctx, hwFrame);
+    }
+    av_frame_free(&hwFrame);
+    return ret;
+}
+
+QStringList EncoderBackends::ffmpegVideoArgs(EncoderBackend backend, int bitrate,
+                                             int width, int height, int fps,
+                                             QStringList& inputArgs)
+{
+    const QString rate = QString::number(bitrate > 0 ? bitrate : defaultBitrate(width, height, fps));
+    QStringList args;
+
+    switch (backend) {
+    case EncoderBackend::NVENC:
+        args << "-c:v" << "h264_nvenc" << "-preset" << "p4" << "-tune" << "hq"
+             << "-rc" << "vbr" << "-cq" << "23" << "-b:v" << "0"
+             << "-pix_fmt" << "yuv420p";
+        break;
+    case EncoderBackend::AMF:
+        args << "-c:v" << "h264_amf" << "-quality" << "balanced"
+             << "-rc" << "cqp" << "-qp_i" << "23" << "-qp_p" << "23"
+             << "-pix_fmt" << "yuv420p";
+        break;
+    case EncoderBackend::QuickSync:
+        args << "-c:v" << "h264_qsv" << "-preset" << "medium"
+             << "-global_quality" << "23" << "-pix_fmt" << "nv12";
+        break;
+    case EncoderBackend::VideoToolbox:
+        args << "-c:v" << "h264_videotoolbox" << "-b:v" << rate
+             << "-allow_sw" << "0" << "-pix_fmt" << "nv12";
+        break;
+    case EncoderBackend::VAAPI:
+        inputArgs << "-vaapi_device" << "/dev/dri/renderD128";
+        args << "-vf" << "format=nv12,hwupload" << "-c:v" << "h264_vaapi"
+             << "-rc_mode" << "CQP" << "-qp" << "23";
+        break;
+    case EncoderBackend::Auto:
+    case EncoderBackend::Software:
+        args << "-c:v" << "libx264" << "-preset" << "medium" << "-crf" << "23"
+             << "-pix_fmt" << "yuv420p";
+        break;
+    }
+    return args;
+}
@@ -0,0 +1,112 @@
+#ifndef ENCODERBACKEND_H
+#define ENCODERBACKEND_H
+
+#include <QString>
+#include <QStringList>
+#include <QList>
+
+struct AVCodecContext;
+struct AVFrame;
+
+/*
+ * EncoderBackend
+ * - Which video encoder implementation to use. `Auto` resolves to the first
+ *   backend that probed successfully, in the order listed below; the
+ *   software encoder (libx264/libx265) is always the last resort.
+ */
+enum class EncoderBackend {
+    Auto,
+    NVENC,
+    AMF,
+    QuickSync,
+    VideoToolbox,
+    VAAPI,
+    Software
+};
+
+/*
+ * EncoderBackends
+ *
+ * Purpose
+ * - Central place for everything backend specific: probing which hardware
+ *   encoders actually work on this machine, opening an encoder context
+ *   with sensible per-backend rate control, and handing frames to it
+ *   (including the upload step for backends that only take GPU surfaces,
+ *   such as VAAPI).
+ *
+ * Usage
+ * - `probe()` is cheap after the first call; results are cached for the
+ *   lifetime of the process. It is safe to call from any thread.
+ * - `openVideoEncoder()` tries the requested backend first and then walks
+ *   the fallback order, so a driver that fails at open time degrades to
+ *   the next backend instead of failing the save/capture.
+ * - `sendFrame()` replaces `avcodec_send_frame` for contexts opened here.
+ * - With `Settings::d3d11Device` set, NVENC and AMF take AV_PIX_FMT_D3D11
+ *   frames (`isD3D11Input()`); system-memory NV12 frames are still
+ *   accepted and uploaded by `sendFrame()`.
+ * - With `Settings::pixelBufferInput` set, VideoToolbox takes
+ *   AV_PIX_FMT_VIDEOTOOLBOX frames wrapping CVPixelBuffers
+ *   (`isPixelBufferInput()`); system-memory frames are uploaded as above.
+ */
+class EncoderBackends {
+public:
+    struct Settings {
+        EncoderBackend backend = EncoderBackend::Auto;
+        bool hevc = false;
+        int width = 0;
+        int height = 0;
+        int fps = 30;
+        int gopSize = 60;
+        int maxBFrames = 0;
+        int bitrate = 0;          // 0 = quality mode (crf) or resolution based default
+        int crf = 23;
+        bool lowLatency = false;  // continuous capture: no lookahead/frame delay
+        bool globalHeader = true;
+        QString softwarePreset = "medium";
+        // ID3D11Device*: NVENC/AMF are then opened with a D3D11 frame pool
+        // so captured textures can be encoded without leaving the GPU
+        void* d3d11Device = nullptr;
+        // macOS: VideoToolbox is opened with a CVPixelBuffer frame pool so
+        // IOSurface-backed capture buffers are encoded as they are
+        bool pixelBufferInput = false;
+    };
+
+    // Backends that opened successfully, in fallback order (Software last)
+    static QList<EncoderBackend> probe();
+    static bool isAvailable(EncoderBackend backend);
+    static EncoderBackend resolve(EncoderBackend requested);
+
+    static QString displayName(EncoderBackend backend);
+    static QString settingsKey(EncoderBackend backend);
+    static EncoderBackend fromSettingsKey(const QString& key);
+
+    // libavcodec encoder name ("h264_nvenc", "libx264", ...)
+    static const char* codecName(EncoderBackend backend, bool hevc);
+
+    /*
+     * Extra ffmpeg CLI arguments for `encodeWithFFmpeg`: the codec selection
+     * plus rate control, replacing the previously hardcoded libx264 flags.
+     * Device arguments that must precede the inputs go into `inputArgs`.
+     */
+    static QStringList ffmpegVideoArgs(EncoderBackend backend, int bitrate,
+                                       int width, int height, int fps,
+                                       QStringList& inputArgs);
+
+    static AVCodecContext* openVideoEncoder(const Settings& settings,
+                                            EncoderBackend* usedBackend,
+                                            QString* error);
+
+    // Pixel format (AVPixelFormat) frames must be converted to before `sendFrame`
+    static int inputPixelFormat(const AVCodecContext* ctx);
+
+    static int sendFrame(AVCodecContext* ctx, AVFrame* frame);
+
+    static bool isD3D11Input(const AVCodecContext* ctx);
+    static bool isPixelBufferInput(const AVCodecContext* ctx);
+
+private:
+    static AVCodecContext* tryOpen(EncoderBackend backend, const Settings& settings, QString* error);
+    static QList<EncoderBackend> candidateOrder();
+};
+
+#endif // ENCODERBACKEND_H
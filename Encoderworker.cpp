@@ -9,9 +9,9 @@
 #include "EncoderWorker.h"
 
 EncoderWorker::EncoderWorker(VideoEncoder* encoder,
-                             std::vector<VideoFrame> frames,
-                             std::vector<AudioSample> mic,
-                             std::vector<AudioSample> desktop,
+                             ReplaySnapshot frames,
+                             AudioSnapshot mic,
+                             AudioSnapshot desktop,
                              VideoEncoder::EncodeOptions opts,
                              QObject* parent)
     : QObject(parent)
@@ -27,11 +27,52 @@ EncoderWorker::EncoderWorker(VideoEncoder* encoder,
             this, &EncoderWorker::progressUpdate);
     connect(m_encoder, &VideoEncoder::encodingComplete,
             this, &EncoderWorker::encodingComplete);
+    connect(m_encoder, &VideoEncoder::encodingCanceled,
+            this, &EncoderWorker::encodingCanceled);
     connect(m_encoder, &VideoEncoder::errorOccurred,
             this, &EncoderWorker::errorOccurred);
+    connect(m_encoder, &VideoEncoder::outputGrowing,
+            this, &EncoderWorker::outputGrowing);
+    connect(m_encoder, &VideoEncoder::outputDiscarded,
+            this, &EncoderWorker::outputDiscarded);
+}
+
+EncoderWorker::EncoderWorker(VideoEncoder* encoder,
+                             EncodedClip clip,
+                             AudioSnapshot mic,
+                             AudioSnapshot desktop,
+                             VideoEncoder::EncodeOptions opts,
+                             QObject* parent)
+    : EncoderWorker(encoder, ReplaySnapshot(), std::move(mic),
+                    std::move(desktop), opts, parent)
+{
+    m_clip = std::move(clip);
+}
+
+EncoderWorker::EncoderWorker(VideoEncoder* encoder,
+                             std::vector<ReplaySnapshot> displays,
+                             AudioSnapshot mic,
+                             AudioSnapshot desktop,
+                             VideoEncoder::EncodeOptions opts,
+                             QObject* parent)
+    : EncoderWorker(encoder, ReplaySnapshot(), std::move(mic),
+                    std::move(desktop), opts, parent)
+{
+    m_displays = std::move(displays);
 }
 
 void EncoderWorker::process() {
-    m_success = m_encoder->encode(m_frames, m_mic, m_desktop, m_options);
+    if (!m_clip.packets.empty()) {
+        m_success = m_encoder->encodePackets(m_clip, m_mic, m_desktop, m_options);
+    } else if (!m_displays.empty()) {
+        std::vector<std::vector<VideoFrame>> displays;
+        for (const ReplaySnapshot& snapshot : m_displays) {
+            displays.push_back(snapshot.frames());
+        }
+        m_success = m_encoder->encodeComposite(displays, m_mic, m_desktop, m_options);
+    } else {
+        // Views into the snapshot's slabs, which m_frames keeps alive
+        m_success = m_encoder->encode(m_frames.frames(), m_mic, m_desktop, m_options);
+    }
     emit finished();
 }
\ No newline at end of file
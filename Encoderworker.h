@@ -9,10 +9,28 @@ class EncoderWorker : public QObject {
     Q_OBJECT
     
 public:
+    // The snapshots keep the buffered data alive until the worker is done;
+    // frames are read in place, never copied
     EncoderWorker(VideoEncoder* encoder,
-                 std::vector<VideoFrame> frames,
-                 std::vector<AudioSample> mic,
-                 std::vector<AudioSample> desktop,
+                 ReplaySnapshot frames,
+                 AudioSnapshot mic,
+                 AudioSnapshot desktop,
+                 VideoEncoder::EncodeOptions opts,
+                 QObject* parent = nullptr);
+    
+    // Remux variant for the continuous-encode capture modes
+    EncoderWorker(VideoEncoder* encoder,
+                 EncodedClip clip,
+                 AudioSnapshot mic,
+                 AudioSnapshot desktop,
+                 VideoEncoder::EncodeOptions opts,
+                 QObject* parent = nullptr);
+    
+    // Composited variant: one snapshot per display, laid out side by side
+    EncoderWorker(VideoEncoder* encoder,
+                 std::vector<ReplaySnapshot> displays,
+                 AudioSnapshot mic,
+                 AudioSnapshot desktop,
                  VideoEncoder::EncodeOptions opts,
                  QObject* parent = nullptr);
     
@@ -25,13 +43,18 @@ signals:
     void finished();
     void progressUpdate(int percent);
     void encodingComplete(bool success, const QString& message);
+    void encodingCanceled();
     void errorOccurred(const QString& error);
+    void outputGrowing(const QString& outputPath);
+    void outputDiscarded(const QString& outputPath);
     
 private:
     VideoEncoder* m_encoder;
-    std::vector<VideoFrame> m_frames;
-    std::vector<AudioSample> m_mic;
-    std::vector<AudioSample> m_desktop;
+    ReplaySnapshot m_frames;
+    EncodedClip m_clip;
+    std::vector<ReplaySnapshot> m_displays;
+    AudioSnapshot m_mic;
+    AudioSnapshot m_desktop;
     VideoEncoder::EncodeOptions m_options;
     bool m_success;
 };
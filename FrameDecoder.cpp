@@ -0,0 +1,437 @@
+/*
+ * FrameDecoder.cpp
+ *
+ * Background decode for the clip viewer and trim dialog. One worker
+ * thread per open clip serves the newest frame request, keeps reading
+ * ahead while playing, and fills a display-sized LRU cache.
+ */
+
+#include "FrameDecoder.h"
+#include "ClipIndex.h"
+#include <QDebug>
+#include <algorithm>
+#include <cmath>
+
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libswscale/swscale.h>
+}
+
+FrameDecoder::FrameDecoder(QObject* parent)
+    : QObject(parent)
+    , m_worker(nullptr)
+    , m_stop(false)
+    , m_playing(false)
+    , m_target(-1)
+    , m_targetRequest(0)
+    , m_request(0)
+    , m_position(0)
+    , m_cacheBytes(0)
+    , m_format(nullptr)
+    , m_codec(nullptr)
+    , m_frame(nullptr)
+    , m_packet(nullptr)
+    , m_sws(nullptr)
+    , m_streamIndex(-1)
+    , m_startPts(0)
+    , m_ticksPerFrame(1.0)
+    , m_lastDecoded(-1)
+    , m_eof(false)
+{
+}
+
+FrameDecoder::~FrameDecoder() {
+    close();
+}
+
+bool FrameDecoder::open(const QString& path, const ClipIndex* index) {
+    close();
+
+    const bool indexed = index && index->info().valid;
+    const QByteArray file = path.toUtf8();
+    if (avformat_open_input(&m_format, file.constData(), nullptr, nullptr) < 0) {
+        qDebug() << "[FrameDecoder] Cannot open" << path;
+        return false;
+    }
+    // The probe decodes frames to fill in what the index already has
+    if (!indexed && avformat_find_stream_info(m_format, nullptr) < 0) {
+        qDebug() << "[FrameDecoder] No stream info in" << path;
+        freeDecoder();
+        return false;
+    }
+
+    const AVCodec* codec = nullptr;
+    m_streamIndex = av_find_best_stream(m_format, AVMEDIA_TYPE_VIDEO, -1, -1, &codec, 0);
+    if (m_streamIndex < 0 || !codec) {
+        qDebug() << "[FrameDecoder] No video stream in" << path;
+        freeDecoder();
+        return false;
+    }
+    AVStream* stream = m_format->streams[m_streamIndex];
+
+    m_codec = avcodec_alloc_context3(codec);
+    if (!m_codec || avcodec_parameters_to_context(m_codec, stream->codecpar) < 0) {
+        freeDecoder();
+        return false;
+    }
+    m_codec->thread_count = 0;
+    if (avcodec_open2(m_codec, codec, nullptr) < 0) {
+        qDebug() << "[FrameDecoder] Cannot open decoder for" << path;
+        freeDecoder();
+        return false;
+    }
+    m_frame = av_frame_alloc();
+    m_packet = av_packet_alloc();
+    if (!m_frame || !m_packet) {
+        freeDecoder();
+        return false;
+    }
+
+    Info info;
+    const AVRational rate = av_guess_frame_rate(m_format, stream, nullptr);
+    if (indexed) {
+        info.fps = index->info().fps;
+    } else if (rate.num > 0 && rate.den > 0) {
+        info.fps = av_q2d(rate);
+    }
+    info.width = stream->codecpar->width;
+    info.height = stream->codecpar->height;
+    if (indexed) {
+        info.frameCount = index->info().frameCount;
+    } else if (stream->nb_frames > 0) {
+        info.frameCount = static_cast<int>(stream->nb_frames);
+    } else if (stream->duration != AV_NOPTS_VALUE) {
+        info.frameCount = static_cast<int>(std::llround(stream->duration * av_q2d(stream->time_base) * info.fps));
+    } else if (m_format->duration != AV_NOPTS_VALUE) {
+        info.frameCount = static_cast<int>(std::llround(m_format->duration / 1e6 * info.fps));
+    }
+    if (info.frameCount <= 0) {
+        qDebug() << "[FrameDecoder] No frames in" << path;
+        freeDecoder();
+        return false;
+    }
+    info.valid = true;
+
+    m_startPts = stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+    m_ticksPerFrame = 1.0 / (av_q2d(stream->time_base) * info.fps);
+    m_info = info;
+
+    // The clip index or the demuxer's own gives the keyframes without
+    // reading the file
+    m_keyframes.clear();
+    if (indexed && !index->keyframesUs().empty()) {
+        for (int64_t us : index->keyframesUs()) {
+            m_keyframes.push_back(static_cast<int>(std::llround(us * info.fps / 1e6)));
+        }
+    } else {
+        const int entries = avformat_index_get_entries_count(stream);
+        for (int i = 0; i < entries; i++) {
+            const AVIndexEntry* entry = avformat_index_get_entry(stream, i);
+            if (entry && (entry->flags & AVINDEX_KEYFRAME)) {
+                m_keyframes.push_back(frameIndex(entry->timestamp));
+            }
+        }
+    }
+    std::sort(m_keyframes.begin(), m_keyframes.end());
+
+    m_stop = false;
+    m_playing = false;
+    m_target = -1;
+    m_request++;
+    m_position = 0;
+    m_lastDecoded = -1;
+    m_eof = false;
+
+    m_worker = QThread::create([this]() { workerLoop(); });
+    m_worker->setObjectName("FrameDecoder");
+    m_worker->start();
+
+    qDebug() << "[FrameDecoder] Opened" << path << "-" << info.width << "x" << info.height
+             << "," << info.frameCount << "frames at" << info.fps << "fps,"
+             << m_keyframes.size() << "keyframes";
+    return true;
+}
+
+void FrameDecoder::close() {
+    if (m_worker) {
+        {
+            QMutexLocker locker(&m_mutex);
+            m_stop = true;
+            m_wake.wakeAll();
+        }
+        m_worker->wait();
+        delete m_worker;
+        m_worker = nullptr;
+    }
+
+    freeDecoder();
+    QMutexLocker locker(&m_mutex);
+    clearCache();
+    m_info = Info();
+    // Frames still queued to the receivers are from this clip
+    m_request++;
+}
+
+void FrameDecoder::freeDecoder() {
+    if (m_sws) {
+        sws_freeContext(m_sws);
+        m_sws = nullptr;
+    }
+    if (m_packet) {
+        av_packet_free(&m_packet);
+    }
+    if (m_frame) {
+        av_frame_free(&m_frame);
+    }
+    if (m_codec) {
+        avcodec_free_context(&m_codec);
+    }
+    if (m_format) {
+        avformat_close_input(&m_format);
+    }
+    m_streamIndex = -1;
+    m_keyframes.clear();
+}
+
+void FrameDecoder::setDisplaySize(const QSize& size) {
+    QMutexLocker locker(&m_mutex);
+    if (size == m_displaySize) {
+        return;
+    }
+    m_displaySize = size;
+    clearCache();
+}
+
+void FrameDecoder::requestFrame(int index) {
+    if (!m_info.valid) {
+        return;
+    }
+    index = std::clamp(index, 0, m_info.frameCount - 1);
+
+    QImage image;
+    bool cached;
+    int request;
+    {
+        QMutexLocker locker(&m_mutex);
+        request = ++m_request;
+        m_position = index;
+        cached = findCached(index, &image);
+        // A newer request replaces one the worker has not started on
+        m_target = cached ? -1 : index;
+        m_targetRequest = request;
+        m_wake.wakeAll();
+    }
+    if (cached) {
+        emit frameReady(request, index, image);
+    }
+}
+
+void FrameDecoder::setPlaying(bool playing) {
+    QMutexLocker locker(&m_mutex);
+    m_playing = playing;
+    m_wake.wakeAll();
+}
+
+int FrameDecoder::frameIndex(int64_t pts) const {
+    return static_cast<int>(std::llround((pts - m_startPts) / m_ticksPerFrame));
+}
+
+int FrameDecoder::keyframeAtOrBefore(int index) const {
+    auto it = std::upper_bound(m_keyframes.begin(), m_keyframes.end(), index);
+    return it == m_keyframes.begin() ? 0 : *(it - 1);
+}
+
+bool FrameDecoder::reachableByDecoding(int index) const {
+    if (m_lastDecoded < 0 || m_eof || index <= m_lastDecoded) {
+        return false;
+    }
+    if (m_keyframes.empty()) {
+        // No index to go by; a short hop forward is still cheaper than a seek
+        return index - m_lastDecoded <= READ_AHEAD;
+    }
+    // No keyframe between the decoder and the frame: same GOP
+    return keyframeAtOrBefore(index) <= m_lastDecoded;
+}
+
+void FrameDecoder::seekTo(int index) {
+    if (reachableByDecoding(index)) {
+        return;
+    }
+    const int64_t ts = m_startPts + static_cast<int64_t>(std::llround(index * m_ticksPerFrame));
+    if (av_seek_frame(m_format, m_streamIndex, ts, AVSEEK_FLAG_BACKWARD) < 0) {
+        av_seek_frame(m_format, m_streamIndex, m_startPts, AVSEEK_FLAG_BACKWARD);
+    }
+    avcodec_flush_buffers(m_codec);
+    m_lastDecoded = -1;
+    m_eof = false;
+}
+
+bool FrameDecoder::decodeNext(int scaleFrom, const QSize& displaySize, int* index, QImage* image) {
+    while (true) {
+        int ret = avcodec_receive_frame(m_codec, m_frame);
+        if (ret == 0) {
+            const int64_t pts = m_frame->best_effort_timestamp != AV_NOPTS_VALUE
+                ? m_frame->best_effort_timestamp : m_frame->pts;
+            // Without timestamps, count from the last frame
+            *index = pts != AV_NOPTS_VALUE ? frameIndex(pts) : m_lastDecoded + 1;
+            *image = *index >= scaleFrom ? scaleFrame(m_frame, displaySize) : QImage();
+            m_lastDecoded = *index;
+            av_frame_unref(m_frame);
+            return true;
+        }
+        if (ret != AVERROR(EAGAIN)) {
+            m_eof = true;
+            return false;
+        }
+
+        ret = av_read_frame(m_format, m_packet);
+        if (ret < 0) {
+            // End of file: drain what the decoder still holds
+            avcodec_send_packet(m_codec, nullptr);
+            continue;
+        }
+        if (m_packet->stream_index == m_streamIndex) {
+            avcodec_send_packet(m_codec, m_packet);
+        }
+        av_packet_unref(m_packet);
+    }
+}
+
+QImage FrameDecoder::scaleFrame(const AVFrame* frame, const QSize& displaySize) {
+    QSize size(frame->width, frame->height);
+    if (displaySize.width() > 0 && displaySize.height() > 0) {
+        size = size.scaled(displaySize, Qt::KeepAspectRatio);
+    }
+    size = size.expandedTo(QSize(1, 1));
+
+    m_sws = sws_getCachedContext(m_sws, frame->width, frame->height, static_cast<AVPixelFormat>(frame->format),
+                                 size.width(), size.height(), AV_PIX_FMT_RGB32,
+                                 SWS_BILINEAR, nullptr, nullptr, nullptr);
+    QImage image(size, QImage::Format_RGB32);
+    if (!m_sws || image.isNull()) {
+        return QImage();
+    }
+    uint8_t* dst[4] = { image.bits(), nullptr, nullptr, nullptr };
+    int dstStride[4] = { static_cast<int>(image.bytesPerLine()), 0, 0, 0 };
+    sws_scale(m_sws, frame->data, frame->linesize, 0, frame->height, dst, dstStride);
+    return image;
+}
+
+void FrameDecoder::decodeTarget(int target, int request, const QSize& displaySize) {
+    seekTo(target);
+
+    QImage last;
+    int index = -1;
+    QImage image;
+    // Neighbours just before the target are cached too, for scrubbing back
+    while (decodeNext(target - READ_AHEAD, displaySize, &index, &image)) {
+        if (!image.isNull()) {
+            last = image;
+            QMutexLocker locker(&m_mutex);
+            insertCached(index, image, displaySize);
+        }
+        if (index >= target) {
+            break;
+        }
+
+        QMutexLocker locker(&m_mutex);
+        if (m_stop) {
+            return;
+        }
+        if (m_target >= 0 && m_target != target) {
+            if (!reachableByDecoding(m_target)) {
+                // The loop seeks for the newer request instead
+                return;
+            }
+            target = m_target;
+            request = m_targetRequest;
+            m_target = -1;
+        }
+    }
+
+    // At the end of the file the last frame stands in for the target; null
+    // if nothing near it could be decoded
+    emit frameReady(request, target, last);
+}
+
+void FrameDecoder::workerLoop() {
+    QMutexLocker locker(&m_mutex);
+    while (!m_stop) {
+        if (m_target >= 0) {
+            const int target = m_target;
+            const int request = m_targetRequest;
+            const QSize displaySize = m_displaySize;
+            m_target = -1;
+
+            QImage image;
+            if (findCached(target, &image)) {
+                locker.unlock();
+                emit frameReady(request, target, image);
+            } else {
+                locker.unlock();
+                decodeTarget(target, request, displaySize);
+            }
+            locker.relock();
+            continue;
+        }
+
+        const bool readAhead = m_playing && !m_eof &&
+            m_lastDecoded >= m_position - 1 && m_lastDecoded < m_position + READ_AHEAD;
+        if (!readAhead) {
+            m_wake.wait(&m_mutex);
+            continue;
+        }
+
+        const QSize displaySize = m_displaySize;
+        locker.unlock();
+        int index = -1;
+        QImage image;
+        const bool decoded = decodeNext(0, displaySize, &index, &image);
+        locker.relock();
+        if (decoded && !image.isNull()) {
+            insertCached(index, image, displaySize);
+        }
+    }
+}
+
+void FrameDecoder::insertCached(int index, const QImage& image, const QSize& size) {
+    // Decoded for a display size that has since changed
+    if (size != m_displaySize) {
+        return;
+    }
+
+    auto it = m_cache.find(index);
+    if (it != m_cache.end()) {
+        m_cacheBytes -= it->second.image.sizeInBytes();
+        m_lru.erase(it->second.order);
+        m_cache.erase(it);
+    }
+
+    m_lru.push_front(index);
+    m_cache[index] = CacheEntry{ image, m_lru.begin() };
+    m_cacheBytes += image.sizeInBytes();
+
+    while (m_cacheBytes > CACHE_BYTES && m_lru.size() > 1) {
+        auto oldest = m_cache.find(m_lru.back());
+        m_cacheBytes -= oldest->second.image.sizeInBytes();
+        m_cache.erase(oldest);
+        m_lru.pop_back();
+    }
+}
+
+bool FrameDecoder::findCached(int index, QImage* image) {
+    auto it = m_cache.find(index);
+    if (it == m_cache.end()) {
+        return false;
+    }
+    m_lru.splice(m_lru.begin(), m_lru, it->second.order);
+    *image = it->second.image;
+    return true;
+}
+
+void FrameDecoder::clearCache() {
+    m_cache.clear();
+    m_lru.clear();
+    m_cacheBytes = 0;
+}
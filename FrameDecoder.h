@@ -0,0 +1,151 @@
+#ifndef FRAMEDECODER_H
+#define FRAMEDECODER_H
+
+#include <QObject>
+#include <QImage>
+#include <QSize>
+#include <QString>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QThread>
+#include <list>
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+
+struct AVFormatContext;
+struct AVCodecContext;
+struct AVFrame;
+struct AVPacket;
+struct SwsContext;
+class ClipIndex;
+
+/*
+ * FrameDecoder
+ *
+ * Purpose
+ * - The playback and scrubbing engine behind `ClipViewer` and `TrimDialog`.
+ *   A worker thread demuxes and decodes the clip through libavcodec and
+ *   scales each picture to the display size with swscale, so the GUI
+ *   thread only ever paints ready-made images.
+ *
+ * Behaviour
+ * - Decoded frames are kept in an LRU cache keyed by frame index and
+ *   bounded by `CACHE_BYTES`. Frames are stored at display size, so a
+ *   1440p clip costs no more cache than a 720p one.
+ * - `requestFrame()` is answered from the cache when it can be; otherwise
+ *   the worker decodes it and emits `frameReady`. Only the newest request
+ *   is kept, so a burst of slider events turns into one decode.
+ * - Every request gets an id, passed back with its frame. A decode can
+ *   finish after a newer request was answered from the cache, and queued
+ *   frames can arrive after `close()`/`open()`, so receivers drop any
+ *   frame whose id is not `lastRequest()`.
+ * - Seeks are keyframe-aware: a frame later in the GOP the decoder is
+ *   already in is reached by decoding forward, and only a frame in another
+ *   GOP (or behind the decoder) costs a demuxer seek. While a seek is being
+ *   decoded, a newer request that is still ahead in the same GOP takes
+ *   over the running decode instead of starting another one.
+ * - While playing, the worker reads up to `READ_AHEAD` frames past the
+ *   last requested one into the cache.
+ * - Frame indices come from presentation timestamps at the stream's frame
+ *   rate, which is exact for the constant-rate clips this app writes.
+ * - Given the clip's `ClipIndex`, `open()` takes the frame count, fps and
+ *   keyframes from it and skips libavformat's stream probe.
+ *
+ * Threading
+ * - All public methods belong to the owning (GUI) thread. `frameReady`
+ *   is emitted from the worker and delivered through a queued connection.
+ *   `close()` stops the worker and releases the file.
+ */
+class FrameDecoder : public QObject {
+    Q_OBJECT
+
+public:
+    struct Info {
+        bool valid = false;
+        int frameCount = 0;
+        double fps = 30.0;
+        int width = 0;
+        int height = 0;
+    };
+
+    static constexpr qint64 CACHE_BYTES = 96LL * 1024 * 1024;
+    static constexpr int READ_AHEAD = 24;
+
+    explicit FrameDecoder(QObject* parent = nullptr);
+    ~FrameDecoder();
+
+    bool open(const QString& path, const ClipIndex* index = nullptr);
+    void close();
+    bool isOpen() const { return m_info.valid; }
+    const Info& info() const { return m_info; }
+
+    // Frames are scaled to fit `size`, keeping their aspect ratio. Changing
+    // it drops the cache.
+    void setDisplaySize(const QSize& size);
+
+    // Emits `frameReady` right away if the frame is cached; otherwise the
+    // worker decodes it and emits it later (a null image if it cannot)
+    void requestFrame(int index);
+    // Id of the newest request. `open()` and `close()` move it on as well,
+    // so nothing asked of an earlier clip matches it.
+    int lastRequest() const { return m_request; }
+    // Read-ahead follows the last requested frame while playing
+    void setPlaying(bool playing);
+
+signals:
+    void frameReady(int request, int index, const QImage& image);
+
+private:
+    struct CacheEntry {
+        QImage image;
+        std::list<int>::iterator order;
+    };
+
+    void workerLoop();
+    // Decoder state below is only touched by the worker after `open()`
+    void decodeTarget(int target, int request, const QSize& displaySize);
+    bool reachableByDecoding(int index) const;
+    void seekTo(int index);
+    // Frames before `scaleFrom` are decoded but not scaled (null image)
+    bool decodeNext(int scaleFrom, const QSize& displaySize, int* index, QImage* image);
+    QImage scaleFrame(const AVFrame* frame, const QSize& displaySize);
+    int frameIndex(int64_t pts) const;
+    int keyframeAtOrBefore(int index) const;
+    void freeDecoder();
+
+    // Guarded by m_mutex
+    void insertCached(int index, const QImage& image, const QSize& size);
+    bool findCached(int index, QImage* image);
+    void clearCache();
+
+    Info m_info;
+    QThread* m_worker;
+
+    QMutex m_mutex;
+    QWaitCondition m_wake;
+    bool m_stop;
+    bool m_playing;
+    int m_target;             // newest request not yet served, or -1
+    int m_targetRequest;      // its id
+    int m_request;            // id of the newest request; written by the GUI thread
+    int m_position;           // last requested frame, for read-ahead
+    QSize m_displaySize;
+    std::list<int> m_lru;     // most recent first
+    std::unordered_map<int, CacheEntry> m_cache;
+    qint64 m_cacheBytes;
+
+    AVFormatContext* m_format;
+    AVCodecContext* m_codec;
+    AVFrame* m_frame;
+    AVPacket* m_packet;
+    SwsContext* m_sws;
+    int m_streamIndex;
+    int64_t m_startPts;
+    double m_ticksPerFrame;   // stream time base units per frame
+    std::vector<int> m_keyframes;  // frame indices, ascending
+    int m_lastDecoded;        // frame index the decoder last produced, or -1
+    bool m_eof;
+};
+
+#endif // FRAMEDECODER_H
@@ -0,0 +1,116 @@
+/*
+ * FramePacer.cpp
+ *
+ * Absolute-deadline frame scheduling for the capture loop, with a
+ * high-resolution timer wait on Windows.
+ */
+
+#include "FramePacer.h"
+#include <QDebug>
+#include <algorithm>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <timeapi.h>
+
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+#endif
+
+using namespace std::chrono;
+
+FramePacer::FramePacer(int fps)
+    : m_fps((std::max)(1, fps))
+    , m_index(0)
+    , m_skipped(0)
+    , m_started(false)
+#ifdef _WIN32
+    , m_timer(nullptr)
+    , m_highResTimer(false)
+#endif
+{
+#ifdef _WIN32
+    m_timer = CreateWaitableTimerExW(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION,
+                                     TIMER_ALL_ACCESS);
+    m_highResTimer = m_timer != nullptr;
+    if (!m_timer) {
+        // Older Windows: a normal timer is only as precise as the system
+        // timer period, so raise that to 1 ms while the pacer exists
+        timeBeginPeriod(1);
+        m_timer = CreateWaitableTimerW(nullptr, TRUE, nullptr);
+    }
+    qDebug() << "[FramePacer]" << m_fps << "fps,"
+             << (m_highResTimer ? "high-resolution waitable timer" : "waitable timer + 1 ms timer period");
+#endif
+}
+
+FramePacer::~FramePacer() {
+#ifdef _WIN32
+    if (m_timer) {
+        CloseHandle(m_timer);
+    }
+    if (!m_highResTimer) {
+        timeEndPeriod(1);
+    }
+#endif
+}
+
+void FramePacer::start() {
+    m_start = MediaClock::Clock::now();
+    m_index = 0;
+    m_skipped = 0;
+    m_started = false;
+}
+
+MediaClock::Clock::time_point FramePacer::deadline(int64_t index) const {
+    // Integer nanoseconds from the index: no accumulated rounding error
+    return m_start + duration_cast<MediaClock::Clock::duration>(nanoseconds(index * 1000000000LL / m_fps));
+}
+
+int FramePacer::waitForNextFrame() {
+    if (!m_started) {
+        m_started = true;
+        return 0;
+    }
+
+    const int64_t next = m_index + 1;
+    const auto now = MediaClock::Clock::now();
+
+    // More than one whole interval behind: skip to the slot that is due
+    // now instead of capturing a burst of frames back to back
+    if (now >= deadline(next + 1)) {
+        const int64_t elapsedNs = duration_cast<nanoseconds>(now - m_start).count();
+        const int64_t current = elapsedNs * m_fps / 1000000000LL;
+        const int missed = static_cast<int>(current - next);
+        m_skipped += missed;
+        m_index = current;
+        return missed;
+    }
+
+    m_index = next;
+    sleepUntil(deadline(m_index));
+    return 0;
+}
+
+void FramePacer::sleepUntil(MediaClock::Clock::time_point time) {
+#ifdef _WIN32
+    const auto remaining = time - MediaClock::Clock::now();
+    if (remaining <= MediaClock::Clock::duration::zero()) {
+        return;
+    }
+    if (m_timer) {
+        // Negative due time = relative, in 100 ns units
+        LARGE_INTEGER due;
+        due.QuadPart = -static_cast<LONGLONG>(duration_cast<nanoseconds>(remaining).count() / 100);
+        if (SetWaitableTimer(m_timer, &due, 0, nullptr, nullptr, FALSE)) {
+            WaitForSingleObject(m_timer, INFINITE);
+            return;
+        }
+    }
+    std::this_thread::sleep_until(time);
+#else
+    std::this_thread::sleep_until(time);
+#endif
+}
@@ -0,0 +1,65 @@
+#ifndef FRAMEPACER_H
+#define FRAMEPACER_H
+
+#include <chrono>
+#include <cstdint>
+#include "MediaClock.h"
+
+/*
+ * FramePacer
+ *
+ * Purpose
+ * - Runs the capture loop at a fixed rate. Frame `n` is due at
+ *   `start + n / fps`, computed from the frame index rather than by adding
+ *   an interval to the previous wake-up, so rounding and oversleeping
+ *   never accumulate into drift.
+ *
+ * Behaviour
+ * - `waitForNextFrame()` sleeps until the next deadline. If the caller
+ *   overran by more than a full interval, the missed deadlines are skipped
+ *   (no burst of catch-up frames) and their count is returned so the
+ *   caller can fill the slots, e.g. with repeat records.
+ * - `frameTimeUs()` is the deadline of the current frame on `MediaClock`.
+ *   Stamping frames with it instead of the time the capture happened to
+ *   finish gives exactly constant intervals between consecutive frames.
+ * - Windows sleeps on a high-resolution waitable timer (Windows 10 1803+),
+ *   falling back to a regular waitable timer with a 1 ms system timer
+ *   period; `Sleep`/`msleep` would round up to the ~15.6 ms tick. Other
+ *   platforms use `std::this_thread::sleep_until` on steady_clock.
+ */
+class FramePacer {
+public:
+    explicit FramePacer(int fps);
+    ~FramePacer();
+
+    FramePacer(const FramePacer&) = delete;
+    FramePacer& operator=(const FramePacer&) = delete;
+
+    // Makes frame 0 due now
+    void start();
+
+    // Returns the number of deadlines skipped before this frame
+    int waitForNextFrame();
+
+    int64_t frameIndex() const { return m_index; }
+    int64_t frameTimeUs() const { return frameTimeUs(m_index); }
+    int64_t frameTimeUs(int64_t index) const { return MediaClock::toUs(deadline(index)); }
+    uint64_t skippedFrames() const { return m_skipped; }
+
+private:
+    MediaClock::Clock::time_point deadline(int64_t index) const;
+    void sleepUntil(MediaClock::Clock::time_point time);
+
+    int m_fps;
+    MediaClock::Clock::time_point m_start;
+    int64_t m_index;
+    uint64_t m_skipped;
+    bool m_started;
+
+#ifdef _WIN32
+    void* m_timer;            // HANDLE
+    bool m_highResTimer;
+#endif
+};
+
+#endif // FRAMEPACER_H
@@ -0,0 +1,67 @@
+/*
+ * FrameScaler.cpp
+ *
+ * Capture-time downscaling of BGRA frames with swscale.
+ */
+
+#include "FrameScaler.h"
+#include "Telemetry.h"
+#include <algorithm>
+
+extern "C" {
+#include <libswscale/swscale.h>
+#include <libavutil/pixfmt.h>
+}
+
+FrameScaler::FrameScaler()
+    : m_sws(nullptr)
+{
+}
+
+FrameScaler::~FrameScaler() {
+    if (m_sws) {
+        sws_freeContext(m_sws);
+    }
+}
+
+QSize FrameScaler::fitHeight(const QSize& source, int maxHeight) {
+    if (source.isEmpty()) {
+        return QSize();
+    }
+    if (maxHeight <= 0 || source.height() <= maxHeight) {
+        return QSize(std::max(2, source.width() & ~1), std::max(2, source.height() & ~1));
+    }
+    const int height = std::max(2, maxHeight & ~1);
+    const int width = (int)((qint64)source.width() * height / source.height());
+    return QSize(std::max(2, width & ~1), height);
+}
+
+bool FrameScaler::scale(const QImage& source, const QSize& size, QImage& out) {
+    Telemetry::Timer timer(Telemetry::Convert);
+    if (source.isNull() || size.isEmpty() || source.depth() != 32) {
+        return false;
+    }
+    
+    // QImage's 32-bit formats are BGRA in memory on little-endian, which
+    // is what AV_PIX_FMT_RGB32 means there
+    m_sws = sws_getCachedContext(m_sws, source.width(), source.height(), AV_PIX_FMT_RGB32,
+                                 size.width(), size.height(), AV_PIX_FMT_RGB32,
+                                 SWS_AREA, nullptr, nullptr, nullptr);
+    if (!m_sws) {
+        return false;
+    }
+    
+    if (out.size() != size || out.format() != source.format() || !out.isDetached()) {
+        out = QImage(size, source.format());
+    }
+    if (out.isNull()) {
+        return false;
+    }
+    
+    const uint8_t* src[4] = { source.constBits(), nullptr, nullptr, nullptr };
+    const int srcStride[4] = { static_cast<int>(source.bytesPerLine()), 0, 0, 0 };
+    uint8_t* dst[4] = { out.bits(), nullptr, nullptr, nullptr };
+    const int dstStride[4] = { static_cast<int>(out.bytesPerLine()), 0, 0, 0 };
+    sws_scale(m_sws, src, srcStride, 0, source.height(), dst, dstStride);
+    return true;
+}
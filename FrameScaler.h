@@ -0,0 +1,47 @@
+#ifndef FRAMESCALER_H
+#define FRAMESCALER_H
+
+#include <QImage>
+#include <QSize>
+
+struct SwsContext;
+
+/*
+ * FrameScaler
+ *
+ * Purpose
+ * - Scales captured 32-bit BGRA frames down to the recording's output
+ *   size on the capture thread, wherever the platform capture cannot do
+ *   it on the GPU (X11, the Windows fallback without a video processor).
+ *
+ * Behaviour
+ * - Uses a cached swscale context with area averaging, the filter that
+ *   keeps text readable when a 4K desktop becomes a 1080p clip.
+ * - `scale()` writes into the caller's image when it already has the
+ *   output size and nobody else shares it, like the capture readbacks do,
+ *   so steady-state scaling allocates nothing.
+ * - `fitHeight()` is the output size for a capture area: at most
+ *   `maxHeight` rows, the area's aspect ratio, even dimensions for the
+ *   4:2:0 encoders.
+ *
+ * Threading
+ * - An instance belongs to one thread.
+ */
+class FrameScaler {
+public:
+    FrameScaler();
+    ~FrameScaler();
+
+    FrameScaler(const FrameScaler&) = delete;
+    FrameScaler& operator=(const FrameScaler&) = delete;
+
+    // `maxHeight` <= 0 keeps the source size (made even)
+    static QSize fitHeight(const QSize& source, int maxHeight);
+
+    bool scale(const QImage& source, const QSize& size, QImage& out);
+
+private:
+    SwsContext* m_sws;
+};
+
+#endif // FRAMESCALER_H
@@ -0,0 +1,151 @@
+/*
+ * JpegDecodeQueue.cpp
+ *
+ * Bounded, in-order decode-ahead for the in-process save path. Workers
+ * fill a ring of `window` slots; the encoder empties it front to back.
+ */
+
+#include "JpegDecodeQueue.h"
+#include <QDebug>
+#include <algorithm>
+
+#ifdef CLIPPER_HAVE_TURBOJPEG
+#include <turbojpeg.h>
+#endif
+
+JpegDecodeQueue::JpegDecodeQueue(const std::vector<VideoFrame>& frames, int workers, int window)
+    : m_frames(frames)
+    , m_workerCount((std::max)(1, workers))
+    , m_window((size_t)(std::max)(1, window))
+    , m_slots(m_window)
+    , m_ready(m_window, 0)
+    , m_claimed(0)
+    , m_taken(0)
+    , m_cancelled(false)
+{
+}
+
+JpegDecodeQueue::~JpegDecodeQueue() {
+    cancel();
+    for (QThread* worker : m_workers) {
+        worker->wait();
+        delete worker;
+    }
+}
+
+int JpegDecodeQueue::defaultWorkerCount() {
+    return (std::min)(4, (std::max)(1, QThread::idealThreadCount() - 1));
+}
+
+void JpegDecodeQueue::start() {
+    for (int i = 0; i < m_workerCount; i++) {
+        QThread* worker = QThread::create([this]() { workerLoop(); });
+        worker->setObjectName(QString("JpegDecode%1").arg(i));
+        worker->start();
+        m_workers.push_back(worker);
+    }
+}
+
+void JpegDecodeQueue::cancel() {
+    QMutexLocker locker(&m_mutex);
+    m_cancelled = true;
+    m_spaceCond.wakeAll();
+    m_readyCond.wakeAll();
+}
+
+// Decodes one payload to RGB32; null on failure
+static QImage decodeJpeg(const QByteArray& data, void* jpegHandle) {
+#ifdef CLIPPER_HAVE_TURBOJPEG
+    if (jpegHandle) {
+        tjhandle handle = static_cast<tjhandle>(jpegHandle);
+        const unsigned char* src = reinterpret_cast<const unsigned char*>(data.constData());
+        int width = 0;
+        int height = 0;
+        int subsampling = 0;
+        int colorspace = 0;
+        if (tjDecompressHeader3(handle, src, data.size(), &width, &height, &subsampling, &colorspace) == 0) {
+            QImage image(width, height, QImage::Format_RGB32);
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+            const int pixelFormat = TJPF_BGRX;
+#else
+            const int pixelFormat = TJPF_XRGB;
+#endif
+            if (!image.isNull() &&
+                tjDecompress2(handle, src, data.size(), image.bits(), width,
+                              static_cast<int>(image.bytesPerLine()), height, pixelFormat,
+                              TJFLAG_FASTDCT) == 0) {
+                return image;
+            }
+        }
+        // Not a JPEG TurboJPEG can read (e.g. the PNG fallback); try Qt
+    }
+#else
+    Q_UNUSED(jpegHandle);
+#endif
+
+    QImage image;
+    if (!image.loadFromData(data, "JPEG")) {
+        return QImage();
+    }
+    if (image.format() != QImage::Format_RGB32 && image.format() != QImage::Format_ARGB32) {
+        image = image.convertToFormat(QImage::Format_RGB32);
+    }
+    return image;
+}
+
+void JpegDecodeQueue::workerLoop() {
+    void* jpegHandle = nullptr;
+#ifdef CLIPPER_HAVE_TURBOJPEG
+    jpegHandle = tjInitDecompress();
+#endif
+
+    QMutexLocker locker(&m_mutex);
+    while (true) {
+        while (!m_cancelled && m_claimed < m_frames.size() && m_claimed >= m_taken + m_window) {
+            m_spaceCond.wait(&m_mutex);
+        }
+        if (m_cancelled || m_claimed >= m_frames.size()) {
+            break;
+        }
+        const size_t index = m_claimed++;
+        locker.unlock();
+
+        const VideoFrame& frame = m_frames[index];
+        QImage image = frame.repeat ? QImage() : decodeJpeg(frame.jpegData, jpegHandle);
+
+        locker.relock();
+        m_slots[index % m_window] = std::move(image);
+        m_ready[index % m_window] = 1;
+        m_readyCond.wakeAll();
+    }
+    locker.unlock();
+
+#ifdef CLIPPER_HAVE_TURBOJPEG
+    if (jpegHandle) {
+        tjDestroy(static_cast<tjhandle>(jpegHandle));
+    }
+#endif
+}
+
+QImage JpegDecodeQueue::take(size_t index) {
+    QMutexLocker locker(&m_mutex);
+    if (index != m_taken || index >= m_frames.size()) {
+        qDebug() << "[JpegDecodeQueue] Frames must be taken in order; got" << index << "expected" << m_taken;
+        return QImage();
+    }
+
+    const size_t slot = index % m_window;
+    while (!m_cancelled && !m_ready[slot]) {
+        m_readyCond.wait(&m_mutex);
+    }
+    if (!m_ready[slot]) {
+        return QImage();
+    }
+
+    QImage image = std::move(m_slots[slot]);
+    m_slots[slot] = QImage();
+    m_ready[slot] = 0;
+    m_taken++;
+    m_spaceCond.wakeAll();
+    return image;
+}
@@ -0,0 +1,71 @@
+#ifndef JPEGDECODEQUEUE_H
+#define JPEGDECODEQUEUE_H
+
+#include <QImage>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QThread>
+#include <vector>
+#include "ReplayBuffer.h"
+
+/*
+ * JpegDecodeQueue
+ *
+ * Purpose
+ * - The decode stage of a save: worker threads decompress the buffered
+ *   JPEGs ahead of the encoder, so decoding frame N+k overlaps encoding
+ *   and muxing frame N instead of alternating with it on one thread.
+ *
+ * Behaviour
+ * - Workers claim frames in order, at most `window` ahead of the one the
+ *   consumer is waiting for, so memory stays at `window` decoded pictures
+ *   however long the clip is.
+ * - Pictures come out as Format_RGB32, the layout the encoder's swscale
+ *   takes directly. Decoding goes through TurboJPEG when built with
+ *   `CLIPPER_HAVE_TURBOJPEG`, otherwise QImage.
+ * - Repeat records are not decoded; `take()` returns a null image for
+ *   them and the caller re-sends its previous picture. A payload that
+ *   fails to decode also comes back null.
+ *
+ * Threading
+ * - `take()` is called from one consumer thread, for indices 0, 1, 2, ...
+ *   in order. `cancel()` may be called from any thread; it wakes a
+ *   waiting `take()`, which then returns a null image.
+ */
+class JpegDecodeQueue {
+public:
+    // `frames` must outlive the queue
+    JpegDecodeQueue(const std::vector<VideoFrame>& frames, int workers, int window);
+    ~JpegDecodeQueue();
+
+    JpegDecodeQueue(const JpegDecodeQueue&) = delete;
+    JpegDecodeQueue& operator=(const JpegDecodeQueue&) = delete;
+
+    void start();
+    void cancel();
+
+    QImage take(size_t index);
+
+    // Leaves a core for the encoder, between 1 and 4
+    static int defaultWorkerCount();
+
+private:
+    void workerLoop();
+
+    const std::vector<VideoFrame>& m_frames;
+    const int m_workerCount;
+    const size_t m_window;
+    std::vector<QThread*> m_workers;
+
+    // Guarded by m_mutex
+    QMutex m_mutex;
+    QWaitCondition m_spaceCond;   // a slot was freed
+    QWaitCondition m_readyCond;   // a slot was filled
+    std::vector<QImage> m_slots;  // frame i lives in slot i % window
+    std::vector<char> m_ready;
+    size_t m_claimed;             // next frame a worker may take
+    size_t m_taken;               // next frame the consumer takes
+    bool m_cancelled;
+};
+
+#endif // JPEGDECODEQUEUE_H
@@ -0,0 +1,411 @@
+/*
+ * LiveEncoder.cpp
+ *
+ * Frame-by-frame H.264/HEVC encoder used by the continuous-encode capture
+ * mode. Frames are converted with swscale to whatever 4:2:0 layout the
+ * selected backend takes and encoded with a low-latency configuration;
+ * packets are returned to the caller which stores them in the GOP ring.
+ */
+
+#include "LiveEncoder.h"
+#include "Telemetry.h"
+#include <QDebug>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/opt.h>
+#include <libavutil/imgutils.h>
+#include <libswscale/swscale.h>
+#ifdef _WIN32
+#include <libavutil/hwcontext_d3d11va.h>
+#endif
+}
+
+#ifdef _WIN32
+#include <d3d11.h>
+#elif __APPLE__
+#include <CoreVideo/CoreVideo.h>
+#endif
+
+static QString liveAvErrorString(int errnum) {
+    char buf[AV_ERROR_MAX_STRING_SIZE] = {0};
+    av_strerror(errnum, buf, sizeof(buf));
+    return QString::fromUtf8(buf);
+}
+
+#ifdef __APPLE__
+// Drops the CVPixelBuffer reference an AV_PIX_FMT_VIDEOTOOLBOX frame holds
+static void releasePixelBuffer(void*, uint8_t* data) {
+    CVPixelBufferRelease(reinterpret_cast<CVPixelBufferRef>(data));
+}
+#endif
+
+LiveEncoder::LiveEncoder()
+    : m_activeBackend(EncoderBackend::Software)
+    , m_codecCtx(nullptr)
+    , m_frame(nullptr)
+    , m_pixelBufferFrame(nullptr)
+    , m_packet(nullptr)
+    , m_swsCtx(nullptr)
+    , m_swsSrcWidth(0)
+    , m_swsSrcHeight(0)
+    , m_swsSrcFormat(-1)
+    , m_hasLastFrame(false)
+{
+}
+
+LiveEncoder::~LiveEncoder() {
+    close();
+}
+
+bool LiveEncoder::setError(const QString& context, int avError) {
+    m_lastError = avError ? QString("%1: %2").arg(context, liveAvErrorString(avError)) : context;
+    qDebug() << "[LiveEncoder]" << m_lastError;
+    return false;
+}
+
+bool LiveEncoder::open(const Config& config) {
+    close();
+    m_config = config;
+    m_config.width &= ~1;
+    m_config.height &= ~1;
+    m_lastError.clear();
+
+    if (m_config.width <= 0 || m_config.height <= 0 || m_config.fps <= 0) {
+        return setError(QString("Invalid encoder format %1x%2 @ %3 fps")
+            .arg(config.width).arg(config.height).arg(config.fps));
+    }
+
+    // Capture runs next to games, so favour speed and zero frame delay.
+    // Scene-cut keyframes are disabled so GOPs have a predictable length.
+    EncoderBackends::Settings settings;
+    settings.backend = m_config.backend;
+    settings.hevc = m_config.codec == HEVC;
+    settings.width = m_config.width;
+    settings.height = m_config.height;
+    settings.fps = m_config.fps;
+    settings.gopSize = m_config.fps * m_config.keyframeSeconds;
+    settings.maxBFrames = 0;
+    settings.bitrate = m_config.bitrate;
+    settings.crf = m_config.crf;
+    settings.lowLatency = true;
+    settings.softwarePreset = "veryfast";
+    settings.d3d11Device = m_config.d3d11Device;
+    settings.pixelBufferInput = m_config.pixelBufferInput;
+
+    QString error;
+    m_codecCtx = EncoderBackends::openVideoEncoder(settings, &m_activeBackend, &error);
+    if (!m_codecCtx) {
+        return setError(QString("Failed to open live encoder: %1").arg(error));
+    }
+
+    int ret = 0;
+    m_frame = av_frame_alloc();
+    m_pixelBufferFrame = av_frame_alloc();
+    m_packet = av_packet_alloc();
+    if (!m_frame || !m_pixelBufferFrame || !m_packet) {
+        setError("Failed to allocate encoder buffers");
+        close();
+        return false;
+    }
+    m_frame->format = EncoderBackends::inputPixelFormat(m_codecCtx);
+    m_frame->width = m_codecCtx->width;
+    m_frame->height = m_codecCtx->height;
+    ret = av_frame_get_buffer(m_frame, 0);
+    if (ret < 0) {
+        setError("Failed to allocate encoder frame", ret);
+        close();
+        return false;
+    }
+
+    m_streamInfo = EncodedStreamInfo();
+    m_streamInfo.codecId = m_codecCtx->codec_id;
+    m_streamInfo.width = m_codecCtx->width;
+    m_streamInfo.height = m_codecCtx->height;
+    m_streamInfo.fps = m_config.fps;
+    m_streamInfo.timeBaseNum = m_codecCtx->time_base.num;
+    m_streamInfo.timeBaseDen = m_codecCtx->time_base.den;
+    if (m_codecCtx->extradata && m_codecCtx->extradata_size > 0) {
+        m_streamInfo.extradata = QByteArray(reinterpret_cast<const char*>(m_codecCtx->extradata),
+                                            m_codecCtx->extradata_size);
+    }
+
+    qDebug() << "[LiveEncoder] Opened" << m_codecCtx->codec->name << m_config.width << "x" << m_config.height
+             << "@" << m_config.fps << "fps, GOP" << m_codecCtx->gop_size << "frames"
+             << (EncoderBackends::isD3D11Input(m_codecCtx) ? "(D3D11 zero-copy)"
+                 : isZeroCopy() ? "(CVPixelBuffer zero-copy)" : "");
+    return true;
+}
+
+void LiveEncoder::close() {
+    avcodec_free_context(&m_codecCtx);
+    av_frame_free(&m_frame);
+    av_frame_free(&m_pixelBufferFrame);
+    av_packet_free(&m_packet);
+    sws_freeContext(m_swsCtx);
+    m_swsCtx = nullptr;
+    m_swsSrcWidth = 0;
+    m_swsSrcHeight = 0;
+    m_swsSrcFormat = -1;
+    m_hasLastFrame = false;
+}
+
+bool LiveEncoder::setRateScale(int percent) {
+    if (!m_codecCtx) {
+        return false;
+    }
+    percent = std::clamp(percent, 25, 100);
+    const bool x264 = std::strcmp(m_codecCtx->codec->name, "libx264") == 0;
+
+    // Both wrappers compare the context with what the encoder was set up
+    // with before every frame and reconfigure on a difference
+    if (m_config.bitrate > 0) {
+        if (!x264 && m_activeBackend != EncoderBackend::NVENC) {
+            return false;
+        }
+        const int64_t bitrate = (int64_t)m_config.bitrate * percent / 100;
+        m_codecCtx->bit_rate = bitrate;
+        if (x264) {
+            m_codecCtx->rc_max_rate = bitrate;
+            m_codecCtx->rc_buffer_size = (int)bitrate;
+        }
+        return true;
+    }
+    if (!x264) {
+        return false;
+    }
+    const double crf = m_config.crf + 6.0 * std::log2(100.0 / percent);
+    return av_opt_set_double(m_codecCtx->priv_data, "crf", crf, 0) >= 0;
+}
+
+bool LiveEncoder::encode(const QImage& image, int64_t pts, std::vector<EncodedPacket>& out) {
+    if (!m_codecCtx) {
+        return setError("Encoder is not open");
+    }
+    if (image.isNull()) {
+        return setError("Null frame");
+    }
+
+    const QImage src = (image.format() == QImage::Format_RGB32 || image.format() == QImage::Format_ARGB32)
+        ? image
+        : image.convertToFormat(QImage::Format_RGB32);
+
+    const uint8_t* srcData[1] = { src.constBits() };
+    const int srcStride[1] = { static_cast<int>(src.bytesPerLine()) };
+    if (!scaleInto(srcData, srcStride, src.width(), src.height(), AV_PIX_FMT_BGRA)) {
+        return false;
+    }
+    return submitFrame(pts, out);
+}
+
+bool LiveEncoder::encode(const Nv12Frame& frame, int64_t pts, std::vector<EncodedPacket>& out) {
+    if (!m_codecCtx) {
+        return setError("Encoder is not open");
+    }
+    if (frame.isNull()) {
+        return setError("Null frame");
+    }
+
+    const uint8_t* y = reinterpret_cast<const uint8_t*>(frame.data.constData());
+    const uint8_t* srcData[2] = { y, y + (size_t)frame.stride * frame.height };
+    const int srcStride[2] = { frame.stride, frame.stride };
+
+    if (m_frame->format == AV_PIX_FMT_NV12 && frame.width == m_frame->width && frame.height == m_frame->height) {
+        int ret = av_frame_make_writable(m_frame);
+        if (ret < 0) {
+            return setError("Encoder frame not writable", ret);
+        }
+        av_image_copy_plane(m_frame->data[0], m_frame->linesize[0], srcData[0], srcStride[0],
+                            frame.width, frame.height);
+        av_image_copy_plane(m_frame->data[1], m_frame->linesize[1], srcData[1], srcStride[1],
+                            frame.width, frame.height / 2);
+    } else if (!scaleInto(srcData, srcStride, frame.width, frame.height, AV_PIX_FMT_NV12)) {
+        return false;
+    }
+    return submitFrame(pts, out);
+}
+
+bool LiveEncoder::isZeroCopy() const {
+    return EncoderBackends::isD3D11Input(m_codecCtx) || EncoderBackends::isPixelBufferInput(m_codecCtx);
+}
+
+bool LiveEncoder::encode(ID3D11Texture2D* nv12Texture, int64_t pts, std::vector<EncodedPacket>& out) {
+#ifdef _WIN32
+    if (!isZeroCopy()) {
+        return setError("Encoder does not take D3D11 textures");
+    }
+    if (!nv12Texture) {
+        return setError("Null texture");
+    }
+
+    AVFrame* hwFrame = av_frame_alloc();
+    if (!hwFrame) {
+        return setError("Failed to allocate hardware frame");
+    }
+    int ret = av_hwframe_get_buffer(m_codecCtx->hw_frames_ctx, hwFrame, 0);
+    if (ret < 0) {
+        av_frame_free(&hwFrame);
+        return setError("Failed to get hardware frame", ret);
+    }
+
+    // data[0] is the pool texture, data[1] its array slice
+    ID3D11Texture2D* target = reinterpret_cast<ID3D11Texture2D*>(hwFrame->data[0]);
+    const UINT slice = static_cast<UINT>(reinterpret_cast<intptr_t>(hwFrame->data[1]));
+    AVHWFramesContext* framesCtx = reinterpret_cast<AVHWFramesContext*>(m_codecCtx->hw_frames_ctx->data);
+    AVD3D11VADeviceContext* device = static_cast<AVD3D11VADeviceContext*>(framesCtx->device_ctx->hwctx);
+
+    D3D11_BOX box = { 0, 0, 0, (UINT)m_codecCtx->width, (UINT)m_codecCtx->height, 1 };
+    device->lock(device->lock_ctx);
+    device->device_context->CopySubresourceRegion(target, slice, 0, 0, 0, nv12Texture, 0, &box);
+    device->unlock(device->lock_ctx);
+
+    hwFrame->pts = pts;
+    ret = avcodec_send_frame(m_codecCtx, hwFrame);
+    av_frame_free(&hwFrame);
+    if (ret < 0) {
+        return setError("Failed to send frame", ret);
+    }
+    return receivePackets(out);
+#else
+    Q_UNUSED(nv12Texture);
+    Q_UNUSED(pts);
+    Q_UNUSED(out);
+    return setError("D3D11 input is only available on Windows");
+#endif
+}
+
+bool LiveEncoder::encode(__CVBuffer* pixelBuffer, int64_t pts, std::vector<EncodedPacket>& out) {
+#ifdef __APPLE__
+    if (!EncoderBackends::isPixelBufferInput(m_codecCtx)) {
+        return setError("Encoder does not take CVPixelBuffers");
+    }
+    if (!pixelBuffer) {
+        return setError("Null pixel buffer");
+    }
+    const int width = static_cast<int>(CVPixelBufferGetWidth(pixelBuffer));
+    const int height = static_cast<int>(CVPixelBufferGetHeight(pixelBuffer));
+    if (width != m_codecCtx->width || height != m_codecCtx->height) {
+        return setError(QString("Pixel buffer is %1x%2, the encoder %3x%4")
+            .arg(width).arg(height).arg(m_codecCtx->width).arg(m_codecCtx->height));
+    }
+
+    // data[3] is the CVPixelBufferRef; buf[0] owns a reference to it, so
+    // the frame stays valid while VideoToolbox still has it in flight
+    av_frame_unref(m_pixelBufferFrame);
+    CVPixelBufferRetain(pixelBuffer);
+    m_pixelBufferFrame->buf[0] = av_buffer_create(reinterpret_cast<uint8_t*>(pixelBuffer), 1,
+                                                  releasePixelBuffer, nullptr, AV_BUFFER_FLAG_READONLY);
+    if (!m_pixelBufferFrame->buf[0]) {
+        CVPixelBufferRelease(pixelBuffer);
+        return setError("Failed to wrap pixel buffer");
+    }
+    m_pixelBufferFrame->hw_frames_ctx = av_buffer_ref(m_codecCtx->hw_frames_ctx);
+    if (!m_pixelBufferFrame->hw_frames_ctx) {
+        av_frame_unref(m_pixelBufferFrame);
+        return setError("Failed to reference the frame pool");
+    }
+    m_pixelBufferFrame->data[3] = m_pixelBufferFrame->buf[0]->data;
+    m_pixelBufferFrame->format = AV_PIX_FMT_VIDEOTOOLBOX;
+    m_pixelBufferFrame->width = m_codecCtx->width;
+    m_pixelBufferFrame->height = m_codecCtx->height;
+    return submitPixelBufferFrame(pts, out);
+#else
+    Q_UNUSED(pixelBuffer);
+    Q_UNUSED(pts);
+    Q_UNUSED(out);
+    return setError("CVPixelBuffer input is only available on macOS");
+#endif
+}
+
+bool LiveEncoder::scaleInto(const uint8_t* const srcData[], const int srcStride[],
+                            int srcWidth, int srcHeight, int srcFormat)
+{
+    Telemetry::Timer timer(Telemetry::Convert);
+    if (!m_swsCtx || m_swsSrcWidth != srcWidth || m_swsSrcHeight != srcHeight || m_swsSrcFormat != srcFormat) {
+        sws_freeContext(m_swsCtx);
+        m_swsCtx = sws_getContext(srcWidth, srcHeight, static_cast<AVPixelFormat>(srcFormat),
+                                  m_codecCtx->width, m_codecCtx->height,
+                                  static_cast<AVPixelFormat>(m_frame->format),
+                                  SWS_FAST_BILINEAR, nullptr, nullptr, nullptr);
+        m_swsSrcWidth = srcWidth;
+        m_swsSrcHeight = srcHeight;
+        m_swsSrcFormat = srcFormat;
+        if (!m_swsCtx) {
+            return setError("Failed to create swscale context");
+        }
+    }
+
+    int ret = av_frame_make_writable(m_frame);
+    if (ret < 0) {
+        return setError("Encoder frame not writable", ret);
+    }
+
+    sws_scale(m_swsCtx, srcData, srcStride, 0, srcHeight, m_frame->data, m_frame->linesize);
+    return true;
+}
+
+bool LiveEncoder::repeatLastFrame(int64_t pts, std::vector<EncodedPacket>& out) {
+    if (!m_codecCtx || !m_hasLastFrame) {
+        return setError("No previous frame to repeat");
+    }
+    return m_pixelBufferFrame->buf[0] ? submitPixelBufferFrame(pts, out) : submitFrame(pts, out);
+}
+
+bool LiveEncoder::submitFrame(int64_t pts, std::vector<EncodedPacket>& out) {
+    Telemetry::Timer timer(Telemetry::Encode);
+    m_hasLastFrame = true;
+    av_frame_unref(m_pixelBufferFrame);
+    m_frame->pts = pts;
+    int ret = EncoderBackends::sendFrame(m_codecCtx, m_frame);
+    if (ret < 0) {
+        return setError("Failed to send frame", ret);
+    }
+    return receivePackets(out);
+}
+
+bool LiveEncoder::submitPixelBufferFrame(int64_t pts, std::vector<EncodedPacket>& out) {
+    Telemetry::Timer timer(Telemetry::Encode);
+    m_hasLastFrame = true;
+
+    // avcodec_send_frame takes its own reference, so m_pixelBufferFrame
+    // keeps the buffer for repeats
+    m_pixelBufferFrame->pts = pts;
+    int ret = avcodec_send_frame(m_codecCtx, m_pixelBufferFrame);
+    if (ret < 0) {
+        return setError("Failed to send frame", ret);
+    }
+    return receivePackets(out);
+}
+
+bool LiveEncoder::flush(std::vector<EncodedPacket>& out) {
+    if (!m_codecCtx) {
+        return true;
+    }
+    avcodec_send_frame(m_codecCtx, nullptr);
+    return receivePackets(out);
+}
+
+bool LiveEncoder::receivePackets(std::vector<EncodedPacket>& out) {
+    while (true) {
+        int ret = avcodec_receive_packet(m_codecCtx, m_packet);
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+            return true;
+        }
+        if (ret < 0) {
+            return setError("Encoder failed", ret);
+        }
+
+        EncodedPacket packet;
+        packet.data = QByteArray(reinterpret_cast<const char*>(m_packet->data), m_packet->size);
+        packet.pts = m_packet->pts;
+        packet.dts = m_packet->dts;
+        packet.duration = m_packet->duration > 0 ? m_packet->duration : 1;
+        packet.keyframe = (m_packet->flags & AV_PKT_FLAG_KEY) != 0;
+        out.push_back(std::move(packet));
+
+        av_packet_unref(m_packet);
+    }
+}
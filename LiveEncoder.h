@@ -0,0 +1,221 @@
+#ifndef LIVEENCODER_H
+#define LIVEENCODER_H
+
+#include <QByteArray>
+#include <QImage>
+#include <QString>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include "EncoderBackend.h"
+
+struct AVCodecContext;
+struct AVFrame;
+struct AVPacket;
+struct SwsContext;
+struct ID3D11Texture2D;
+struct __CVBuffer;   // CVPixelBufferRef is a __CVBuffer*
+
+/*
+ * EncodedPacket
+ * - One compressed access unit produced by `LiveEncoder`. Timestamps are in
+ *   the stream time base described by `EncodedStreamInfo`.
+ */
+struct EncodedPacket {
+    QByteArray data;
+    int64_t pts = 0;
+    int64_t dts = 0;
+    int64_t duration = 0;
+    bool keyframe = false;
+};
+
+/*
+ * EncodedStreamInfo
+ * - Everything a muxer needs to stream-copy `EncodedPacket`s into a
+ *   container: codec id, dimensions, time base and the codec extradata
+ *   (SPS/PPS for H.264, VPS/SPS/PPS for HEVC).
+ */
+struct EncodedStreamInfo {
+    int codecId = 0;          // AVCodecID
+    int width = 0;
+    int height = 0;
+    int fps = 30;
+    int timeBaseNum = 1;
+    int timeBaseDen = 30;
+    int64_t startTimeUs = 0;  // MediaClock time of pts 0, set by the capture side
+    QByteArray extradata;
+
+    bool isValid() const { return codecId != 0 && width > 0 && height > 0; }
+};
+
+/*
+ * EncodedClip
+ * - A contiguous run of packets that starts on a keyframe, plus the stream
+ *   description needed to remux it. Returned by
+ *   `ScreenRecorder::getPackets` and consumed by `VideoEncoder`.
+ * - With the disk-backed buffer the payloads point into mapped segment
+ *   files; `storage` keeps those segments alive for as long as the clip.
+ */
+struct EncodedClip {
+    EncodedStreamInfo stream;
+    std::vector<EncodedPacket> packets;
+    std::vector<std::shared_ptr<const void>> storage;
+};
+
+/*
+ * Nv12Frame
+ * - A captured frame already converted to NV12 (e.g. on the GPU by the
+ *   D3D11 video processor): `height` rows of Y followed by `height / 2`
+ *   rows of interleaved UV, both `stride` bytes apart.
+ */
+struct Nv12Frame {
+    QByteArray data;
+    int width = 0;
+    int height = 0;
+    int stride = 0;
+
+    bool isNull() const { return width <= 0 || height <= 0 || data.isEmpty(); }
+    void clear() { width = height = stride = 0; }
+};
+
+/*
+ * LiveEncoder
+ *
+ * Purpose
+ * - Encodes captured frames into H.264 or HEVC packets as they arrive so the
+ *   replay buffer can hold compressed GOPs instead of JPEG stills. Saving a
+ *   clip then becomes a remux with no re-encode.
+ *
+ * Behaviour
+ * - Configured for low latency (no B-frames, no lookahead) so every packet
+ *   comes out immediately after the frame that produced it, and with a
+ *   fixed keyframe interval so the buffer can be pruned at GOP boundaries.
+ * - The encoder implementation comes from `EncoderBackends`, so the same
+ *   hardware backend selection applies to capture and to saving.
+ * - Global headers are requested so `streamInfo().extradata` is usable by
+ *   any MP4 muxer.
+ */
+
+class LiveEncoder {
+public:
+    enum Codec {
+        H264,
+        HEVC
+    };
+
+    struct Config {
+        Codec codec = H264;
+        int width = 0;
+        int height = 0;
+        int fps = 30;
+        int keyframeSeconds = 2;
+        int bitrate = 0;          // 0 = constant quality (crf)
+        int crf = 23;
+        EncoderBackend backend = EncoderBackend::Auto;
+        void* d3d11Device = nullptr; // ID3D11Device*, see isZeroCopy()
+        bool pixelBufferInput = false; // CVPixelBuffer input (macOS), ditto
+    };
+
+    LiveEncoder();
+    ~LiveEncoder();
+
+    LiveEncoder(const LiveEncoder&) = delete;
+    LiveEncoder& operator=(const LiveEncoder&) = delete;
+
+    bool open(const Config& config);
+    void close();
+    bool isOpen() const { return m_codecCtx != nullptr; }
+
+    /*
+     * encode
+     * - Converts `image` (any QImage format; RGB32 is the fast path) and
+     *   submits it with timestamp `pts` (in stream time base units).
+     *   Produced packets are appended to `out`.
+     */
+    bool encode(const QImage& image, int64_t pts, std::vector<EncodedPacket>& out);
+
+    /*
+     * NV12 input skips the RGB conversion entirely; when the encoder takes
+     * NV12 and the size matches, the planes are copied straight in.
+     */
+    bool encode(const Nv12Frame& frame, int64_t pts, std::vector<EncodedPacket>& out);
+
+    /*
+     * Zero-copy input (Windows)
+     * - When opened with `Config::d3d11Device` on NVENC/AMF the encoder
+     *   takes D3D11 textures. `encode(texture)` copies an NV12 texture on
+     *   that device into the encoder's pool GPU-side; nothing is mapped.
+     * - `isZeroCopy()` tells the caller whether this path is active; the
+     *   other `encode` overloads keep working either way.
+     */
+    bool isZeroCopy() const;
+    bool encode(ID3D11Texture2D* nv12Texture, int64_t pts, std::vector<EncodedPacket>& out);
+
+    /*
+     * Zero-copy input (macOS)
+     * - When opened with `Config::pixelBufferInput` on VideoToolbox the
+     *   encoder takes CVPixelBuffers of the configured size, such as the
+     *   IOSurface-backed NV12 buffers ScreenCaptureKit delivers. The buffer
+     *   is retained until VideoToolbox is done with it; nothing is copied.
+     * - `repeatLastFrame` re-submits the last such buffer.
+     */
+    bool encode(__CVBuffer* pixelBuffer, int64_t pts, std::vector<EncodedPacket>& out);
+
+    /*
+     * repeatLastFrame
+     * - Re-submits the last converted system-memory frame at a new `pts`
+     *   for captures where the screen did not change. Skips the colour
+     *   conversion; the encoder turns it into near-empty skip frames.
+     */
+    bool repeatLastFrame(int64_t pts, std::vector<EncodedPacket>& out);
+    bool hasLastFrame() const { return m_hasLastFrame; }
+
+    /*
+     * setRateScale
+     * - Lowers the rate of the open stream to `percent` (25..100) of the
+     *   configured one without reopening it, so the buffered GOPs stay
+     *   valid: the bitrate when one is set, otherwise crf goes up by the
+     *   amount that roughly gives that rate (6 per halving).
+     * - Only libx264 (bitrate or crf) and NVENC (bitrate) reconfigure
+     *   mid-stream; returns false where the rate cannot change and leaves
+     *   the encoder as it was.
+     */
+    bool setRateScale(int percent);
+
+    /*
+     * flush
+     * - Drains packets still held by the encoder. Only needed when the
+     *   encoder has internal delay; the default low-latency setup has none.
+     */
+    bool flush(std::vector<EncodedPacket>& out);
+
+    const Config& config() const { return m_config; }
+    EncoderBackend activeBackend() const { return m_activeBackend; }
+    EncodedStreamInfo streamInfo() const { return m_streamInfo; }
+    QString lastError() const { return m_lastError; }
+
+private:
+    bool scaleInto(const uint8_t* const srcData[], const int srcStride[],
+                   int srcWidth, int srcHeight, int srcFormat);
+    bool submitFrame(int64_t pts, std::vector<EncodedPacket>& out);
+    bool submitPixelBufferFrame(int64_t pts, std::vector<EncodedPacket>& out);
+    bool receivePackets(std::vector<EncodedPacket>& out);
+    bool setError(const QString& context, int avError = 0);
+
+    Config m_config;
+    EncoderBackend m_activeBackend;
+    EncodedStreamInfo m_streamInfo;
+    QString m_lastError;
+
+    AVCodecContext* m_codecCtx;
+    AVFrame* m_frame;
+    AVFrame* m_pixelBufferFrame;   // last CVPixelBuffer sent, while it is the last frame
+    AVPacket* m_packet;
+    SwsContext* m_swsCtx;
+    int m_swsSrcWidth;
+    int m_swsSrcHeight;
+    int m_swsSrcFormat;
+    bool m_hasLastFrame;
+};
+
+#endif // LIVEENCODER_H
@@ -9,7 +9,8 @@
 
 #include "MainWindow.h"
 #include "TrimDialog.h"
-#include "EncoderWorker.h"
+#include "ClipTrimmer.h"
+#include "ClipIndex.h"
 #include <QVBoxLayout>
 #include <QHBoxLayout>
 #include <QGroupBox>
@@ -25,16 +26,30 @@
 #include <QThread>
 #include <QThreadPool>
 #include <QCloseEvent>
-#include <QProgressDialog>
+#include <QFileInfo>
+#include <QClipboard>
+#include <QCoreApplication>
+#include <QPointer>
+#include <QGuiApplication>
+#include <algorithm>
 
 #ifdef _WIN32
 #include <windows.h>
 #endif
 
+// Save combo entries besides the single displays (which are their index)
+static constexpr int SAVE_SIDE_BY_SIDE = -2;
+static constexpr int SAVE_EACH_DISPLAY = -1;
+
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
     , m_hotkeyRegistered(false)
     , m_currentHotkey("F9")
+    , m_encoderBackend(EncoderBackend::Auto)
+    , m_compressionWorkers(0)
+    , m_metricsPort(0)
+    , m_fragmentedMp4(true)
+    , m_uploadOnSave(false)
 #ifdef _WIN32
     , m_hotkeyId(1)
 #endif
@@ -43,12 +58,14 @@ MainWindow::MainWindow(QWidget *parent)
     m_screenRecorder = std::make_unique<ScreenRecorder>(30);
     m_micCapture = std::make_unique<AudioCapture>(AudioCapture::Microphone);
     m_desktopCapture = std::make_unique<AudioCapture>(AudioCapture::DesktopAudio);
-    m_encoder = std::make_unique<VideoEncoder>();
+    m_saveQueue = std::make_unique<SaveQueue>();
+    m_uploader = std::make_unique<ClipUploader>();
     
     setupUI();
     setupConnections();
     loadSettings();
     loadClipsList();
+    probeEncoderBackends();
     
     // Auto-start recording after UI is ready
     QTimer::singleShot(500, this, &MainWindow::autoStartRecording);
@@ -116,7 +133,8 @@ void MainWindow::setupUI() {
     QVBoxLayout* bufferLayout = new QVBoxLayout(bufferGroup);
     
     m_bufferPreset = new QComboBox();
-    m_bufferPreset->addItems({"15 seconds", "30 seconds", "1 minute", "2 minutes", "5 minutes", "Custom"});
+    m_bufferPreset->addItems({"15 seconds", "30 seconds", "1 minute", "2 minutes", "5 minutes",
+                              "10 minutes", "30 minutes", "1 hour", "Custom"});
     m_bufferPreset->setCurrentText("30 seconds");
     bufferLayout->addWidget(m_bufferPreset);
     
@@ -124,7 +142,7 @@ void MainWindow::setupUI() {
     QHBoxLayout* customLayout = new QHBoxLayout(m_customBufferWidget);
     customLayout->addWidget(new QLabel("Minutes:"));
     m_customMinutes = new QSpinBox();
-    m_customMinutes->setRange(0, 10);
+    m_customMinutes->setRange(0, ScreenRecorder::MAX_BUFFER_SECONDS / 60);
     customLayout->addWidget(m_customMinutes);
     customLayout->addWidget(new QLabel("Seconds:"));
     m_customSeconds = new QSpinBox();
@@ -134,6 +152,79 @@ void MainWindow::setupUI() {
     m_customBufferWidget->setVisible(false);
     bufferLayout->addWidget(m_customBufferWidget);
     
+    QHBoxLayout* budgetLayout = new QHBoxLayout();
+    budgetLayout->addWidget(new QLabel("Memory budget:"));
+    m_bufferBudget = new QSpinBox();
+    m_bufferBudget->setRange(0, 32768);
+    m_bufferBudget->setSingleStep(256);
+    m_bufferBudget->setSuffix(" MB");
+    m_bufferBudget->setSpecialValueText("Auto");
+    m_bufferBudget->setToolTip("Memory the JPEG replay buffer may use. Beyond it the oldest frames are dropped early.");
+    budgetLayout->addWidget(m_bufferBudget);
+    bufferLayout->addLayout(budgetLayout);
+    
+    bufferLayout->addWidget(new QLabel("Capture Mode:"));
+    m_captureModeCombo = new QComboBox();
+    m_captureModeCombo->addItem("JPEG frames (encode on save)", ScreenRecorder::JpegFrames);
+    m_captureModeCombo->addItem("Continuous H.264 (instant save)", ScreenRecorder::EncodedH264);
+    m_captureModeCombo->addItem("Continuous HEVC (instant save)", ScreenRecorder::EncodedHEVC);
+    bufferLayout->addWidget(m_captureModeCombo);
+    
+    // Frames are scaled at capture, so everything after it works at this size
+    bufferLayout->addWidget(new QLabel("Output resolution:"));
+    m_resolutionCombo = new QComboBox();
+    m_resolutionCombo->addItem("Native", 0);
+    m_resolutionCombo->addItem("1440p", 1440);
+    m_resolutionCombo->addItem("1080p", 1080);
+    m_resolutionCombo->addItem("720p", 720);
+    m_resolutionCombo->setToolTip("Scale frames down while capturing; smaller screens are kept as they are");
+    bufferLayout->addWidget(m_resolutionCombo);
+    
+    // Each checked display gets a recorder and buffer of its own. Only
+    // shown when there is more than one to choose from.
+    m_displayWidget = new QWidget();
+    QVBoxLayout* displayLayout = new QVBoxLayout(m_displayWidget);
+    displayLayout->setContentsMargins(0, 0, 0, 0);
+    displayLayout->addWidget(new QLabel("Displays:"));
+    m_displayList = new QListWidget();
+    m_displayList->setToolTip("Displays to capture; none checked captures the default one");
+    m_displayList->setMaximumHeight(90);
+    const QStringList displays = ScreenRecorder::availableDisplays();
+    for (int i = 0; i < displays.size(); ++i) {
+        QListWidgetItem* item = new QListWidgetItem(displays[i], m_displayList);
+        item->setFlags(item->flags() | Qt::ItemIsUserCheckable);
+        item->setCheckState(Qt::Unchecked);
+        item->setData(Qt::UserRole, i);
+    }
+    displayLayout->addWidget(m_displayList);
+    displayLayout->addWidget(new QLabel("Save:"));
+    m_saveTargetCombo = new QComboBox();
+    m_saveTargetCombo->setToolTip("Side by side composites the displays into one clip (JPEG mode)");
+    displayLayout->addWidget(m_saveTargetCombo);
+    m_displayWidget->setVisible(displays.size() > 1);
+    bufferLayout->addWidget(m_displayWidget);
+    
+    bufferLayout->addWidget(new QLabel("Encoder:"));
+    m_encoderCombo = new QComboBox();
+    m_encoderCombo->addItem("Auto (detecting...)", static_cast<int>(EncoderBackend::Auto));
+    m_encoderCombo->setEnabled(false);
+    bufferLayout->addWidget(m_encoderCombo);
+    
+    // Only the D3D11 capture path can hand textures to the encoder
+    m_zeroCopyCheck = new QCheckBox("Zero-copy GPU encode (NVENC/AMF)");
+    m_zeroCopyCheck->setToolTip("Keep captured frames on the GPU in continuous-encode modes");
+#ifndef _WIN32
+    m_zeroCopyCheck->setVisible(false);
+#endif
+    bufferLayout->addWidget(m_zeroCopyCheck);
+    
+    // Long buffers only fit in RAM as encoded packets, and even then only
+    // for a while; this moves them to disk
+    m_spillCheck = new QCheckBox("Keep encoded buffer on disk");
+    m_spillCheck->setToolTip("Continuous-encode modes: store the replay buffer in segment files "
+                             "for buffers of several minutes up to an hour");
+    bufferLayout->addWidget(m_spillCheck);
+    
     leftPanel->addWidget(bufferGroup);
     
     // Control buttons
@@ -143,6 +234,18 @@ void MainWindow::setupUI() {
     m_saveBtn = new QPushButton("💾 Save Clip (F9)");
     leftPanel->addWidget(m_saveBtn);
     
+    // Shown while saves are queued or running
+    QHBoxLayout* saveProgressLayout = new QHBoxLayout();
+    m_saveProgress = new QProgressBar();
+    m_saveProgress->setRange(0, 100);
+    m_saveProgress->setVisible(false);
+    saveProgressLayout->addWidget(m_saveProgress);
+    m_cancelSavesBtn = new QPushButton("Cancel");
+    m_cancelSavesBtn->setToolTip("Cancel every queued and running save");
+    m_cancelSavesBtn->setVisible(false);
+    saveProgressLayout->addWidget(m_cancelSavesBtn);
+    leftPanel->addLayout(saveProgressLayout);
+    
     m_hotkeyBtn = new QPushButton("⌨️ Hotkey: Enabled (F9)");
     leftPanel->addWidget(m_hotkeyBtn);
     
@@ -196,6 +299,34 @@ void MainWindow::setupUI() {
     
     leftPanel->addWidget(logGroup);
     
+    // Per-stage latencies from Telemetry, refreshed once a second
+    QGroupBox* statsGroup = new QGroupBox("Pipeline Stats");
+    QVBoxLayout* statsLayout = new QVBoxLayout(statsGroup);
+    m_statsTable = new QTableWidget(Telemetry::StageCount, 5);
+    m_statsTable->setHorizontalHeaderLabels({"Count", "Mean ms", "p50 ms", "p99 ms", "Max ms"});
+    QStringList stageNames;
+    for (int s = 0; s < Telemetry::StageCount; ++s) {
+        stageNames << Telemetry::stageName(static_cast<Telemetry::Stage>(s));
+        for (int column = 0; column < m_statsTable->columnCount(); ++column) {
+            QTableWidgetItem* item = new QTableWidgetItem();
+            item->setTextAlignment(Qt::AlignRight | Qt::AlignVCenter);
+            m_statsTable->setItem(s, column, item);
+        }
+    }
+    m_statsTable->setVerticalHeaderLabels(stageNames);
+    m_statsTable->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    m_statsTable->setSelectionMode(QAbstractItemView::NoSelection);
+    m_statsTable->setMaximumHeight(150);
+    m_statsTable->setStyleSheet("QTableWidget { font-family: 'Consolas', 'Courier New', monospace; font-size: 8pt; }");
+    statsLayout->addWidget(m_statsTable);
+    m_statsCounters = new QLabel();
+    m_statsCounters->setWordWrap(true);
+    statsLayout->addWidget(m_statsCounters);
+    leftPanel->addWidget(statsGroup);
+    
+    m_statsTimer = new QTimer(this);
+    m_statsTimer->setInterval(1000);
+    
     addLog("🚀 Application started");
     
     mainLayout->addLayout(leftPanel, 1);
@@ -217,12 +348,24 @@ void MainWindow::setupConnections() {
     connect(m_renameBtn, &QPushButton::clicked, this, &MainWindow::onRenameClip);
     connect(m_deleteBtn, &QPushButton::clicked, this, &MainWindow::onDeleteClip);
     connect(m_openFolderBtn, &QPushButton::clicked, this, &MainWindow::onOpenClipsFolder);
+    connect(m_cancelSavesBtn, &QPushButton::clicked, this, &MainWindow::onCancelSavesClicked);
     
     // Clips list
     connect(m_clipsList, &QListWidget::itemClicked, this, &MainWindow::onClipSelected);
     
     // Buffer preset
     connect(m_bufferPreset, &QComboBox::currentTextChanged, this, &MainWindow::onBufferPresetChanged);
+    // Changing the budget drops the buffer, so apply it once editing is done
+    connect(m_bufferBudget, &QSpinBox::editingFinished, this, &MainWindow::onBufferBudgetChanged);
+    connect(m_captureModeCombo, QOverload<int>::of(&QComboBox::currentIndexChanged),
+            this, &MainWindow::onCaptureModeChanged);
+    connect(m_encoderCombo, QOverload<int>::of(&QComboBox::currentIndexChanged),
+            this, &MainWindow::onEncoderBackendChanged);
+    connect(m_zeroCopyCheck, &QCheckBox::toggled, this, &MainWindow::onZeroCopyToggled);
+    connect(m_spillCheck, &QCheckBox::toggled, this, &MainWindow::onSpillToggled);
+    connect(m_resolutionCombo, QOverload<int>::of(&QComboBox::currentIndexChanged),
+            this, &MainWindow::onOutputResolutionChanged);
+    connect(m_displayList, &QListWidget::itemChanged, this, &MainWindow::onDisplaySelectionChanged);
     
     // Recorder signals
     connect(m_screenRecorder.get(), &ScreenRecorder::recordingStarted, 
@@ -233,6 +376,46 @@ void MainWindow::setupConnections() {
             this, &MainWindow::onErrorOccurred);
     connect(m_screenRecorder.get(), &ScreenRecorder::debugLog,
             this, &MainWindow::addLog);
+    connect(m_screenRecorder.get(), &ScreenRecorder::qualityDegraded,
+            this, [this](int, const QString& description) {
+        onStatusUpdate(QString("Recording at reduced quality (%1)").arg(description));
+    });
+    connect(m_screenRecorder.get(), &ScreenRecorder::qualityRestored,
+            this, [this](int level, const QString& description) {
+        onStatusUpdate(level == 0 ? QString("Recording at full quality")
+                                  : QString("Recording at reduced quality (%1)").arg(description));
+    });
+    
+    // Save queue
+    connect(m_saveQueue.get(), &SaveQueue::jobStarted, this, [this](int jobId) {
+        addLog(QString("🔄 Save #%1 started").arg(jobId));
+    });
+    connect(m_saveQueue.get(), &SaveQueue::jobCoalesced, this, [this](int jobId) {
+        addLog(QString("↩️ Repeated save request folded into #%1").arg(jobId));
+    });
+    connect(m_saveQueue.get(), &SaveQueue::jobProgress, this, &MainWindow::onSaveProgress);
+    connect(m_saveQueue.get(), &SaveQueue::jobFinished, this, &MainWindow::onSaveFinished);
+    connect(m_saveQueue.get(), &SaveQueue::jobCanceled, this, &MainWindow::onSaveCanceled);
+    connect(m_saveQueue.get(), &SaveQueue::depthChanged, this, &MainWindow::onSaveQueueChanged);
+    
+    // Uploads
+    connect(m_uploader.get(), &ClipUploader::uploadStarted, this, [this](int uploadId, const QString& filepath) {
+        addLog(QString("☁️ Upload #%1 started: %2").arg(uploadId).arg(QFileInfo(filepath).fileName()));
+    });
+    connect(m_uploader.get(), &ClipUploader::uploadProgress, this, &MainWindow::onUploadProgress);
+    connect(m_uploader.get(), &ClipUploader::uploadFinished, this, &MainWindow::onUploadFinished);
+    connect(m_saveQueue.get(), &SaveQueue::jobOutputGrowing, this, &MainWindow::onSaveOutputGrowing);
+    connect(m_saveQueue.get(), &SaveQueue::jobOutputDiscarded, this, [this](int jobId) {
+        // A fallback writes the clip again; it is uploaded once saved
+        auto it = m_saveUploads.find(jobId);
+        if (it != m_saveUploads.end()) {
+            m_uploader->finishSource(it->second, -1);
+            m_saveUploads.erase(it);
+        }
+    });
+    
+    connect(m_statsTimer, &QTimer::timeout, this, &MainWindow::refreshStats);
+    m_statsTimer->start();
 }
 
 void MainWindow::autoStartRecording() {
@@ -254,7 +437,7 @@ void MainWindow::autoStartRecording() {
     }
     
     // Start recording
-    m_screenRecorder->startRecording();
+    startScreenRecording();
     m_micCapture->startCapture();
     m_desktopCapture->startCapture();
     
@@ -264,7 +447,7 @@ void MainWindow::autoStartRecording() {
 
 void MainWindow::onStartStopClicked() {
     if (m_screenRecorder->isRecording()) {
-        m_screenRecorder->stopRecording();
+        stopScreenRecording();
         m_micCapture->stopCapture();
         m_desktopCapture->stopCapture();
         m_startStopBtn->setText("▶️ Start Recording");
@@ -272,8 +455,7 @@ void MainWindow::onStartStopClicked() {
         addLog("⏹️ All recording stopped");
     } else {
         int bufferSecs = getBufferSeconds();
-        m_screenRecorder->setBufferSeconds(bufferSecs);
-        m_screenRecorder->startRecording();
+        startScreenRecording();
         m_micCapture->startCapture();
         m_desktopCapture->startCapture();
         m_startStopBtn->setText("⏹️ Stop Recording");
@@ -283,33 +465,76 @@ void MainWindow::onStartStopClicked() {
 }
 
 void MainWindow::onSaveClipClicked() {
-    // Disable save button to prevent double-clicks
-    m_saveBtn->setEnabled(false);
-    
     int bufferSecs = getBufferSeconds();
     
     addLog(QString("💾 SAVE CLIP REQUESTED (%1 seconds)").arg(bufferSecs));
     
-    // Get frames and audio
-    auto frames = m_screenRecorder->getFrames(bufferSecs);
+    // With several displays the save combo picks all of them or one
+    const std::vector<ScreenRecorder*> recorders = screenRecorders();
+    const int target = recorders.size() > 1 ? m_saveTargetCombo->currentData().toInt() : 0;
+    
+    // Get frames (or encoded packets) and audio. A display with nothing
+    // buffered (one that failed to start, say) is left out.
+    const bool encodedMode = m_screenRecorder->isEncodedMode();
+    std::vector<int> sources;
+    std::vector<ReplaySnapshot> frames;
+    std::vector<EncodedClip> clips;
+    size_t retrieved = 0;
+    for (int i = 0; i < static_cast<int>(recorders.size()); ++i) {
+        if (target >= 0 && target != i) {
+            continue;
+        }
+        if (encodedMode) {
+            EncodedClip clip = recorders[i]->getPackets(bufferSecs);
+            if (clip.packets.empty()) {
+                continue;
+            }
+            retrieved += clip.packets.size();
+            clips.push_back(std::move(clip));
+        } else {
+            ReplaySnapshot snapshot = recorders[i]->getFrames(bufferSecs);
+            if (snapshot.empty()) {
+                continue;
+            }
+            retrieved += snapshot.size();
+            frames.push_back(std::move(snapshot));
+        }
+        sources.push_back(i);
+    }
     auto micAudio = m_micCapture->getBuffer(bufferSecs);
     auto desktopAudio = m_desktopCapture->getBuffer(bufferSecs);
     
-    addLog(QString("📊 Retrieved: %1 frames, %2 mic chunks, %3 desktop chunks")
-        .arg(frames.size())
+    addLog(QString("📊 Retrieved: %1 %2 from %3 display(s), %4 mic chunks, %5 desktop chunks")
+        .arg(retrieved)
+        .arg(encodedMode ? "packets" : "frames")
+        .arg(sources.size())
         .arg(micAudio.size())
         .arg(desktopAudio.size()));
     
-    if (frames.empty()) {
+    if (sources.empty()) {
         QString error = "❌ No frames to save - recording might not be started";
         onErrorOccurred(error);
         addLog(error);
-        m_saveBtn->setEnabled(true);
         return;
     }
     
+    // Compositing redraws every frame, which the JPEG buffer is decoded
+    // for anyway; encoded rings would need a full decode, so they are
+    // saved one clip per display instead
+    const bool composite = target == SAVE_SIDE_BY_SIDE && sources.size() > 1 && !encodedMode;
+    if (target == SAVE_SIDE_BY_SIDE && sources.size() > 1 && encodedMode) {
+        addLog("ℹ️ Side by side needs the JPEG capture mode; saving one clip per display");
+    }
+    
     // Calculate actual duration
-    double actualDuration = frames.size() / (double)m_screenRecorder->getFPS();
+    double actualDuration = encodedMode ? 0.0 : frames.front().size() / (double)m_screenRecorder->getFPS();
+    if (encodedMode) {
+        const EncodedClip& clip = clips.front();
+        const EncodedPacket& first = clip.packets.front();
+        const EncodedPacket& last = clip.packets.back();
+        actualDuration = (last.pts + last.duration - first.pts) * clip.stream.timeBaseNum
+                         / (double)clip.stream.timeBaseDen;
+    }
     addLog(QString("⏱️  Duration: %1 seconds at %2 fps")
         .arg(actualDuration, 0, 'f', 1)
         .arg(m_screenRecorder->getFPS()));
@@ -321,83 +546,111 @@ void MainWindow::onSaveClipClicked() {
             QString("Clip is only %1 seconds long. Buffer may need more time to fill.").arg(actualDuration, 0, 'f', 1));
     }
     
-    // Generate filename
+    // Generate filename; a clip of one display among several says which
     QString timestamp = QDateTime::currentDateTime().toString("yyyyMMdd_HHmmss");
-    QString filename = QString("clip_%1.mp4").arg(timestamp);
-    QString filepath = getClipsDirectory() + "/" + filename;
-    
-    addLog(QString("📁 Output: %1").arg(filepath));
+    auto outputPath = [&](int recorder) {
+        QString filename = QString("clip_%1.mp4").arg(timestamp);
+        if (recorders.size() > 1 && recorder >= 0) {
+            const int display = m_captureDisplays.empty() ? 0 : m_captureDisplays[recorder];
+            filename = QString("clip_%1_display%2.mp4").arg(timestamp).arg(display + 1);
+        }
+        return getClipsDirectory() + "/" + filename;
+    };
     
     // Set encoding options
     VideoEncoder::EncodeOptions options;
-    options.outputPath = filepath;
     options.fps = m_screenRecorder->getFPS();
     options.audioSampleRate = 48000; // Standard sample rate
-    
-    onStatusUpdate("Encoding clip...");
-    addLog("🎬 Starting encoder...");
-    
-    // Create progress dialog
-    QProgressDialog* progressDialog = new QProgressDialog("Encoding video...", "Cancel", 0, 100, this);
-    progressDialog->setWindowModality(Qt::WindowModal);
-    progressDialog->setMinimumDuration(0);
-    progressDialog->setValue(0);
-    
-    QThread* thread = new QThread;
-    EncoderWorker* worker = new EncoderWorker(
-        m_encoder.get(),
-        std::move(frames),
-        std::move(micAudio),
-        std::move(desktopAudio),
-        options
-    );
-    
-    worker->moveToThread(thread);
-    
-    // Connect signals
-    connect(thread, &QThread::started, worker, &EncoderWorker::process);
-    connect(worker, &EncoderWorker::finished, thread, &QThread::quit);
-    connect(worker, &EncoderWorker::finished, worker, &QObject::deleteLater);
-    connect(thread, &QThread::finished, thread, &QObject::deleteLater);
-    
-    // Progress updates
-    connect(worker, &EncoderWorker::progressUpdate, progressDialog, &QProgressDialog::setValue);
-    connect(worker, &EncoderWorker::progressUpdate, this, [this](int percent) {
-        addLog(QString("📊 Encoding progress: %1%").arg(percent));
-    });
-    
-    // Completion
-    connect(worker, &EncoderWorker::encodingComplete, this, [this, filepath, progressDialog](bool success, const QString& message) {
-        progressDialog->close();
-        
-        if (success) {
-            addLog(QString("✅ %1").arg(message));
-            onClipSaved(filepath);
-        } else {
-            addLog(QString("❌ Encoding failed: %1").arg(message));
-            onErrorOccurred("Failed to encode clip");
+    options.backend = m_encoderBackend;
+    options.fragmented = m_fragmentedMp4;
+    
+    // Queued behind any save still running; the request holds its own
+    // snapshot, so capture carries on meanwhile. The clips of one press
+    // go in together so a double press folds into all of them.
+    std::vector<SaveQueue::Request> requests;
+    if (composite) {
+        SaveQueue::Request request;
+        request.displays = std::move(frames);
+        request.mic = std::move(micAudio);
+        request.desktop = std::move(desktopAudio);
+        request.options = options;
+        request.options.outputPath = outputPath(-1);
+        request.options.qualityTimeline = m_screenRecorder->qualityTimeline();
+        requests.push_back(std::move(request));
+    } else {
+        for (size_t k = 0; k < sources.size(); ++k) {
+            SaveQueue::Request request;
+            if (encodedMode) {
+                request.clip = std::move(clips[k]);
+            } else {
+                request.frames = std::move(frames[k]);
+            }
+            if (k + 1 == sources.size()) {
+                request.mic = std::move(micAudio);
+                request.desktop = std::move(desktopAudio);
+            } else {
+                request.mic = micAudio;
+                request.desktop = desktopAudio;
+            }
+            request.options = options;
+            request.options.outputPath = outputPath(sources[k]);
+            request.options.qualityTimeline = recorders[sources[k]]->qualityTimeline();
+            requests.push_back(std::move(request));
         }
-        
-        m_saveBtn->setEnabled(true);
-    });
-    
-    // Errors
-    connect(worker, &EncoderWorker::errorOccurred, this, [this, progressDialog](const QString& error) {
-        addLog(QString("❌ Encoder error: %1").arg(error));
-        progressDialog->close();
-        m_saveBtn->setEnabled(true);
-    });
-    
-    // Cancel button
-    connect(progressDialog, &QProgressDialog::canceled, this, [this, thread]() {
-        addLog("⚠️ Encoding canceled by user");
-        thread->quit();
-        m_saveBtn->setEnabled(true);
-    });
+    }
+    for (const SaveQueue::Request& request : requests) {
+        addLog(QString("📁 Output: %1").arg(request.options.outputPath));
+    }
     
-    // Start encoding
-    thread->start();
-    addLog("🔄 Encoder thread started");
+    QStringList jobIds;
+    for (int jobId : m_saveQueue->submit(std::move(requests))) {
+        jobIds << QString("#%1").arg(jobId);
+    }
+    addLog(QString("🎬 Save %1 queued (%2 in queue)").arg(jobIds.join(", ")).arg(m_saveQueue->depth()));
+}
+
+void MainWindow::onSaveProgress(int jobId, int percent) {
+    m_saveProgress->setValue(percent);
+    m_saveProgress->setFormat(QString("Saving #%1: %p% (%2 in queue)").arg(jobId).arg(m_saveQueue->depth()));
+    // Progress arrives per frame; the log only gets every 10%
+    if (percent % 10 == 0) {
+        addLog(QString("📊 Save #%1 progress: %2%").arg(jobId).arg(percent));
+    }
+}
+
+void MainWindow::onSaveFinished(int jobId, bool success, const QString& filepath,
+                                const QString& message, double waitMs, double encodeMs) {
+    if (success) {
+        addLog(QString("✅ Save #%1: %2 (waited %3 ms, encoded in %4 s)")
+            .arg(jobId).arg(message).arg(waitMs, 0, 'f', 0).arg(encodeMs / 1000.0, 0, 'f', 1));
+        onClipSaved(filepath);
+        endSaveUpload(jobId, filepath, true);
+    } else {
+        addLog(QString("❌ Save #%1 failed: %2").arg(jobId).arg(message));
+        onErrorOccurred("Failed to encode clip");
+        endSaveUpload(jobId, filepath, false);
+    }
+}
+
+void MainWindow::onSaveCanceled(int jobId, const QString& filepath) {
+    addLog(QString("⚠️ Save #%1 canceled: %2").arg(jobId).arg(QFileInfo(filepath).fileName()));
+    endSaveUpload(jobId, filepath, false);
+    onStatusUpdate("Save canceled");
+}
+
+void MainWindow::onSaveQueueChanged(int depth) {
+    m_saveProgress->setVisible(depth > 0);
+    m_cancelSavesBtn->setVisible(depth > 0);
+    if (depth == 0) {
+        m_saveProgress->setValue(0);
+    } else {
+        onStatusUpdate(QString("Saving clips (%1 in queue)...").arg(depth));
+    }
+}
+
+void MainWindow::onCancelSavesClicked() {
+    addLog("⚠️ Canceling saves...");
+    m_saveQueue->cancelAll();
 }
 
 void MainWindow::onApplyAudioDevices() {
@@ -474,6 +727,16 @@ void MainWindow::loadClipsList() {
         QString fullPath = clipsDir.absoluteFilePath(clip);
         QListWidgetItem* item = new QListWidgetItem(clip);
         item->setData(Qt::UserRole, fullPath);
+        
+        // Header only; clips without an index get one when first opened
+        ClipIndex index;
+        if (index.load(fullPath, false)) {
+            const ClipIndex::Info& meta = index.info();
+            item->setToolTip(QString("%1 s, %2x%3 @ %4 fps")
+                .arg(meta.durationUs / 1e6, 0, 'f', 1)
+                .arg(meta.width).arg(meta.height)
+                .arg(meta.fps, 0, 'f', 0));
+        }
         m_clipsList->addItem(item);
     }
 }
@@ -494,10 +757,58 @@ void MainWindow::onTrimClip() {
     QString filepath = current->data(Qt::UserRole).toString();
     
     TrimDialog dialog(filepath, this);
-    if (dialog.exec() == QDialog::Accepted) {
-        // TODO: Implement trim functionality
-        onStatusUpdate("Trimming not yet implemented");
+    if (dialog.exec() != QDialog::Accepted) {
+        return;
     }
+    
+    // Next to the original as <name>_trim.mp4, _trim2.mp4, ...
+    const QFileInfo info(filepath);
+    QString outputPath = info.path() + "/" + info.completeBaseName() + "_trim.mp4";
+    for (int n = 2; QFileInfo::exists(outputPath); n++) {
+        outputPath = QString("%1/%2_trim%3.mp4").arg(info.path(), info.completeBaseName()).arg(n);
+    }
+    
+    const int64_t startUs = dialog.getStartUs();
+    const int64_t endUs = dialog.getEndUs();
+    addLog(QString("✂️ Trimming %1 to %2s - %3s").arg(info.fileName())
+        .arg(startUs / 1e6, 0, 'f', 2).arg(endUs / 1e6, 0, 'f', 2));
+    onStatusUpdate("Trimming clip...");
+    m_trimBtn->setEnabled(false);
+    
+    // Stream copy is mostly file I/O, but keep it off the GUI thread. The
+    // window may be closed before the trim ends: the result is posted to the
+    // application and only checked against the window on the GUI thread.
+    QPointer<MainWindow> self(this);
+    QThread* trimThread = QThread::create([self, filepath, outputPath, startUs, endUs]() {
+        ClipTrimmer trimmer;
+        const bool ok = trimmer.trim(filepath, outputPath, startUs, endUs);
+        if (ok) {
+            ClipIndex index;
+            if (index.build(outputPath)) {
+                index.save(outputPath);
+            }
+        }
+        const ClipTrimmer::Result result = trimmer.result();
+        const QString error = trimmer.lastError();
+        QMetaObject::invokeMethod(QCoreApplication::instance(), [self, ok, result, error, outputPath]() {
+            if (!self) {
+                return;
+            }
+            MainWindow* window = self.data();
+            window->m_trimBtn->setEnabled(true);
+            if (!ok) {
+                window->addLog(QString("❌ Trim failed: %1").arg(error));
+                window->onErrorOccurred("Failed to trim clip: " + error);
+                return;
+            }
+            window->addLog(QString("✂️ Trimmed in %1 s: %2 packets copied, %3 frames re-encoded%4")
+                .arg(result.seconds, 0, 'f', 2).arg(result.copiedPackets).arg(result.reencodedFrames)
+                .arg(result.smartCut ? "" : " (start GOP copied whole)"));
+            window->onClipSaved(outputPath);
+        }, Qt::QueuedConnection);
+    });
+    connect(trimThread, &QThread::finished, trimThread, &QObject::deleteLater);
+    trimThread->start(QThread::LowPriority);
 }
 
 void MainWindow::onRenameClip() {
@@ -519,16 +830,103 @@ void MainWindow::onDeleteClip() {
             m_clipViewer->releaseCurrentClip();
         }
         
-        QFile::remove(filepath);
-        loadClipsList();
-        onStatusUpdate("Clip deleted");
         addLog(QString("🗑️ Deleted: %1").arg(current->text()));
+        if (m_uploader->isUploading(filepath)) {
+            // The session holds the file open and would write its sidecar
+            // again; the clip goes once onUploadFinished sees it stop
+            m_pendingDeletes.insert(filepath);
+            m_uploader->cancel(filepath);
+            if (m_uploader->isUploading(filepath)) {
+                onStatusUpdate("Stopping the clip's upload to delete it...");
+                return;
+            }
+            m_pendingDeletes.erase(filepath);
+        }
+        deleteClipFiles(filepath);
     }
 }
 
+void MainWindow::deleteClipFiles(const QString& filepath) {
+    QFile::remove(filepath);
+    ClipIndex::remove(filepath);
+    UploadSession::forget(filepath);
+    loadClipsList();
+    onStatusUpdate("Clip deleted");
+}
+
 void MainWindow::onUploadClip() {
-    // TODO: Implement upload
-    onStatusUpdate("Upload not yet implemented");
+    QListWidgetItem* current = m_clipsList->currentItem();
+    if (!current) return;
+    
+    const QString filepath = current->data(Qt::UserRole).toString();
+    if (m_uploader->settings().endpoint.isEmpty()) {
+        onStatusUpdate("Set uploadEndpoint in the settings file to upload clips");
+        return;
+    }
+    if (m_uploader->isUploading(filepath)) {
+        onStatusUpdate("Clip is already being uploaded");
+        return;
+    }
+    
+    const bool resuming = QFileInfo::exists(UploadSession::sidecarPath(filepath));
+    const int uploadId = m_uploader->upload(filepath);
+    addLog(QString("☁️ Upload #%1 %2: %3").arg(uploadId)
+        .arg(resuming ? "resuming" : "queued").arg(current->text()));
+    onStatusUpdate(QString("Uploading (%1 in queue)...").arg(m_uploader->depth()));
+}
+
+void MainWindow::onSaveOutputGrowing(int jobId, const QString& filepath) {
+    if (!m_uploadOnSave || m_uploader->settings().endpoint.isEmpty()) {
+        return;
+    }
+    // Fragments go up while later ones are still being encoded
+    const int uploadId = m_uploader->upload(filepath, true);
+    m_saveUploads[jobId] = uploadId;
+    addLog(QString("☁️ Upload #%1 follows save #%2 as it is written").arg(uploadId).arg(jobId));
+}
+
+void MainWindow::endSaveUpload(int jobId, const QString& filepath, bool saved) {
+    auto it = m_saveUploads.find(jobId);
+    if (it != m_saveUploads.end()) {
+        m_uploader->finishSource(it->second, saved ? QFileInfo(filepath).size() : -1);
+        m_saveUploads.erase(it);
+    } else if (saved && m_uploadOnSave && !m_uploader->settings().endpoint.isEmpty()) {
+        const int uploadId = m_uploader->upload(filepath);
+        addLog(QString("☁️ Upload #%1 queued for save #%2").arg(uploadId).arg(jobId));
+    }
+}
+
+void MainWindow::onUploadProgress(int uploadId, qint64 sentBytes, qint64 totalBytes, double bytesPerSecond) {
+    const double mbps = bytesPerSecond / (1024.0 * 1024.0);
+    if (totalBytes > 0) {
+        onStatusUpdate(QString("Upload #%1: %2% at %3 MB/s")
+            .arg(uploadId).arg(sentBytes * 100 / totalBytes).arg(mbps, 0, 'f', 1));
+    } else {
+        onStatusUpdate(QString("Upload #%1: %2 MB at %3 MB/s")
+            .arg(uploadId).arg(sentBytes / (1024.0 * 1024.0), 0, 'f', 1).arg(mbps, 0, 'f', 1));
+    }
+}
+
+void MainWindow::onUploadFinished(int uploadId, bool success, const QString& filepath, const QString& message) {
+    if (m_pendingDeletes.count(filepath)) {
+        // Finished or canceled, its link is to a clip that is going away
+        addLog(QString("☁️ Upload #%1 stopped: %2 was deleted").arg(uploadId).arg(QFileInfo(filepath).fileName()));
+        if (!m_uploader->isUploading(filepath)) {
+            m_pendingDeletes.erase(filepath);
+            deleteClipFiles(filepath);
+        }
+        return;
+    }
+    if (success) {
+        addLog(QString("✅ Upload #%1: %2 → %3").arg(uploadId).arg(QFileInfo(filepath).fileName()).arg(message));
+        if (!message.isEmpty()) {
+            QGuiApplication::clipboard()->setText(message);
+        }
+        onStatusUpdate("Clip uploaded, link copied to clipboard");
+    } else {
+        addLog(QString("❌ Upload #%1 failed: %2").arg(uploadId).arg(message));
+        onStatusUpdate("Upload failed; upload again to resume");
+    }
 }
 
 void MainWindow::onOpenClipsFolder() {
@@ -588,6 +986,9 @@ int MainWindow::getBufferSeconds() const {
     if (preset == "1 minute") return 60;
     if (preset == "2 minutes") return 120;
     if (preset == "5 minutes") return 300;
+    if (preset == "10 minutes") return 600;
+    if (preset == "30 minutes") return 1800;
+    if (preset == "1 hour") return 3600;
     if (preset == "Custom") {
         return m_customMinutes->value() * 60 + m_customSeconds->value();
     }
@@ -621,9 +1022,260 @@ void MainWindow::onBufferPresetChanged(const QString& preset) {
     m_customBufferWidget->setVisible(preset == "Custom");
     int bufferSecs = getBufferSeconds();
     m_screenRecorder->setBufferSeconds(bufferSecs);
+    syncDisplayRecorders();
     addLog(QString("⚙️ Buffer changed to %1 seconds").arg(bufferSecs));
 }
 
+void MainWindow::onBufferBudgetChanged() {
+    const int megabytes = m_bufferBudget->value();
+    if (!m_screenRecorder->setBufferBudgetMB(displayBudgetMB())) {
+        return;
+    }
+    syncDisplayRecorders();
+    addLog(megabytes > 0 ? QString("⚙️ Replay buffer memory budget: %1 MB").arg(megabytes)
+                         : QString("⚙️ Replay buffer memory budget: auto"));
+}
+
+void MainWindow::onCaptureModeChanged(int index) {
+    auto mode = static_cast<ScreenRecorder::CaptureMode>(m_captureModeCombo->itemData(index).toInt());
+    
+    // The mode is fixed for the lifetime of a capture thread, so restart
+    // screen capture around the change. Audio capture is unaffected.
+    bool wasRecording = m_screenRecorder->isRecording();
+    if (wasRecording) {
+        stopScreenRecording();
+    }
+    
+    if (m_screenRecorder->setCaptureMode(mode)) {
+        addLog(QString("⚙️ Capture mode changed to: %1").arg(m_captureModeCombo->itemText(index)));
+    }
+    syncDisplayRecorders();
+    
+    if (wasRecording) {
+        startScreenRecording();
+    }
+}
+
+void MainWindow::onEncoderBackendChanged(int index) {
+    if (index < 0) {
+        return;
+    }
+    m_encoderBackend = static_cast<EncoderBackend>(m_encoderCombo->itemData(index).toInt());
+    m_screenRecorder->setEncoderBackend(m_encoderBackend);
+    syncDisplayRecorders();
+    addLog(QString("⚙️ Encoder changed to: %1").arg(m_encoderCombo->itemText(index)));
+    
+    // Encoded capture modes hold an open encoder; restart so the new
+    // backend is used. Saving picks it up on the next clip.
+    if (m_screenRecorder->isRecording() && m_screenRecorder->isEncodedMode()) {
+        restartScreenRecording();
+    }
+}
+
+void MainWindow::onZeroCopyToggled(bool enabled) {
+    m_screenRecorder->setZeroCopyCapture(enabled);
+    syncDisplayRecorders();
+    addLog(QString("⚙️ Zero-copy GPU encode: %1").arg(enabled ? "on" : "off"));
+    
+    if (m_screenRecorder->isRecording() && m_screenRecorder->isEncodedMode()) {
+        restartScreenRecording();
+    }
+}
+
+void MainWindow::onSpillToggled(bool enabled) {
+    m_screenRecorder->setSpillToDisk(enabled, m_screenRecorder->spillDirectory());
+    syncDisplayRecorders();
+    addLog(enabled ? QString("⚙️ Encoded buffer on disk: %1").arg(m_screenRecorder->spillDirectory())
+                   : QString("⚙️ Encoded buffer in memory"));
+    
+    if (m_screenRecorder->isRecording() && m_screenRecorder->isEncodedMode()) {
+        restartScreenRecording();
+    }
+}
+
+void MainWindow::onOutputResolutionChanged(int index) {
+    m_screenRecorder->setMaxOutputHeight(m_resolutionCombo->itemData(index).toInt());
+    syncDisplayRecorders();
+    addLog(QString("⚙️ Output resolution: %1").arg(m_resolutionCombo->itemText(index)));
+    
+    // The buffer is kept at one frame size, so this needs a fresh start
+    if (m_screenRecorder->isRecording()) {
+        restartScreenRecording();
+    }
+}
+
+void MainWindow::onDisplaySelectionChanged(QListWidgetItem* item) {
+    Q_UNUSED(item);
+    m_captureDisplays.clear();
+    for (int i = 0; i < m_displayList->count(); ++i) {
+        if (m_displayList->item(i)->checkState() == Qt::Checked) {
+            m_captureDisplays.push_back(m_displayList->item(i)->data(Qt::UserRole).toInt());
+        }
+    }
+    
+    // Recorders are tied to their display, so the set is rebuilt around
+    // a stopped capture
+    const bool wasRecording = m_screenRecorder->isRecording();
+    if (wasRecording) {
+        stopScreenRecording();
+    }
+    rebuildDisplayRecorders();
+    addLog(QString("⚙️ Capturing %1 display(s)").arg(screenRecorders().size()));
+    if (wasRecording) {
+        startScreenRecording();
+    }
+}
+
+void MainWindow::rebuildDisplayRecorders() {
+    // The first recorder keeps its connections and settings and only
+    // changes display; the others are created to follow it
+    m_screenRecorder->setDisplay(m_captureDisplays.empty() ? -1 : m_captureDisplays.front());
+    m_extraRecorders.clear();
+    for (size_t i = 1; i < m_captureDisplays.size(); ++i) {
+        auto recorder = std::make_unique<ScreenRecorder>(m_screenRecorder->getFPS());
+        recorder->setDisplay(m_captureDisplays[i]);
+        const QString tag = QString("[Display %1] ").arg(m_captureDisplays[i] + 1);
+        connect(recorder.get(), &ScreenRecorder::errorOccurred, this, [this, tag](const QString& error) {
+            onErrorOccurred(tag + error);
+        });
+        connect(recorder.get(), &ScreenRecorder::debugLog, this, [this, tag](const QString& message) {
+            addLog(tag + message);
+        });
+        connect(recorder.get(), &ScreenRecorder::qualityDegraded, this, [this, tag](int, const QString& description) {
+            onStatusUpdate(QString("%1Recording at reduced quality (%2)").arg(tag, description));
+        });
+        m_extraRecorders.push_back(std::move(recorder));
+    }
+    syncDisplayRecorders();
+    
+    const QString previous = m_saveTargetCombo->currentText();
+    m_saveTargetCombo->clear();
+    if (!m_extraRecorders.empty()) {
+        m_saveTargetCombo->addItem("All displays, side by side", SAVE_SIDE_BY_SIDE);
+        m_saveTargetCombo->addItem("All displays, one clip each", SAVE_EACH_DISPLAY);
+        for (size_t i = 0; i < m_captureDisplays.size(); ++i) {
+            QListWidgetItem* item = m_displayList->item(m_captureDisplays[i]);
+            m_saveTargetCombo->addItem(QString("Only %1").arg(item ? item->text()
+                : QString("display %1").arg(m_captureDisplays[i] + 1)), static_cast<int>(i));
+        }
+        const int index = m_saveTargetCombo->findText(previous);
+        m_saveTargetCombo->setCurrentIndex(index >= 0 ? index : 0);
+    }
+    m_saveTargetCombo->setEnabled(!m_extraRecorders.empty());
+}
+
+void MainWindow::syncDisplayRecorders() {
+    // The memory budget and the JPEG workers are for the whole app, so
+    // every display gets its share
+    const int count = static_cast<int>(screenRecorders().size());
+    const int workers = m_compressionWorkers > 0 || count == 1 ? m_compressionWorkers
+        : (std::max)(1, CompressionPipeline::defaultWorkerCount() / count);
+    const int budgetMB = displayBudgetMB();
+    m_screenRecorder->setBufferBudgetMB(budgetMB);
+    m_screenRecorder->setCompressionWorkers(workers);
+    
+    const QString spillDir = m_screenRecorder->spillDirectory();
+    for (size_t i = 0; i < m_extraRecorders.size(); ++i) {
+        ScreenRecorder* recorder = m_extraRecorders[i].get();
+        recorder->setFPS(m_screenRecorder->getFPS());
+        recorder->setBufferSeconds(m_screenRecorder->getBufferSeconds());
+        recorder->setBufferBudgetMB(budgetMB);
+        recorder->setCompressionWorkers(workers);
+        recorder->setBackpressurePolicy(m_screenRecorder->backpressurePolicy());
+        recorder->setAdaptiveQuality(m_screenRecorder->adaptiveQuality());
+        if (recorder->captureMode() != m_screenRecorder->captureMode()) {
+            recorder->setCaptureMode(m_screenRecorder->captureMode());
+        }
+        recorder->setEncoderBackend(m_screenRecorder->encoderBackend());
+        recorder->setZeroCopyCapture(m_screenRecorder->zeroCopyCapture());
+        recorder->setMaxOutputHeight(m_screenRecorder->maxOutputHeight());
+        // Segment files of each display go in a directory of their own
+        recorder->setSpillToDisk(m_screenRecorder->spillToDisk(),
+                                 spillDir + QString("/display%1").arg(m_captureDisplays[i + 1] + 1));
+    }
+}
+
+void MainWindow::startScreenRecording() {
+    m_screenRecorder->setBufferSeconds(getBufferSeconds());
+    syncDisplayRecorders();
+    for (ScreenRecorder* recorder : screenRecorders()) {
+        recorder->startRecording();
+    }
+}
+
+void MainWindow::stopScreenRecording() {
+    for (ScreenRecorder* recorder : screenRecorders()) {
+        recorder->stopRecording();
+    }
+}
+
+void MainWindow::restartScreenRecording() {
+    stopScreenRecording();
+    startScreenRecording();
+}
+
+std::vector<ScreenRecorder*> MainWindow::screenRecorders() const {
+    std::vector<ScreenRecorder*> recorders = { m_screenRecorder.get() };
+    for (const auto& recorder : m_extraRecorders) {
+        recorders.push_back(recorder.get());
+    }
+    return recorders;
+}
+
+int MainWindow::displayBudgetMB() const {
+    const int megabytes = m_bufferBudget->value();
+    if (m_extraRecorders.empty()) {
+        return megabytes;
+    }
+    // Auto would size every buffer from physical memory; split that instead
+    const int total = megabytes > 0 ? megabytes
+        : static_cast<int>(ReplayBuffer::defaultBudgetBytes() / (1024 * 1024));
+    return (std::max)(1, total / static_cast<int>(m_extraRecorders.size() + 1));
+}
+
+void MainWindow::probeEncoderBackends() {
+    // Opening hardware encoders can take a second or more on some drivers,
+    // so probe off the GUI thread and fill the combo when done.
+    QThread* probeThread = QThread::create([this]() {
+        QList<EncoderBackend> available = EncoderBackends::probe();
+        QMetaObject::invokeMethod(this, [this, available]() {
+            populateEncoderCombo(available);
+        }, Qt::QueuedConnection);
+    });
+    connect(probeThread, &QThread::finished, probeThread, &QObject::deleteLater);
+    probeThread->start(QThread::LowPriority);
+}
+
+void MainWindow::populateEncoderCombo(const QList<EncoderBackend>& available) {
+    m_encoderCombo->blockSignals(true);
+    m_encoderCombo->clear();
+    
+    const EncoderBackend autoBackend = EncoderBackends::resolve(EncoderBackend::Auto);
+    m_encoderCombo->addItem(QString("Auto (%1)").arg(EncoderBackends::displayName(autoBackend)),
+                            static_cast<int>(EncoderBackend::Auto));
+    for (EncoderBackend backend : available) {
+        m_encoderCombo->addItem(EncoderBackends::displayName(backend), static_cast<int>(backend));
+    }
+    
+    // Fall back to Auto if the saved backend is no longer usable
+    int index = m_encoderCombo->findData(static_cast<int>(m_encoderBackend));
+    if (index < 0) {
+        index = 0;
+        m_encoderBackend = EncoderBackend::Auto;
+        m_screenRecorder->setEncoderBackend(m_encoderBackend);
+        syncDisplayRecorders();
+    }
+    m_encoderCombo->setCurrentIndex(index);
+    m_encoderCombo->setEnabled(true);
+    m_encoderCombo->blockSignals(false);
+    
+    QStringList names;
+    for (EncoderBackend backend : available) {
+        names << EncoderBackends::displayName(backend);
+    }
+    addLog(QString("🔎 Available encoders: %1").arg(names.join(", ")));
+}
+
 void MainWindow::onRecordingStarted() {
     onStatusUpdate("Recording started");
     addLog("🎥 Screen recording started");
@@ -641,20 +1293,191 @@ void MainWindow::onErrorOccurred(const QString& error) {
     QMessageBox::critical(this, "Error", error);
 }
 
+void MainWindow::refreshStats() {
+    // Nobody is looking; the metrics endpoint takes its own snapshots
+    if (!isVisible() || isMinimized()) {
+        return;
+    }
+    
+    const Telemetry::Snapshot snapshot = Telemetry::snapshot();
+    auto ms = [](double ns) { return QString::number(ns / 1e6, 'f', 2); };
+    for (int s = 0; s < Telemetry::StageCount; ++s) {
+        const Telemetry::Histogram& h = snapshot.stages[s];
+        m_statsTable->item(s, 0)->setText(QString::number((qulonglong)h.count));
+        m_statsTable->item(s, 1)->setText(h.count ? ms(h.meanNs()) : QString());
+        m_statsTable->item(s, 2)->setText(h.count ? ms(h.percentileNs(50)) : QString());
+        m_statsTable->item(s, 3)->setText(h.count ? ms(h.percentileNs(99)) : QString());
+        m_statsTable->item(s, 4)->setText(h.count ? ms(h.maxNs) : QString());
+    }
+    
+    QStringList counters;
+    for (int c = 0; c < Telemetry::CounterCount; ++c) {
+        counters << QString("%1: %2")
+            .arg(QString(Telemetry::counterName(static_cast<Telemetry::Counter>(c))).replace('_', ' '))
+            .arg((qulonglong)snapshot.counters[c]);
+    }
+    m_statsCounters->setText(counters.join(" | "));
+}
+
 void MainWindow::loadSettings() {
     QSettings settings("ScreenClip", "Recorder");
     m_username = settings.value("username", "Anonymous").toString();
+    m_encoderBackend = EncoderBackends::fromSettingsKey(settings.value("encoderBackend", "auto").toString());
+    m_screenRecorder->setEncoderBackend(m_encoderBackend);
+    
+    // Applied to the recorders by rebuildDisplayRecorders() below
+    m_bufferBudget->blockSignals(true);
+    m_bufferBudget->setValue(settings.value("bufferBudgetMB", 0).toInt());
+    m_bufferBudget->blockSignals(false);
+    
+    // Save scheduling; no UI either
+    m_saveQueue->setMaxConcurrent(settings.value("saveConcurrency", SaveQueue::DEFAULT_CONCURRENT).toInt());
+    m_saveQueue->setCoalesceWindowMs(settings.value("saveCoalesceMs", SaveQueue::DEFAULT_COALESCE_MS).toInt());
+    
+    // Clip upload; no UI. Without an endpoint the Upload button only says
+    // so. The bandwidth cap keeps an upload from starving the game.
+    UploadSession::Settings upload;
+    upload.endpoint = settings.value("uploadEndpoint", QString()).toString();
+    upload.token = settings.value("uploadToken", QString()).toString();
+    upload.user = m_username;
+    upload.chunkSizeKB = settings.value("uploadChunkKB", upload.chunkSizeKB).toInt();
+    upload.parallelChunks = settings.value("uploadParallel", upload.parallelChunks).toInt();
+    upload.limitKBps = settings.value("uploadLimitKBps", 2048).toInt();
+    m_uploader->setSettings(upload);
+    // Upload every clip as it is saved; fragmented saves stream it
+    m_uploadOnSave = settings.value("uploadOnSave", false).toBool();
+    
+    // Fragmented MP4 saves (no UI): written in one pass and playable up to
+    // the last fragment if the app dies mid-save. Off writes a faststart
+    // MP4 for players that cannot handle fragments.
+    m_fragmentedMp4 = settings.value("fragmentedMp4", true).toBool();
+    
+    // Local metrics endpoint for Prometheus (/metrics) or scripts
+    // (/metrics.json); no UI, 0 keeps it off
+    m_metricsPort = settings.value("metricsPort", 0).toInt();
+    if (m_metricsPort > 0 && m_metricsPort <= 65535) {
+        m_metricsServer = std::make_unique<MetricsServer>();
+        if (m_metricsServer->start(static_cast<quint16>(m_metricsPort))) {
+            addLog(QString("📈 Metrics at http://127.0.0.1:%1/metrics").arg(m_metricsPort));
+        } else {
+            addLog(QString("❌ Metrics endpoint: %1").arg(m_metricsServer->lastError()));
+            m_metricsServer.reset();
+        }
+    }
+    
+    // JPEG compression tuning; no UI, edit the settings file to change
+    m_compressionWorkers = settings.value("compressionWorkers", 0).toInt();
+    const QString policy = settings.value("backpressurePolicy", "drop-oldest").toString();
+    m_screenRecorder->setBackpressurePolicy(
+        policy == "drop-newest" ? CompressionPipeline::DropNewest
+        : policy == "degrade-quality" ? CompressionPipeline::DegradeQuality
+        : CompressionPipeline::DropOldest);
+    // Step quality down when capture falls behind; no UI either
+    m_screenRecorder->setAdaptiveQuality(settings.value("adaptiveQuality", true).toBool());
+    
+    // Audio capture period in ms; also no UI. Applies when capture restarts.
+    const int audioPeriodMs = settings.value("audioPeriodMs", 10).toInt();
+    m_micCapture->setPeriodMs(audioPeriodMs);
+    m_desktopCapture->setPeriodMs(audioPeriodMs);
+    
+    // Audio storage: "raw", or "opus"/"aac" to keep encoded packets for
+    // buffers past a minute. No UI either.
+    const QString storage = settings.value("audioStorage", "raw").toString();
+    const int storageBitrate = settings.value("audioStorageBitrate", 96000).toInt();
+    const AudioPacketRing::Codec storageCodec = storage == "aac" ? AudioPacketRing::Aac : AudioPacketRing::Opus;
+    m_micCapture->setCompressedStorage(storage != "raw", storageCodec, storageBitrate);
+    m_desktopCapture->setCompressedStorage(storage != "raw", storageCodec, storageBitrate);
+    
+    // Segment directory has no UI; defaults to the cache location
+    const QString spillDir = settings.value("spillDirectory",
+        QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/replay").toString();
+    const bool spill = settings.value("spillToDisk", false).toBool();
+    m_screenRecorder->setSpillToDisk(spill, spillDir);
+    m_spillCheck->blockSignals(true);
+    m_spillCheck->setChecked(spill);
+    m_spillCheck->blockSignals(false);
+    m_spillCheck->setToolTip(m_spillCheck->toolTip() + "\n" + spillDir);
+    
+    const int maxHeight = settings.value("maxOutputHeight", 0).toInt();
+    const int resolutionIndex = m_resolutionCombo->findData(maxHeight);
+    m_screenRecorder->setMaxOutputHeight(maxHeight);
+    m_resolutionCombo->blockSignals(true);
+    m_resolutionCombo->setCurrentIndex(resolutionIndex >= 0 ? resolutionIndex : 0);
+    m_resolutionCombo->blockSignals(false);
+    
+    // Capture area; no UI. "captureRegion" is a rectangle in screen pixels,
+    // "captureWindow" a window title to follow instead.
+    m_screenRecorder->setCaptureRegion(settings.value("captureRegion", QRect()).toRect());
+    m_screenRecorder->setCaptureWindow(settings.value("captureWindow", QString()).toString());
+    
+#ifdef _WIN32
+    bool zeroCopy = settings.value("zeroCopyCapture", false).toBool();
+    m_screenRecorder->setZeroCopyCapture(zeroCopy);
+    m_zeroCopyCheck->blockSignals(true);
+    m_zeroCopyCheck->setChecked(zeroCopy);
+    m_zeroCopyCheck->blockSignals(false);
+#endif
+    
+    // Displays to capture, as indices into availableDisplays(); the
+    // checkboxes above the save combo edit it
+    m_captureDisplays.clear();
+    m_displayList->blockSignals(true);
+    for (const QString& entry : settings.value("captureDisplays", QStringList()).toStringList()) {
+        bool ok = false;
+        const int display = entry.toInt(&ok);
+        if (ok && display >= 0 && display < m_displayList->count() &&
+            std::find(m_captureDisplays.begin(), m_captureDisplays.end(), display) == m_captureDisplays.end()) {
+            m_captureDisplays.push_back(display);
+            m_displayList->item(display)->setCheckState(Qt::Checked);
+        }
+    }
+    m_displayList->blockSignals(false);
+    rebuildDisplayRecorders();
 }
 
 void MainWindow::saveSettings() {
     QSettings settings("ScreenClip", "Recorder");
     settings.setValue("username", m_username);
+    settings.setValue("encoderBackend", EncoderBackends::settingsKey(m_encoderBackend));
+    settings.setValue("bufferBudgetMB", m_bufferBudget->value());
+    settings.setValue("compressionWorkers", m_compressionWorkers);
+    settings.setValue("saveConcurrency", m_saveQueue->maxConcurrent());
+    settings.setValue("saveCoalesceMs", m_saveQueue->coalesceWindowMs());
+    const UploadSession::Settings& upload = m_uploader->settings();
+    settings.setValue("uploadEndpoint", upload.endpoint);
+    settings.setValue("uploadToken", upload.token);
+    settings.setValue("uploadChunkKB", upload.chunkSizeKB);
+    settings.setValue("uploadParallel", upload.parallelChunks);
+    settings.setValue("uploadLimitKBps", upload.limitKBps);
+    settings.setValue("uploadOnSave", m_uploadOnSave);
+    settings.setValue("fragmentedMp4", m_fragmentedMp4);
+    settings.setValue("metricsPort", m_metricsPort);
+    static const char* policyKeys[] = { "drop-oldest", "drop-newest", "degrade-quality" };
+    settings.setValue("backpressurePolicy", policyKeys[m_screenRecorder->backpressurePolicy()]);
+    settings.setValue("adaptiveQuality", m_screenRecorder->adaptiveQuality());
+    settings.setValue("audioPeriodMs", m_micCapture->periodMs());
+    settings.setValue("audioStorage", !m_micCapture->compressedStorage() ? "raw"
+                      : m_micCapture->compressedCodec() == AudioPacketRing::Aac ? "aac" : "opus");
+    settings.setValue("audioStorageBitrate", m_micCapture->compressedBitrate());
+    settings.setValue("spillToDisk", m_spillCheck->isChecked());
+    settings.setValue("spillDirectory", m_screenRecorder->spillDirectory());
+    settings.setValue("maxOutputHeight", m_screenRecorder->maxOutputHeight());
+    settings.setValue("captureRegion", m_screenRecorder->captureRegion());
+    settings.setValue("captureWindow", m_screenRecorder->captureWindow());
+    QStringList displays;
+    for (int display : m_captureDisplays) {
+        displays << QString::number(display);
+    }
+    settings.setValue("captureDisplays", displays);
+#ifdef _WIN32
+    settings.setValue("zeroCopyCapture", m_zeroCopyCheck->isChecked());
+#endif
 }
 
 void MainWindow::closeEvent(QCloseEvent *event) {
     addLog("🛑 Application closing...");
     m_clipViewer->releaseCurrentClip();
-    m_screenRecorder->stopRecording();
+    stopScreenRecording();
     m_micCapture->stopCapture();
     m_desktopCapture->stopCapture();
     unregisterGlobalHotkey();
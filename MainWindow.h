@@ -6,16 +6,25 @@
 #include <QPushButton>
 #include <QLabel>
 #include <QComboBox>
+#include <QCheckBox>
 #include <QSlider>
 #include <QSpinBox>
 #include <QLineEdit>
 #include <QTimer>
 #include <QTextEdit>
+#include <QProgressBar>
+#include <QTableWidget>
+#include <map>
+#include <set>
 #include <memory>
+#include <vector>
 #include "ScreenRecorder.h"
 #include "AudioCapture.h"
 #include "ClipViewer.h"
 #include "VideoEncoder.h"
+#include "SaveQueue.h"
+#include "ClipUploader.h"
+#include "MetricsServer.h"
 
 /*
  * MainWindow
@@ -23,12 +32,15 @@
  * The central UI and orchestration layer. Responsibilities:
  * - Build the primary GUI and expose controls for buffer size, hotkey,
  *   device selection, and clip management (save/trim/upload/delete).
- * - Own and manage subsystem instances: `ScreenRecorder`, two
- *   `AudioCapture` instances (mic and desktop) and a `VideoEncoder`.
+ * - Own and manage subsystem instances: one `ScreenRecorder` per
+ *   captured display, two `AudioCapture` instances (mic and desktop) and
+ *   the `SaveQueue` that encodes clips and the `ClipUploader` that
+ *   uploads them.
  * - Coordinate lifecycle and threading: start/stop capture threads,
  *   collect buffers and hand them off to the encoder on demand.
  * - Surface runtime logs to an on-screen debug console to ease
- *   troubleshooting during development.
+ *   troubleshooting during development, next to a panel of pipeline
+ *   telemetry (and, when configured, a local metrics endpoint).
  *
  * Design notes
  * - The MainWindow keeps UI code and orchestration logic in the same
@@ -57,6 +69,13 @@ private slots:
     
     // Buffer settings
     void onBufferPresetChanged(const QString& preset);
+    void onBufferBudgetChanged();
+    void onCaptureModeChanged(int index);
+    void onEncoderBackendChanged(int index);
+    void onZeroCopyToggled(bool enabled);
+    void onSpillToggled(bool enabled);
+    void onOutputResolutionChanged(int index);
+    void onDisplaySelectionChanged(QListWidgetItem* item);
     
     // Clip management
     void onClipSelected(QListWidgetItem* item);
@@ -75,9 +94,23 @@ private slots:
     void onRecordingStopped();
     void onClipSaved(const QString& filepath);
     
+    // Save queue
+    void onSaveProgress(int jobId, int percent);
+    void onSaveFinished(int jobId, bool success, const QString& filepath,
+                        const QString& message, double waitMs, double encodeMs);
+    void onSaveCanceled(int jobId, const QString& filepath);
+    void onSaveQueueChanged(int depth);
+    void onCancelSavesClicked();
+    
+    // Uploads
+    void onUploadProgress(int uploadId, qint64 sentBytes, qint64 totalBytes, double bytesPerSecond);
+    void onUploadFinished(int uploadId, bool success, const QString& filepath, const QString& message);
+    void onSaveOutputGrowing(int jobId, const QString& filepath);
+    
     // Status updates
     void onStatusUpdate(const QString& message);
     void onErrorOccurred(const QString& error);
+    void refreshStats();
 
 private:
     void setupUI();
@@ -86,17 +119,38 @@ private:
     void loadSettings();
     void saveSettings();
     void autoStartRecording();
+    void probeEncoderBackends();
+    void populateEncoderCombo(const QList<EncoderBackend>& available);
     void registerGlobalHotkey();
     void unregisterGlobalHotkey();
     
+    // Screen capture runs one recorder per selected display. The first
+    // one holds the settings; syncDisplayRecorders() copies them over.
+    void rebuildDisplayRecorders();
+    void syncDisplayRecorders();
+    void startScreenRecording();
+    void stopScreenRecording();
+    void restartScreenRecording();
+    std::vector<ScreenRecorder*> screenRecorders() const;
+    // One display's share of the buffer memory budget
+    int displayBudgetMB() const;
+    
     QString getClipsDirectory() const;
     int getBufferSeconds() const;
+    // Hands a save's result to its upload with uploadOnSave
+    void endSaveUpload(int jobId, const QString& filepath, bool saved);
+    // Removes the clip with its index and upload sidecar
+    void deleteClipFiles(const QString& filepath);
     
     // Core components
     std::unique_ptr<ScreenRecorder> m_screenRecorder;
+    std::vector<std::unique_ptr<ScreenRecorder>> m_extraRecorders;
+    std::vector<int> m_captureDisplays;  // availableDisplays() indices; empty = default
     std::unique_ptr<AudioCapture> m_micCapture;
     std::unique_ptr<AudioCapture> m_desktopCapture;
-    std::unique_ptr<VideoEncoder> m_encoder;
+    std::unique_ptr<SaveQueue> m_saveQueue;
+    std::unique_ptr<ClipUploader> m_uploader;
+    std::unique_ptr<MetricsServer> m_metricsServer;
     
     // UI Components
     QLabel* m_statusLabel;
@@ -111,10 +165,21 @@ private:
     QWidget* m_customBufferWidget;
     QSpinBox* m_customMinutes;
     QSpinBox* m_customSeconds;
+    QSpinBox* m_bufferBudget;
+    QComboBox* m_captureModeCombo;
+    QComboBox* m_encoderCombo;
+    QCheckBox* m_zeroCopyCheck;
+    QCheckBox* m_spillCheck;
+    QComboBox* m_resolutionCombo;
+    QWidget* m_displayWidget;
+    QListWidget* m_displayList;
+    QComboBox* m_saveTargetCombo;
     
     // Control buttons
     QPushButton* m_startStopBtn;
     QPushButton* m_saveBtn;
+    QProgressBar* m_saveProgress;
+    QPushButton* m_cancelSavesBtn;
     QPushButton* m_hotkeyBtn;
     QPushButton* m_uploadBtn;
     
@@ -127,6 +192,11 @@ private:
     ClipViewer* m_clipViewer;
     QTextEdit* m_logViewer;
     
+    // Pipeline stats
+    QTableWidget* m_statsTable;
+    QLabel* m_statsCounters;
+    QTimer* m_statsTimer;
+    
     // Clip actions
     QPushButton* m_trimBtn;
     QPushButton* m_renameBtn;
@@ -140,6 +210,13 @@ private:
     bool m_hotkeyRegistered;
     QString m_username;
     QString m_currentHotkey;
+    EncoderBackend m_encoderBackend;
+    int m_compressionWorkers;  // per display; 0 shares the default among displays
+    int m_metricsPort;         // 0 = no metrics endpoint
+    bool m_fragmentedMp4;
+    bool m_uploadOnSave;
+    std::map<int, int> m_saveUploads;  // save job id -> upload id, while both run
+    std::set<QString> m_pendingDeletes;  // deleted clips waiting for their upload to stop
     
 #ifdef _WIN32
     // Windows hotkey registration
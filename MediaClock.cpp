@@ -0,0 +1,25 @@
+/*
+ * MediaClock.cpp
+ *
+ * Process-wide monotonic time base shared by video and audio capture.
+ */
+
+#include "MediaClock.h"
+
+MediaClock::Clock::time_point MediaClock::epoch() {
+    // Initialised on first use; thread-safe since C++11
+    static const Clock::time_point start = Clock::now();
+    return start;
+}
+
+int64_t MediaClock::nowUs() {
+    return toUs(Clock::now());
+}
+
+int64_t MediaClock::toUs(Clock::time_point time) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(time - epoch()).count();
+}
+
+MediaClock::Clock::time_point MediaClock::fromUs(int64_t us) {
+    return epoch() + std::chrono::duration_cast<Clock::duration>(std::chrono::microseconds(us));
+}
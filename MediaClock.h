@@ -0,0 +1,31 @@
+#ifndef MEDIACLOCK_H
+#define MEDIACLOCK_H
+
+#include <chrono>
+#include <cstdint>
+
+/*
+ * MediaClock
+ * - The one clock every captured sample is stamped with: microseconds on
+ *   `std::chrono::steady_clock` since the first use in this process.
+ *   Unlike wall-clock time it never jumps (NTP sync, DST, the user
+ *   changing the clock), so timestamps from the screen recorder and the
+ *   audio capture threads can be compared and subtracted directly.
+ * - Values are only meaningful within one process run; nothing persists
+ *   them.
+ */
+class MediaClock {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static int64_t nowUs();
+    static double nowSeconds() { return nowUs() / 1000000.0; }
+
+    static int64_t toUs(Clock::time_point time);
+    static Clock::time_point fromUs(int64_t us);
+
+private:
+    static Clock::time_point epoch();
+};
+
+#endif // MEDIACLOCK_H
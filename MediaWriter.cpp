@@ -0,0 +1,480 @@
+/*
+ * MediaWriter.cpp
+ *
+ * In-process encoder/muxer built directly on the FFmpeg libraries. Frames
+ * arrive as QImages, are converted to YUV 4:2:0 with swscale and encoded
+ * with libx264 (or, in copy mode, already encoded packets are remuxed
+ * untouched); audio arrives as interleaved float stereo and is encoded
+ * to AAC. Both streams are interleaved into the output container by
+ * libavformat.
+ */
+
+#include "MediaWriter.h"
+#include "Telemetry.h"
+#include <QDebug>
+#include <algorithm>
+#include <cstring>
+
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include <libavutil/opt.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/channel_layout.h>
+#include <libswscale/swscale.h>
+}
+
+static QString avErrorString(int errnum) {
+    char buf[AV_ERROR_MAX_STRING_SIZE] = {0};
+    av_strerror(errnum, buf, sizeof(buf));
+    return QString::fromUtf8(buf);
+}
+
+MediaWriter::MediaWriter()
+    : m_headerWritten(false)
+    , m_finished(false)
+    , m_formatCtx(nullptr)
+    , m_videoCodecCtx(nullptr)
+    , m_videoStream(nullptr)
+    , m_videoFrame(nullptr)
+    , m_swsCtx(nullptr)
+    , m_swsSrcWidth(0)
+    , m_swsSrcHeight(0)
+    , m_audioCodecCtx(nullptr)
+    , m_audioStream(nullptr)
+    , m_audioFrame(nullptr)
+    , m_audioPts(0)
+    , m_packet(nullptr)
+{
+}
+
+MediaWriter::~MediaWriter() {
+    cleanup();
+}
+
+bool MediaWriter::setError(const QString& context, int avError) {
+    m_lastError = avError ? QString("%1: %2").arg(context, avErrorString(avError)) : context;
+    qDebug() << "[MediaWriter]" << m_lastError;
+    return false;
+}
+
+bool MediaWriter::open(const Config& config) {
+    cleanup();
+    m_config = config;
+    m_lastError.clear();
+    m_finished = false;
+    m_keyframesUs.clear();
+
+    const bool copyVideo = m_config.copyVideo.isValid();
+    if (copyVideo) {
+        m_config.width = m_config.copyVideo.width;
+        m_config.height = m_config.copyVideo.height;
+        m_config.fps = m_config.copyVideo.fps;
+    }
+
+    // yuv420p requires even dimensions; swscale absorbs the odd pixel.
+    m_config.width &= ~1;
+    m_config.height &= ~1;
+    if (m_config.width <= 0 || m_config.height <= 0 || m_config.fps <= 0) {
+        return setError(QString("Invalid output format %1x%2 @ %3 fps")
+            .arg(config.width).arg(config.height).arg(config.fps));
+    }
+
+    const QByteArray path = m_config.outputPath.toUtf8();
+    int ret = avformat_alloc_output_context2(&m_formatCtx, nullptr, nullptr, path.constData());
+    if (ret < 0 || !m_formatCtx) {
+        return setError("Failed to allocate output context", ret);
+    }
+
+    m_packet = av_packet_alloc();
+    if (!m_packet) {
+        return setError("Failed to allocate packet");
+    }
+
+    if (!(copyVideo ? openCopyVideoStream() : openVideoStream())) {
+        return false;
+    }
+    if (m_config.hasAudio && !openAudioStream()) {
+        return false;
+    }
+
+    if (!(m_formatCtx->oformat->flags & AVFMT_NOFILE)) {
+        ret = avio_open(&m_formatCtx->pb, path.constData(), AVIO_FLAG_WRITE);
+        if (ret < 0) {
+            return setError("Failed to open output file", ret);
+        }
+    }
+
+    AVDictionary* muxOpts = nullptr;
+    if (m_config.fragmented) {
+        // Append-only: nothing is rewritten at the end, and each fragment
+        // reaches the file as soon as the next keyframe closes it
+        av_dict_set(&muxOpts, "movflags", "+frag_keyframe+empty_moov+default_base_moof", 0);
+        av_dict_set(&muxOpts, "flush_packets", "1", 0);
+    } else {
+        av_dict_set(&muxOpts, "movflags", "+faststart", 0);
+    }
+    ret = avformat_write_header(m_formatCtx, &muxOpts);
+    av_dict_free(&muxOpts);
+    if (ret < 0) {
+        return setError("Failed to write container header", ret);
+    }
+    m_headerWritten = true;
+
+    qDebug() << "[MediaWriter] Opened" << m_config.outputPath
+             << m_config.width << "x" << m_config.height << "@" << m_config.fps << "fps"
+             << (m_config.hasAudio ? "with audio" : "without audio")
+             << (m_config.fragmented ? "(fragmented)" : "");
+    return true;
+}
+
+bool MediaWriter::openVideoStream() {
+    m_videoStream = avformat_new_stream(m_formatCtx, nullptr);
+    if (!m_videoStream) {
+        return setError("Failed to allocate video stream");
+    }
+
+    // Software settings match the ffmpeg CLI path; hardware backends get
+    // their own rate control from EncoderBackends.
+    EncoderBackends::Settings settings;
+    settings.backend = m_config.backend;
+    settings.width = m_config.width;
+    settings.height = m_config.height;
+    settings.fps = m_config.fps;
+    settings.gopSize = m_config.fps * 2;
+    settings.maxBFrames = 2;
+    settings.bitrate = 0;
+    settings.crf = 23;
+    settings.globalHeader = (m_formatCtx->oformat->flags & AVFMT_GLOBALHEADER) != 0;
+    settings.softwarePreset = "medium";
+
+    QString error;
+    EncoderBackend used = EncoderBackend::Software;
+    m_videoCodecCtx = EncoderBackends::openVideoEncoder(settings, &used, &error);
+    if (!m_videoCodecCtx) {
+        return setError(QString("Failed to open video encoder: %1").arg(error));
+    }
+    qDebug() << "[MediaWriter] Video encoder:" << m_videoCodecCtx->codec->name
+             << "(" << EncoderBackends::displayName(used) << ")";
+
+    int ret = 0;
+    ret = avcodec_parameters_from_context(m_videoStream->codecpar, m_videoCodecCtx);
+    if (ret < 0) {
+        return setError("Failed to copy video codec parameters", ret);
+    }
+    m_videoStream->time_base = m_videoCodecCtx->time_base;
+    m_videoStream->avg_frame_rate = m_videoCodecCtx->framerate;
+
+    m_videoFrame = av_frame_alloc();
+    if (!m_videoFrame) {
+        return setError("Failed to allocate video frame");
+    }
+    m_videoFrame->format = EncoderBackends::inputPixelFormat(m_videoCodecCtx);
+    m_videoFrame->width = m_videoCodecCtx->width;
+    m_videoFrame->height = m_videoCodecCtx->height;
+    ret = av_frame_get_buffer(m_videoFrame, 0);
+    if (ret < 0) {
+        return setError("Failed to allocate video frame buffer", ret);
+    }
+
+    return true;
+}
+
+bool MediaWriter::openCopyVideoStream() {
+    const EncodedStreamInfo& info = m_config.copyVideo;
+
+    m_videoStream = avformat_new_stream(m_formatCtx, nullptr);
+    if (!m_videoStream) {
+        return setError("Failed to allocate video stream");
+    }
+
+    AVCodecParameters* par = m_videoStream->codecpar;
+    par->codec_type = AVMEDIA_TYPE_VIDEO;
+    par->codec_id = static_cast<AVCodecID>(info.codecId);
+    par->width = info.width;
+    par->height = info.height;
+    par->format = AV_PIX_FMT_YUV420P;
+    if (!info.extradata.isEmpty()) {
+        par->extradata = static_cast<uint8_t*>(
+            av_mallocz(info.extradata.size() + AV_INPUT_BUFFER_PADDING_SIZE));
+        if (!par->extradata) {
+            return setError("Failed to allocate codec extradata");
+        }
+        memcpy(par->extradata, info.extradata.constData(), info.extradata.size());
+        par->extradata_size = info.extradata.size();
+    }
+
+    m_videoStream->time_base = AVRational{info.timeBaseNum, info.timeBaseDen};
+    m_videoStream->avg_frame_rate = AVRational{info.fps, 1};
+    return true;
+}
+
+bool MediaWriter::openAudioStream() {
+    const AVCodec* codec = avcodec_find_encoder(AV_CODEC_ID_AAC);
+    if (!codec) {
+        return setError("No AAC encoder available in linked libavcodec");
+    }
+
+    m_audioStream = avformat_new_stream(m_formatCtx, nullptr);
+    m_audioCodecCtx = avcodec_alloc_context3(codec);
+    if (!m_audioStream || !m_audioCodecCtx) {
+        return setError("Failed to allocate audio stream");
+    }
+
+    m_audioCodecCtx->sample_fmt = AV_SAMPLE_FMT_FLTP;
+    m_audioCodecCtx->sample_rate = m_config.audioSampleRate;
+    m_audioCodecCtx->bit_rate = m_config.audioBitrate;
+    m_audioCodecCtx->time_base = AVRational{1, m_config.audioSampleRate};
+    av_channel_layout_default(&m_audioCodecCtx->ch_layout, 2);
+    if (m_formatCtx->oformat->flags & AVFMT_GLOBALHEADER) {
+        m_audioCodecCtx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    }
+
+    int ret = avcodec_open2(m_audioCodecCtx, codec, nullptr);
+    if (ret < 0) {
+        return setError("Failed to open audio encoder", ret);
+    }
+
+    ret = avcodec_parameters_from_context(m_audioStream->codecpar, m_audioCodecCtx);
+    if (ret < 0) {
+        return setError("Failed to copy audio codec parameters", ret);
+    }
+    m_audioStream->time_base = m_audioCodecCtx->time_base;
+
+    m_audioFrame = av_frame_alloc();
+    if (!m_audioFrame) {
+        return setError("Failed to allocate audio frame");
+    }
+    m_audioFrame->format = m_audioCodecCtx->sample_fmt;
+    m_audioFrame->sample_rate = m_audioCodecCtx->sample_rate;
+    m_audioFrame->nb_samples = m_audioCodecCtx->frame_size > 0 ? m_audioCodecCtx->frame_size : 1024;
+    av_channel_layout_copy(&m_audioFrame->ch_layout, &m_audioCodecCtx->ch_layout);
+    ret = av_frame_get_buffer(m_audioFrame, 0);
+    if (ret < 0) {
+        return setError("Failed to allocate audio frame buffer", ret);
+    }
+
+    return true;
+}
+
+bool MediaWriter::writeVideoFrame(const QImage& image, int64_t frameIndex) {
+    Telemetry::Timer timer(Telemetry::Encode);
+    if (!m_headerWritten || m_finished || !m_videoCodecCtx) {
+        return setError("Writer is not open for encoding");
+    }
+    if (image.isNull()) {
+        return setError("Null video frame");
+    }
+
+    // Format_RGB32/ARGB32 are stored as B,G,R,A bytes on little-endian hosts.
+    const QImage src = (image.format() == QImage::Format_RGB32 || image.format() == QImage::Format_ARGB32)
+        ? image
+        : image.convertToFormat(QImage::Format_RGB32);
+
+    if (!m_swsCtx || m_swsSrcWidth != src.width() || m_swsSrcHeight != src.height()) {
+        sws_freeContext(m_swsCtx);
+        m_swsCtx = sws_getContext(src.width(), src.height(), AV_PIX_FMT_BGRA,
+                                  m_config.width, m_config.height,
+                                  static_cast<AVPixelFormat>(m_videoFrame->format),
+                                  SWS_BILINEAR, nullptr, nullptr, nullptr);
+        m_swsSrcWidth = src.width();
+        m_swsSrcHeight = src.height();
+        if (!m_swsCtx) {
+            return setError("Failed to create swscale context");
+        }
+    }
+
+    int ret = av_frame_make_writable(m_videoFrame);
+    if (ret < 0) {
+        return setError("Video frame not writable", ret);
+    }
+
+    const uint8_t* srcData[1] = { src.constBits() };
+    const int srcStride[1] = { static_cast<int>(src.bytesPerLine()) };
+    sws_scale(m_swsCtx, srcData, srcStride, 0, src.height(),
+              m_videoFrame->data, m_videoFrame->linesize);
+
+    m_videoFrame->pts = frameIndex;
+    ret = EncoderBackends::sendFrame(m_videoCodecCtx, m_videoFrame);
+    if (ret < 0) {
+        return setError("Failed to send video frame", ret);
+    }
+    return drainEncoder(m_videoCodecCtx, m_videoStream);
+}
+
+bool MediaWriter::writeVideoPacket(const EncodedPacket& packet, int64_t timestampOffset) {
+    if (!m_headerWritten || m_finished) {
+        return setError("Writer is not open");
+    }
+    if (m_videoCodecCtx) {
+        return setError("Writer was opened for encoding, not stream copy");
+    }
+
+    // The muxer may have changed the stream time base in write_header, so
+    // rescale from the ring's time base rather than assuming they match.
+    const AVRational srcTb{m_config.copyVideo.timeBaseNum, m_config.copyVideo.timeBaseDen};
+
+    av_packet_unref(m_packet);
+    int ret = av_new_packet(m_packet, packet.data.size());
+    if (ret < 0) {
+        return setError("Failed to allocate packet", ret);
+    }
+    memcpy(m_packet->data, packet.data.constData(), packet.data.size());
+    m_packet->pts = packet.pts - timestampOffset;
+    m_packet->dts = packet.dts - timestampOffset;
+    m_packet->duration = packet.duration;
+    m_packet->flags = packet.keyframe ? AV_PKT_FLAG_KEY : 0;
+    m_packet->stream_index = m_videoStream->index;
+    if (packet.keyframe) {
+        m_keyframesUs.push_back(av_rescale_q(m_packet->pts, srcTb, AV_TIME_BASE_Q));
+    }
+    av_packet_rescale_ts(m_packet, srcTb, m_videoStream->time_base);
+
+    ret = av_interleaved_write_frame(m_formatCtx, m_packet);
+    av_packet_unref(m_packet);
+    if (ret < 0) {
+        return setError("Failed to write packet", ret);
+    }
+    return true;
+}
+
+bool MediaWriter::writeAudio(const float* interleaved, size_t frames) {
+    if (!m_audioCodecCtx) {
+        return true; // Audio disabled for this output
+    }
+    if (!m_headerWritten || m_finished) {
+        return setError("Writer is not open");
+    }
+
+    m_pendingAudio.insert(m_pendingAudio.end(), interleaved, interleaved + frames * 2);
+
+    const size_t frameSize = static_cast<size_t>(m_audioFrame->nb_samples);
+    while (m_pendingAudio.size() / 2 >= frameSize) {
+        if (!encodeAudioFrame(false)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool MediaWriter::encodeAudioFrame(bool flush) {
+    const int frameSize = m_audioFrame->nb_samples;
+    const size_t available = m_pendingAudio.size() / 2;
+    const size_t take = std::min(available, static_cast<size_t>(frameSize));
+    if (take == 0 && !flush) {
+        return true;
+    }
+
+    int ret = av_frame_make_writable(m_audioFrame);
+    if (ret < 0) {
+        return setError("Audio frame not writable", ret);
+    }
+
+    // Deinterleave into planar float; the final partial frame is padded with
+    // silence so every frame handed to the encoder has the same size.
+    float* left = reinterpret_cast<float*>(m_audioFrame->data[0]);
+    float* right = reinterpret_cast<float*>(m_audioFrame->data[1]);
+    for (size_t i = 0; i < take; i++) {
+        left[i] = m_pendingAudio[i * 2];
+        right[i] = m_pendingAudio[i * 2 + 1];
+    }
+    for (int i = static_cast<int>(take); i < frameSize; i++) {
+        left[i] = 0.0f;
+        right[i] = 0.0f;
+    }
+    m_pendingAudio.erase(m_pendingAudio.begin(), m_pendingAudio.begin() + take * 2);
+
+    m_audioFrame->pts = m_audioPts;
+    m_audioPts += frameSize;
+
+    ret = avcodec_send_frame(m_audioCodecCtx, m_audioFrame);
+    if (ret < 0) {
+        return setError("Failed to send audio frame", ret);
+    }
+    return drainEncoder(m_audioCodecCtx, m_audioStream);
+}
+
+bool MediaWriter::drainEncoder(AVCodecContext* codecCtx, AVStream* stream) {
+    while (true) {
+        int ret = avcodec_receive_packet(codecCtx, m_packet);
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+            return true;
+        }
+        if (ret < 0) {
+            return setError("Encoder failed", ret);
+        }
+
+        if (stream == m_videoStream && (m_packet->flags & AV_PKT_FLAG_KEY)) {
+            m_keyframesUs.push_back(av_rescale_q(m_packet->pts, codecCtx->time_base, AV_TIME_BASE_Q));
+        }
+        av_packet_rescale_ts(m_packet, codecCtx->time_base, stream->time_base);
+        m_packet->stream_index = stream->index;
+        ret = av_interleaved_write_frame(m_formatCtx, m_packet);
+        av_packet_unref(m_packet);
+        if (ret < 0) {
+            return setError("Failed to write packet", ret);
+        }
+    }
+}
+
+bool MediaWriter::finish() {
+    if (!m_headerWritten || m_finished) {
+        return setError("Writer is not open");
+    }
+    m_finished = true;
+
+    bool ok = true;
+
+    if (m_audioCodecCtx) {
+        if (!m_pendingAudio.empty()) {
+            ok = encodeAudioFrame(true) && ok;
+        }
+        avcodec_send_frame(m_audioCodecCtx, nullptr);
+        ok = drainEncoder(m_audioCodecCtx, m_audioStream) && ok;
+    }
+
+    if (m_videoCodecCtx) {
+        avcodec_send_frame(m_videoCodecCtx, nullptr);
+        ok = drainEncoder(m_videoCodecCtx, m_videoStream) && ok;
+    }
+
+    int ret = av_write_trailer(m_formatCtx);
+    if (ret < 0) {
+        ok = setError("Failed to write container trailer", ret);
+    }
+
+    cleanup();
+    return ok;
+}
+
+void MediaWriter::abort() {
+    m_finished = true;
+    cleanup();
+}
+
+void MediaWriter::cleanup() {
+    if (m_formatCtx) {
+        if (m_formatCtx->pb && !(m_formatCtx->oformat->flags & AVFMT_NOFILE)) {
+            avio_closep(&m_formatCtx->pb);
+        }
+        avformat_free_context(m_formatCtx);
+        m_formatCtx = nullptr;
+    }
+
+    avcodec_free_context(&m_videoCodecCtx);
+    avcodec_free_context(&m_audioCodecCtx);
+    av_frame_free(&m_videoFrame);
+    av_frame_free(&m_audioFrame);
+    av_packet_free(&m_packet);
+
+    sws_freeContext(m_swsCtx);
+    m_swsCtx = nullptr;
+    m_swsSrcWidth = 0;
+    m_swsSrcHeight = 0;
+
+    m_videoStream = nullptr;
+    m_audioStream = nullptr;
+    m_pendingAudio.clear();
+    m_audioPts = 0;
+    m_headerWritten = false;
+}
@@ -0,0 +1,123 @@
+#ifndef MEDIAWRITER_H
+#define MEDIAWRITER_H
+
+#include <QString>
+#include <QImage>
+#include <vector>
+#include <cstdint>
+#include "LiveEncoder.h"
+
+struct AVFormatContext;
+struct AVCodecContext;
+struct AVStream;
+struct AVFrame;
+struct AVPacket;
+struct SwsContext;
+
+/*
+ * MediaWriter
+ *
+ * Purpose
+ * - Thin wrapper around libavformat/libavcodec that encodes raw frames and
+ *   interleaved float audio directly into an output container. This is the
+ *   in-process replacement for the "write JPEGs + WAV, then run ffmpeg"
+ *   pipeline: nothing touches the disk except the final output file.
+ *
+ * Usage
+ * - `open()` creates the container, the H.264 video stream and (optionally)
+ *   the AAC audio stream, and writes the header. The video encoder is
+ *   chosen by `Config::backend` through `EncoderBackends`.
+ * - `writeVideoFrame()` converts a QImage to the encoder's 4:2:0 layout
+ *   with swscale and encodes it at the given frame index (pts in 1/fps units).
+ * - Alternatively, when `Config::copyVideo` describes an already encoded
+ *   stream, no video encoder is created and `writeVideoPacket()` remuxes
+ *   packets from the continuous-encode ring as-is.
+ * - `writeAudio()` accepts interleaved stereo float samples at the
+ *   configured sample rate and feeds the encoder in codec-sized frames.
+ * - `finish()` drains both encoders and writes the trailer.
+ * - Packets reach the file as they are muxed, so the output grows while
+ *   later frames are still being encoded. `abort()` stops a cancelled
+ *   save without draining anything.
+ * - `keyframesUs()` lists the presentation time of every video keyframe
+ *   written, for the clip's `ClipIndex`; it survives `finish()`.
+ * - With `Config::fragmented` the output is a fragmented MP4: an empty
+ *   moov up front, then one moof+mdat fragment per keyframe, each flushed
+ *   to the file as it is completed. The file only ever grows, plays while
+ *   it is written and stays playable up to its last fragment if the
+ *   process dies. Otherwise it is a regular MP4 whose moov is moved to the
+ *   front (faststart) by `finish()`, which rewrites the whole file.
+ *
+ * Error handling
+ * - Methods return false on failure; `lastError()` holds a human readable
+ *   description suitable for logs or UI messages.
+ */
+
+class MediaWriter {
+public:
+    struct Config {
+        QString outputPath;
+        int width = 0;
+        int height = 0;
+        int fps = 30;
+        int videoBitrate = 5000000;
+        int audioBitrate = 192000;
+        int audioSampleRate = 48000;
+        bool hasAudio = false;
+        EncoderBackend backend = EncoderBackend::Auto;
+        EncodedStreamInfo copyVideo; // valid => stream-copy video
+        bool fragmented = false;
+    };
+
+    MediaWriter();
+    ~MediaWriter();
+
+    MediaWriter(const MediaWriter&) = delete;
+    MediaWriter& operator=(const MediaWriter&) = delete;
+
+    bool open(const Config& config);
+    bool writeVideoFrame(const QImage& image, int64_t frameIndex);
+    bool writeVideoPacket(const EncodedPacket& packet, int64_t timestampOffset);
+    bool writeAudio(const float* interleaved, size_t frames);
+    bool finish();
+    // Closes the output without a trailer; the caller removes the file
+    void abort();
+
+    // Relative to the first frame, in muxing order
+    const std::vector<int64_t>& keyframesUs() const { return m_keyframesUs; }
+    QString lastError() const { return m_lastError; }
+
+private:
+    bool openVideoStream();
+    bool openCopyVideoStream();
+    bool openAudioStream();
+    bool encodeAudioFrame(bool flush);
+    bool drainEncoder(AVCodecContext* codecCtx, AVStream* stream);
+    bool setError(const QString& context, int avError = 0);
+    void cleanup();
+
+    Config m_config;
+    QString m_lastError;
+    bool m_headerWritten;
+    bool m_finished;
+
+    AVFormatContext* m_formatCtx;
+
+    AVCodecContext* m_videoCodecCtx;
+    AVStream* m_videoStream;
+    AVFrame* m_videoFrame;
+    SwsContext* m_swsCtx;
+    int m_swsSrcWidth;
+    int m_swsSrcHeight;
+
+    AVCodecContext* m_audioCodecCtx;
+    AVStream* m_audioStream;
+    AVFrame* m_audioFrame;
+    std::vector<float> m_pendingAudio; // interleaved stereo, not yet encoded
+    int64_t m_audioPts;
+
+    std::vector<int64_t> m_keyframesUs;
+
+    AVPacket* m_packet;
+};
+
+#endif // MEDIAWRITER_H
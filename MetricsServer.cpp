@@ -0,0 +1,166 @@
+/*
+ * MetricsServer.cpp
+ *
+ * Loopback HTTP endpoint serving the pipeline telemetry.
+ */
+
+#include "MetricsServer.h"
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QHostAddress>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QDebug>
+
+// Requests are a single line plus headers; anything bigger is not ours
+static constexpr int MAX_REQUEST_BYTES = 8192;
+
+static QByteArray httpResponse(int status, const QByteArray& reason,
+                               const QByteArray& contentType, const QByteArray& body) {
+    QByteArray response;
+    response += "HTTP/1.1 " + QByteArray::number(status) + " " + reason + "\r\n";
+    response += "Content-Type: " + contentType + "\r\n";
+    response += "Content-Length: " + QByteArray::number(body.size()) + "\r\n";
+    response += "Connection: close\r\n\r\n";
+    response += body;
+    return response;
+}
+
+static QByteArray seconds(uint64_t ns) {
+    return QByteArray::number(ns / 1e9, 'g', 9);
+}
+
+MetricsServer::MetricsServer(QObject* parent)
+    : QObject(parent)
+    , m_server(new QTcpServer(this))
+{
+    connect(m_server, &QTcpServer::newConnection, this, &MetricsServer::onNewConnection);
+}
+
+MetricsServer::~MetricsServer() {
+    stop();
+}
+
+bool MetricsServer::start(quint16 port) {
+    stop();
+    if (!m_server->listen(QHostAddress::LocalHost, port)) {
+        m_lastError = QString("Cannot listen on port %1: %2").arg(port).arg(m_server->errorString());
+        qDebug() << "[Metrics]" << m_lastError;
+        return false;
+    }
+    qDebug() << "[Metrics] Serving http://127.0.0.1:" << m_server->serverPort() << "/metrics";
+    return true;
+}
+
+void MetricsServer::stop() {
+    if (m_server->isListening()) {
+        m_server->close();
+    }
+}
+
+bool MetricsServer::isListening() const {
+    return m_server->isListening();
+}
+
+quint16 MetricsServer::port() const {
+    return m_server->serverPort();
+}
+
+void MetricsServer::onNewConnection() {
+    while (QTcpSocket* socket = m_server->nextPendingConnection()) {
+        connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
+        connect(socket, &QTcpSocket::readyRead, this, [this, socket]() { handleRequest(socket); });
+    }
+}
+
+void MetricsServer::handleRequest(QTcpSocket* socket) {
+    // Wait for the end of the headers; the body (if any) is ignored
+    const QByteArray pending = socket->peek(MAX_REQUEST_BYTES);
+    if (!pending.contains("\r\n\r\n") && !pending.contains("\n\n")) {
+        if (pending.size() >= MAX_REQUEST_BYTES) {
+            socket->abort();
+        }
+        return;
+    }
+    const QByteArray requestLine = socket->readLine(MAX_REQUEST_BYTES).trimmed();
+    socket->readAll();
+    disconnect(socket, &QTcpSocket::readyRead, this, nullptr);
+
+    const QList<QByteArray> parts = requestLine.split(' ');
+    const QByteArray method = parts.value(0);
+    const QByteArray path = parts.value(1).split('?').value(0);
+
+    QByteArray response;
+    if (method != "GET") {
+        response = httpResponse(405, "Method Not Allowed", "text/plain", "GET only\n");
+    } else if (path == "/metrics") {
+        response = httpResponse(200, "OK", "text/plain; version=0.0.4",
+                                prometheusText(Telemetry::snapshot()));
+    } else if (path == "/metrics.json") {
+        response = httpResponse(200, "OK", "application/json", json(Telemetry::snapshot()));
+    } else {
+        response = httpResponse(404, "Not Found", "text/plain", "Try /metrics or /metrics.json\n");
+    }
+    socket->write(response);
+    socket->disconnectFromHost();
+}
+
+QByteArray MetricsServer::prometheusText(const Telemetry::Snapshot& snapshot) {
+    static const double quantiles[] = { 0.5, 0.9, 0.99 };
+
+    QByteArray out;
+    out += "# HELP clipper_stage_latency_seconds Time spent in one pipeline stage.\n";
+    out += "# TYPE clipper_stage_latency_seconds summary\n";
+    for (int s = 0; s < Telemetry::StageCount; ++s) {
+        const Telemetry::Histogram& h = snapshot.stages[s];
+        const QByteArray stage = Telemetry::stageName(static_cast<Telemetry::Stage>(s));
+        for (double q : quantiles) {
+            out += "clipper_stage_latency_seconds{stage=\"" + stage + "\",quantile=\""
+                 + QByteArray::number(q) + "\"} " + seconds(h.percentileNs(q * 100.0)) + "\n";
+        }
+        out += "clipper_stage_latency_seconds_sum{stage=\"" + stage + "\"} " + seconds(h.totalNs) + "\n";
+        out += "clipper_stage_latency_seconds_count{stage=\"" + stage + "\"} "
+             + QByteArray::number((qulonglong)h.count) + "\n";
+    }
+
+    out += "# HELP clipper_stage_latency_max_seconds Longest time spent in one pipeline stage.\n";
+    out += "# TYPE clipper_stage_latency_max_seconds gauge\n";
+    for (int s = 0; s < Telemetry::StageCount; ++s) {
+        out += "clipper_stage_latency_max_seconds{stage=\""
+             + QByteArray(Telemetry::stageName(static_cast<Telemetry::Stage>(s))) + "\"} "
+             + seconds(snapshot.stages[s].maxNs) + "\n";
+    }
+
+    for (int c = 0; c < Telemetry::CounterCount; ++c) {
+        const QByteArray name = QByteArray("clipper_")
+            + Telemetry::counterName(static_cast<Telemetry::Counter>(c)) + "_total";
+        out += "# TYPE " + name + " counter\n";
+        out += name + " " + QByteArray::number((qulonglong)snapshot.counters[c]) + "\n";
+    }
+    return out;
+}
+
+QByteArray MetricsServer::json(const Telemetry::Snapshot& snapshot) {
+    QJsonObject stages;
+    for (int s = 0; s < Telemetry::StageCount; ++s) {
+        const Telemetry::Histogram& h = snapshot.stages[s];
+        QJsonObject stage;
+        stage["count"] = (qint64)h.count;
+        stage["mean_us"] = h.meanNs() / 1000.0;
+        stage["p50_us"] = h.percentileNs(50) / 1000.0;
+        stage["p90_us"] = h.percentileNs(90) / 1000.0;
+        stage["p99_us"] = h.percentileNs(99) / 1000.0;
+        stage["max_us"] = h.maxNs / 1000.0;
+        stages[Telemetry::stageName(static_cast<Telemetry::Stage>(s))] = stage;
+    }
+
+    QJsonObject counters;
+    for (int c = 0; c < Telemetry::CounterCount; ++c) {
+        counters[Telemetry::counterName(static_cast<Telemetry::Counter>(c))] = (qint64)snapshot.counters[c];
+    }
+
+    QJsonObject root;
+    root["stages"] = stages;
+    root["counters"] = counters;
+    return QJsonDocument(root).toJson(QJsonDocument::Compact);
+}
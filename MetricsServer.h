@@ -0,0 +1,65 @@
+#ifndef METRICSSERVER_H
+#define METRICSSERVER_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QString>
+#include "Telemetry.h"
+
+class QTcpServer;
+class QTcpSocket;
+
+/*
+ * MetricsServer
+ *
+ * Purpose
+ * - A small HTTP endpoint on localhost that serves the `Telemetry`
+ *   counters and histograms, so they can be scraped by Prometheus or
+ *   polled by a script while a game is running.
+ *
+ * Behaviour
+ * - `GET /metrics` answers in the Prometheus text format: one summary per
+ *   stage (`clipper_stage_latency_seconds`, with 0.5/0.9/0.99 quantiles,
+ *   sum and count), a max gauge per stage, and one `clipper_*_total`
+ *   counter per `Telemetry::Counter`.
+ * - `GET /metrics.json` answers with the same data as JSON, latencies in
+ *   microseconds.
+ * - Anything else gets a 404. Each connection serves one request and is
+ *   closed; there is no keep-alive and no TLS.
+ * - Only binds to the loopback interface.
+ *
+ * Error handling
+ * - `start()` returns false and sets `lastError()` if the port cannot be
+ *   bound.
+ *
+ * Threading
+ * - Lives on the GUI thread; requests are answered from its event loop.
+ *   Building a response takes one `Telemetry::snapshot()`.
+ */
+class MetricsServer : public QObject {
+    Q_OBJECT
+
+public:
+    explicit MetricsServer(QObject* parent = nullptr);
+    ~MetricsServer();
+
+    bool start(quint16 port);
+    void stop();
+    bool isListening() const;
+    quint16 port() const;
+    QString lastError() const { return m_lastError; }
+
+    static QByteArray prometheusText(const Telemetry::Snapshot& snapshot);
+    static QByteArray json(const Telemetry::Snapshot& snapshot);
+
+private slots:
+    void onNewConnection();
+
+private:
+    void handleRequest(QTcpSocket* socket);
+
+    QTcpServer* m_server;
+    QString m_lastError;
+};
+
+#endif // METRICSSERVER_H
@@ -0,0 +1,131 @@
+/*
+ * QualityController.cpp
+ *
+ * Load-driven quality levels for the capture loop.
+ */
+
+#include "QualityController.h"
+#include <QStringList>
+#include <algorithm>
+
+// Cheapest changes first: the encoder's quality costs the least to give
+// up, the frame rate the most
+static const QualityController::Level LEVELS[QualityController::LEVEL_COUNT] = {
+    { 75, 100, 100, 1 },
+    { 60,  75, 100, 1 },
+    { 45,  50, 100, 1 },
+    { 45,  50,  75, 1 },
+    { 45,  50,  50, 1 },
+    { 45,  50,  50, 2 },
+};
+
+// A level that only changes the capture size relative to the one before
+static bool sizeOnlyStep(int index) {
+    if (index <= 0 || index >= QualityController::LEVEL_COUNT) {
+        return false;
+    }
+    const QualityController::Level& a = LEVELS[index - 1];
+    const QualityController::Level& b = LEVELS[index];
+    return a.jpegQuality == b.jpegQuality && a.ratePercent == b.ratePercent && a.fpsDivisor == b.fpsDivisor;
+}
+
+const QualityController::Level& QualityController::level(int index) {
+    return LEVELS[std::clamp(index, 0, LEVEL_COUNT - 1)];
+}
+
+QString QualityController::describe(int index, bool encoded) {
+    const Level& l = level(index);
+    const Level& full = LEVELS[0];
+    QStringList parts;
+    if (encoded && l.ratePercent < full.ratePercent) {
+        parts << QString("%1% bitrate").arg(l.ratePercent);
+    } else if (!encoded && l.jpegQuality < full.jpegQuality) {
+        parts << QString("JPEG %1").arg(l.jpegQuality);
+    }
+    if (!encoded && l.scalePercent < full.scalePercent) {
+        parts << QString("%1% size").arg(l.scalePercent);
+    }
+    if (l.fpsDivisor > 1) {
+        parts << (l.fpsDivisor == 2 ? QString("half frame rate") : QString("1/%1 frame rate").arg(l.fpsDivisor));
+    }
+    return parts.isEmpty() ? QString("full quality") : parts.join(", ");
+}
+
+QualityController::QualityController() {
+    reset(true);
+}
+
+void QualityController::reset(bool canScale) {
+    m_canScale = canScale;
+    m_level = 0;
+    m_calmWindows = 0;
+    m_reason.clear();
+    m_windowStartUs = -1;
+    m_workUs = 0;
+    m_slots = 0;
+    m_missed = 0;
+    m_queueFill = 0.0;
+}
+
+int QualityController::nextLevel(int from, int step) const {
+    int next = from + step;
+    while (!m_canScale && sizeOnlyStep(next)) {
+        next += step;
+    }
+    return std::clamp(next, 0, LEVEL_COUNT - 1);
+}
+
+double QualityController::relativeCost(const Level& from, const Level& to) {
+    const double scale = to.scalePercent / (double)from.scalePercent;
+    return scale * scale * from.fpsDivisor / (double)to.fpsDivisor;
+}
+
+bool QualityController::update(int64_t nowUs, int64_t workUs, int queueDepth, int maxQueue, int missed) {
+    if (m_windowStartUs < 0) {
+        m_windowStartUs = nowUs;
+    }
+    m_workUs += (std::max<int64_t>)(0, workUs);
+    m_slots++;
+    m_missed += (std::max)(0, missed);
+    if (maxQueue > 0) {
+        m_queueFill = (std::max)(m_queueFill, queueDepth / (double)maxQueue);
+    }
+
+    const int64_t elapsedUs = nowUs - m_windowStartUs;
+    if (elapsedUs < WINDOW_US) {
+        return false;
+    }
+    const double busy = m_workUs / (double)elapsedUs;
+    const double missedShare = m_missed / (double)(m_slots + m_missed);
+    const double queueFill = m_queueFill;
+    const bool anyMissed = m_missed > 0;
+    m_windowStartUs = nowUs;
+    m_workUs = 0;
+    m_slots = 0;
+    m_missed = 0;
+    m_queueFill = 0.0;
+
+    const QString load = QString("capture busy %1%, queue %2%, missed %3%")
+        .arg(busy * 100.0, 0, 'f', 0).arg(queueFill * 100.0, 0, 'f', 0).arg(missedShare * 100.0, 0, 'f', 1);
+
+    int target = m_level;
+    if (busy > OVERLOAD_BUSY || queueFill >= 1.0 || missedShare > OVERLOAD_MISSED) {
+        m_calmWindows = 0;
+        target = nextLevel(m_level, 1);
+    } else if (m_level > 0 && !anyMissed && queueFill <= 0.25
+               && busy * relativeCost(current(), level(nextLevel(m_level, -1))) < RECOVER_BUSY) {
+        if (++m_calmWindows >= RECOVER_WINDOWS) {
+            m_calmWindows = 0;
+            target = nextLevel(m_level, -1);
+        }
+    } else {
+        m_calmWindows = 0;
+    }
+
+    if (target == m_level) {
+        return false;
+    }
+    m_level = target;
+    m_reason = load;
+    return true;
+}
@@ -0,0 +1,99 @@
+#ifndef QUALITYCONTROLLER_H
+#define QUALITYCONTROLLER_H
+
+#include <QString>
+#include <cstdint>
+
+/*
+ * QualityController
+ *
+ * Purpose
+ * - Keeps capture real-time when the machine is short of CPU (typically a
+ *   game saturating it): rather than falling behind and silently missing
+ *   frames, `ScreenRecorder` gives up quality one step at a time and takes
+ *   it back once the load is gone.
+ *
+ * Behaviour
+ * - The capture loop reports every frame slot: how long the capture thread
+ *   worked on it, the compression queue depth and the slots the pacer
+ *   missed. Every WINDOW_US the controller looks at the window:
+ *   - overloaded: the capture thread was busy for more than
+ *     OVERLOAD_BUSY of the window, the compression queue filled up, or
+ *     more than OVERLOAD_MISSED of the slots were missed. Quality drops
+ *     one level.
+ *   - calm: no missed slots, a near-empty queue, and the busy share would
+ *     stay under RECOVER_BUSY at the next better level (the cost of that
+ *     level is estimated from its pixel count and frame rate). After
+ *     RECOVER_WINDOWS calm windows in a row quality goes up one level.
+ * - Levels go from 0 (as configured) down to `LEVEL_COUNT - 1`: first
+ *   JPEG quality or the live encoder's rate, then the capture size, then
+ *   every other frame slot becomes a repeat. Without `canScale` (encoded
+ *   modes, where a new size means a new stream and an empty buffer) the
+ *   size levels are skipped.
+ *
+ * Threading
+ * - Owned and called by the capture thread only.
+ */
+class QualityController {
+public:
+    struct Level {
+        int jpegQuality;     // cap on the JPEG quality (JpegFrames)
+        int ratePercent;     // live encoder bitrate, or the crf equivalent
+        int scalePercent;    // capture height relative to the configured one
+        int fpsDivisor;      // 1 = every slot captured, 2 = every other one
+    };
+
+    // A level change at `timeUs` (MediaClock)
+    struct Change {
+        int64_t timeUs = 0;
+        int level = 0;
+    };
+
+    static constexpr int LEVEL_COUNT = 6;
+    static constexpr int64_t WINDOW_US = 1000000;
+    static constexpr double OVERLOAD_BUSY = 0.85;
+    static constexpr double OVERLOAD_MISSED = 0.05;
+    static constexpr double RECOVER_BUSY = 0.6;
+    static constexpr int RECOVER_WINDOWS = 5;
+
+    static const Level& level(int index);
+    // "JPEG 60, 75% size" or, for the encoded modes, "75% bitrate, half
+    // frame rate"; "full quality" for level 0
+    static QString describe(int index, bool encoded);
+
+    QualityController();
+
+    // Back to level 0 with an empty window
+    void reset(bool canScale);
+
+    /*
+     * update
+     * - Call once per frame slot. `workUs` is the capture thread's time on
+     *   the slot, `queueDepth`/`maxQueue` the compression backlog (0/0 when
+     *   there is none). Returns true when the level changed.
+     */
+    bool update(int64_t nowUs, int64_t workUs, int queueDepth, int maxQueue, int missed);
+
+    int currentLevel() const { return m_level; }
+    const Level& current() const { return level(m_level); }
+    // Why the last change happened, for the log
+    QString reason() const { return m_reason; }
+
+private:
+    int nextLevel(int from, int step) const;
+    static double relativeCost(const Level& from, const Level& to);
+
+    bool m_canScale;
+    int m_level;
+    int m_calmWindows;
+    QString m_reason;
+
+    // Current window
+    int64_t m_windowStartUs;
+    int64_t m_workUs;
+    int m_slots;
+    int m_missed;
+    double m_queueFill;
+};
+
+#endif // QUALITYCONTROLLER_H
@@ -0,0 +1,393 @@
+/*
+ * ReplayBuffer.cpp
+ *
+ * Slab-based storage for the JPEG replay buffer. Records are appended to
+ * the newest slab and only ever removed from the oldest, so a slab's
+ * contents never change once written; that is what lets snapshots share
+ * slabs with the capture thread without copying or locking.
+ */
+
+#include "ReplayBuffer.h"
+#include <QDebug>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <new>
+
+#ifdef _WIN32
+#include <windows.h>
+#elif __APPLE__
+#include <sys/types.h>
+#include <sys/sysctl.h>
+#else
+#include <unistd.h>
+#endif
+
+static const size_t MB = 1024 * 1024;
+
+// Records per slab; bounds a slab that fills up with repeats only
+static const size_t SLAB_SLOTS = 4096;
+
+struct ReplaySlab {
+    struct Slot {
+        size_t offset;
+        int size;
+        QSize originalSize;
+        QImage::Format format;
+        int64_t timestampUs;
+        bool repeat;
+        bool ownsBytes;   // false for repeats pointing at an earlier payload
+        size_t payloadsBefore;   // payload records ahead of this one in the slab
+    };
+
+    std::unique_ptr<char[]> bytes;
+    std::unique_ptr<Slot[]> slots;
+    size_t used = 0;       // bytes written
+    size_t count = 0;      // records written
+    size_t payloads = 0;   // records written that own their bytes
+};
+
+// A slab only the buffer references can be reused; one a snapshot still
+// holds is left to the snapshot to free
+static std::shared_ptr<ReplaySlab> reclaim(std::shared_ptr<ReplaySlab> slab) {
+    if (slab.use_count() != 1) {
+        return nullptr;
+    }
+    // Pairs with the release in the snapshot's final reference drop
+    std::atomic_thread_fence(std::memory_order_acquire);
+    slab->used = 0;
+    slab->count = 0;
+    slab->payloads = 0;
+    return slab;
+}
+
+VideoFrame ReplaySnapshot::front() const {
+    VideoFrame frame;
+    if (m_size == 0) {
+        return frame;
+    }
+    const ReplaySlab& slab = *m_slabs.front();
+    const ReplaySlab::Slot& slot = slab.slots[m_first];
+    frame.jpegData = QByteArray::fromRawData(slab.bytes.get() + slot.offset, slot.size);
+    frame.originalSize = slot.originalSize;
+    frame.format = slot.format;
+    frame.timestampUs = slot.timestampUs;
+    frame.repeat = slot.repeat;
+    return frame;
+}
+
+std::vector<VideoFrame> ReplaySnapshot::frames() const {
+    std::vector<VideoFrame> result;
+    result.reserve(m_size);
+
+    for (size_t s = 0; s < m_slabs.size(); s++) {
+        const ReplaySlab& slab = *m_slabs[s];
+        const size_t begin = (s == 0) ? m_first : 0;
+        // The newest slab may have grown since; only read what was there
+        const size_t end = (s + 1 == m_slabs.size()) ? m_lastCount : slab.count;
+        for (size_t i = begin; i < end; i++) {
+            const ReplaySlab::Slot& slot = slab.slots[i];
+            VideoFrame frame;
+            frame.jpegData = QByteArray::fromRawData(slab.bytes.get() + slot.offset, slot.size);
+            frame.originalSize = slot.originalSize;
+            frame.format = slot.format;
+            frame.timestampUs = slot.timestampUs;
+            frame.repeat = slot.repeat;
+            result.push_back(std::move(frame));
+        }
+    }
+    return result;
+}
+
+ReplayBuffer::ReplayBuffer(size_t budgetBytes)
+    : m_budget(0)
+    , m_slabBytes(0)
+    , m_maxSlabs(0)
+    , m_windowUs(30 * 1000000LL)
+    , m_front(0)
+    , m_frames(0)
+    , m_payloads(0)
+    , m_usedBytes(0)
+    , m_evictedByTime(0)
+    , m_evictedByBytes(0)
+    , m_rejected(0)
+{
+    configure(budgetBytes ? budgetBytes : defaultBudgetBytes());
+}
+
+ReplayBuffer::~ReplayBuffer() = default;
+
+size_t ReplayBuffer::defaultBudgetBytes() {
+    uint64_t physical = 0;
+#ifdef _WIN32
+    MEMORYSTATUSEX status;
+    status.dwLength = sizeof(status);
+    if (GlobalMemoryStatusEx(&status)) {
+        physical = status.ullTotalPhys;
+    }
+#elif __APPLE__
+    uint64_t memsize = 0;
+    size_t len = sizeof(memsize);
+    if (sysctlbyname("hw.memsize", &memsize, &len, nullptr, 0) == 0) {
+        physical = memsize;
+    }
+#else
+    const long pages = sysconf(_SC_PHYS_PAGES);
+    const long pageSize = sysconf(_SC_PAGE_SIZE);
+    if (pages > 0 && pageSize > 0) {
+        physical = (uint64_t)pages * (uint64_t)pageSize;
+    }
+#endif
+    const uint64_t budget = physical ? physical / 8 : 512 * MB;
+    return (size_t)std::min<uint64_t>(std::max<uint64_t>(budget, 256 * MB), 2048 * MB);
+}
+
+bool ReplayBuffer::setBudget(size_t budgetBytes) {
+    const size_t budget = budgetBytes ? budgetBytes : defaultBudgetBytes();
+    if (budget == m_budget) {
+        return false;
+    }
+    release();
+    configure(budget);
+    return true;
+}
+
+void ReplayBuffer::configure(size_t budget) {
+    // Large enough for a 4K payload with room to spare, small enough that
+    // evicting one slab drops only a few seconds
+    m_budget = budget;
+    m_slabBytes = (std::min)((std::max)(budget / 16, 8 * MB), 64 * MB);
+    m_maxSlabs = std::max<size_t>(2, budget / m_slabBytes);
+}
+
+void ReplayBuffer::setWindowUs(int64_t windowUs) {
+    m_windowUs = std::max<int64_t>(0, windowUs);
+    evictByTime();
+}
+
+std::shared_ptr<ReplaySlab> ReplayBuffer::allocateSlab() const {
+    std::shared_ptr<ReplaySlab> slab(new (std::nothrow) ReplaySlab);
+    if (!slab) {
+        return nullptr;
+    }
+    slab->bytes.reset(new (std::nothrow) char[m_slabBytes]);
+    slab->slots.reset(new (std::nothrow) ReplaySlab::Slot[SLAB_SLOTS]);
+    if (!slab->bytes || !slab->slots) {
+        qDebug() << "[ReplayBuffer] Could not allocate a" << m_slabBytes / MB << "MB slab";
+        return nullptr;
+    }
+    return slab;
+}
+
+bool ReplayBuffer::openSlab() {
+    std::shared_ptr<ReplaySlab> slab;
+    if (!m_spare.empty()) {
+        slab = std::move(m_spare.back());
+        m_spare.pop_back();
+    } else if (m_slabs.size() >= m_maxSlabs) {
+        slab = evictFrontSlab();
+    }
+    if (!slab) {
+        slab = allocateSlab();
+    }
+    if (!slab && m_slabs.size() > 1) {
+        // Out of memory below the budget: make do with what we have
+        slab = evictFrontSlab();
+    }
+    if (!slab) {
+        return false;
+    }
+    m_slabs.push_back(std::move(slab));
+    return true;
+}
+
+std::shared_ptr<ReplaySlab> ReplayBuffer::evictFrontSlab() {
+    std::shared_ptr<ReplaySlab> slab = std::move(m_slabs.front());
+    m_slabs.pop_front();
+    for (size_t i = m_front; i < slab->count; i++) {
+        if (slab->slots[i].ownsBytes) {
+            m_payloads--;
+            m_usedBytes -= slab->slots[i].size;
+        }
+    }
+    m_frames -= slab->count - m_front;
+    m_evictedByBytes += slab->count - m_front;
+    m_front = 0;
+    return reclaim(std::move(slab));
+}
+
+void ReplayBuffer::evictOldest() {
+    ReplaySlab& slab = *m_slabs.front();
+    const ReplaySlab::Slot& slot = slab.slots[m_front];
+    if (slot.ownsBytes) {
+        m_payloads--;
+        m_usedBytes -= slot.size;
+    }
+    m_frames--;
+    m_front++;
+
+    if (m_front == slab.count && m_slabs.size() > 1) {
+        std::shared_ptr<ReplaySlab> spare = reclaim(std::move(m_slabs.front()));
+        m_slabs.pop_front();
+        m_front = 0;
+        if (spare) {
+            m_spare.push_back(std::move(spare));
+        }
+    }
+}
+
+void ReplayBuffer::evictByTime() {
+    // Keeps at most one window of frames, and always the newest one
+    while (m_frames > 1) {
+        const ReplaySlab& oldest = *m_slabs.front();
+        const ReplaySlab& newest = *m_slabs.back();
+        if (newest.slots[newest.count - 1].timestampUs - oldest.slots[m_front].timestampUs < m_windowUs) {
+            break;
+        }
+        evictOldest();
+        m_evictedByTime++;
+    }
+}
+
+void ReplayBuffer::clear() {
+    while (!m_slabs.empty()) {
+        std::shared_ptr<ReplaySlab> spare = reclaim(std::move(m_slabs.back()));
+        m_slabs.pop_back();
+        if (spare) {
+            m_spare.push_back(std::move(spare));
+        }
+    }
+    m_front = 0;
+    m_frames = 0;
+    m_payloads = 0;
+    m_usedBytes = 0;
+}
+
+void ReplayBuffer::release() {
+    clear();
+    m_spare.clear();
+}
+
+bool ReplayBuffer::push(const VideoFrame& frame) {
+    ReplaySlab::Slot slot;
+    slot.originalSize = frame.originalSize;
+    slot.format = frame.format;
+    slot.timestampUs = frame.timestampUs;
+    slot.repeat = frame.repeat;
+
+    const char* data = frame.jpegData.constData();
+    size_t bytes = (size_t)frame.jpegData.size();
+    // Keeps the repeated payload alive should opening a slab evict it
+    std::shared_ptr<ReplaySlab> source;
+
+    if (frame.repeat) {
+        // Point at the payload being repeated; without one there is nothing to show
+        if (m_frames == 0) {
+            return false;
+        }
+        source = m_slabs.back();
+        const ReplaySlab::Slot& previous = source->slots[source->count - 1];
+        if (source->count < SLAB_SLOTS) {
+            slot.offset = previous.offset;
+            slot.size = previous.size;
+            slot.ownsBytes = false;
+            slot.payloadsBefore = source->payloads;
+            source->slots[source->count++] = slot;
+            m_frames++;
+            evictByTime();
+            return true;
+        }
+        // The slot table is full; the repeat opens the next slab with its
+        // own copy of the payload
+        data = source->bytes.get() + previous.offset;
+        bytes = (size_t)previous.size;
+    } else if (bytes == 0) {
+        return false;
+    }
+
+    if (bytes > m_slabBytes) {
+        m_rejected++;
+        return false;
+    }
+    const bool fits = !m_slabs.empty() &&
+                      m_slabs.back()->count < SLAB_SLOTS &&
+                      m_slabBytes - m_slabs.back()->used >= bytes;
+    if (!fits && !openSlab()) {
+        m_rejected++;
+        return false;
+    }
+
+    ReplaySlab& slab = *m_slabs.back();
+    memcpy(slab.bytes.get() + slab.used, data, bytes);
+    slot.offset = slab.used;
+    slot.size = (int)bytes;
+    slot.ownsBytes = true;
+    slot.payloadsBefore = slab.payloads;
+    slab.slots[slab.count++] = slot;
+    slab.used += bytes;
+    slab.payloads++;
+
+    m_frames++;
+    m_payloads++;
+    m_usedBytes += bytes;
+    evictByTime();
+    return true;
+}
+
+ReplaySnapshot ReplayBuffer::snapshot(size_t maxFrames) const {
+    ReplaySnapshot snapshot;
+    const size_t count = (std::min)(maxFrames, m_frames);
+    if (count == 0) {
+        return snapshot;
+    }
+
+    // Walk back from the newest slab until `count` records are covered
+    size_t remaining = count;
+    size_t first = m_slabs.size();
+    size_t firstRecord = 0;
+    while (first > 0) {
+        first--;
+        const ReplaySlab& slab = *m_slabs[first];
+        const size_t live = slab.count - (first == 0 ? m_front : 0);
+        if (live >= remaining) {
+            firstRecord = slab.count - remaining;
+            break;
+        }
+        remaining -= live;
+    }
+
+    snapshot.m_slabs.assign(m_slabs.begin() + first, m_slabs.end());
+    snapshot.m_first = firstRecord;
+    snapshot.m_lastCount = m_slabs.back()->count;
+    snapshot.m_size = count;
+
+    // Whole slabs, less what the oldest one holds ahead of the first record
+    for (const auto& slab : snapshot.m_slabs) {
+        snapshot.m_payloads += slab->payloads;
+        snapshot.m_bytes += slab->used;
+    }
+    const ReplaySlab::Slot& head = m_slabs[first]->slots[firstRecord];
+    snapshot.m_payloads -= head.payloadsBefore;
+    snapshot.m_bytes -= head.offset;
+    return snapshot;
+}
+
+ReplayBuffer::Stats ReplayBuffer::stats() const {
+    Stats stats;
+    stats.capacityBytes = (m_slabs.size() + m_spare.size()) * m_slabBytes;
+    stats.usedBytes = m_usedBytes;
+    stats.frames = m_frames;
+    stats.payloads = m_payloads;
+    stats.evictedByTime = m_evictedByTime;
+    stats.evictedByBytes = m_evictedByBytes;
+    stats.rejected = m_rejected;
+    if (m_frames > 0) {
+        const ReplaySlab& oldest = *m_slabs.front();
+        const ReplaySlab& newest = *m_slabs.back();
+        stats.durationUs = newest.slots[newest.count - 1].timestampUs - oldest.slots[m_front].timestampUs;
+    }
+    if (m_budget > 0) {
+        stats.fillPercent = m_usedBytes * 100.0 / m_budget;
+    }
+    return stats;
+}
@@ -0,0 +1,167 @@
+#ifndef REPLAYBUFFER_H
+#define REPLAYBUFFER_H
+
+#include <QByteArray>
+#include <QImage>
+#include <QSize>
+#include <deque>
+#include <memory>
+#include <vector>
+#include <cstdint>
+
+/*
+ * VideoFrame
+ * - One buffered JPEG-mode frame. When the screen did not change since the
+ *   previous capture, `repeat` is set and `jpegData` shares the previous
+ *   frame's payload (QByteArray implicit sharing, no extra memory), so a
+ *   slice of the buffer starting on a repeat is still decodable. Encoders
+ *   expand repeats by re-emitting the previous picture.
+ * - `timestampUs` is the frame's deadline on `MediaClock` (same clock as
+ *   `AudioSample::timestamp`). Consecutive frames are exactly one frame
+ *   interval apart; encoders derive presentation times from it.
+ */
+struct VideoFrame {
+    QByteArray jpegData;
+    QSize originalSize;
+    QImage::Format format;
+    int64_t timestampUs = 0;
+    bool repeat = false;
+};
+
+struct ReplaySlab;
+
+/*
+ * ReplaySnapshot
+ * - An immutable view of the newest frames of a `ReplayBuffer`. It holds
+ *   references to the slabs the frames live in, so taking one under the
+ *   buffer lock costs a few pointer copies regardless of the clip length,
+ *   and later eviction never touches the data it covers.
+ * - `frames()` builds `VideoFrame`s whose `jpegData` points straight into
+ *   the slabs (`QByteArray::fromRawData`, no copy). Those frames are only
+ *   valid while the snapshot they came from is alive. `front()` builds
+ *   just the oldest one; `payloads()` and `payloadBytes()` are counted
+ *   when the snapshot is taken, so none of these walk the frames.
+ * - Cheap to copy and safe to hand to another thread.
+ */
+class ReplaySnapshot {
+public:
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+    // Records that own a payload, and the bytes those take
+    size_t payloads() const { return m_payloads; }
+    size_t payloadBytes() const { return m_bytes; }
+
+    std::vector<VideoFrame> frames() const;
+    // The oldest frame; an empty VideoFrame for an empty snapshot
+    VideoFrame front() const;
+
+private:
+    friend class ReplayBuffer;
+
+    std::vector<std::shared_ptr<const ReplaySlab>> m_slabs;
+    size_t m_first = 0;       // first record in m_slabs.front()
+    size_t m_lastCount = 0;   // records of m_slabs.back() the snapshot covers
+    size_t m_size = 0;
+    size_t m_payloads = 0;
+    size_t m_bytes = 0;
+};
+
+/*
+ * ReplayBuffer
+ *
+ * Purpose
+ * - Holds the JPEG replay buffer in fixed-size slabs carved out of a byte
+ *   budget instead of one heap block per frame, so the memory a long
+ *   high-resolution buffer can take is bounded up front rather than
+ *   growing with the frame count.
+ *
+ * Behaviour
+ * - `push()` copies the payload into the newest slab; when it is full the
+ *   next slab is opened. Once the budget's worth of slabs exists the oldest
+ *   slab is evicted whole and reused (byte eviction). Frames older than the
+ *   time window are evicted one by one (time eviction).
+ * - Repeat records store no bytes; they point at the payload of the frame
+ *   they repeat in the same slab. A repeat that lands in a fresh slab takes
+ *   a copy of the payload, so every slab is self-contained.
+ * - `snapshot()` shares slabs with the caller instead of copying frames.
+ *   A slab still held by a snapshot is dropped from the buffer rather than
+ *   reused, so memory can exceed the budget by the slabs a save in
+ *   progress is reading.
+ * - Slabs are allocated as the buffer first fills and kept until
+ *   `release()` or a budget change, so steady-state capture does no
+ *   allocation.
+ *
+ * Threading
+ * - Not synchronised; `ScreenRecorder` guards it with `m_bufferMutex`.
+ *   Snapshots need no lock.
+ */
+class ReplayBuffer {
+public:
+    struct Stats {
+        size_t capacityBytes = 0;    // slabs allocated, including spares
+        size_t usedBytes = 0;        // payload bytes of the frames held
+        size_t frames = 0;           // records, including repeats
+        size_t payloads = 0;         // records that own a payload
+        double fillPercent = 0.0;    // usedBytes relative to the budget
+        int64_t durationUs = 0;      // newest - oldest timestamp
+        quint64 evictedByTime = 0;
+        quint64 evictedByBytes = 0;
+        quint64 rejected = 0;        // frames larger than a slab, or out of memory
+    };
+
+    // `budgetBytes` of 0 picks `defaultBudgetBytes()`
+    explicit ReplayBuffer(size_t budgetBytes = 0);
+    ~ReplayBuffer();
+
+    ReplayBuffer(const ReplayBuffer&) = delete;
+    ReplayBuffer& operator=(const ReplayBuffer&) = delete;
+
+    // Changing the budget drops the buffered frames; false if unchanged
+    bool setBudget(size_t budgetBytes);
+    size_t budget() const { return m_budget; }
+    size_t slabBytes() const { return m_slabBytes; }
+
+    // Frames older than newest - window are evicted
+    void setWindowUs(int64_t windowUs);
+
+    bool push(const VideoFrame& frame);
+    ReplaySnapshot snapshot(size_t maxFrames) const;
+
+    size_t size() const { return m_frames; }
+    bool empty() const { return m_frames == 0; }
+    void clear();
+    // clear() and free the slabs
+    void release();
+
+    Stats stats() const;
+
+    // An eighth of physical memory, between 256 MB and 2 GB
+    static size_t defaultBudgetBytes();
+
+private:
+    void configure(size_t budget);
+    bool openSlab();
+    std::shared_ptr<ReplaySlab> allocateSlab() const;
+    std::shared_ptr<ReplaySlab> evictFrontSlab();
+    void evictOldest();
+    void evictByTime();
+
+    size_t m_budget;
+    size_t m_slabBytes;
+    size_t m_maxSlabs;
+    int64_t m_windowUs;
+
+    std::deque<std::shared_ptr<ReplaySlab>> m_slabs;   // oldest first
+    std::vector<std::shared_ptr<ReplaySlab>> m_spare;  // emptied, ready for reuse
+    size_t m_front;       // first live record in m_slabs.front()
+    size_t m_frames;
+    size_t m_payloads;
+    size_t m_usedBytes;
+
+    quint64 m_evictedByTime;
+    quint64 m_evictedByBytes;
+    quint64 m_rejected;
+};
+
+#endif // REPLAYBUFFER_H
@@ -0,0 +1,303 @@
+/*
+ * SaveQueue.cpp
+ *
+ * Save scheduling. Requests wait in a FIFO until a slot is free; each
+ * running save is an `EncoderWorker` on its own low-priority QThread,
+ * reporting back to the queue through queued signals.
+ */
+
+#include "SaveQueue.h"
+#include "EncoderWorker.h"
+#include "Telemetry.h"
+#include <QDebug>
+#include <QFileInfo>
+
+SaveQueue::SaveQueue(QObject* parent)
+    : QObject(parent)
+    , m_maxConcurrent(DEFAULT_CONCURRENT)
+    , m_coalesceMs(DEFAULT_COALESCE_MS)
+    , m_nextJobId(1)
+{
+}
+
+SaveQueue::~SaveQueue() {
+    m_pending.clear();
+    for (const auto& worker : m_workers) {
+        if (worker->jobId != 0 && worker->encoder) {
+            worker->encoder->requestCancel();
+        }
+    }
+    // The encoders must outlive the threads using them
+    for (const auto& worker : m_workers) {
+        if (worker->thread) {
+            worker->thread->wait();
+        }
+    }
+}
+
+void SaveQueue::setMaxConcurrent(int jobs) {
+    m_maxConcurrent = std::clamp(jobs, 1, MAX_CONCURRENT);
+    startPending();
+}
+
+int SaveQueue::runningCount() const {
+    int running = 0;
+    for (const auto& worker : m_workers) {
+        if (worker->jobId != 0) {
+            running++;
+        }
+    }
+    return running;
+}
+
+SaveQueue::Stats SaveQueue::stats() const {
+    Stats stats = m_stats;
+    stats.queued = static_cast<int>(m_pending.size());
+    stats.running = runningCount();
+    return stats;
+}
+
+QString SaveQueue::uniquePath(const QString& path) const {
+    auto taken = [this](const QString& candidate) {
+        if (QFileInfo::exists(candidate)) {
+            return true;
+        }
+        for (const Job& job : m_pending) {
+            if (job.request.options.outputPath == candidate) {
+                return true;
+            }
+        }
+        for (const auto& worker : m_workers) {
+            if (worker->jobId != 0 && worker->outputPath == candidate) {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    if (!taken(path)) {
+        return path;
+    }
+    const QFileInfo info(path);
+    const QString stem = info.path() + "/" + info.completeBaseName();
+    const QString suffix = info.suffix().isEmpty() ? QString() : "." + info.suffix();
+    for (int n = 2;; n++) {
+        const QString candidate = QString("%1_%2%3").arg(stem).arg(n).arg(suffix);
+        if (!taken(candidate)) {
+            return candidate;
+        }
+    }
+}
+
+int SaveQueue::submit(Request request) {
+    std::vector<Request> requests;
+    requests.push_back(std::move(request));
+    return submit(std::move(requests)).front();
+}
+
+std::vector<int> SaveQueue::submit(std::vector<Request> requests) {
+    std::vector<int> ids;
+    if (requests.empty()) {
+        return ids;
+    }
+
+    // A second press right after the first is the same moment; keep one
+    // clip per request, with the newer snapshot if it has not started
+    if (!m_lastJobIds.empty() && m_coalesceMs > 0 &&
+        m_lastSubmit.isValid() && m_lastSubmit.elapsed() < m_coalesceMs)
+    {
+        for (size_t i = 0; i < requests.size(); ++i) {
+            const int target = m_lastJobIds[(std::min)(i, m_lastJobIds.size() - 1)];
+            for (Job& job : m_pending) {
+                if (job.id == target) {
+                    requests[i].options.outputPath = job.request.options.outputPath;
+                    job.request = std::move(requests[i]);
+                    break;
+                }
+            }
+            ids.push_back(target);
+            m_stats.coalesced++;
+            qDebug() << "[SaveQueue] Request coalesced into job" << target;
+            emit jobCoalesced(target);
+        }
+        return ids;
+    }
+
+    for (Request& request : requests) {
+        Job job;
+        job.id = m_nextJobId++;
+        job.request = std::move(request);
+        job.request.options.outputPath = uniquePath(job.request.options.outputPath);
+        job.queued.start();
+
+        const int id = job.id;
+        const QString outputPath = job.request.options.outputPath;
+        m_pending.push_back(std::move(job));
+        ids.push_back(id);
+        m_stats.submitted++;
+
+        qDebug() << "[SaveQueue] Job" << id << "queued:" << outputPath;
+        emit jobQueued(id, outputPath);
+    }
+    m_lastJobIds = ids;
+    m_lastSubmit.start();
+
+    startPending();
+    emit depthChanged(depth());
+    return ids;
+}
+
+void SaveQueue::cancel(int jobId) {
+    for (auto it = m_pending.begin(); it != m_pending.end(); ++it) {
+        if (it->id == jobId) {
+            const QString outputPath = it->request.options.outputPath;
+            m_pending.erase(it);
+            m_stats.canceled++;
+            emit jobCanceled(jobId, outputPath);
+            emit depthChanged(depth());
+            return;
+        }
+    }
+    // A running job reports back through onJobDone
+    for (const auto& worker : m_workers) {
+        if (worker->jobId == jobId) {
+            worker->encoder->requestCancel();
+            return;
+        }
+    }
+}
+
+void SaveQueue::cancelAll() {
+    while (!m_pending.empty()) {
+        cancel(m_pending.back().id);
+    }
+    for (const auto& worker : m_workers) {
+        if (worker->jobId != 0) {
+            worker->encoder->requestCancel();
+        }
+    }
+}
+
+void SaveQueue::startPending() {
+    while (!m_pending.empty() && runningCount() < m_maxConcurrent) {
+        Worker* idle = nullptr;
+        for (const auto& worker : m_workers) {
+            if (worker->jobId == 0) {
+                idle = worker.get();
+                break;
+            }
+        }
+        if (!idle) {
+            m_workers.push_back(std::make_unique<Worker>());
+            idle = m_workers.back().get();
+        }
+
+        Job job = std::move(m_pending.front());
+        m_pending.pop_front();
+        startJob(*idle, std::move(job));
+    }
+}
+
+void SaveQueue::startJob(Worker& worker, Job&& job) {
+    worker.encoder = std::make_unique<VideoEncoder>();
+    worker.jobId = job.id;
+    worker.outputPath = job.request.options.outputPath;
+    worker.waitMs = job.queued.nsecsElapsed() / 1e6;
+    worker.succeeded = false;
+    worker.canceled = false;
+    worker.message.clear();
+    worker.clock.start();
+
+    Request& request = job.request;
+    EncoderWorker* encoderWorker = !request.clip.packets.empty()
+        ? new EncoderWorker(worker.encoder.get(), std::move(request.clip), std::move(request.mic),
+                            std::move(request.desktop), request.options)
+        : !request.displays.empty()
+        ? new EncoderWorker(worker.encoder.get(), std::move(request.displays), std::move(request.mic),
+                            std::move(request.desktop), request.options)
+        : new EncoderWorker(worker.encoder.get(), std::move(request.frames), std::move(request.mic),
+                            std::move(request.desktop), request.options);
+
+    QThread* thread = new QThread;
+    thread->setObjectName(QString("Save%1").arg(job.id));
+    encoderWorker->moveToThread(thread);
+    worker.thread = thread;
+
+    connect(thread, &QThread::started, encoderWorker, &EncoderWorker::process);
+    // Direct, so the thread also stops while the destructor waits for it
+    connect(encoderWorker, &EncoderWorker::finished, thread, &QThread::quit, Qt::DirectConnection);
+    connect(encoderWorker, &EncoderWorker::finished, encoderWorker, &QObject::deleteLater);
+    connect(thread, &QThread::finished, thread, &QObject::deleteLater);
+
+    // Queued to this thread, in the order the encoder emitted them
+    const int id = job.id;
+    Worker* slot = &worker;
+    connect(encoderWorker, &EncoderWorker::progressUpdate, this, [this, id](int percent) {
+        emit jobProgress(id, percent);
+    });
+    connect(encoderWorker, &EncoderWorker::outputGrowing, this, [this, id](const QString& outputPath) {
+        emit jobOutputGrowing(id, outputPath);
+    });
+    connect(encoderWorker, &EncoderWorker::outputDiscarded, this, [this, id]() {
+        emit jobOutputDiscarded(id);
+    });
+    connect(encoderWorker, &EncoderWorker::encodingComplete, this, [slot](bool success, const QString& message) {
+        slot->succeeded = success;
+        slot->message = message;
+    });
+    connect(encoderWorker, &EncoderWorker::errorOccurred, this, [slot](const QString& error) {
+        slot->message = error;
+    });
+    connect(encoderWorker, &EncoderWorker::encodingCanceled, this, [slot]() {
+        slot->canceled = true;
+    });
+    connect(encoderWorker, &EncoderWorker::finished, this, [this, slot]() {
+        onJobDone(slot);
+    });
+    // Queued behind the one above, so the result is always reported first
+    connect(thread, &QThread::finished, this, [this, slot]() {
+        onThreadFinished(slot);
+    });
+
+    // Below capture and the game; JpegDecodeQueue's workers inherit this
+    thread->start(QThread::LowPriority);
+
+    qDebug() << "[SaveQueue] Job" << id << "started after" << worker.waitMs << "ms";
+    emit jobStarted(id);
+}
+
+void SaveQueue::onJobDone(Worker* worker) {
+    const int id = worker->jobId;
+    const QString outputPath = worker->outputPath;
+    const double encodeMs = worker->clock.nsecsElapsed() / 1e6;
+    const double waitMs = worker->waitMs;
+
+    // The slot stays taken until its thread has finished; see onThreadFinished
+    if (worker->canceled) {
+        m_stats.canceled++;
+        qDebug() << "[SaveQueue] Job" << id << "canceled after" << encodeMs << "ms";
+        emit jobCanceled(id, outputPath);
+    } else {
+        if (worker->succeeded) {
+            m_stats.completed++;
+            Telemetry::add(Telemetry::ClipsSaved);
+            m_stats.totalEncodeMs += encodeMs;
+        } else {
+            m_stats.failed++;
+        }
+        m_stats.lastWaitMs = waitMs;
+        m_stats.lastEncodeMs = encodeMs;
+        qDebug() << "[SaveQueue] Job" << id << (worker->succeeded ? "done" : "failed")
+                 << "- waited" << waitMs << "ms, encoded in" << encodeMs << "ms";
+        emit jobFinished(id, worker->succeeded, outputPath, worker->message, waitMs, encodeMs);
+    }
+}
+
+void SaveQueue::onThreadFinished(Worker* worker) {
+    // Only now is the encoder out of use, and is the thread no longer one
+    // the destructor has to wait for. The thread deletes itself.
+    worker->jobId = 0;
+    worker->encoder.reset();
+    startPending();
+    emit depthChanged(depth());
+}
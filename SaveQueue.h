@@ -0,0 +1,155 @@
+#ifndef SAVEQUEUE_H
+#define SAVEQUEUE_H
+
+#include <QObject>
+#include <QString>
+#include <QElapsedTimer>
+#include <QPointer>
+#include <QThread>
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <vector>
+#include "VideoEncoder.h"
+
+/*
+ * SaveQueue
+ *
+ * Purpose
+ * - Schedules clip saves so that pressing the clip hotkey again while a
+ *   save is running queues another clip instead of being ignored. Each
+ *   request is snapshotted when it is made; encoding happens later on a
+ *   small pool of save threads.
+ *
+ * Behaviour
+ * - At most `maxConcurrent()` saves encode at once, each with its own
+ *   `VideoEncoder`; the rest wait in submission order. Save threads run at
+ *   QThread::LowPriority (and the decode threads they start inherit it),
+ *   so a save never competes with capture for the CPU.
+ * - Requests hold snapshots, not copies: overlapping clips reference the
+ *   same replay slabs, segment files and audio blocks, which stay alive
+ *   until the last save using them is done.
+ * - A request made within `coalesceWindowMs()` of the last accepted one is
+ *   treated as a double press. If that save has not started yet it takes
+ *   the newer snapshot; either way no second clip is written, and the id
+ *   of the existing job is returned.
+ * - One press can save several clips at once (one per display). Such a
+ *   group is submitted together and coalesces as a unit: a double press
+ *   folds each request into the matching job of the previous group.
+ * - Two requests for the same file name (the name has one-second
+ *   resolution) get "_2", "_3", ... appended.
+ * - Every job reports how long it waited for a thread and how long it took
+ *   to encode; `stats()` keeps totals and the queue depth.
+ * - A fragmented save reports `jobOutputGrowing` once its file can be read
+ *   while it is written, and `jobOutputDiscarded` if a fallback starts it
+ *   over (see `VideoEncoder`).
+ *
+ * Threading
+ * - All methods and signals belong to the thread that owns the queue (the
+ *   GUI thread). Destroying the queue cancels what is still queued or
+ *   running and waits for the save threads to stop.
+ */
+class SaveQueue : public QObject {
+    Q_OBJECT
+
+public:
+    struct Request {
+        ReplaySnapshot frames;    // the JPEG capture modes
+        EncodedClip clip;         // the encoded capture modes
+        std::vector<ReplaySnapshot> displays;  // JPEG mode, composited side by side
+        AudioSnapshot mic;
+        AudioSnapshot desktop;
+        VideoEncoder::EncodeOptions options;
+    };
+
+    struct Stats {
+        int queued = 0;           // waiting for a save thread
+        int running = 0;
+        quint64 submitted = 0;    // accepted requests
+        quint64 coalesced = 0;    // requests folded into an earlier one
+        quint64 completed = 0;
+        quint64 failed = 0;
+        quint64 canceled = 0;
+        double lastWaitMs = 0;
+        double lastEncodeMs = 0;
+        double totalEncodeMs = 0; // over completed jobs
+    };
+
+    static constexpr int DEFAULT_CONCURRENT = 2;
+    static constexpr int MAX_CONCURRENT = 4;
+    static constexpr int DEFAULT_COALESCE_MS = 1000;
+
+    explicit SaveQueue(QObject* parent = nullptr);
+    ~SaveQueue();
+
+    // Returns the job id, or the id of the job the request was folded into
+    int submit(Request request);
+    // One press saving several clips; returns one id per request
+    std::vector<int> submit(std::vector<Request> requests);
+    // A running job stops at its next frame and removes its partial file
+    void cancel(int jobId);
+    void cancelAll();
+
+    // Applies to saves started from now on
+    void setMaxConcurrent(int jobs);
+    int maxConcurrent() const { return m_maxConcurrent; }
+    void setCoalesceWindowMs(int ms) { m_coalesceMs = (std::max)(0, ms); }
+    int coalesceWindowMs() const { return m_coalesceMs; }
+
+    int depth() const { return static_cast<int>(m_pending.size()) + runningCount(); }
+    Stats stats() const;
+
+signals:
+    void jobQueued(int jobId, const QString& outputPath);
+    void jobStarted(int jobId);
+    void jobProgress(int jobId, int percent);
+    void jobFinished(int jobId, bool success, const QString& outputPath,
+                     const QString& message, double waitMs, double encodeMs);
+    void jobCanceled(int jobId, const QString& outputPath);
+    void jobCoalesced(int jobId);
+    void jobOutputGrowing(int jobId, const QString& outputPath);
+    void jobOutputDiscarded(int jobId);
+    void depthChanged(int depth);
+
+private:
+    struct Job {
+        int id = 0;
+        Request request;
+        QElapsedTimer queued;
+    };
+
+    // One save slot. Each job gets a fresh encoder, so a cancel that
+    // arrives just as a job ends cannot stop the slot's next one.
+    struct Worker {
+        std::unique_ptr<VideoEncoder> encoder;
+        QPointer<QThread> thread;
+        int jobId = 0;            // 0 while idle
+        QString outputPath;
+        QElapsedTimer clock;
+        double waitMs = 0;
+        bool succeeded = false;
+        bool canceled = false;
+        QString message;
+    };
+
+    void startPending();
+    void startJob(Worker& worker, Job&& job);
+    void onJobDone(Worker* worker);
+    void onThreadFinished(Worker* worker);
+    int runningCount() const;
+    QString uniquePath(const QString& path) const;
+
+    int m_maxConcurrent;
+    int m_coalesceMs;
+    int m_nextJobId;
+    std::deque<Job> m_pending;
+    std::vector<std::unique_ptr<Worker>> m_workers;
+
+    // The jobs of the last accepted press, for coalescing
+    std::vector<int> m_lastJobIds;
+    QElapsedTimer m_lastSubmit;
+
+    Stats m_stats;
+};
+
+#endif // SAVEQUEUE_H
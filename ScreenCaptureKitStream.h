@@ -0,0 +1,106 @@
+#ifndef SCREENCAPTUREKITSTREAM_H
+#define SCREENCAPTUREKITSTREAM_H
+
+#include <QRect>
+#include <QSize>
+#include <QString>
+#include <cstdint>
+#include <memory>
+
+struct __CVBuffer;   // CVPixelBufferRef is a __CVBuffer*
+
+/*
+ * ScreenCaptureKitStream (macOS 12.3+)
+ *
+ * Purpose
+ * - Streaming display capture for `ScreenRecorder`, replacing one
+ *   synchronous CGDisplayCreateImage snapshot per frame. An SCStream on the
+ *   display delivers IOSurface-backed CVPixelBuffers as the window server
+ *   composes them, already cropped, scaled and, for NV12, colour
+ *   converted on the GPU. The capture thread only picks up the newest one.
+ *
+ * Behaviour
+ * - `start` blocks until the stream runs or fails; looking the display up in
+ *   the shareable content is also where screen recording permission is
+ *   checked. Frames then arrive on a private dispatch queue at up to
+ *   `Config::fps`, and never faster than the display refreshes. Only
+ *   complete frames count: when nothing on screen changed the stream sends
+ *   idle frames, which leave the newest frame as it was.
+ * - `acquireFrame` hands out the newest frame, retained for the caller,
+ *   if it arrived after the previous call and reports `Unchanged`
+ *   otherwise. The stream's pool holds QUEUE_DEPTH buffers, enough for
+ *   the caller to keep one (the encoder's last frame) while new ones come.
+ * - `sourceRect` is in display pixels, like the rest of the capture area
+ *   code; it is converted to the points ScreenCaptureKit works in.
+ *   `reconfigure` changes it and the output size while the stream runs.
+ *   Buffers of the old size keep coming until the change applies.
+ *
+ * Error handling
+ * - `start` returns false with `lastError()` when ScreenCaptureKit is
+ *   missing (macOS before 12.3), the display is not shareable or
+ *   permission was not granted. A stream the system stops (display
+ *   unplugged, permission revoked) makes `acquireFrame` return `Failed`
+ *   until it is started again.
+ *
+ * Threading
+ * - Owned and called by the capture thread. The delivery queue only
+ *   touches the newest-frame slot, under its own mutex.
+ */
+class ScreenCaptureKitStream {
+public:
+    enum PixelFormat {
+        BGRA,   // Format_RGB32 byte order, for the JPEG mode
+        NV12    // video range BT.601, for the live encoder
+    };
+
+    enum FrameResult {
+        Failed,
+        NewFrame,
+        Unchanged
+    };
+
+    struct Config {
+        uint32_t displayId = 0;   // CGDirectDisplayID
+        QRect sourceRect;         // display pixels
+        QSize outputSize;         // size of the delivered buffers
+        int fps = 30;
+        PixelFormat format = BGRA;
+        bool showCursor = true;
+    };
+
+    static constexpr int QUEUE_DEPTH = 5;
+    static constexpr int START_TIMEOUT_MS = 5000;
+
+    static bool isAvailable();
+    // The display's current mode in pixels (not points); empty if unknown
+    static QSize displayPixelSize(uint32_t displayId);
+
+    ScreenCaptureKitStream();
+    ~ScreenCaptureKitStream();
+
+    ScreenCaptureKitStream(const ScreenCaptureKitStream&) = delete;
+    ScreenCaptureKitStream& operator=(const ScreenCaptureKitStream&) = delete;
+
+    bool start(const Config& config);
+    void stop();
+    bool isRunning() const;
+    bool reconfigure(const QRect& sourceRect, const QSize& outputSize);
+    const Config& config() const { return m_config; }
+
+    // On `NewFrame` *outBuffer is retained; CVPixelBufferRelease it.
+    // Otherwise it is set to nullptr.
+    FrameResult acquireFrame(__CVBuffer** outBuffer);
+
+    QString lastError() const { return m_lastError; }
+
+private:
+    struct State;   // Objective-C objects, see the .mm
+
+    bool setError(const QString& message);
+
+    Config m_config;
+    QString m_lastError;
+    std::unique_ptr<State> m_state;
+};
+
+#endif // SCREENCAPTUREKITSTREAM_H
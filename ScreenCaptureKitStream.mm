@@ -0,0 +1,310 @@
+/*
+ * ScreenCaptureKitStream.mm
+ *
+ * SCStream display capture for macOS 12.3+. Objective-C++ built with ARC;
+ * the Objective-C side stays in this file behind `State`.
+ */
+
+#include "ScreenCaptureKitStream.h"
+#include <QDebug>
+#include <QMutex>
+#include <QMutexLocker>
+#include <algorithm>
+
+#import <Foundation/Foundation.h>
+#import <CoreGraphics/CoreGraphics.h>
+#import <CoreMedia/CoreMedia.h>
+#import <CoreVideo/CoreVideo.h>
+#import <ScreenCaptureKit/ScreenCaptureKit.h>
+
+// The newest complete frame; written by the delivery queue, read by the
+// capture thread
+struct LatestFrame {
+    QMutex mutex;
+    CVPixelBufferRef buffer = nullptr;
+    uint64_t sequence = 0;
+    bool stopped = false;
+    QString error;
+
+    ~LatestFrame() {
+        if (buffer) {
+            CVPixelBufferRelease(buffer);
+        }
+    }
+};
+
+static QString nsErrorString(NSError* error) {
+    return error ? QString::fromNSString(error.localizedDescription) : QString("unknown error");
+}
+
+API_AVAILABLE(macos(12.3))
+@interface ClipperStreamOutput : NSObject <SCStreamOutput, SCStreamDelegate>
+- (instancetype)initWithLatest:(std::shared_ptr<LatestFrame>)latest;
+@end
+
+@implementation ClipperStreamOutput {
+    std::shared_ptr<LatestFrame> _latest;
+}
+
+- (instancetype)initWithLatest:(std::shared_ptr<LatestFrame>)latest {
+    if ((self = [super init])) {
+        _latest = std::move(latest);
+    }
+    return self;
+}
+
+- (void)stream:(SCStream*)stream didOutputSampleBuffer:(CMSampleBufferRef)sampleBuffer
+        ofType:(SCStreamOutputType)type {
+    if (type != SCStreamOutputTypeScreen || !CMSampleBufferIsValid(sampleBuffer)) {
+        return;
+    }
+
+    // Idle (nothing changed), blank and suspended frames carry no picture
+    CFArrayRef attachments = CMSampleBufferGetSampleAttachmentsArray(sampleBuffer, false);
+    if (!attachments || CFArrayGetCount(attachments) == 0) {
+        return;
+    }
+    NSDictionary* info = (__bridge NSDictionary*)CFArrayGetValueAtIndex(attachments, 0);
+    NSNumber* status = info[SCStreamFrameInfoStatus];
+    if (!status || status.integerValue != SCFrameStatusComplete) {
+        return;
+    }
+    CVPixelBufferRef buffer = CMSampleBufferGetImageBuffer(sampleBuffer);
+    if (!buffer) {
+        return;
+    }
+
+    CVPixelBufferRetain(buffer);
+    CVPixelBufferRef previous = nullptr;
+    {
+        QMutexLocker locker(&_latest->mutex);
+        previous = _latest->buffer;
+        _latest->buffer = buffer;
+        _latest->sequence++;
+    }
+    if (previous) {
+        CVPixelBufferRelease(previous);
+    }
+}
+
+- (void)stream:(SCStream*)stream didStopWithError:(NSError*)error {
+    QMutexLocker locker(&_latest->mutex);
+    _latest->stopped = true;
+    _latest->error = nsErrorString(error);
+}
+
+@end
+
+// Typed as id so the struct needs no availability guard; the members are
+// only used inside @available(macOS 12.3) blocks
+struct ScreenCaptureKitStream::State {
+    std::shared_ptr<LatestFrame> latest;
+    id stream = nil;            // SCStream
+    id output = nil;            // ClipperStreamOutput
+    dispatch_queue_t queue = nil;
+    double pointsPerPixel = 1.0;
+    uint64_t consumed = 0;
+};
+
+API_AVAILABLE(macos(12.3))
+static SCStreamConfiguration* makeConfiguration(const ScreenCaptureKitStream::Config& config,
+                                                double pointsPerPixel) {
+    SCStreamConfiguration* sc = [[SCStreamConfiguration alloc] init];
+    sc.width = static_cast<size_t>((std::max)(2, config.outputSize.width()));
+    sc.height = static_cast<size_t>((std::max)(2, config.outputSize.height()));
+    sc.sourceRect = CGRectMake(config.sourceRect.x() * pointsPerPixel, config.sourceRect.y() * pointsPerPixel,
+                               config.sourceRect.width() * pointsPerPixel,
+                               config.sourceRect.height() * pointsPerPixel);
+    sc.minimumFrameInterval = CMTimeMake(1, (std::max)(1, config.fps));
+    sc.queueDepth = ScreenCaptureKitStream::QUEUE_DEPTH;
+    sc.showsCursor = config.showCursor;
+    if (config.format == ScreenCaptureKitStream::NV12) {
+        // BT.601 video range is what swscale assumes for the other capture
+        // paths, so every encoded stream has the same colours
+        sc.pixelFormat = kCVPixelFormatType_420YpCbCr8BiPlanarVideoRange;
+        sc.colorMatrix = kCGDisplayStreamYCbCrMatrix_ITU_R_601_4;
+    } else {
+        sc.pixelFormat = kCVPixelFormatType_32BGRA;
+    }
+    return sc;
+}
+
+bool ScreenCaptureKitStream::isAvailable() {
+    if (@available(macOS 12.3, *)) {
+        return true;
+    }
+    return false;
+}
+
+QSize ScreenCaptureKitStream::displayPixelSize(uint32_t displayId) {
+    CGDisplayModeRef mode = CGDisplayCopyDisplayMode(displayId);
+    if (!mode) {
+        return QSize();
+    }
+    const QSize size(static_cast<int>(CGDisplayModeGetPixelWidth(mode)),
+                     static_cast<int>(CGDisplayModeGetPixelHeight(mode)));
+    CGDisplayModeRelease(mode);
+    return size;
+}
+
+ScreenCaptureKitStream::ScreenCaptureKitStream()
+    : m_state(std::make_unique<State>())
+{
+}
+
+ScreenCaptureKitStream::~ScreenCaptureKitStream() {
+    stop();
+}
+
+bool ScreenCaptureKitStream::setError(const QString& message) {
+    m_lastError = message;
+    qDebug() << "[ScreenCaptureKit]" << m_lastError;
+    return false;
+}
+
+bool ScreenCaptureKitStream::isRunning() const {
+    return m_state->stream != nil;
+}
+
+bool ScreenCaptureKitStream::start(const Config& config) {
+    stop();
+    m_config = config;
+    m_lastError.clear();
+
+    if (@available(macOS 12.3, *)) {
+        const dispatch_time_t deadline = dispatch_time(DISPATCH_TIME_NOW, START_TIMEOUT_MS * NSEC_PER_MSEC);
+
+        // Both lookups and start are asynchronous; the capture thread waits.
+        // __block variables live on the heap, so a late completion is safe.
+        __block SCShareableContent* content = nil;
+        __block NSError* contentError = nil;
+        dispatch_semaphore_t listed = dispatch_semaphore_create(0);
+        [SCShareableContent getShareableContentExcludingDesktopWindows:NO
+                                                   onScreenWindowsOnly:YES
+                                                     completionHandler:^(SCShareableContent* result, NSError* error) {
+            content = result;
+            contentError = error;
+            dispatch_semaphore_signal(listed);
+        }];
+        if (dispatch_semaphore_wait(listed, deadline) != 0) {
+            return setError("Timed out listing shareable content");
+        }
+        if (!content) {
+            return setError(QString("No shareable content (screen recording permission?): %1")
+                .arg(nsErrorString(contentError)));
+        }
+
+        SCDisplay* display = nil;
+        for (SCDisplay* candidate in content.displays) {
+            if (candidate.displayID == config.displayId) {
+                display = candidate;
+                break;
+            }
+        }
+        if (!display) {
+            return setError(QString("Display %1 is not shareable").arg(config.displayId));
+        }
+        const QSize pixels = displayPixelSize(config.displayId);
+        const double pointsPerPixel = pixels.width() > 0 ? display.width / (double)pixels.width() : 1.0;
+
+        SCContentFilter* filter = [[SCContentFilter alloc] initWithDisplay:display excludingWindows:@[]];
+        auto latest = std::make_shared<LatestFrame>();
+        ClipperStreamOutput* output = [[ClipperStreamOutput alloc] initWithLatest:latest];
+        SCStream* stream = [[SCStream alloc] initWithFilter:filter
+                                              configuration:makeConfiguration(config, pointsPerPixel)
+                                                   delegate:output];
+        dispatch_queue_t queue = dispatch_queue_create("clipper.screencapturekit", DISPATCH_QUEUE_SERIAL);
+
+        NSError* addError = nil;
+        if (![stream addStreamOutput:output type:SCStreamOutputTypeScreen
+                  sampleHandlerQueue:queue error:&addError]) {
+            return setError(QString("Adding the stream output failed: %1").arg(nsErrorString(addError)));
+        }
+
+        __block NSError* startError = nil;
+        dispatch_semaphore_t started = dispatch_semaphore_create(0);
+        [stream startCaptureWithCompletionHandler:^(NSError* error) {
+            startError = error;
+            dispatch_semaphore_signal(started);
+        }];
+        if (dispatch_semaphore_wait(started, deadline) != 0) {
+            [stream stopCaptureWithCompletionHandler:^(NSError*) {}];
+            return setError("Timed out starting the stream");
+        }
+        if (startError) {
+            return setError(QString("Starting the stream failed: %1").arg(nsErrorString(startError)));
+        }
+
+        m_state->latest = latest;
+        m_state->stream = stream;
+        m_state->output = output;
+        m_state->queue = queue;
+        m_state->pointsPerPixel = pointsPerPixel;
+        m_state->consumed = 0;
+        qDebug() << "[ScreenCaptureKit] Streaming display" << config.displayId
+                 << config.outputSize.width() << "x" << config.outputSize.height()
+                 << "@" << config.fps << "fps" << (config.format == NV12 ? "NV12" : "BGRA");
+        return true;
+    }
+    return setError("ScreenCaptureKit needs macOS 12.3 or later");
+}
+
+void ScreenCaptureKitStream::stop() {
+    if (@available(macOS 12.3, *)) {
+        SCStream* stream = m_state->stream;
+        if (stream) {
+            // Wait so no frame is delivered into a stream that is gone
+            dispatch_semaphore_t stopped = dispatch_semaphore_create(0);
+            [stream stopCaptureWithCompletionHandler:^(NSError*) {
+                dispatch_semaphore_signal(stopped);
+            }];
+            dispatch_semaphore_wait(stopped, dispatch_time(DISPATCH_TIME_NOW, START_TIMEOUT_MS * NSEC_PER_MSEC));
+        }
+    }
+    m_state->stream = nil;
+    m_state->output = nil;
+    m_state->queue = nil;
+    m_state->latest.reset();
+    m_state->consumed = 0;
+}
+
+bool ScreenCaptureKitStream::reconfigure(const QRect& sourceRect, const QSize& outputSize) {
+    if (@available(macOS 12.3, *)) {
+        SCStream* stream = m_state->stream;
+        if (!stream) {
+            return false;
+        }
+        m_config.sourceRect = sourceRect;
+        m_config.outputSize = outputSize;
+        [stream updateConfiguration:makeConfiguration(m_config, m_state->pointsPerPixel)
+                  completionHandler:^(NSError* error) {
+            if (error) {
+                qDebug() << "[ScreenCaptureKit] Reconfiguring the stream failed:" << nsErrorString(error);
+            }
+        }];
+        return true;
+    }
+    return false;
+}
+
+ScreenCaptureKitStream::FrameResult ScreenCaptureKitStream::acquireFrame(__CVBuffer** outBuffer) {
+    *outBuffer = nullptr;
+    const std::shared_ptr<LatestFrame> latest = m_state->latest;
+    if (!latest) {
+        return Failed;
+    }
+
+    QMutexLocker locker(&latest->mutex);
+    if (latest->stopped) {
+        m_lastError = QString("Stream stopped: %1").arg(latest->error);
+        return Failed;
+    }
+    // Before the first frame there is nothing to repeat either; the caller
+    // treats that like any capture that produced nothing
+    if (!latest->buffer || latest->sequence == m_state->consumed) {
+        return Unchanged;
+    }
+    m_state->consumed = latest->sequence;
+    *outBuffer = CVPixelBufferRetain(latest->buffer);
+    return NewFrame;
+}
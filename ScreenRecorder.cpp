@@ -8,22 +8,33 @@
  *
  * The class runs on its own `QThread` and stores compressed frames in a
  * memory-backed circular buffer to support instant-replay functionality.
+ * Depending on the capture mode the buffer holds either JPEG stills or
+ * continuously encoded H.264/HEVC packets grouped into whole GOPs.
  */
 
 #include "ScreenRecorder.h"
+#include "FramePacer.h"
+#include "Telemetry.h"
+#include "SyntheticSource.h"
 #include <QDebug>
 #include <QThread>
 #include <QScreen>
 #include <QGuiApplication>
-#include <QBuffer>
 #include <QIODevice>
 #include <algorithm>
-#include <d3d11.h>
-#include <dxgi1_2.h>
+#include <cstring>
 
 #ifdef _WIN32
+#include <d3d11.h>
+#include <dxgi1_2.h>
+#include <dwmapi.h>
 #pragma comment(lib, "d3d11.lib")
 #pragma comment(lib, "dxgi.lib")
+#pragma comment(lib, "dwmapi.lib")
+#elif !defined(__APPLE__)
+#include <X11/extensions/Xrandr.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
 #endif
 
 ScreenRecorder::ScreenRecorder(int fps, QObject *parent)
@@ -32,17 +43,67 @@ ScreenRecorder::ScreenRecorder(int fps, QObject *parent)
     , m_bufferSeconds(30)
     , m_recording(false)
     , m_stopRequested(false)
+    , m_budgetWarned(false)
+    , m_compressionWorkers(0)
+    , m_backpressurePolicy(CompressionPipeline::DropOldest)
+    , m_firstFrameStored(false)
+    , m_captureMode(JpegFrames)
+    , m_liveEncoder(std::make_unique<LiveEncoder>())
+    , m_encoderBackend(EncoderBackend::Auto)
+    , m_zeroCopy(false)
+    , m_encoderEpochUs(-1)
+    , m_lastEncodedPts(-1)
+    , m_packetCount(0)
+    , m_packetBufferBytes(0)
+    , m_spillActive(false)
+    , m_spillToDisk(false)
+    , m_maxOutputHeight(0)
+    , m_displayIndex(-1)
+    , m_captureWindowId(0)
+    , m_adaptiveQuality(true)
+    , m_qualityLevel(0)
+    , m_qualityScalePercent(100)
+    , m_qualityRatePercent(100)
 #ifdef _WIN32
     , m_d3dDevice(nullptr)
     , m_d3dContext(nullptr)
     , m_deskDupl(nullptr)
     , m_lastFramePresented(0)
+    , m_outputOrigin{}
+    , m_stagingPool{}
+    , m_stagingNext(0)
+    , m_videoDevice(nullptr)
+    , m_videoContext(nullptr)
+    , m_vpEnum(nullptr)
+    , m_videoProcessor(nullptr)
+    , m_vpInputTexture(nullptr)
+    , m_vpOutputTexture(nullptr)
+    , m_vpInputView(nullptr)
+    , m_vpOutputView(nullptr)
+    , m_vpWidth(0)
+    , m_vpHeight(0)
+    , m_vpInputWidth(0)
+    , m_vpInputHeight(0)
+    , m_vpOutputFormat(DXGI_FORMAT_UNKNOWN)
+    , m_vpSourceRect{}
+    , m_gpuConvertUnavailable(false)
 #elif __APPLE__
     , m_displayID(CGMainDisplayID())
+    , m_sckPixelBuffer(nullptr)
 #else
     , m_display(nullptr)
     , m_root(0)
     , m_image(nullptr)
+    , m_shmInfo{}
+    , m_useShm(false)
+    , m_screenWidth(0)
+    , m_screenHeight(0)
+    , m_useDamage(false)
+    , m_damageEventBase(0)
+    , m_damage(0)
+    , m_damageRegion(0)
+    , m_damagePending(false)
+    , m_fullGrabNeeded(true)
 #endif
 {
 }
@@ -57,16 +118,153 @@ ScreenRecorder::~ScreenRecorder() {
 }
 
 void ScreenRecorder::setBufferSeconds(int seconds) {
+    seconds = (std::max)(1, (std::min)(seconds, MAX_BUFFER_SECONDS));
     m_bufferSeconds = seconds;
     
     QMutexLocker locker(&m_bufferMutex);
-    // Calculate the maximum number of frames to keep: FPS × desired seconds.
-    // If we exceed this limit, discard old frames from the front of the deque.
-    size_t maxFrames = seconds * m_fps;
+    // Keep one window of frames: anything older than `seconds` before the
+    // newest frame is evicted from the replay buffer.
+    m_replayBuffer.setWindowUs((int64_t)seconds * 1000000);
+    m_budgetWarned = false;
     
-    while (m_frameBuffer.size() > maxFrames) {
-        m_frameBuffer.pop_front();
+    prunePacketBuffer();
+}
+
+void ScreenRecorder::setSpillToDisk(bool enabled, const QString& directory) {
+    QMutexLocker locker(&m_bufferMutex);
+    m_spillToDisk = enabled;
+    m_spillDirectory = directory;
+}
+
+QString ScreenRecorder::spillDirectory() {
+    QMutexLocker locker(&m_bufferMutex);
+    return m_spillDirectory;
+}
+
+QStringList ScreenRecorder::availableDisplays() {
+    QStringList names;
+#ifdef _WIN32
+    // Same enumeration and filtering as initD3D, so indices match
+    IDXGIFactory1* factory = nullptr;
+    if (FAILED(CreateDXGIFactory1(__uuidof(IDXGIFactory1), (void**)&factory))) {
+        return names;
+    }
+    IDXGIAdapter1* adapter = nullptr;
+    for (UINT i = 0; factory->EnumAdapters1(i, &adapter) != DXGI_ERROR_NOT_FOUND; i++) {
+        DXGI_ADAPTER_DESC1 desc;
+        adapter->GetDesc1(&desc);
+        if (!(desc.Flags & DXGI_ADAPTER_FLAG_SOFTWARE)) {
+            IDXGIOutput* output = nullptr;
+            for (UINT j = 0; adapter->EnumOutputs(j, &output) != DXGI_ERROR_NOT_FOUND; j++) {
+                DXGI_OUTPUT_DESC outDesc;
+                output->GetDesc(&outDesc);
+                if (outDesc.AttachedToDesktop) {
+                    const RECT& r = outDesc.DesktopCoordinates;
+                    names << QString("%1 (%2x%3)").arg(QString::fromWCharArray(outDesc.DeviceName))
+                                                  .arg(r.right - r.left).arg(r.bottom - r.top);
+                }
+                output->Release();
+            }
+        }
+        adapter->Release();
     }
+    factory->Release();
+#elif __APPLE__
+    CGDirectDisplayID displays[16];
+    uint32_t count = 0;
+    if (CGGetActiveDisplayList(16, displays, &count) == kCGErrorSuccess) {
+        for (uint32_t i = 0; i < count; i++) {
+            names << QString("Display %1%2 (%3x%4)").arg(i + 1)
+                         .arg(CGDisplayIsMain(displays[i]) ? " (main)" : "")
+                         .arg(CGDisplayPixelsWide(displays[i])).arg(CGDisplayPixelsHigh(displays[i]));
+        }
+    }
+#else
+    Display* display = XOpenDisplay(nullptr);
+    if (!display) {
+        return names;
+    }
+    int count = 0;
+    XRRMonitorInfo* monitors = XRRGetMonitors(display, DefaultRootWindow(display), True, &count);
+    for (int i = 0; i < count; i++) {
+        char* name = XGetAtomName(display, monitors[i].name);
+        names << QString("%1 (%2x%3)").arg(name ? QString::fromLatin1(name) : QString("Monitor %1").arg(i + 1))
+                                      .arg(monitors[i].width).arg(monitors[i].height);
+        if (name) {
+            XFree(name);
+        }
+    }
+    if (monitors) {
+        XRRFreeMonitors(monitors);
+    }
+    XCloseDisplay(display);
+#endif
+    return names;
+}
+
+void ScreenRecorder::setCaptureRegion(const QRect& region) {
+    QMutexLocker locker(&m_bufferMutex);
+    m_captureRegion = region.normalized();
+}
+
+void ScreenRecorder::setCaptureWindow(const QString& title) {
+    QMutexLocker locker(&m_bufferMutex);
+    m_captureWindowTitle = title.trimmed();
+}
+
+QRect ScreenRecorder::captureRegion() {
+    QMutexLocker locker(&m_bufferMutex);
+    return m_captureRegion;
+}
+
+QString ScreenRecorder::captureWindow() {
+    QMutexLocker locker(&m_bufferMutex);
+    return m_captureWindowTitle;
+}
+
+bool ScreenRecorder::setBufferBudgetMB(int megabytes) {
+    QMutexLocker locker(&m_bufferMutex);
+    if (!m_replayBuffer.setBudget((size_t)(std::max)(0, megabytes) * 1024 * 1024)) {
+        return false;
+    }
+    m_budgetWarned = false;
+    emit debugLog(QString("⚙️ [ScreenRecorder] Replay buffer budget: %1 MB%2")
+        .arg(m_replayBuffer.budget() / (1024 * 1024))
+        .arg(megabytes <= 0 ? " (auto)" : ""));
+    return true;
+}
+
+ReplayBuffer::Stats ScreenRecorder::replayStats() {
+    QMutexLocker locker(&m_bufferMutex);
+    return m_replayBuffer.stats();
+}
+
+bool ScreenRecorder::setSyntheticSource(std::shared_ptr<SyntheticFrameSource> source) {
+    if (isRunning()) {
+        emit debugLog("⚠️  WARNING: The capture source can only be changed while recording is stopped");
+        return false;
+    }
+    m_synthetic = std::move(source);
+    return true;
+}
+
+bool ScreenRecorder::setCaptureMode(CaptureMode mode) {
+    if (isRunning()) {
+        emit debugLog("⚠️  WARNING: Capture mode can only be changed while recording is stopped");
+        return false;
+    }
+    
+    m_captureMode = mode;
+    clearBuffer();
+    if (mode != JpegFrames) {
+        // Encoded modes keep packets, not JPEGs; give the arena back
+        QMutexLocker locker(&m_bufferMutex);
+        m_replayBuffer.release();
+    }
+    
+    static const char* names[] = { "JPEG frames", "continuous H.264", "continuous HEVC" };
+    emit debugLog(QString("⚙️ [ScreenRecorder] Capture mode: %1").arg(names[mode]));
+    return true;
 }
 
 void ScreenRecorder::startRecording() {
@@ -86,96 +284,92 @@ void ScreenRecorder::stopRecording() {
     wait(5000);
 }
 
-void ScreenRecorder::compressFrame(const QImage &raw, VideoFrame &outFrame) {
-    if (raw.isNull()) {
-        emit debugLog("❌ [Compress] ERROR: Raw image is null!");
-        return;
-    }
-
-    // Convert to RGB888 format which JPEG supports well (JPEG doesn't include alpha).
-    // This is a simple color space conversion that the QImage class handles internally.
-    QImage frameToSave = raw.convertToFormat(QImage::Format_RGB888);
-
-    QBuffer buffer(&outFrame.jpegData);
-    if (!buffer.open(QIODevice::WriteOnly)) {
-        emit debugLog("❌ [Compress] ERROR: Failed to open QBuffer for writing!");
-        return;
-    }
-
-    // Attempt JPEG compression at quality 75 (0-100 scale). Higher quality means
-    // larger files but less visible artifacts. Qt's save() function uses libjpeg.
-    bool saved = frameToSave.save(&buffer, "JPG", 75);
+void ScreenRecorder::storeCompressedFrame(const VideoFrame& frame) {
+    bool budgetExceeded = false;
+    ReplayBuffer::Stats stats;
+    size_t budget = 0;
+    {
+        Telemetry::Timer lockTimer(Telemetry::BufferLock);
+        QMutexLocker locker(&m_bufferMutex);
+        lockTimer.stop();
+        Telemetry::Timer insertTimer(Telemetry::BufferInsert);
+        if (!m_replayBuffer.push(frame) && !frame.repeat) {
+            emit debugLog(QString("❌ [Buffer] Frame of %1 KB rejected (slab %2 MB)")
+                .arg(frame.jpegData.size() / 1024)
+                .arg(m_replayBuffer.slabBytes() / (1024 * 1024)));
+        }
 
-    // Fallback strategy: if JPEG fails (often due to missing image format plugins),
-    // try PNG as a second attempt. PNG is always built into Qt.
-    if (!saved) {
-        emit debugLog("⚠️ [Compress] JPG save failed (Missing plugin?). Trying PNG...");
-        buffer.seek(0);
-        outFrame.jpegData.clear();
-        saved = frameToSave.save(&buffer, "PNG");
-        if (saved) {
-             emit debugLog("✓ [Compress] Saved as PNG instead.");
+        // Warn once per configuration when bytes, not time, limit the buffer
+        stats = m_replayBuffer.stats();
+        if (!m_budgetWarned && stats.evictedByBytes > 0 &&
+            stats.durationUs < (int64_t)m_bufferSeconds * 1000000) {
+            m_budgetWarned = true;
+            budgetExceeded = true;
+            budget = m_replayBuffer.budget();
         }
     }
 
-    if (!saved) {
-        // If both JPEG and PNG failed, there is a serious issue with image codec
-        // plugins or the buffer state. Log diagnostics to help debug.
-        emit debugLog("❌ [Compress] CRITICAL: Failed to save image (Both JPG and PNG failed)!");
-        emit debugLog(QString("  Input format: %1").arg(raw.format()));
-    } else {
-        // Log compression success only once to avoid flooding the debug console.
-        static bool firstLog = true;
-        if (firstLog) {
-            emit debugLog("✓ [Compress] Frame compression working!");
-            emit debugLog(QString("  Compressed to: %1 KB").arg(outFrame.jpegData.size() / 1024));
-            firstLog = false;
-        }
+    if (budgetExceeded) {
+        emit debugLog(QString("⚠️ [Buffer] Memory budget (%1 MB) holds only %2 of %3 seconds - "
+                              "raise the budget or lower the buffer length")
+            .arg(budget / (1024 * 1024))
+            .arg(stats.durationUs / 1000000.0, 0, 'f', 1)
+            .arg(m_bufferSeconds));
     }
 
-    outFrame.originalSize = raw.size();
-    outFrame.format = raw.format();
-    buffer.close();
+    // Log first successful frame
+    if (!frame.repeat && !m_firstFrameStored.exchange(true)) {
+        emit debugLog("═══════════════════════════════════════════════════════════════");
+        emit debugLog("✓✓✓ [Capture] FIRST FRAME CAPTURED & BUFFERED SUCCESSFULLY ✓✓✓");
+        emit debugLog(QString("  • Frame size: %1 KB (compressed)").arg(frame.jpegData.size() / 1024));
+        emit debugLog(QString("  • Resolution: %1x%2")
+            .arg(frame.originalSize.width()).arg(frame.originalSize.height()));
+        emit debugLog("  • System is now recording frames into buffer at " +
+            QString::number(m_fps) + " FPS");
+        emit debugLog("═══════════════════════════════════════════════════════════════");
+    }
 }
 
-std::vector<VideoFrame> ScreenRecorder::getFrames(int seconds) {
-    QMutexLocker locker(&m_bufferMutex);
+ReplaySnapshot ScreenRecorder::getFrames(int seconds) {
+    const int framesToGet = (std::max)(0, seconds * m_fps);
+    ReplaySnapshot snapshot;
+    size_t buffered = 0;
+    {
+        // Only slab references are taken under the lock, so capture does
+        // not stall while the clip is being saved
+        Telemetry::Timer timer(Telemetry::SaveSnapshot);
+        QMutexLocker locker(&m_bufferMutex);
+        buffered = m_replayBuffer.size();
+        snapshot = m_replayBuffer.snapshot(framesToGet);
+    }
     
     emit debugLog("═══════════════════════════════════════════════════════════════");
     emit debugLog("[GetFrames] 🔍 Extracting frames from buffer for encoding");
     emit debugLog(QString("  • Requested duration: %1 seconds").arg(seconds));
-    emit debugLog(QString("  • Current buffer size: %1 frames").arg(m_frameBuffer.size()));
+    emit debugLog(QString("  • Current buffer size: %1 frames").arg(buffered));
     emit debugLog(QString("  • FPS: %1").arg(m_fps));
-    
-    int framesToGet = seconds * m_fps;
     emit debugLog(QString("  • Frames to retrieve: %1").arg(framesToGet));
     
-    std::vector<VideoFrame> result;
+    int startIdx = (std::max)(0, (int)buffered - framesToGet);
+    emit debugLog(QString("  • Retrieving from index: %1 to %2").arg(startIdx).arg(buffered));
+    emit debugLog(QString("✓ Retrieved: %1 frames (%2 seconds)")
+        .arg(snapshot.size()).arg(snapshot.size() / (double)m_fps, 0, 'f', 1));
     
-    int startIdx = (std::max)(0, (int)m_frameBuffer.size() - framesToGet);
-    emit debugLog(QString("  • Retrieving from index: %1 to %2").arg(startIdx).arg(m_frameBuffer.size()));
-    
-    for (size_t i = startIdx; i < m_frameBuffer.size(); i++) {
-        result.push_back(m_frameBuffer[i]);
-    }
-    
-    emit debugLog(QString("✓ Retrieved: %1 frames (%.1f seconds)").arg(result.size()).arg(result.size() / (double)m_fps));
-    
-    // Log compression stats and diagnose empty jpegData
-    if (!result.empty()) {
-        if (!result[0].jpegData.isEmpty()) {
+    // Log compression stats and diagnose empty jpegData; the totals come
+    // with the snapshot, so the frames are not built here
+    if (!snapshot.empty()) {
+        const VideoFrame first = snapshot.front();
+        if (!first.jpegData.isEmpty()) {
             emit debugLog("✓✓ Frames ARE properly JPEG compressed (ready for encoding!)");
-            emit debugLog(QString("  • Sample frame: %1 KB").arg(result[0].jpegData.size() / 1024));
-            emit debugLog(QString("  • Resolution: %1x%2").arg(result[0].originalSize.width()).arg(result[0].originalSize.height()));
-            // Calculate total
-            size_t totalSize = 0;
-            for (const auto& frame : result) {
-                totalSize += frame.jpegData.size();
-            }
-            emit debugLog(QString("  • Total buffer: %1 MB").arg(totalSize / 1024.0 / 1024.0, 0, 'f', 2));
+            emit debugLog(QString("  • Sample frame: %1 KB").arg(first.jpegData.size() / 1024));
+            emit debugLog(QString("  • Resolution: %1x%2").arg(first.originalSize.width()).arg(first.originalSize.height()));
+            emit debugLog(QString("  • Total buffer: %1 MB in %2 payloads (%3 repeats)")
+                .arg(snapshot.payloadBytes() / 1024.0 / 1024.0, 0, 'f', 2)
+                .arg(snapshot.payloads())
+                .arg(snapshot.size() - snapshot.payloads()));
         } else {
             emit debugLog("❌ ERROR: First frame has EMPTY jpegData!");
-            emit debugLog(QString("  • Original size stored: %1x%2").arg(result[0].originalSize.width()).arg(result[0].originalSize.height()));
+            emit debugLog(QString("  • Original size stored: %1x%2").arg(first.originalSize.width()).arg(first.originalSize.height()));
             emit debugLog("  • This means compression never happened!");
         }
     } else {
@@ -187,32 +381,524 @@ std::vector<VideoFrame> ScreenRecorder::getFrames(int seconds) {
     }
     emit debugLog("═══════════════════════════════════════════════════════════════");
 
-    return result;
+    return snapshot;
+}
+
+bool ScreenRecorder::ensureLiveEncoder(int width, int height) {
+    width &= ~1;
+    height &= ~1;
+    const LiveEncoder::Config& current = m_liveEncoder->config();
+    
+    // Open lazily on the first frame and reopen on resolution changes. The
+    // buffered packets belong to the old stream description, so drop them.
+    if (!m_liveEncoder->isOpen() || current.width != width || current.height != height) {
+        LiveEncoder::Config config;
+        config.codec = (m_captureMode == EncodedHEVC) ? LiveEncoder::HEVC : LiveEncoder::H264;
+        config.width = width;
+        config.height = height;
+        config.fps = m_fps;
+        config.backend = m_encoderBackend.load();
+#ifdef _WIN32
+        if (m_zeroCopy.load()) {
+            config.d3d11Device = m_d3dDevice;
+        }
+#elif __APPLE__
+        // ScreenCaptureKit's NV12 buffers go to VideoToolbox as they are
+        config.pixelBufferInput = m_sckStream != nullptr;
+#endif
+        
+        if (!m_liveEncoder->open(config)) {
+            emit debugLog(QString("❌ [Encode] Failed to open live encoder: %1").arg(m_liveEncoder->lastError()));
+            return false;
+        }
+        if (m_qualityRatePercent < 100) {
+            m_liveEncoder->setRateScale(m_qualityRatePercent);
+        }
+        
+        QMutexLocker locker(&m_bufferMutex);
+        m_packetGops.clear();
+        m_packetCount = 0;
+        m_packetBufferBytes = 0;
+        m_segments.clear();
+        m_streamInfo = m_liveEncoder->streamInfo();
+        m_encoderEpochUs = -1;
+        m_lastEncodedPts = -1;
+        
+        emit debugLog(QString("✓ [Encode] Live encoder ready: %1x%2, keyframe every %3s (%4%5)")
+            .arg(width).arg(height).arg(config.keyframeSeconds)
+            .arg(EncoderBackends::displayName(m_liveEncoder->activeBackend()))
+            .arg(m_liveEncoder->isZeroCopy() ? ", zero-copy" : ""));
+    }
+    return true;
+}
+
+int64_t ScreenRecorder::encoderPts(int64_t timestampUs) {
+    // Frame timestamps sit on the pacer's deadlines, so this is the frame
+    // slot index since the encoder opened; skipped slots leave pts gaps
+    // instead of compressing time.
+    if (m_encoderEpochUs < 0) {
+        m_encoderEpochUs = timestampUs;
+        QMutexLocker locker(&m_bufferMutex);
+        m_streamInfo.startTimeUs = timestampUs;
+    }
+    int64_t pts = ((timestampUs - m_encoderEpochUs) * m_fps + 500000) / 1000000;
+    if (pts <= m_lastEncodedPts) {
+        pts = m_lastEncodedPts + 1;
+    }
+    m_lastEncodedPts = pts;
+    return pts;
+}
+
+bool ScreenRecorder::encodeFrame(const QImage &raw, int64_t timestampUs) {
+    if (!ensureLiveEncoder(raw.width(), raw.height())) {
+        return false;
+    }
+    
+    std::vector<EncodedPacket> packets;
+    if (!m_liveEncoder->encode(raw, encoderPts(timestampUs), packets)) {
+        emit debugLog(QString("❌ [Encode] %1").arg(m_liveEncoder->lastError()));
+        return false;
+    }
+    storePackets(packets);
+    return true;
+}
+
+bool ScreenRecorder::encodeFrame(const Nv12Frame &raw, int64_t timestampUs) {
+    if (!ensureLiveEncoder(raw.width, raw.height)) {
+        return false;
+    }
+    
+    std::vector<EncodedPacket> packets;
+    if (!m_liveEncoder->encode(raw, encoderPts(timestampUs), packets)) {
+        emit debugLog(QString("❌ [Encode] %1").arg(m_liveEncoder->lastError()));
+        return false;
+    }
+    storePackets(packets);
+    return true;
+}
+
+#ifdef _WIN32
+bool ScreenRecorder::encodeGpuFrame(int64_t timestampUs) {
+    if (!ensureLiveEncoder(m_vpWidth, m_vpHeight)) {
+        return false;
+    }
+    
+    // The backend may have fallen back to one without D3D11 input; read
+    // the converted frame back and take the NV12 system-memory path then.
+    if (!m_liveEncoder->isZeroCopy()) {
+        return readbackNV12(m_nv12Frame) && encodeFrame(m_nv12Frame, timestampUs);
+    }
+    
+    std::vector<EncodedPacket> packets;
+    if (!m_liveEncoder->encode(m_vpOutputTexture, encoderPts(timestampUs), packets)) {
+        emit debugLog(QString("❌ [Encode] %1").arg(m_liveEncoder->lastError()));
+        return false;
+    }
+    storePackets(packets);
+    return true;
+}
+#endif
+
+bool ScreenRecorder::encodeRepeatFrame(int64_t timestampUs) {
+    if (!m_liveEncoder->isOpen()) {
+        return false;
+    }
+    
+#ifdef _WIN32
+    // Zero-copy keeps no system-memory frame; the last converted NV12
+    // texture is still current, so copy it into the encoder again.
+    if (m_liveEncoder->isZeroCopy()) {
+        return m_vpOutputTexture && encodeGpuFrame(timestampUs);
+    }
+#endif
+    
+    if (!m_liveEncoder->hasLastFrame()) {
+        return false;
+    }
+    
+    std::vector<EncodedPacket> packets;
+    if (!m_liveEncoder->repeatLastFrame(encoderPts(timestampUs), packets)) {
+        emit debugLog(QString("❌ [Encode] %1").arg(m_liveEncoder->lastError()));
+        return false;
+    }
+    storePackets(packets);
+    return true;
+}
+
+void ScreenRecorder::storePackets(std::vector<EncodedPacket>& packets) {
+    if (!packets.empty()) {
+        Telemetry::Timer lockTimer(Telemetry::BufferLock);
+        QMutexLocker locker(&m_bufferMutex);
+        lockTimer.stop();
+        Telemetry::Timer insertTimer(Telemetry::BufferInsert);
+        if (m_spillActive) {
+            for (const auto& packet : packets) {
+                m_segments.append(packet, m_streamInfo);
+            }
+            prunePacketBuffer();
+            return;
+        }
+        for (auto& packet : packets) {
+            appendPacket(std::move(packet));
+        }
+        prunePacketBuffer();
+    }
+}
+
+void ScreenRecorder::appendPacket(EncodedPacket&& packet) {
+    if (packet.keyframe || m_packetGops.empty()) {
+        m_packetGops.push_back(std::make_shared<PacketGop>());
+    } else if (m_packetGops.back().use_count() > 1) {
+        // A save holds this GOP; it keeps its copy and we append to ours.
+        // Costs one GOP of shallow packet copies, once per save.
+        m_packetGops.back() = std::make_shared<PacketGop>(*m_packetGops.back());
+    } else {
+        // Pairs with the release in the save's final reference drop
+        std::atomic_thread_fence(std::memory_order_acquire);
+    }
+    PacketGop& gop = *m_packetGops.back();
+    gop.bytes += packet.data.size();
+    m_packetBufferBytes += packet.data.size();
+    m_packetCount++;
+    gop.packets.push_back(std::move(packet));
+}
+
+void ScreenRecorder::prunePacketBuffer() {
+    if (m_streamInfo.timeBaseNum <= 0) {
+        return;
+    }
+    
+    const int64_t limit = (int64_t)m_bufferSeconds * m_streamInfo.timeBaseDen / m_streamInfo.timeBaseNum;
+    if (m_spillActive) {
+        m_segments.prune(limit);
+        return;
+    }
+    if (m_packetGops.empty()) {
+        return;
+    }
+    const int64_t newest = m_packetGops.back()->packets.back().pts;
+    
+    // Drop the first GOP only if the buffer starting at the next keyframe
+    // still covers the window. A save holding it keeps it alive.
+    while (m_packetGops.size() > 1 && newest - m_packetGops[1]->packets.front().pts >= limit) {
+        m_packetBufferBytes -= m_packetGops.front()->bytes;
+        m_packetCount -= m_packetGops.front()->packets.size();
+        m_packetGops.pop_front();
+    }
+}
+
+EncodedClip ScreenRecorder::getPackets(int seconds) {
+    EncodedClip clip;
+    std::vector<std::shared_ptr<const PacketGop>> gops;
+    size_t buffered = 0;
+    size_t bufferedBytes = 0;
+    {
+        // Only GOP references are taken under the lock, as with the JPEG
+        // buffer's slabs; the packets are copied out below
+        Telemetry::Timer timer(Telemetry::SaveSnapshot);
+        QMutexLocker locker(&m_bufferMutex);
+        clip.stream = m_streamInfo;
+        if (m_spillActive) {
+            return getSegmentPackets(seconds);
+        }
+        buffered = m_packetCount;
+        bufferedBytes = m_packetBufferBytes;
+        
+        if (!m_packetGops.empty() && m_streamInfo.timeBaseNum > 0) {
+            const int64_t wanted = (int64_t)seconds * m_streamInfo.timeBaseDen / m_streamInfo.timeBaseNum;
+            const int64_t startPts = m_packetGops.back()->packets.back().pts - wanted;
+            
+            // Start at the last keyframe at or before the requested start so
+            // the clip is decodable from its first packet
+            size_t first = 0;
+            for (size_t i = m_packetGops.size(); i-- > 0;) {
+                if (m_packetGops[i]->packets.front().pts <= startPts) {
+                    first = i;
+                    break;
+                }
+            }
+            gops.assign(m_packetGops.begin() + first, m_packetGops.end());
+        }
+    }
+    
+    emit debugLog(QString("[GetPackets] 🔍 Requested %1 seconds from %2 packets (%3 MB)")
+        .arg(seconds)
+        .arg(buffered)
+        .arg(bufferedBytes / 1024.0 / 1024.0, 0, 'f', 2));
+    
+    if (gops.empty()) {
+        emit debugLog("❌ [GetPackets] No encoded packets in buffer");
+        return clip;
+    }
+    
+    size_t count = 0;
+    for (const auto& gop : gops) {
+        count += gop->packets.size();
+    }
+    clip.packets.reserve(count);
+    for (const auto& gop : gops) {
+        clip.packets.insert(clip.packets.end(), gop->packets.begin(), gop->packets.end());
+    }
+    
+    const EncodedPacket& first = clip.packets.front();
+    const EncodedPacket& last = clip.packets.back();
+    double duration = (last.pts + last.duration - first.pts) * m_streamInfo.timeBaseNum
+                      / (double)m_streamInfo.timeBaseDen;
+    emit debugLog(QString("✓ [GetPackets] Retrieved %1 packets (%2 seconds)")
+        .arg(clip.packets.size()).arg(duration, 0, 'f', 1));
+    
+    return clip;
+}
+
+EncodedClip ScreenRecorder::getSegmentPackets(int seconds) {
+    emit debugLog(QString("[GetPackets] 🔍 Requested %1 seconds from %2 packets in %3 segments (%4 MB on disk, %5 MB in memory)")
+        .arg(seconds)
+        .arg(m_segments.packetCount())
+        .arg(m_segments.segmentCount())
+        .arg(m_segments.diskBytes() / 1024.0 / 1024.0, 0, 'f', 1)
+        .arg(m_segments.memoryBytes() / 1024.0 / 1024.0, 0, 'f', 1));
+    
+    const int64_t wanted = m_streamInfo.timeBaseNum > 0
+        ? (int64_t)seconds * m_streamInfo.timeBaseDen / m_streamInfo.timeBaseNum : 0;
+    EncodedClip clip = m_segments.clip(wanted, m_streamInfo);
+    if (clip.packets.empty()) {
+        emit debugLog("❌ [GetPackets] No encoded packets in buffer");
+        return clip;
+    }
+    
+    const EncodedPacket& first = clip.packets.front();
+    const EncodedPacket& last = clip.packets.back();
+    double duration = (last.pts + last.duration - first.pts) * m_streamInfo.timeBaseNum
+                      / (double)m_streamInfo.timeBaseDen;
+    emit debugLog(QString("✓ [GetPackets] Retrieved %1 packets (%2 seconds) from %3 segments")
+        .arg(clip.packets.size()).arg(duration, 0, 'f', 1).arg(clip.storage.size()));
+    return clip;
 }
 
 void ScreenRecorder::clearBuffer() {
     QMutexLocker locker(&m_bufferMutex);
-    m_frameBuffer.clear();
+    m_replayBuffer.clear();
+    m_packetGops.clear();
+    m_packetCount = 0;
+    m_packetBufferBytes = 0;
+    m_segments.clear();
 }
 
-void ScreenRecorder::run() {
-#ifdef _WIN32
-    if (!initD3D()) {
-        emit debugLog("❌ [Init] FAILED: DirectX initialization failed!");
-        emit errorOccurred("Failed to initialize DirectX");
+void ScreenRecorder::resolveCaptureArea(const QRect& screen) {
+    QRect region;
+    QString windowTitle;
+    {
+        QMutexLocker locker(&m_bufferMutex);
+        region = m_captureRegion;
+        windowTitle = m_captureWindowTitle;
+    }
+    
+    const QSize screenSize = screen.size();
+    QRect area = screen;
+    m_captureScreen = screen;
+    m_captureWindowId = 0;
+    
+    if (!windowTitle.isEmpty()) {
+        QRect windowRect;
+        if (findCaptureWindow(windowTitle) && captureWindowRect(windowRect) &&
+            windowRect.intersects(screen)) {
+            area = windowRect & screen;
+        } else {
+            m_captureWindowId = 0;
+            emit debugLog(QString("⚠️  [Capture] No window titled \"%1\" on this screen - capturing %2")
+                .arg(windowTitle, QString(region.isEmpty() ? "the whole screen" : "the region")));
+        }
+    }
+    if (!m_captureWindowId && !region.isEmpty()) {
+        region.translate(screen.topLeft());
+        if (region.intersects(screen)) {
+            area = region & screen;
+        } else {
+            emit debugLog(QString("⚠️  [Capture] Region %1x%2+%3+%4 is outside the %5x%6 screen - capturing all of it")
+                .arg(region.width()).arg(region.height())
+                .arg(region.x() - screen.x()).arg(region.y() - screen.y())
+                .arg(screenSize.width()).arg(screenSize.height()));
+        }
+    }
+    
+    // Even sizes for NV12 and the 4:2:0 encoders
+    area.setWidth((std::max)(2, area.width() & ~1));
+    area.setHeight((std::max)(2, area.height() & ~1));
+    
+    m_captureRect = area;
+    updateOutputSize();
+    m_captureAreaFrame = QImage();
+    m_windowTrackTimer.start();
+    
+    if (area.size() != screenSize || isScalingCapture()) {
+        emit debugLog(QString("✓ [Capture] Area %1x%2 at (%3,%4) of the %5x%6 screen%7 -> output %8x%9")
+            .arg(area.width()).arg(area.height())
+            .arg(area.x() - screen.x()).arg(area.y() - screen.y())
+            .arg(screenSize.width()).arg(screenSize.height())
+            .arg(m_captureWindowId ? QString(", following \"%1\"").arg(windowTitle) : QString())
+            .arg(m_outputSize.width()).arg(m_outputSize.height()));
+    }
+}
+
+void ScreenRecorder::updateOutputSize() {
+    const QSize configured = FrameScaler::fitHeight(m_captureRect.size(), m_maxOutputHeight.load());
+    m_outputSize = m_qualityScalePercent < 100
+        ? FrameScaler::fitHeight(m_captureRect.size(), configured.height() * m_qualityScalePercent / 100)
+        : configured;
+}
+
+std::vector<QualityController::Change> ScreenRecorder::qualityTimeline() {
+    QMutexLocker locker(&m_bufferMutex);
+    return std::vector<QualityController::Change>(m_qualityTimeline.begin(), m_qualityTimeline.end());
+}
+
+void ScreenRecorder::updateQuality(int64_t slotStartUs, int missed) {
+    const int previous = m_quality.currentLevel();
+    const int64_t nowUs = MediaClock::nowUs();
+    if (!m_adaptiveQuality.load()) {
+        // Switched off while degraded: straight back to full quality
+        if (previous != 0) {
+            m_quality.reset(m_captureMode == JpegFrames);
+            applyQualityLevel(nowUs);
+            emit qualityRestored(0, QualityController::describe(0, m_captureMode != JpegFrames));
+        }
         return;
     }
-    emit debugLog("✓ [Init] DirectX initialized and ready");
-#elif defined(__linux__)
-    if (!initX11()) {
-        emit debugLog("❌ [Init] FAILED: X11 initialization failed!");
-        emit errorOccurred("Failed to initialize X11");
+    
+    int queueDepth = 0;
+    int maxQueue = 0;
+    if (m_compression) {
+        queueDepth = m_compression->stats().queueDepth;
+        maxQueue = m_compression->maxQueue();
+    }
+    if (!m_quality.update(nowUs, nowUs - slotStartUs, queueDepth, maxQueue, missed)) {
+        return;
+    }
+    
+    applyQualityLevel(nowUs);
+    const int level = m_quality.currentLevel();
+    const QString description = QualityController::describe(level, m_captureMode != JpegFrames);
+    if (level > previous) {
+        emit debugLog(QString("⚠️  [Quality] Capture falling behind (%1) - now %2")
+            .arg(m_quality.reason(), description));
+        emit qualityDegraded(level, description);
+    } else {
+        emit debugLog(QString("✓ [Quality] Load dropped (%1) - back to %2")
+            .arg(m_quality.reason(), description));
+        emit qualityRestored(level, description);
+    }
+}
+
+void ScreenRecorder::applyQualityLevel(int64_t timeUs) {
+    const QualityController::Level& level = m_quality.current();
+    if (m_compression) {
+        m_compression->setQualityCap(level.jpegQuality);
+    }
+    
+    // The encoded modes keep their size: a new one would start a new
+    // stream and drop the buffer
+    m_qualityRatePercent = level.ratePercent;
+    if (m_liveEncoder->isOpen() && !m_liveEncoder->setRateScale(level.ratePercent) && level.ratePercent < 100) {
+        emit debugLog("ℹ️ [Quality] This encoder cannot change its rate mid-stream; only the frame rate step applies");
+    }
+    const int scale = m_captureMode == JpegFrames ? level.scalePercent : 100;
+    if (scale != m_qualityScalePercent) {
+        m_qualityScalePercent = scale;
+        updateOutputSize();
+    }
+    
+    m_qualityLevel = m_quality.currentLevel();
+    QMutexLocker locker(&m_bufferMutex);
+    m_qualityTimeline.push_back({ timeUs, m_quality.currentLevel() });
+    // Keep the change in force at the start of the buffer, drop the rest
+    const int64_t bufferStartUs = timeUs - (int64_t)m_bufferSeconds * 1000000;
+    while (m_qualityTimeline.size() > 1 && m_qualityTimeline[1].timeUs <= bufferStartUs) {
+        m_qualityTimeline.pop_front();
+    }
+}
+
+void ScreenRecorder::trackCaptureWindow() {
+    if (!m_captureWindowId || m_windowTrackTimer.elapsed() < WINDOW_TRACK_INTERVAL_MS) {
         return;
     }
-    emit debugLog("✓ [Init] X11 initialized and ready");
+    m_windowTrackTimer.restart();
+    
+    // Closed or minimised: keep capturing where the window was
+    QRect windowRect;
+    if (!captureWindowRect(windowRect)) {
+        return;
+    }
+    
+    // Same size as when recording started, moved with the window and kept
+    // on screen, so the frame size (and the encoder) never changes
+    QRect moved(windowRect.topLeft(), m_captureRect.size());
+    moved.moveLeft(qBound(m_captureScreen.left(), moved.left(),
+                          m_captureScreen.left() + m_captureScreen.width() - moved.width()));
+    moved.moveTop(qBound(m_captureScreen.top(), moved.top(),
+                         m_captureScreen.top() + m_captureScreen.height() - moved.height()));
+    if (moved != m_captureRect) {
+        m_captureRect = moved;
+#if !defined(_WIN32) && !defined(__APPLE__)
+        m_fullGrabNeeded = true;
+#endif
+    }
+}
+
+void ScreenRecorder::run() {
+    const std::shared_ptr<SyntheticFrameSource> synthetic = m_synthetic;
+    
+    // Every run starts at full quality; the capture size below depends on it
+    m_quality.reset(m_captureMode == JpegFrames);
+    m_qualityLevel = 0;
+    m_qualityScalePercent = 100;
+    m_qualityRatePercent = 100;
+    {
+        QMutexLocker locker(&m_bufferMutex);
+        if (!m_qualityTimeline.empty() && m_qualityTimeline.back().level != 0) {
+            m_qualityTimeline.push_back({ MediaClock::nowUs(), 0 });
+        }
+    }
+    
+    if (synthetic) {
+        emit debugLog(QString("✓ [Init] Synthetic source ready (%1x%2)")
+            .arg(synthetic->config().size.width()).arg(synthetic->config().size.height()));
+    } else {
+#ifdef _WIN32
+        if (!initD3D()) {
+            emit debugLog("❌ [Init] FAILED: DirectX initialization failed!");
+            emit errorOccurred("Failed to initialize DirectX");
+            return;
+        }
+        emit debugLog("✓ [Init] DirectX initialized and ready");
+#elif defined(__linux__)
+        if (!initX11()) {
+            emit debugLog("❌ [Init] FAILED: X11 initialization failed!");
+            emit errorOccurred("Failed to initialize X11");
+            return;
+        }
+        emit debugLog("✓ [Init] X11 initialized and ready");
 #else
-    emit debugLog("✓ [Init] macOS native capture ready");
+        m_displayID = CGMainDisplayID();
+        if (m_displayIndex.load() >= 0) {
+            CGDirectDisplayID displays[16];
+            uint32_t count = 0;
+            if (CGGetActiveDisplayList(16, displays, &count) != kCGErrorSuccess ||
+                m_displayIndex.load() >= (int)count) {
+                emit debugLog(QString("❌ [Init] FAILED: Display %1 not found").arg(m_displayIndex.load()));
+                emit errorOccurred("Selected display not found");
+                return;
+            }
+            m_displayID = displays[m_displayIndex.load()];
+        }
+        // The capture area is resolved against the first display image
+        m_captureScreen = QRect();
+        if (initScreenCaptureKit()) {
+            emit debugLog("✓ [Init] ScreenCaptureKit stream ready");
+        } else {
+            emit debugLog("✓ [Init] macOS native capture ready (CoreGraphics)");
+        }
 #endif
+    }
 
     m_recording = true;
     emit recordingStarted();
@@ -224,95 +910,192 @@ void ScreenRecorder::run() {
     emit debugLog(QString("  • Max frames in buffer: %1").arg(m_bufferSeconds * m_fps));
     emit debugLog("═══════════════════════════════════════════════════════════════");
 
-    qint64 frameDelay = 1000 / m_fps;
-    size_t maxFrames = m_bufferSeconds * m_fps;
-
     int frameCount = 0;
     int failureCount = 0;
     int consecutiveFailures = 0;
-    size_t totalCompressedSize = 0;
+    int repeatCount = 0;
+
+    // JPEG mode: compression runs on worker threads, results come back
+    // through storeCompressedFrame in capture order
+    if (m_captureMode == JpegFrames) {
+        const int workers = m_compressionWorkers.load() > 0 ? m_compressionWorkers.load()
+                                                            : CompressionPipeline::defaultWorkerCount();
+        m_firstFrameStored = false;
+        m_compression = std::make_unique<CompressionPipeline>(
+            workers, workers + 2, m_backpressurePolicy.load(),
+            [this](const VideoFrame& frame) { storeCompressedFrame(frame); });
+        connect(m_compression.get(), &CompressionPipeline::debugLog, this, &ScreenRecorder::debugLog);
+        m_compression->start();
+    }
 
+    // Encoded modes: decide once per run where the GOP ring lives
+    {
+        QMutexLocker locker(&m_bufferMutex);
+        m_spillActive = false;
+        m_segments.close();
+        if (m_captureMode != JpegFrames && m_spillToDisk.load()) {
+            m_spillActive = m_segments.open(m_spillDirectory);
+            emit debugLog(m_spillActive
+                ? QString("✓ [Recording] Spilling the encoded buffer to %1").arg(m_segments.directory())
+                : QString("⚠️  [Recording] Cannot use %1 for the buffer, keeping it in memory").arg(m_spillDirectory));
+        }
+    }
+    
     // Reuse this object to prevent heap fragmentation
     QImage rawFrame;
 
+    // Frames are due on absolute deadlines and stamped with them
+    FramePacer pacer(m_fps);
+    pacer.start();
+
     while (!m_stopRequested.load()) {
-        QDateTime startTime = QDateTime::currentDateTime();
-        bool success = false;
+        const int missed = pacer.waitForNextFrame();
+        const int64_t frameTimeUs = pacer.frameTimeUs();
+        const int64_t slotStartUs = MediaClock::nowUs();
+        if (missed > 0) {
+            Telemetry::add(Telemetry::FramesMissed, missed);
+        }
+
+        // Overran (slow capture, system stall): the skipped slots still get
+        // an entry so the buffer stays one record per frame interval and
+        // clip durations match wall time. Only short gaps are filled.
+        if (missed > 0 && missed <= m_fps && frameCount > 0) {
+            for (int slot = missed; slot > 0; slot--) {
+                const int64_t slotTimeUs = pacer.frameTimeUs(pacer.frameIndex() - slot);
+                const bool filled = (m_captureMode != JpegFrames) ? encodeRepeatFrame(slotTimeUs)
+                                                                  : m_compression->submitRepeat(slotTimeUs);
+                if (filled) {
+                    frameCount++;
+                    repeatCount++;
+                    Telemetry::add(Telemetry::FramesRepeated);
+                }
+            }
+        }
 
+        // Reduced frame rate: the slots in between repeat the last frame
+        // without grabbing the screen
+        const int fpsDivisor = m_quality.current().fpsDivisor;
+        if (fpsDivisor > 1 && frameCount > 0 && pacer.frameIndex() % fpsDivisor != 0) {
+            const bool filled = (m_captureMode != JpegFrames) ? encodeRepeatFrame(frameTimeUs)
+                                                              : m_compression->submitRepeat(frameTimeUs);
+            if (filled) {
+                frameCount++;
+                repeatCount++;
+                Telemetry::add(Telemetry::FramesRepeated);
+            }
+            updateQuality(slotStartUs, missed);
+            continue;
+        }
+
+        CaptureResult result = CaptureFailed;
+        bool gotNv12 = false;
+        trackCaptureWindow();
+        Telemetry::Timer captureTimer(Telemetry::Capture);
+
+#if defined(_WIN32) || defined(__APPLE__)
+        Nv12Frame* nv12 = (m_captureMode != JpegFrames) ? &m_nv12Frame : nullptr;
+        bool gpuFrame = false;
+#endif
+        if (synthetic) {
+            result = synthetic->next(rawFrame) ? CaptureNewFrame : CaptureUnchanged;
+        } else {
 #ifdef _WIN32
-        success = captureFrameD3D(rawFrame);
+            result = captureFrameD3D(rawFrame, nv12, (nv12 && m_zeroCopy.load()) ? &gpuFrame : nullptr);
+            gotNv12 = result == CaptureNewFrame && nv12 && (gpuFrame || !nv12->isNull());
 #elif __APPLE__
-        success = captureFrameCG(rawFrame);
+            if (m_sckStream) {
+                result = captureFrameSCK(rawFrame, nv12, nv12 ? &gpuFrame : nullptr);
+                gotNv12 = result == CaptureNewFrame && nv12 && (gpuFrame || !nv12->isNull());
+            } else {
+                result = captureFrameCG(rawFrame);
+            }
 #else
-        success = captureFrameX11(rawFrame);
+            result = captureFrameX11(rawFrame);
 #endif
+        }
+        captureTimer.stop();
+        bool success = result == CaptureNewFrame;
+        if (success) {
+            Telemetry::add(Telemetry::FramesCaptured);
+        }
+
+        // Unchanged screen: store a repeat record instead of a new payload.
+        // If there is nothing to repeat yet (buffer just cleared, encoder
+        // just reopened) the last captured image is processed normally.
+        bool repeated = false;
+        if (result == CaptureUnchanged) {
+            if (m_captureMode != JpegFrames) {
+                repeated = encodeRepeatFrame(frameTimeUs);
+            } else {
+                repeated = m_compression->submitRepeat(frameTimeUs);
+            }
+            success = !repeated && !rawFrame.isNull() && !gotNv12;
+            if (repeated) {
+                consecutiveFailures = 0;
+                failureCount = 0;
+                frameCount++;
+                repeatCount++;
+                Telemetry::add(Telemetry::FramesRepeated);
+            }
+        }
 
-        if (success && !rawFrame.isNull()) {
+#ifdef _WIN32
+        const QSize frameSize = gpuFrame ? QSize(m_vpWidth & ~1u, m_vpHeight & ~1u)
+                              : gotNv12 ? QSize(m_nv12Frame.width, m_nv12Frame.height)
+                              : rawFrame.size();
+#elif __APPLE__
+        const QSize frameSize = gpuFrame ? QSize((int)CVPixelBufferGetWidth(m_sckPixelBuffer) & ~1,
+                                                 (int)CVPixelBufferGetHeight(m_sckPixelBuffer) & ~1)
+                              : gotNv12 ? QSize(m_nv12Frame.width, m_nv12Frame.height)
+                              : rawFrame.size();
+#else
+        const QSize frameSize = rawFrame.size();
+#endif
+
+        if (repeated) {
+            // Nothing else to do for a repeat record
+        } else if (success && (gotNv12 || !rawFrame.isNull())) {
             consecutiveFailures = 0; // Reset on success
             failureCount = 0; // Reset total failure count on success
 
-            VideoFrame vf;
-            vf.timestamp = startTime;
-
             // Sanity-check that the captured frame has valid dimensions before compression.
             // Invalid dimensions indicate a capture failure at the OS level.
-            if (rawFrame.size().width() <= 0 || rawFrame.size().height() <= 0) {
+            if (frameSize.width() <= 0 || frameSize.height() <= 0) {
                 emit debugLog(QString("❌ [Capture] ERROR: Invalid frame dimensions: %1x%2")
-                    .arg(rawFrame.size().width()).arg(rawFrame.size().height()));
-            } else {
-                // Compress the raw frame into JPEG format for memory efficiency.
-                compressFrame(rawFrame, vf);
-
-                // Verify that compression succeeded and produced non-empty data.
-                if (vf.jpegData.isEmpty()) {
-                    emit debugLog("❌ [Compression] ERROR: Compression failed - jpegData is empty!");
-                    emit debugLog(QString("  Raw frame size: %1x%2")
-                        .arg(rawFrame.size().width()).arg(rawFrame.size().height()));
-                } else {
-                    // Buffer the compressed frame and apply time-based pruning.
-                    {
-                        QMutexLocker locker(&m_bufferMutex);
-                        m_frameBuffer.push_back(vf);
-
-                        totalCompressedSize += vf.jpegData.size();
-
-                        while (m_frameBuffer.size() > maxFrames) {
-                            totalCompressedSize -= m_frameBuffer.front().jpegData.size();
-                            m_frameBuffer.pop_front();
-                        }
-                    }
-
+                    .arg(frameSize.width()).arg(frameSize.height()));
+            } else if (m_captureMode != JpegFrames) {
+                // Continuous-encode mode: the frame goes straight into the
+                // live encoder and only packets are buffered.
+#if defined(_WIN32) || defined(__APPLE__)
+                const bool encoded = gpuFrame ? encodeGpuFrame(frameTimeUs)
+                                   : gotNv12 ? encodeFrame(m_nv12Frame, frameTimeUs)
+                                   : encodeFrame(rawFrame, frameTimeUs);
+#else
+                const bool encoded = encodeFrame(rawFrame, frameTimeUs);
+#endif
+                if (encoded) {
                     frameCount++;
-
-                    // Log first successful frame
+                    
                     if (frameCount == 1) {
-                        emit debugLog("═══════════════════════════════════════════════════════════════");
-                        emit debugLog("✓✓✓ [Capture] FIRST FRAME CAPTURED & BUFFERED SUCCESSFULLY ✓✓✓");
-                        emit debugLog(QString("  • Frame size: %1 KB (compressed)").arg(vf.jpegData.size() / 1024));
-                        emit debugLog(QString("  • Resolution: %1x%2")
-                            .arg(vf.originalSize.width()).arg(vf.originalSize.height()));
-                        emit debugLog("  • System is now recording frames into buffer at " +
-                            QString::number(m_fps) + " FPS");
-                        emit debugLog("═══════════════════════════════════════════════════════════════");
-                    }
-
-                    // Log stats every 10 seconds
-                    if (frameCount % (m_fps * 10) == 0) {
-                        double avgSize = totalCompressedSize / (double)m_frameBuffer.size();
-                        double totalMB = totalCompressedSize / 1024.0 / 1024.0;
-                        double duration = m_frameBuffer.size() / (double)m_fps;
-                        emit debugLog(QString("[Stats] ✓ %1 frames (%2 sec) | Avg: %3 KB | Total: %4 MB")
-                            .arg(frameCount)
-                            .arg(duration, 0, 'f', 1)
-                            .arg(avgSize / 1024, 0, 'f', 1)
-                            .arg(totalMB, 0, 'f', 2));
+                        emit debugLog("✓✓✓ [Capture] FIRST FRAME CAPTURED & ENCODED SUCCESSFULLY ✓✓✓");
+                        emit debugLog(QString("  • Resolution: %1x%2 (%3)")
+                            .arg(frameSize.width()).arg(frameSize.height())
+                            .arg(m_liveEncoder->isZeroCopy() ? "GPU zero-copy"
+                                 : gotNv12 ? "GPU NV12" : "BGRA"));
                     }
+                    
                 }
+            } else {
+                // Hand the frame to the compression workers; the capture
+                // loop never waits for JPEG encoding.
+                m_compression->submit(rawFrame, frameTimeUs);
+                frameCount++;
             }
         } else {
             // Failure handling
             consecutiveFailures++;
             failureCount++;
+            Telemetry::add(Telemetry::CaptureFailures);
             
             // Log early failures for debugging
             if (frameCount == 0 && failureCount <= 5) {
@@ -322,6 +1105,7 @@ void ScreenRecorder::run() {
 
             // Attempt recovery after sustained failures
             if (consecutiveFailures >= 50) { // ~5 seconds at 10fps
+#ifdef _WIN32
                 emit debugLog(QString("🔄 [Recovery] %1 consecutive failures - attempting D3D recovery...")
                     .arg(consecutiveFailures));
 
@@ -338,6 +1122,31 @@ void ScreenRecorder::run() {
                     emit errorOccurred("DirectX recovery failed");
                     break;
                 }
+#elif defined(__linux__)
+                emit debugLog(QString("🔄 [Recovery] %1 consecutive failures - reconnecting to X11...")
+                    .arg(consecutiveFailures));
+
+                cleanupX11();
+                if (initX11()) {
+                    emit debugLog("✓ [Recovery] X11 reinitialized successfully!");
+                    consecutiveFailures = 0;
+                    failureCount = 0;
+                } else {
+                    emit debugLog("❌ [Recovery] X11 reinit failed - stopping recording");
+                    emit errorOccurred("X11 recovery failed");
+                    break;
+                }
+#else
+                // A stream the system stopped (display reconfigured, say)
+                // is started again; CoreGraphics takes over if it can't be
+                if (m_sckStream) {
+                    emit debugLog(QString("🔄 [Recovery] %1 consecutive failures - restarting ScreenCaptureKit (%2)...")
+                        .arg(consecutiveFailures).arg(m_sckStream->lastError()));
+                    emit debugLog(initScreenCaptureKit() ? "✓ [Recovery] ScreenCaptureKit stream restarted"
+                                                         : "⚠️  [Recovery] Falling back to CoreGraphics capture");
+                }
+                consecutiveFailures = 0;
+#endif
             }
 
             // Give up if we never get started
@@ -352,19 +1161,60 @@ void ScreenRecorder::run() {
             }
         }
 
-        // Accurate sleep timing
-        qint64 elapsed = startTime.msecsTo(QDateTime::currentDateTime());
-        qint64 sleepTime = frameDelay - elapsed;
-        if (sleepTime > 0) {
-            QThread::msleep(sleepTime);
+        // Log stats every 10 seconds
+        if ((success || repeated) && frameCount > 0 && frameCount % (m_fps * 10) == 0) {
+            QMutexLocker locker(&m_bufferMutex);
+            if (m_captureMode != JpegFrames) {
+                double duration = m_packetGops.empty() ? 0.0
+                    : (m_packetGops.back()->packets.back().pts - m_packetGops.front()->packets.front().pts)
+                      * m_streamInfo.timeBaseNum / (double)m_streamInfo.timeBaseDen;
+                emit debugLog(QString("[Stats] ✓ %1 frames (%2 repeats) | %3 packets (%4 sec) | Total: %5 MB")
+                    .arg(frameCount)
+                    .arg(repeatCount)
+                    .arg(m_packetCount)
+                    .arg(duration, 0, 'f', 1)
+                    .arg(m_packetBufferBytes / 1024.0 / 1024.0, 0, 'f', 2));
+            } else if (!m_replayBuffer.empty()) {
+                const CompressionPipeline::Stats cs = m_compression->stats();
+                const ReplayBuffer::Stats rs = m_replayBuffer.stats();
+                double avgSize = rs.usedBytes / (double)std::max<size_t>(1, rs.payloads);
+                double totalMB = rs.usedBytes / 1024.0 / 1024.0;
+                double duration = rs.frames / (double)m_fps;
+                emit debugLog(QString("[Stats] ✓ %1 frames (%2 repeats) (%3 sec) | Avg: %4 KB | Total: %5 MB")
+                    .arg(frameCount)
+                    .arg(repeatCount)
+                    .arg(duration, 0, 'f', 1)
+                    .arg(avgSize / 1024, 0, 'f', 1)
+                    .arg(totalMB, 0, 'f', 2));
+                emit debugLog(QString("[Stats]   Buffer: %1% of %2 MB | evicted %3 by time, %4 by bytes")
+                    .arg(rs.fillPercent, 0, 'f', 1)
+                    .arg(rs.capacityBytes / (1024 * 1024))
+                    .arg(rs.evictedByTime)
+                    .arg(rs.evictedByBytes));
+                emit debugLog(QString("[Stats]   JPEG: queue %1 | quality %2 | %3 dropped | %4 degraded")
+                    .arg(cs.queueDepth)
+                    .arg(cs.quality)
+                    .arg(cs.dropped)
+                    .arg(cs.degraded));
+            }
         }
+        
+        updateQuality(slotStartUs, missed);
+    }
+
+    // Finish compressing whatever is still queued before reporting
+    if (m_compression) {
+        m_compression->stop();
+        m_compression.reset();
     }
 
     emit debugLog("═══════════════════════════════════════════════════════════════");
     emit debugLog("⏹️  [Recording] STOPPED - Capture loop terminated");
     emit debugLog(QString("  • Total frames captured: %1").arg(frameCount));
-    emit debugLog(QString("  • Final buffer size: %1 frames").arg(m_frameBuffer.size()));
-    double finalBufferDuration = m_frameBuffer.size() / (double)m_fps;
+    emit debugLog(QString("  • Frame slots missed by the pacer: %1").arg(pacer.skippedFrames()));
+    const size_t finalFrames = replayStats().frames;
+    emit debugLog(QString("  • Final buffer size: %1 frames").arg(finalFrames));
+    double finalBufferDuration = finalFrames / (double)m_fps;
     emit debugLog(QString("  • Buffer duration: %1 seconds").arg(finalBufferDuration, 0, 'f', 1));
     emit debugLog("═══════════════════════════════════════════════════════════════");
 
@@ -372,8 +1222,11 @@ void ScreenRecorder::run() {
     cleanupD3D();
 #elif defined(__linux__)
     cleanupX11();
+#else
+    cleanupScreenCaptureKit();
 #endif
 
+    m_liveEncoder->close();
     m_recording = false;
     emit recordingStopped();
 }
@@ -417,6 +1270,11 @@ bool ScreenRecorder::initD3D() {
     IDXGIAdapter1* selectedAdapter = nullptr;
     IDXGIOutput1* selectedOutput = nullptr;
     bool found = false;
+    
+    // Attached outputs are numbered in enumeration order, the order
+    // availableDisplays() lists them in
+    const int wantedDisplay = m_displayIndex.load();
+    int displayOrdinal = 0;
 
     // Enumerate adapters and outputs
     while (factory->EnumAdapters1(i, &adapter) != DXGI_ERROR_NOT_FOUND) {
@@ -452,6 +1310,13 @@ bool ScreenRecorder::initD3D() {
                 continue;
             }
             
+            if (wantedDisplay >= 0 && displayOrdinal++ != wantedDisplay) {
+                emit debugLog("  -> Skipping (another display is selected)");
+                output->Release();
+                j++;
+                continue;
+            }
+            
             IDXGIOutput1* output1 = nullptr;
             hr = output->QueryInterface(__uuidof(IDXGIOutput1), (void**)&output1);
             output->Release();
@@ -470,11 +1335,13 @@ bool ScreenRecorder::initD3D() {
                 createFlags |= D3D11_CREATE_DEVICE_DEBUG;
 #endif
                 
+                // Video support is needed for the GPU NV12 conversion; some
+                // drivers refuse it, so retry without before giving up.
                 hr = D3D11CreateDevice(
                     adapter, 
                     D3D_DRIVER_TYPE_UNKNOWN, 
                     nullptr, 
-                    createFlags, 
+                    createFlags | D3D11_CREATE_DEVICE_VIDEO_SUPPORT, 
                     featureLevels, 
                     ARRAYSIZE(featureLevels), 
                     D3D11_SDK_VERSION, 
@@ -482,6 +1349,20 @@ bool ScreenRecorder::initD3D() {
                     &featureLevel, 
                     &m_d3dContext
                 );
+                if (FAILED(hr)) {
+                    hr = D3D11CreateDevice(
+                        adapter, 
+                        D3D_DRIVER_TYPE_UNKNOWN, 
+                        nullptr, 
+                        createFlags, 
+                        featureLevels, 
+                        ARRAYSIZE(featureLevels), 
+                        D3D11_SDK_VERSION, 
+                        &m_d3dDevice, 
+                        &featureLevel, 
+                        &m_d3dContext
+                    );
+                }
 
                 if (SUCCEEDED(hr)) {
                     emit debugLog(QString("  -> D3D Device created (Feature Level: 0x%1)").arg(featureLevel, 0, 16));
@@ -507,6 +1388,8 @@ bool ScreenRecorder::initD3D() {
                         selectedOutput = output1;
                         found = true;
                         m_lastFramePresented = 0;
+                        m_outputModeSize = QSize(duplDesc.ModeDesc.Width, duplDesc.ModeDesc.Height);
+                        m_outputOrigin = { outDesc.DesktopCoordinates.left, outDesc.DesktopCoordinates.top };
                         break;
                     } else {
                         // DuplicateOutput failed - explain why
@@ -556,40 +1439,427 @@ bool ScreenRecorder::initD3D() {
     factory->Release();
 
     if (!found) {
-        emit debugLog("❌ [D3D Init] FAILED: No compatible adapter/output found!");
+        emit debugLog(wantedDisplay >= 0
+            ? QString("❌ [D3D Init] FAILED: Display %1 not found or cannot be duplicated!").arg(wantedDisplay)
+            : QString("❌ [D3D Init] FAILED: No compatible adapter/output found!"));
+        return false;
+    }
+    
+    // Clean up adapter/output references (we don't need to hold them)
+    if (selectedAdapter) selectedAdapter->Release();
+    if (selectedOutput) selectedOutput->Release();
+
+    resolveCaptureArea(QRect(QPoint(0, 0), m_outputModeSize));
+    return true;
+}
+
+void ScreenRecorder::cleanupD3D() {
+    // A zero-copy encoder holds a reference to this device; it is reopened
+    // on the new device by the next encoded frame.
+    if (m_liveEncoder && m_liveEncoder->isZeroCopy()) {
+        m_liveEncoder->close();
+    }
+    cleanupVideoProcessor();
+    
+    for (int i = 0; i < STAGING_POOL_SIZE; i++) {
+        if (m_stagingPool[i]) {
+            m_stagingPool[i]->Release();
+            m_stagingPool[i] = nullptr;
+        }
+    }
+    m_stagingNext = 0;
+    
+    if (m_deskDupl) {
+        m_deskDupl->Release();
+        m_deskDupl = nullptr;
+    }
+    
+    if (m_d3dContext) {
+        m_d3dContext->Release();
+        m_d3dContext = nullptr;
+    }
+    
+    if (m_d3dDevice) {
+        m_d3dDevice->Release();
+        m_d3dDevice = nullptr;
+    }
+    
+    m_lastFramePresented = 0;
+    
+    // A new device may have a working video processor
+    m_gpuConvertUnavailable = false;
+}
+
+ID3D11Texture2D* ScreenRecorder::acquireStagingTexture(UINT width, UINT height, DXGI_FORMAT format) {
+    ID3D11Texture2D*& slot = m_stagingPool[m_stagingNext];
+    m_stagingNext = (m_stagingNext + 1) % STAGING_POOL_SIZE;
+    
+    if (slot) {
+        D3D11_TEXTURE2D_DESC existing;
+        slot->GetDesc(&existing);
+        if (existing.Width == width && existing.Height == height && existing.Format == format) {
+            return slot;
+        }
+        slot->Release();
+        slot = nullptr;
+    }
+    
+    D3D11_TEXTURE2D_DESC desc = {};
+    desc.Width = width;
+    desc.Height = height;
+    desc.MipLevels = 1;
+    desc.ArraySize = 1;
+    desc.Format = format;
+    desc.SampleDesc.Count = 1;
+    desc.Usage = D3D11_USAGE_STAGING;
+    desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+    
+    HRESULT hr = m_d3dDevice->CreateTexture2D(&desc, nullptr, &slot);
+    if (FAILED(hr)) {
+        emit debugLog(QString("❌ [D3D Capture] Staging texture creation failed: 0x%1").arg(hr, 0, 16));
+        slot = nullptr;
+    }
+    return slot;
+}
+
+bool ScreenRecorder::initVideoProcessor(UINT width, UINT height, DXGI_FORMAT outputFormat) {
+    cleanupVideoProcessor();
+    
+    HRESULT hr = m_d3dDevice->QueryInterface(__uuidof(ID3D11VideoDevice), (void**)&m_videoDevice);
+    if (FAILED(hr)) {
+        emit debugLog(QString("⚠️ [D3D Convert] No ID3D11VideoDevice (0x%1)").arg(hr, 0, 16));
+        return false;
+    }
+    hr = m_d3dContext->QueryInterface(__uuidof(ID3D11VideoContext), (void**)&m_videoContext);
+    if (FAILED(hr)) {
+        emit debugLog(QString("⚠️ [D3D Convert] No ID3D11VideoContext (0x%1)").arg(hr, 0, 16));
+        return false;
+    }
+    
+    // The output is the capture area at the output size; both are even,
+    // which NV12 needs.
+    const UINT outWidth = (UINT)m_outputSize.width();
+    const UINT outHeight = (UINT)m_outputSize.height();
+    const char* conversion = outputFormat == DXGI_FORMAT_NV12 ? "BGRA->NV12" : "BGRA scaling";
+    
+    D3D11_VIDEO_PROCESSOR_CONTENT_DESC contentDesc = {};
+    contentDesc.InputFrameFormat = D3D11_VIDEO_FRAME_FORMAT_PROGRESSIVE;
+    contentDesc.InputFrameRate = { (UINT)m_fps, 1 };
+    contentDesc.InputWidth = width;
+    contentDesc.InputHeight = height;
+    contentDesc.OutputFrameRate = { (UINT)m_fps, 1 };
+    contentDesc.OutputWidth = outWidth;
+    contentDesc.OutputHeight = outHeight;
+    contentDesc.Usage = D3D11_VIDEO_USAGE_PLAYBACK_NORMAL;
+    
+    hr = m_videoDevice->CreateVideoProcessorEnumerator(&contentDesc, &m_vpEnum);
+    if (FAILED(hr)) {
+        emit debugLog(QString("⚠️ [D3D Convert] CreateVideoProcessorEnumerator failed: 0x%1").arg(hr, 0, 16));
+        return false;
+    }
+    
+    UINT inputSupport = 0;
+    UINT outputSupport = 0;
+    m_vpEnum->CheckVideoProcessorFormat(DXGI_FORMAT_B8G8R8A8_UNORM, &inputSupport);
+    m_vpEnum->CheckVideoProcessorFormat(outputFormat, &outputSupport);
+    if (!(inputSupport & D3D11_VIDEO_PROCESSOR_FORMAT_SUPPORT_INPUT) ||
+        !(outputSupport & D3D11_VIDEO_PROCESSOR_FORMAT_SUPPORT_OUTPUT)) {
+        emit debugLog(QString("⚠️ [D3D Convert] Video processor cannot do %1").arg(conversion));
+        return false;
+    }
+    
+    hr = m_videoDevice->CreateVideoProcessor(m_vpEnum, 0, &m_videoProcessor);
+    if (FAILED(hr)) {
+        emit debugLog(QString("⚠️ [D3D Convert] CreateVideoProcessor failed: 0x%1").arg(hr, 0, 16));
+        return false;
+    }
+    
+    // The duplication surface can't always be bound as processor input, so
+    // the frame is first copied (GPU-side) into a texture we own.
+    D3D11_TEXTURE2D_DESC texDesc = {};
+    texDesc.Width = width;
+    texDesc.Height = height;
+    texDesc.MipLevels = 1;
+    texDesc.ArraySize = 1;
+    texDesc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+    texDesc.SampleDesc.Count = 1;
+    texDesc.Usage = D3D11_USAGE_DEFAULT;
+    texDesc.BindFlags = D3D11_BIND_RENDER_TARGET | D3D11_BIND_SHADER_RESOURCE;
+    hr = m_d3dDevice->CreateTexture2D(&texDesc, nullptr, &m_vpInputTexture);
+    if (FAILED(hr)) {
+        emit debugLog(QString("⚠️ [D3D Convert] Input texture creation failed: 0x%1").arg(hr, 0, 16));
+        return false;
+    }
+    
+    texDesc.Width = outWidth;
+    texDesc.Height = outHeight;
+    texDesc.Format = outputFormat;
+    texDesc.BindFlags = D3D11_BIND_RENDER_TARGET;
+    hr = m_d3dDevice->CreateTexture2D(&texDesc, nullptr, &m_vpOutputTexture);
+    if (FAILED(hr)) {
+        emit debugLog(QString("⚠️ [D3D Convert] Output texture creation failed: 0x%1").arg(hr, 0, 16));
+        return false;
+    }
+    
+    D3D11_VIDEO_PROCESSOR_INPUT_VIEW_DESC inputViewDesc = {};
+    inputViewDesc.ViewDimension = D3D11_VPIV_DIMENSION_TEXTURE2D;
+    hr = m_videoDevice->CreateVideoProcessorInputView(m_vpInputTexture, m_vpEnum, &inputViewDesc, &m_vpInputView);
+    if (FAILED(hr)) {
+        emit debugLog(QString("⚠️ [D3D Convert] Input view creation failed: 0x%1").arg(hr, 0, 16));
+        return false;
+    }
+    
+    D3D11_VIDEO_PROCESSOR_OUTPUT_VIEW_DESC outputViewDesc = {};
+    outputViewDesc.ViewDimension = D3D11_VPOV_DIMENSION_TEXTURE2D;
+    hr = m_videoDevice->CreateVideoProcessorOutputView(m_vpOutputTexture, m_vpEnum, &outputViewDesc, &m_vpOutputView);
+    if (FAILED(hr)) {
+        emit debugLog(QString("⚠️ [D3D Convert] Output view creation failed: 0x%1").arg(hr, 0, 16));
+        return false;
+    }
+    
+    // Full-range RGB in, limited-range BT.601 out: the same conversion
+    // swscale applies on the CPU path, so both paths look identical.
+    // BGRA output stays full-range RGB.
+    D3D11_VIDEO_PROCESSOR_COLOR_SPACE inputSpace = {};
+    inputSpace.RGB_Range = 0;
+    D3D11_VIDEO_PROCESSOR_COLOR_SPACE outputSpace = {};
+    if (outputFormat == DXGI_FORMAT_NV12) {
+        outputSpace.YCbCr_Matrix = 0;
+        outputSpace.Nominal_Range = D3D11_VIDEO_PROCESSOR_NOMINAL_RANGE_16_235;
+    }
+    m_videoContext->VideoProcessorSetStreamColorSpace(m_videoProcessor, 0, &inputSpace);
+    m_videoContext->VideoProcessorSetOutputColorSpace(m_videoProcessor, &outputSpace);
+    m_videoContext->VideoProcessorSetStreamAutoProcessingMode(m_videoProcessor, 0, FALSE);
+    m_videoContext->VideoProcessorSetStreamFrameFormat(m_videoProcessor, 0, D3D11_VIDEO_FRAME_FORMAT_PROGRESSIVE);
+    
+    // Source is the capture area, scaled onto the whole output
+    m_vpSourceRect = { m_captureRect.left(), m_captureRect.top(),
+                       m_captureRect.left() + m_captureRect.width(),
+                       m_captureRect.top() + m_captureRect.height() };
+    RECT rect = { 0, 0, (LONG)outWidth, (LONG)outHeight };
+    m_videoContext->VideoProcessorSetStreamSourceRect(m_videoProcessor, 0, TRUE, &m_vpSourceRect);
+    m_videoContext->VideoProcessorSetStreamDestRect(m_videoProcessor, 0, TRUE, &rect);
+    m_videoContext->VideoProcessorSetOutputTargetRect(m_videoProcessor, TRUE, &rect);
+    
+    m_vpWidth = outWidth;
+    m_vpHeight = outHeight;
+    m_vpInputWidth = width;
+    m_vpInputHeight = height;
+    m_vpOutputFormat = outputFormat;
+    emit debugLog(QString("✓ [D3D Convert] GPU %1 enabled (%2x%3 of %4x%5 -> %6x%7)")
+        .arg(conversion)
+        .arg(m_captureRect.width()).arg(m_captureRect.height())
+        .arg(width).arg(height)
+        .arg(outWidth).arg(outHeight));
+    return true;
+}
+
+void ScreenRecorder::cleanupVideoProcessor() {
+    if (m_vpOutputView) { m_vpOutputView->Release(); m_vpOutputView = nullptr; }
+    if (m_vpInputView) { m_vpInputView->Release(); m_vpInputView = nullptr; }
+    if (m_vpOutputTexture) { m_vpOutputTexture->Release(); m_vpOutputTexture = nullptr; }
+    if (m_vpInputTexture) { m_vpInputTexture->Release(); m_vpInputTexture = nullptr; }
+    if (m_videoProcessor) { m_videoProcessor->Release(); m_videoProcessor = nullptr; }
+    if (m_vpEnum) { m_vpEnum->Release(); m_vpEnum = nullptr; }
+    if (m_videoContext) { m_videoContext->Release(); m_videoContext = nullptr; }
+    if (m_videoDevice) { m_videoDevice->Release(); m_videoDevice = nullptr; }
+    m_vpWidth = 0;
+    m_vpHeight = 0;
+    m_vpInputWidth = 0;
+    m_vpInputHeight = 0;
+    m_vpOutputFormat = DXGI_FORMAT_UNKNOWN;
+    m_vpSourceRect = {};
+}
+
+bool ScreenRecorder::convertOnGpu(ID3D11Texture2D* texture, DXGI_FORMAT outputFormat) {
+    Telemetry::Timer timer(Telemetry::Convert);
+    D3D11_TEXTURE2D_DESC desc;
+    texture->GetDesc(&desc);
+    
+    if (!m_videoProcessor || m_vpInputWidth != desc.Width || m_vpInputHeight != desc.Height ||
+        m_vpOutputFormat != outputFormat ||
+        m_vpWidth != (UINT)m_outputSize.width() || m_vpHeight != (UINT)m_outputSize.height()) {
+        if (!initVideoProcessor(desc.Width, desc.Height, outputFormat)) {
+            cleanupVideoProcessor();
+            m_gpuConvertUnavailable = true;
+            emit debugLog(outputFormat == DXGI_FORMAT_NV12
+                ? "⚠️ [D3D Convert] Falling back to BGRA readback + CPU conversion"
+                : "⚠️ [D3D Convert] Falling back to BGRA readback + CPU scaling");
+            return false;
+        }
+    }
+    
+    // A followed window only moves the source rectangle, which the
+    // processor takes per blit without being recreated
+    const RECT source = { m_captureRect.left(), m_captureRect.top(),
+                          m_captureRect.left() + m_captureRect.width(),
+                          m_captureRect.top() + m_captureRect.height() };
+    if (source.left != m_vpSourceRect.left || source.top != m_vpSourceRect.top ||
+        source.right != m_vpSourceRect.right || source.bottom != m_vpSourceRect.bottom) {
+        m_videoContext->VideoProcessorSetStreamSourceRect(m_videoProcessor, 0, TRUE, &source);
+        m_vpSourceRect = source;
+    }
+    
+    m_d3dContext->CopyResource(m_vpInputTexture, texture);
+    
+    D3D11_VIDEO_PROCESSOR_STREAM stream = {};
+    stream.Enable = TRUE;
+    stream.pInputSurface = m_vpInputView;
+    HRESULT hr = m_videoContext->VideoProcessorBlt(m_videoProcessor, m_vpOutputView, 0, 1, &stream);
+    if (FAILED(hr)) {
+        emit debugLog(QString("❌ [D3D Convert] VideoProcessorBlt failed: 0x%1").arg(hr, 0, 16));
+        return false;
+    }
+    return true;
+}
+
+bool ScreenRecorder::readbackNV12(Nv12Frame& out) {
+    Telemetry::Timer timer(Telemetry::Convert);
+    const UINT width = m_vpWidth & ~1u;
+    const UINT height = m_vpHeight & ~1u;
+    ID3D11Texture2D* staging = acquireStagingTexture(width, height, DXGI_FORMAT_NV12);
+    if (!staging) {
+        return false;
+    }
+    m_d3dContext->CopyResource(staging, m_vpOutputTexture);
+    
+    D3D11_MAPPED_SUBRESOURCE mapped;
+    HRESULT hr = m_d3dContext->Map(staging, 0, D3D11_MAP_READ, 0, &mapped);
+    if (FAILED(hr)) {
+        return false;
+    }
+    
+    // Mapped NV12: Y rows, then UV rows starting RowPitch * Height bytes in.
+    // Repacked tightly so the buffer does not depend on the driver pitch.
+    const size_t frameBytes = (size_t)width * height * 3 / 2;
+    if ((size_t)out.data.size() != frameBytes) {
+        out.data.resize(frameBytes);
+    }
+    uint8_t* dst = reinterpret_cast<uint8_t*>(out.data.data());
+    const uint8_t* src = static_cast<const uint8_t*>(mapped.pData);
+    for (UINT y = 0; y < height; y++) {
+        memcpy(dst + (size_t)y * width, src + (size_t)y * mapped.RowPitch, width);
+    }
+    const uint8_t* srcUV = src + (size_t)mapped.RowPitch * height;
+    uint8_t* dstUV = dst + (size_t)width * height;
+    for (UINT y = 0; y < height / 2; y++) {
+        memcpy(dstUV + (size_t)y * width, srcUV + (size_t)y * mapped.RowPitch, width);
+    }
+    m_d3dContext->Unmap(staging, 0);
+    
+    out.width = width;
+    out.height = height;
+    out.stride = width;
+    return true;
+}
+
+bool ScreenRecorder::readbackBGRA(ID3D11Texture2D* texture, QImage& outImage, const QRect& area) {
+    Telemetry::Timer timer(Telemetry::Convert);
+    D3D11_TEXTURE2D_DESC desc;
+    texture->GetDesc(&desc);
+    
+    // Only the area crosses to the CPU; the copy into the staging texture
+    // is a GPU-side blit of that sub-rectangle
+    const UINT width = area.isEmpty() ? desc.Width : (UINT)area.width();
+    const UINT height = area.isEmpty() ? desc.Height : (UINT)area.height();
+    ID3D11Texture2D* staging = acquireStagingTexture(width, height, desc.Format);
+    if (!staging) {
+        return false;
+    }
+    if (area.isEmpty()) {
+        m_d3dContext->CopyResource(staging, texture);
+    } else {
+        D3D11_BOX box = { (UINT)area.left(), (UINT)area.top(), 0,
+                          (UINT)(area.left() + area.width()), (UINT)(area.top() + area.height()), 1 };
+        m_d3dContext->CopySubresourceRegion(staging, 0, 0, 0, 0, texture, 0, &box);
+    }
+    
+    D3D11_MAPPED_SUBRESOURCE mapped;
+    HRESULT hr = m_d3dContext->Map(staging, 0, D3D11_MAP_READ, 0, &mapped);
+    if (FAILED(hr)) {
+        return false;
+    }
+    
+    // Reuse the caller's image when the size is unchanged and nobody else
+    // (e.g. a queued compression job) still shares it; writing into a
+    // shared image would only detach it with a full copy first
+    if (outImage.width() != (int)width || outImage.height() != (int)height ||
+        outImage.format() != QImage::Format_ARGB32 || !outImage.isDetached()) {
+        outImage = QImage(width, height, QImage::Format_ARGB32);
+    }
+    
+    if (outImage.isNull()) {
+        m_d3dContext->Unmap(staging, 0);
         return false;
     }
     
-    // Clean up adapter/output references (we don't need to hold them)
-    if (selectedAdapter) selectedAdapter->Release();
-    if (selectedOutput) selectedOutput->Release();
-
+    // Copy data with proper pitch handling
+    for (UINT y = 0; y < height; y++) {
+        memcpy(outImage.scanLine(y),
+               (BYTE*)mapped.pData + (y * mapped.RowPitch),
+               width * 4);
+    }
+    
+    m_d3dContext->Unmap(staging, 0);
     return true;
 }
 
-void ScreenRecorder::cleanupD3D() {
-    if (m_deskDupl) {
-        m_deskDupl->Release();
-        m_deskDupl = nullptr;
+struct WindowSearch {
+    QString title;
+    HWND exact;
+    HWND partial;
+};
+
+static BOOL CALLBACK findWindowByTitle(HWND hwnd, LPARAM param) {
+    WindowSearch* search = reinterpret_cast<WindowSearch*>(param);
+    if (!IsWindowVisible(hwnd)) {
+        return TRUE;
     }
-    
-    if (m_d3dContext) {
-        m_d3dContext->Release();
-        m_d3dContext = nullptr;
+    wchar_t buffer[512];
+    const int length = GetWindowTextW(hwnd, buffer, 512);
+    if (length <= 0) {
+        return TRUE;
     }
-    
-    if (m_d3dDevice) {
-        m_d3dDevice->Release();
-        m_d3dDevice = nullptr;
+    const QString name = QString::fromWCharArray(buffer, length);
+    if (name == search->title) {
+        search->exact = hwnd;
+        return FALSE;
     }
-    
-    m_lastFramePresented = 0;
+    if (!search->partial && name.contains(search->title, Qt::CaseInsensitive)) {
+        search->partial = hwnd;
+    }
+    return TRUE;
 }
 
-bool ScreenRecorder::captureFrameD3D(QImage& outImage) {
-    if (!m_deskDupl || !m_d3dDevice || !m_d3dContext) {
+bool ScreenRecorder::findCaptureWindow(const QString& title) {
+    WindowSearch search = { title, nullptr, nullptr };
+    EnumWindows(findWindowByTitle, reinterpret_cast<LPARAM>(&search));
+    HWND hwnd = search.exact ? search.exact : search.partial;
+    m_captureWindowId = reinterpret_cast<quintptr>(hwnd);
+    return hwnd != nullptr;
+}
+
+bool ScreenRecorder::captureWindowRect(QRect& rect) {
+    HWND hwnd = reinterpret_cast<HWND>(m_captureWindowId);
+    if (!IsWindow(hwnd) || IsIconic(hwnd)) {
+        return false;
+    }
+    // The extended frame bounds leave out the invisible resize borders
+    // that GetWindowRect includes on Windows 10 and later
+    RECT bounds;
+    if (FAILED(DwmGetWindowAttribute(hwnd, DWMWA_EXTENDED_FRAME_BOUNDS, &bounds, sizeof(bounds))) &&
+        !GetWindowRect(hwnd, &bounds)) {
         return false;
     }
+    rect = QRect(bounds.left - m_outputOrigin.x, bounds.top - m_outputOrigin.y,
+                 bounds.right - bounds.left, bounds.bottom - bounds.top);
+    return true;
+}
+
+ScreenRecorder::CaptureResult ScreenRecorder::captureFrameD3D(QImage& outImage, Nv12Frame* outNv12, bool* outGpuFrame) {
+    if (!m_deskDupl || !m_d3dDevice || !m_d3dContext) {
+        return CaptureFailed;
+    }
     
     static int consecutiveTimeouts = 0;
     static int totalFramesCaptured = 0;
@@ -598,11 +1868,19 @@ bool ScreenRecorder::captureFrameD3D(QImage& outImage) {
     DXGI_OUTDUPL_FRAME_INFO frameInfo;
     HRESULT hr = S_OK;
     
-    // FIRST ATTEMPT: Try normal capture without forcing
-    hr = m_deskDupl->AcquireNextFrame(100, &frameInfo, &desktopResource);
+    // FIRST ATTEMPT: Try normal capture without forcing. The frame pacer
+    // has already waited for this frame's deadline, so once frames flow
+    // don't wait at all: a timeout just means nothing on screen changed.
+    // Until the first frame arrives, allow one frame interval.
+    const UINT timeoutMs = m_lastFramePresented != 0 ? 0
+                         : (UINT)(std::max)(1, 1000 / (std::max)(1, m_fps));
+    hr = m_deskDupl->AcquireNextFrame(timeoutMs, &frameInfo, &desktopResource);
     
-    // If timeout AND we've had multiple consecutive timeouts, THEN force update and retry
-    if (hr == DXGI_ERROR_WAIT_TIMEOUT && consecutiveTimeouts >= 3) {
+    // If timeout AND we've had multiple consecutive timeouts before the
+    // first frame ever arrived, THEN force update and retry (some AMD
+    // drivers deliver nothing until the desktop is invalidated). Once
+    // frames flow, timeouts are just a static screen.
+    if (hr == DXGI_ERROR_WAIT_TIMEOUT && consecutiveTimeouts >= 3 && m_lastFramePresented == 0) {
         // Force desktop update
         HWND desktopHwnd = GetDesktopWindow();
         InvalidateRect(desktopHwnd, NULL, FALSE);
@@ -629,7 +1907,7 @@ bool ScreenRecorder::captureFrameD3D(QImage& outImage) {
                 .arg(consecutiveTimeouts).arg(totalFramesCaptured));
         }
         
-        return false;
+        return m_lastFramePresented != 0 ? CaptureUnchanged : CaptureFailed;
     }
     
     // Handle ACCESS_LOST
@@ -639,7 +1917,7 @@ bool ScreenRecorder::captureFrameD3D(QImage& outImage) {
             emit debugLog("⚠️ [D3D Capture] DXGI_ERROR_ACCESS_LOST - will attempt recovery");
             accessLostCount++;
         }
-        return false;
+        return CaptureFailed;
     }
     
     // Handle other errors
@@ -657,24 +1935,19 @@ bool ScreenRecorder::captureFrameD3D(QImage& outImage) {
             emit debugLog(QString("❌ [D3D Capture] AcquireNextFrame failed: %1").arg(errorMsg));
             errorCount++;
         }
-        return false;
+        return CaptureFailed;
     }
     
     // SUCCESS - reset timeout counter
     consecutiveTimeouts = 0;
     
-    // Validate frame info
-    if (frameInfo.LastPresentTime.QuadPart == 0) {
-        desktopResource->Release();
-        m_deskDupl->ReleaseFrame();
-        return false;
-    }
-    
-    // Check for duplicate frames
-    if (frameInfo.LastPresentTime.QuadPart == m_lastFramePresented) {
+    // A zero present time means only the mouse pointer changed; an equal
+    // one means the desktop image is the one we already have.
+    if (frameInfo.LastPresentTime.QuadPart == 0 ||
+        frameInfo.LastPresentTime.QuadPart == m_lastFramePresented) {
         desktopResource->Release();
         m_deskDupl->ReleaseFrame();
-        return false;
+        return m_lastFramePresented != 0 ? CaptureUnchanged : CaptureFailed;
     }
     
     m_lastFramePresented = frameInfo.LastPresentTime.QuadPart;
@@ -686,7 +1959,7 @@ bool ScreenRecorder::captureFrameD3D(QImage& outImage) {
     
     if (FAILED(hr)) {
         m_deskDupl->ReleaseFrame();
-        return false;
+        return CaptureFailed;
     }
     
     // Get texture description
@@ -696,61 +1969,59 @@ bool ScreenRecorder::captureFrameD3D(QImage& outImage) {
     if (desc.Width == 0 || desc.Height == 0) {
         texture->Release();
         m_deskDupl->ReleaseFrame();
-        return false;
+        return CaptureFailed;
     }
     
-    // Create staging texture for CPU access
-    D3D11_TEXTURE2D_DESC stagingDesc = desc;
-    stagingDesc.Usage = D3D11_USAGE_STAGING;
-    stagingDesc.BindFlags = 0;
-    stagingDesc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
-    stagingDesc.MiscFlags = 0;
-    
-    ID3D11Texture2D* stagingTexture = nullptr;
-    hr = m_d3dDevice->CreateTexture2D(&stagingDesc, nullptr, &stagingTexture);
-    
-    if (FAILED(hr)) {
-        texture->Release();
-        m_deskDupl->ReleaseFrame();
-        return false;
+    // A mode change normally arrives as ACCESS_LOST and a reinit, but
+    // never crop outside the texture we actually got
+    if (QRect(0, 0, desc.Width, desc.Height) != m_captureScreen) {
+        resolveCaptureArea(QRect(0, 0, desc.Width, desc.Height));
     }
     
-    // Copy to staging texture
-    m_d3dContext->CopyResource(stagingTexture, texture);
-    texture->Release();
-    
-    // Map staging texture
-    D3D11_MAPPED_SUBRESOURCE mapped;
-    hr = m_d3dContext->Map(stagingTexture, 0, D3D11_MAP_READ, 0, &mapped);
-    
-    if (FAILED(hr)) {
-        stagingTexture->Release();
-        m_deskDupl->ReleaseFrame();
-        return false;
+    // Encoded modes convert to NV12 on the GPU (cropping and scaling in
+    // the same pass) and either read it back or, for zero-copy, leave it in
+    // m_vpOutputTexture for the encoder. The JPEG path reads back BGRA,
+    // scaled by the processor when the output is smaller than the area;
+    // without a usable processor only the area is read back and scaled
+    // on the CPU.
+    bool ok = false;
+    if (outGpuFrame) {
+        *outGpuFrame = false;
     }
-    
-    // Create QImage
-    outImage = QImage(desc.Width, desc.Height, QImage::Format_ARGB32);
-    
-    if (outImage.isNull()) {
-        m_d3dContext->Unmap(stagingTexture, 0);
-        stagingTexture->Release();
-        m_deskDupl->ReleaseFrame();
-        return false;
+    const bool gpuUsable = !m_gpuConvertUnavailable && desc.Format == DXGI_FORMAT_B8G8R8A8_UNORM;
+    if (outNv12) {
+        outNv12->clear();
+        if (gpuUsable && convertOnGpu(texture, DXGI_FORMAT_NV12)) {
+            if (outGpuFrame) {
+                *outGpuFrame = true;
+                ok = true;
+            } else {
+                ok = readbackNV12(*outNv12);
+            }
+            if (!ok) {
+                outNv12->clear();
+            }
+        }
+    } else if (gpuUsable && isScalingCapture() && convertOnGpu(texture, DXGI_FORMAT_B8G8R8A8_UNORM)) {
+        ok = readbackBGRA(m_vpOutputTexture, outImage);
     }
-    
-    // Copy data with proper pitch handling
-    for (UINT y = 0; y < desc.Height; y++) {
-        memcpy(outImage.scanLine(y),
-               (BYTE*)mapped.pData + (y * mapped.RowPitch),
-               desc.Width * 4);
+    if (!ok) {
+        const bool fullTexture = m_captureRect == QRect(0, 0, desc.Width, desc.Height);
+        if (isScalingCapture()) {
+            ok = readbackBGRA(texture, m_captureAreaFrame, m_captureRect) &&
+                 m_scaler.scale(m_captureAreaFrame, m_outputSize, outImage);
+        } else {
+            ok = readbackBGRA(texture, outImage, fullTexture ? QRect() : m_captureRect);
+        }
     }
     
-    // Cleanup
-    m_d3dContext->Unmap(stagingTexture, 0);
-    stagingTexture->Release();
+    texture->Release();
     m_deskDupl->ReleaseFrame();
     
+    if (!ok) {
+        return CaptureFailed;
+    }
+    
     // Track successful captures
     totalFramesCaptured++;
     
@@ -763,20 +2034,233 @@ bool ScreenRecorder::captureFrameD3D(QImage& outImage) {
         emit debugLog(QString("✓ [AMD] %1 frames captured total").arg(totalFramesCaptured));
     }
     
-    return true;
+    return CaptureNewFrame;
 }
 
 #elif __APPLE__
 
-bool ScreenRecorder::captureFrameCG(QImage& outImage) {
+bool ScreenRecorder::findCaptureWindow(const QString& title) {
+    CFArrayRef windows = CGWindowListCopyWindowInfo(
+        kCGWindowListOptionOnScreenOnly | kCGWindowListExcludeDesktopElements, kCGNullWindowID);
+    if (!windows) {
+        return false;
+    }
+    CGWindowID exact = 0;
+    CGWindowID partial = 0;
+    for (CFIndex i = 0; i < CFArrayGetCount(windows) && !exact; i++) {
+        CFDictionaryRef info = static_cast<CFDictionaryRef>(CFArrayGetValueAtIndex(windows, i));
+        CFStringRef name = static_cast<CFStringRef>(CFDictionaryGetValue(info, kCGWindowName));
+        CFNumberRef number = static_cast<CFNumberRef>(CFDictionaryGetValue(info, kCGWindowNumber));
+        if (!name || !number) {
+            continue;
+        }
+        CGWindowID id = 0;
+        CFNumberGetValue(number, kCFNumberSInt32Type, &id);
+        const QString windowName = QString::fromCFString(name);
+        if (windowName == title) {
+            exact = id;
+        } else if (!partial && windowName.contains(title, Qt::CaseInsensitive)) {
+            partial = id;
+        }
+    }
+    CFRelease(windows);
+    m_captureWindowId = exact ? exact : partial;
+    return m_captureWindowId != 0;
+}
+
+bool ScreenRecorder::captureWindowRect(QRect& rect) {
+    CFArrayRef windows = CGWindowListCopyWindowInfo(kCGWindowListOptionIncludingWindow,
+                                                    static_cast<CGWindowID>(m_captureWindowId));
+    if (!windows) {
+        return false;
+    }
+    bool found = false;
+    if (CFArrayGetCount(windows) > 0) {
+        CFDictionaryRef info = static_cast<CFDictionaryRef>(CFArrayGetValueAtIndex(windows, 0));
+        CFDictionaryRef boundsDict = static_cast<CFDictionaryRef>(CFDictionaryGetValue(info, kCGWindowBounds));
+        CGRect bounds;
+        if (boundsDict && CGRectMakeWithDictionaryRepresentation(boundsDict, &bounds)) {
+            // Window bounds are global points; the capture area is in this
+            // display's pixels
+            const CGRect display = CGDisplayBounds(m_displayID);
+            const double scale = display.size.width > 0 ? m_captureScreen.width() / display.size.width : 1.0;
+            rect = QRect(qRound((bounds.origin.x - display.origin.x) * scale),
+                         qRound((bounds.origin.y - display.origin.y) * scale),
+                         qRound(bounds.size.width * scale),
+                         qRound(bounds.size.height * scale));
+            found = true;
+        }
+    }
+    CFRelease(windows);
+    return found;
+}
+
+bool ScreenRecorder::initScreenCaptureKit() {
+    cleanupScreenCaptureKit();
+    if (!ScreenCaptureKitStream::isAvailable()) {
+        emit debugLog("⚠️  [Init] ScreenCaptureKit needs macOS 12.3 - capturing with CGDisplayCreateImage");
+        return false;
+    }
+    const QSize pixels = ScreenCaptureKitStream::displayPixelSize(m_displayID);
+    if (pixels.isEmpty()) {
+        return false;
+    }
+    resolveCaptureArea(QRect(QPoint(0, 0), pixels));
+    
+    ScreenCaptureKitStream::Config config;
+    config.displayId = m_displayID;
+    config.sourceRect = m_captureRect;
+    config.outputSize = m_outputSize;
+    config.fps = m_fps;
+    config.format = (m_captureMode != JpegFrames) ? ScreenCaptureKitStream::NV12 : ScreenCaptureKitStream::BGRA;
+    
+    auto stream = std::make_unique<ScreenCaptureKitStream>();
+    if (!stream->start(config)) {
+        emit debugLog(QString("⚠️  [Init] ScreenCaptureKit unavailable (%1) - capturing with CGDisplayCreateImage")
+            .arg(stream->lastError()));
+        return false;
+    }
+    m_sckStream = std::move(stream);
+    return true;
+}
+
+void ScreenRecorder::cleanupScreenCaptureKit() {
+    m_sckStream.reset();
+    if (m_sckPixelBuffer) {
+        CVPixelBufferRelease(m_sckPixelBuffer);
+        m_sckPixelBuffer = nullptr;
+    }
+}
+
+// Copies a ScreenCaptureKit buffer into system memory: BGRA into
+// `outImage` (reused when it is not shared), NV12 into `outNv12` with a
+// stride of one row
+static bool copyPixelBuffer(CVPixelBufferRef buffer, QImage& outImage, Nv12Frame* outNv12) {
+    if (CVPixelBufferLockBaseAddress(buffer, kCVPixelBufferLock_ReadOnly) != kCVReturnSuccess) {
+        return false;
+    }
+    const int width = static_cast<int>(CVPixelBufferGetWidth(buffer));
+    const int height = static_cast<int>(CVPixelBufferGetHeight(buffer));
+    const OSType format = CVPixelBufferGetPixelFormatType(buffer);
+    bool copied = false;
+    
+    if (format == kCVPixelFormatType_32BGRA) {
+        // B,G,R,A bytes are Format_RGB32 on little-endian hosts
+        if (outImage.size() != QSize(width, height) || outImage.format() != QImage::Format_RGB32 ||
+            !outImage.isDetached()) {
+            outImage = QImage(width, height, QImage::Format_RGB32);
+        }
+        const uint8_t* src = static_cast<const uint8_t*>(CVPixelBufferGetBaseAddress(buffer));
+        const size_t srcStride = CVPixelBufferGetBytesPerRow(buffer);
+        for (int y = 0; y < height; y++) {
+            memcpy(outImage.scanLine(y), src + y * srcStride, (size_t)width * 4);
+        }
+        copied = !outImage.isNull();
+    } else if (outNv12 && CVPixelBufferGetPlaneCount(buffer) == 2) {
+        const int w = width & ~1;
+        const int h = height & ~1;
+        outNv12->data.resize(w * h * 3 / 2);
+        outNv12->width = w;
+        outNv12->height = h;
+        outNv12->stride = w;
+        uint8_t* dst = reinterpret_cast<uint8_t*>(outNv12->data.data());
+        for (size_t plane = 0; plane < 2; plane++) {
+            const uint8_t* src = static_cast<const uint8_t*>(CVPixelBufferGetBaseAddressOfPlane(buffer, plane));
+            const size_t srcStride = CVPixelBufferGetBytesPerRowOfPlane(buffer, plane);
+            const int rows = plane == 0 ? h : h / 2;
+            for (int y = 0; y < rows; y++) {
+                memcpy(dst, src + y * srcStride, w);
+                dst += w;
+            }
+        }
+        copied = true;
+    }
+    
+    CVPixelBufferUnlockBaseAddress(buffer, kCVPixelBufferLock_ReadOnly);
+    return copied;
+}
+
+ScreenRecorder::CaptureResult ScreenRecorder::captureFrameSCK(QImage& outImage, Nv12Frame* outNv12,
+                                                              bool* outPixelBuffer) {
+    // Follow the captured window and the quality controller's size step
+    const ScreenCaptureKitStream::Config& config = m_sckStream->config();
+    if (config.sourceRect != m_captureRect || config.outputSize != m_outputSize) {
+        m_sckStream->reconfigure(m_captureRect, m_outputSize);
+    }
+    
+    CVPixelBufferRef buffer = nullptr;
+    switch (m_sckStream->acquireFrame(&buffer)) {
+    case ScreenCaptureKitStream::Failed:
+        return CaptureFailed;
+    case ScreenCaptureKitStream::Unchanged:
+        return CaptureUnchanged;
+    case ScreenCaptureKitStream::NewFrame:
+        break;
+    }
+    
+    // The encoder takes the IOSurface as it is; keep it for encodeGpuFrame
+    if (outPixelBuffer && CVPixelBufferGetPlaneCount(buffer) == 2) {
+        if (m_sckPixelBuffer) {
+            CVPixelBufferRelease(m_sckPixelBuffer);
+        }
+        m_sckPixelBuffer = buffer;
+        *outPixelBuffer = true;
+        return CaptureNewFrame;
+    }
+    
+    const bool copied = copyPixelBuffer(buffer, outImage, outNv12);
+    CVPixelBufferRelease(buffer);
+    return copied ? CaptureNewFrame : CaptureFailed;
+}
+
+bool ScreenRecorder::encodeGpuFrame(int64_t timestampUs) {
+    if (!ensureLiveEncoder((int)CVPixelBufferGetWidth(m_sckPixelBuffer), (int)CVPixelBufferGetHeight(m_sckPixelBuffer))) {
+        return false;
+    }
+    
+    // Not VideoToolbox, or it could not take pixel buffers: copy the
+    // planes out and take the NV12 system-memory path
+    if (!m_liveEncoder->isZeroCopy()) {
+        QImage unused;
+        return copyPixelBuffer(m_sckPixelBuffer, unused, &m_nv12Frame) && encodeFrame(m_nv12Frame, timestampUs);
+    }
+    
+    std::vector<EncodedPacket> packets;
+    if (!m_liveEncoder->encode(m_sckPixelBuffer, encoderPts(timestampUs), packets)) {
+        emit debugLog(QString("❌ [Encode] %1").arg(m_liveEncoder->lastError()));
+        return false;
+    }
+    storePackets(packets);
+    return true;
+}
+
+ScreenRecorder::CaptureResult ScreenRecorder::captureFrameCG(QImage& outImage) {
     CGImageRef screenshot = CGDisplayCreateImage(m_displayID);
     
     if (!screenshot) {
-        return false;
+        return CaptureFailed;
+    }
+    
+    const QSize screenSize((int)CGImageGetWidth(screenshot), (int)CGImageGetHeight(screenshot));
+    if (QRect(QPoint(0, 0), screenSize) != m_captureScreen) {
+        resolveCaptureArea(QRect(QPoint(0, 0), screenSize));
+    }
+    
+    // Only the capture area is drawn, straight into an output-sized
+    // bitmap, so cropping and scaling are the one draw that was already
+    // copying the pixels
+    CGImageRef area = screenshot;
+    if (m_captureRect != QRect(QPoint(0, 0), screenSize)) {
+        area = CGImageCreateWithImageInRect(screenshot, CGRectMake(m_captureRect.x(), m_captureRect.y(),
+                                                                   m_captureRect.width(), m_captureRect.height()));
+        if (!area) {
+            CGImageRelease(screenshot);
+            return CaptureFailed;
+        }
     }
     
-    size_t width = CGImageGetWidth(screenshot);
-    size_t height = CGImageGetHeight(screenshot);
+    const size_t width = m_outputSize.width();
+    const size_t height = m_outputSize.height();
     
     outImage = QImage(width, height, QImage::Format_RGB32);
     
@@ -790,13 +2274,28 @@ bool ScreenRecorder::captureFrameCG(QImage& outImage) {
         colorSpace,
         kCGImageAlphaPremultipliedFirst | kCGBitmapByteOrder32Little);
     
-    CGContextDrawImage(context, CGRectMake(0, 0, width, height), screenshot);
+    if (isScalingCapture()) {
+        CGContextSetInterpolationQuality(context, kCGInterpolationHigh);
+    }
+    CGContextDrawImage(context, CGRectMake(0, 0, width, height), area);
     
     CGContextRelease(context);
     CGColorSpaceRelease(colorSpace);
+    if (area != screenshot) {
+        CGImageRelease(area);
+    }
     CGImageRelease(screenshot);
     
-    return true;
+    // CoreGraphics has no change notification, so compare against the
+    // previous capture. Each capture is a fresh image, so keeping the
+    // previous one is just a reference.
+    if (m_previousCGFrame.size() == outImage.size() &&
+        memcmp(m_previousCGFrame.constBits(), outImage.constBits(), outImage.sizeInBytes()) == 0) {
+        return CaptureUnchanged;
+    }
+    m_previousCGFrame = outImage;
+    
+    return CaptureNewFrame;
 }
 
 #else
@@ -808,69 +2307,391 @@ bool ScreenRecorder::initX11() {
     }
     
     m_root = DefaultRootWindow(m_display);
+    
+    XWindowAttributes attrs;
+    XGetWindowAttributes(m_display, m_root, &attrs);
+    m_screenWidth = attrs.width;
+    m_screenHeight = attrs.height;
+    
+    m_displayRect = queryDisplayRect();
+    if (m_displayRect.isEmpty()) {
+        emit debugLog(QString("❌ [X11] Monitor %1 not found").arg(m_displayIndex.load()));
+        XCloseDisplay(m_display);
+        m_display = nullptr;
+        return false;
+    }
+    
+    // Resolution changes arrive as ConfigureNotify on the root window
+    XSelectInput(m_display, m_root, StructureNotifyMask);
+    
+    m_useShm = XShmQueryExtension(m_display) && initShmImage();
+    emit debugLog(m_useShm
+        ? QString("✓ [X11] Shared-memory capture enabled (%1x%2)").arg(m_screenWidth).arg(m_screenHeight)
+        : QString("⚠️ [X11] XShm unavailable - falling back to XGetImage"));
+    
+    // XFixes supplies the region type XDamage reports into
+    int fixesEvent = 0;
+    int fixesError = 0;
+    int damageError = 0;
+    m_useDamage = XFixesQueryExtension(m_display, &fixesEvent, &fixesError) &&
+                  XDamageQueryExtension(m_display, &m_damageEventBase, &damageError);
+    if (m_useDamage) {
+        m_damage = XDamageCreate(m_display, m_root, XDamageReportNonEmpty);
+        m_damageRegion = XFixesCreateRegion(m_display, nullptr, 0);
+        emit debugLog("✓ [X11] XDamage dirty-region tracking enabled");
+    } else {
+        emit debugLog("⚠️ [X11] XDamage unavailable - grabbing every frame");
+    }
+    
+    m_damagePending = false;
+    m_fullGrabNeeded = true;
+    resolveCaptureArea(m_displayRect);
     return true;
 }
 
-void ScreenRecorder::cleanupX11() {
-    if (m_image) {
+QRect ScreenRecorder::queryDisplayRect() {
+    const QRect root(0, 0, m_screenWidth, m_screenHeight);
+    const int wanted = m_displayIndex.load();
+    if (wanted < 0) {
+        return root;
+    }
+    int count = 0;
+    XRRMonitorInfo* monitors = XRRGetMonitors(m_display, m_root, True, &count);
+    QRect rect;
+    if (monitors && wanted < count) {
+        rect = QRect(monitors[wanted].x, monitors[wanted].y,
+                     monitors[wanted].width, monitors[wanted].height) & root;
+    }
+    if (monitors) {
+        XRRFreeMonitors(monitors);
+    }
+    return rect;
+}
+
+bool ScreenRecorder::initShmImage() {
+    Screen* screen = DefaultScreenOfDisplay(m_display);
+    m_image = XShmCreateImage(m_display, DefaultVisualOfScreen(screen), DefaultDepthOfScreen(screen),
+                              ZPixmap, nullptr, &m_shmInfo, m_screenWidth, m_screenHeight);
+    if (!m_image) {
+        return false;
+    }
+    if (m_image->bits_per_pixel != 32) {
+        XDestroyImage(m_image);
+        m_image = nullptr;
+        return false;
+    }
+    
+    m_shmInfo.shmid = shmget(IPC_PRIVATE, (size_t)m_image->bytes_per_line * m_image->height, IPC_CREAT | 0600);
+    if (m_shmInfo.shmid < 0) {
         XDestroyImage(m_image);
         m_image = nullptr;
+        return false;
+    }
+    m_shmInfo.shmaddr = m_image->data = static_cast<char*>(shmat(m_shmInfo.shmid, nullptr, 0));
+    m_shmInfo.readOnly = False;
+    
+    if (m_shmInfo.shmaddr == reinterpret_cast<char*>(-1) || !XShmAttach(m_display, &m_shmInfo)) {
+        if (m_shmInfo.shmaddr != reinterpret_cast<char*>(-1)) {
+            shmdt(m_shmInfo.shmaddr);
+        }
+        shmctl(m_shmInfo.shmid, IPC_RMID, nullptr);
+        m_image->data = nullptr;
+        XDestroyImage(m_image);
+        m_image = nullptr;
+        return false;
     }
     
+    // Mark for removal now; it is freed once both sides detach, even if
+    // the process dies without cleaning up.
+    XSync(m_display, False);
+    shmctl(m_shmInfo.shmid, IPC_RMID, nullptr);
+    return true;
+}
+
+void ScreenRecorder::cleanupShmImage() {
+    if (!m_image) {
+        return;
+    }
+    if (m_useShm) {
+        XShmDetach(m_display, &m_shmInfo);
+        XSync(m_display, False);
+        shmdt(m_shmInfo.shmaddr);
+        m_image->data = nullptr;
+    }
+    XDestroyImage(m_image);
+    m_image = nullptr;
+    m_shmInfo = XShmSegmentInfo{};
+}
+
+void ScreenRecorder::cleanupX11() {
     if (m_display) {
+        cleanupShmImage();
+        if (m_damageRegion) {
+            XFixesDestroyRegion(m_display, m_damageRegion);
+            m_damageRegion = 0;
+        }
+        if (m_damage) {
+            XDamageDestroy(m_display, m_damage);
+            m_damage = 0;
+        }
         XCloseDisplay(m_display);
         m_display = nullptr;
     }
+    m_useShm = false;
+    m_useDamage = false;
 }
 
-bool ScreenRecorder::captureFrameX11(QImage& outImage) {
-    if (!m_display) {
-        return false;
+// Window lookups race with windows being destroyed; Xlib's default
+// handler would exit the process on the resulting BadWindow
+static int ignoreXError(Display*, XErrorEvent*) {
+    return 0;
+}
+
+static QString x11WindowTitle(Display* display, Window window) {
+    const Atom netWmName = XInternAtom(display, "_NET_WM_NAME", False);
+    const Atom utf8String = XInternAtom(display, "UTF8_STRING", False);
+    Atom type = None;
+    int format = 0;
+    unsigned long count = 0;
+    unsigned long remaining = 0;
+    unsigned char* data = nullptr;
+    QString title;
+    if (XGetWindowProperty(display, window, netWmName, 0, 1024, False, utf8String,
+                           &type, &format, &count, &remaining, &data) == Success && data) {
+        if (type == utf8String && format == 8) {
+            title = QString::fromUtf8(reinterpret_cast<const char*>(data), (int)count);
+        }
+        XFree(data);
+    }
+    if (title.isEmpty()) {
+        char* name = nullptr;
+        if (XFetchName(display, window, &name) && name) {
+            title = QString::fromLocal8Bit(name);
+            XFree(name);
+        }
+    }
+    return title;
+}
+
+bool ScreenRecorder::findCaptureWindow(const QString& title) {
+    XErrorHandler previous = XSetErrorHandler(ignoreXError);
+    
+    // Titles live on the client windows, which sit below the window
+    // manager's frames, so walk the whole tree
+    std::vector<Window> pending = { m_root };
+    Window exact = 0;
+    Window partial = 0;
+    while (!pending.empty() && !exact) {
+        const Window window = pending.back();
+        pending.pop_back();
+        if (window != m_root) {
+            XWindowAttributes attrs;
+            if (XGetWindowAttributes(m_display, window, &attrs) && attrs.map_state == IsViewable) {
+                const QString name = x11WindowTitle(m_display, window);
+                if (name == title) {
+                    exact = window;
+                } else if (!partial && !name.isEmpty() && name.contains(title, Qt::CaseInsensitive)) {
+                    partial = window;
+                }
+            }
+        }
+        Window rootReturn = 0;
+        Window parent = 0;
+        Window* children = nullptr;
+        unsigned int count = 0;
+        if (XQueryTree(m_display, window, &rootReturn, &parent, &children, &count)) {
+            pending.insert(pending.end(), children, children + count);
+        }
+        if (children) {
+            XFree(children);
+        }
     }
+    
+    XSync(m_display, False);
+    XSetErrorHandler(previous);
+    m_captureWindowId = exact ? exact : partial;
+    return m_captureWindowId != 0;
+}
 
+bool ScreenRecorder::captureWindowRect(QRect& rect) {
+    const Window window = static_cast<Window>(m_captureWindowId);
+    XErrorHandler previous = XSetErrorHandler(ignoreXError);
     XWindowAttributes attrs;
-    XGetWindowAttributes(m_display, m_root, &attrs);
+    int x = 0;
+    int y = 0;
+    Window child = 0;
+    const bool ok = XGetWindowAttributes(m_display, window, &attrs) && attrs.map_state == IsViewable &&
+                    XTranslateCoordinates(m_display, window, m_root, 0, 0, &x, &y, &child);
+    XSync(m_display, False);
+    XSetErrorHandler(previous);
+    if (!ok) {
+        return false;
+    }
+    rect = QRect(x, y, attrs.width, attrs.height);
+    return true;
+}
+
+bool ScreenRecorder::grabShmRect(QImage& outImage, int x, int y, int width, int height) {
+    // The segment is sized for the full screen; a sub-rectangle is fetched
+    // by shrinking the image header, which packs rows at width * 4 bytes.
+    m_image->width = width;
+    m_image->height = height;
+    m_image->bytes_per_line = width * 4;
+    
+    bool ok = XShmGetImage(m_display, m_root, m_image, x, y, AllPlanes);
+    
+    // `outImage` holds the capture area, so screen coordinates shift by
+    // its origin
+    if (ok) {
+        const uchar* src = reinterpret_cast<const uchar*>(m_image->data);
+        const int outX = x - m_captureRect.x();
+        const int outY = y - m_captureRect.y();
+        for (int row = 0; row < height; row++) {
+            memcpy(outImage.scanLine(outY + row) + outX * 4, src + (size_t)row * width * 4, (size_t)width * 4);
+        }
+    }
+    
+    m_image->width = m_screenWidth;
+    m_image->height = m_screenHeight;
+    m_image->bytes_per_line = m_screenWidth * 4;
+    return ok;
+}
 
+ScreenRecorder::CaptureResult ScreenRecorder::captureFrameX11(QImage& outImage) {
+    if (!m_display) {
+        return CaptureFailed;
+    }
+    
+    // Drain pending events without blocking: damage notifications and
+    // root window resizes. No events means nothing changed on screen.
+    while (XPending(m_display) > 0) {
+        XEvent event;
+        XNextEvent(m_display, &event);
+        if (m_useDamage && event.type == m_damageEventBase + XDamageNotify) {
+            m_damagePending = true;
+        } else if (event.type == ConfigureNotify && event.xconfigure.window == m_root &&
+                   (event.xconfigure.width != m_screenWidth || event.xconfigure.height != m_screenHeight)) {
+            m_screenWidth = event.xconfigure.width;
+            m_screenHeight = event.xconfigure.height;
+            emit debugLog(QString("🔄 [X11] Screen resized to %1x%2").arg(m_screenWidth).arg(m_screenHeight));
+            if (m_useShm) {
+                cleanupShmImage();
+                m_useShm = initShmImage();
+            }
+            // Monitors may have moved within the root; if ours is gone,
+            // keep recording the whole root rather than nothing
+            m_displayRect = queryDisplayRect();
+            if (m_displayRect.isEmpty()) {
+                m_displayRect = QRect(0, 0, m_screenWidth, m_screenHeight);
+            }
+            resolveCaptureArea(m_displayRect);
+            m_fullGrabNeeded = true;
+        }
+    }
+    
+    // The area is grabbed straight into the caller's image, or into
+    // m_captureAreaFrame and then scaled into it
+    const QRect area = m_captureRect;
+    const bool scaling = isScalingCapture();
+    QImage& frame = scaling ? m_captureAreaFrame : outImage;
+    if (frame.size() != area.size() || frame.format() != QImage::Format_RGB32) {
+        frame = QImage(area.size(), QImage::Format_RGB32);
+        m_fullGrabNeeded = true;
+    }
+    
+    if (m_useDamage && !m_fullGrabNeeded && !m_damagePending) {
+        // Idle screen: the previous frame in outImage is still current
+        return CaptureUnchanged;
+    }
+    
+    // Collect the dirty rectangles inside the area and reset the damage
+    // for the next frame
+    std::vector<QRect> dirty;
+    if (m_useDamage && m_damagePending) {
+        XDamageSubtract(m_display, m_damage, None, m_damageRegion);
+        int count = 0;
+        XRectangle* rects = XFixesFetchRegion(m_display, m_damageRegion, &count);
+        if (rects) {
+            for (int i = 0; i < count; i++) {
+                const QRect r = QRect(rects[i].x, rects[i].y, rects[i].width, rects[i].height) & area;
+                if (!r.isEmpty()) {
+                    dirty.push_back(r);
+                }
+            }
+            XFree(rects);
+        }
+        m_damagePending = false;
+    }
+    
+    if (m_useShm) {
+        // One request for the whole area beats many small ones once a
+        // large part of it (or a fragmented region) has changed.
+        qint64 dirtyArea = 0;
+        for (const QRect& r : dirty) {
+            dirtyArea += (qint64)r.width() * r.height();
+        }
+        const bool fullGrab = m_fullGrabNeeded || !m_useDamage || dirty.size() > 32 ||
+                              dirtyArea * 2 > (qint64)area.width() * area.height();
+        
+        if (fullGrab) {
+            // Every pixel is overwritten, so don't detach-copy a shared image
+            if (!frame.isDetached()) {
+                frame = QImage(area.size(), QImage::Format_RGB32);
+            }
+            if (!grabShmRect(frame, area.x(), area.y(), area.width(), area.height())) {
+                return CaptureFailed;
+            }
+        } else if (dirty.empty()) {
+            return CaptureUnchanged;
+        } else {
+            for (const QRect& r : dirty) {
+                if (!grabShmRect(frame, r.x(), r.y(), r.width(), r.height())) {
+                    return CaptureFailed;
+                }
+            }
+        }
+        m_fullGrabNeeded = false;
+        return (!scaling || m_scaler.scale(frame, m_outputSize, outImage)) ? CaptureNewFrame : CaptureFailed;
+    }
+    
+    // XGetImage fallback: pixels come over the socket, copied once into
+    // the reused output image.
     XImage* image = XGetImage(
         m_display, 
         m_root, 
-        0, 0, 
-        attrs.width, 
-        attrs.height, 
+        area.x(), area.y(), 
+        area.width(), 
+        area.height(), 
         AllPlanes, 
         ZPixmap);
     
     if (!image) {
-        return false;
+        return CaptureFailed;
     }
 
-    if (image->depth == 24 || image->depth == 32) {
-        QImage wrapper(
-            (const uchar*)image->data, 
-            image->width, 
-            image->height, 
-            image->bytes_per_line, 
-            QImage::Format_RGB32);
-        
-        outImage = wrapper.copy(); 
+    if (image->bits_per_pixel == 32) {
+        for (int y = 0; y < image->height; y++) {
+            memcpy(frame.scanLine(y),
+                   image->data + (size_t)y * image->bytes_per_line,
+                   (size_t)image->width * 4);
+        }
     } else {
-        outImage = QImage(attrs.width, attrs.height, QImage::Format_RGB32);
-        
-        for (int y = 0; y < attrs.height; y++) {
-            for (int x = 0; x < attrs.width; x++) {
+        for (int y = 0; y < image->height; y++) {
+            for (int x = 0; x < image->width; x++) {
                 unsigned long pixel = XGetPixel(image, x, y);
                 
                 int r = (pixel & image->red_mask) >> 16;
                 int g = (pixel & image->green_mask) >> 8;
                 int b = (pixel & image->blue_mask);
                 
-                outImage.setPixel(x, y, qRgb(r, g, b));
+                frame.setPixel(x, y, qRgb(r, g, b));
             }
         }
     }
 
     XDestroyImage(image);
-    return true;
+    m_fullGrabNeeded = false;
+    return (!scaling || m_scaler.scale(frame, m_outputSize, outImage)) ? CaptureNewFrame : CaptureFailed;
 }
 
 #endif
\ No newline at end of file
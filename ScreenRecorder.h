@@ -7,10 +7,24 @@
 #include <QByteArray>
 #include <QDateTime>
 #include <QImage>
-#include <QDateTime>
+#include <QRect>
+#include <QSize>
+#include <QString>
+#include <QStringList>
+#include <QElapsedTimer>
+#include <algorithm>
 #include <deque>
 #include <memory>
 #include <atomic>
+#include "LiveEncoder.h"
+#include "CompressionPipeline.h"
+#include "MediaClock.h"
+#include "ReplayBuffer.h"
+#include "SegmentStore.h"
+#include "FrameScaler.h"
+#include "QualityController.h"
+
+class SyntheticFrameSource;
 
 #ifdef _WIN32
 #include <windows.h>
@@ -19,22 +33,32 @@
 #elif __APPLE__
 #include <CoreGraphics/CoreGraphics.h>
 #include <CoreVideo/CoreVideo.h>
+#include "ScreenCaptureKitStream.h"
 #else
 #include <X11/Xlib.h>
 #include <X11/extensions/XShm.h>
+#include <X11/extensions/Xdamage.h>
+#include <X11/extensions/Xfixes.h>
 #endif
 
-struct VideoFrame {
-    QByteArray jpegData; 
-    QSize originalSize;
-    QImage::Format format;
-    QDateTime timestamp;
-};
-
 class ScreenRecorder : public QThread {
     Q_OBJECT
 
 public:
+    /*
+     * Capture modes
+     * - `JpegFrames`: every captured frame is JPEG-compressed and kept in
+     *   `m_replayBuffer`; all video encoding happens when a clip is saved.
+     * - `EncodedH264` / `EncodedHEVC`: frames are encoded continuously by a
+     *   `LiveEncoder` and the buffer keeps whole GOPs of packets. Saving a
+     *   clip is a remux of the most recent packets (`getPackets`).
+     */
+    enum CaptureMode {
+        JpegFrames,
+        EncodedH264,
+        EncodedHEVC
+    };
+
     explicit ScreenRecorder(int fps = 30, QObject *parent = nullptr);
     ~ScreenRecorder();
 
@@ -42,14 +66,159 @@ public:
     void stopRecording();
     bool isRecording() const { return m_recording.load(); }
     
+    /*
+     * Display selection
+     * - A recorder captures one display. Several displays are recorded by
+     *   running one recorder per display, each with its own capture
+     *   thread, buffer and encoder; they all stamp frames on `MediaClock`,
+     *   so their buffers line up for per-display or composited saves.
+     * - `index` is a position in `availableDisplays()` (DXGI outputs,
+     *   XRandR monitors, active CoreGraphics displays). -1, the default,
+     *   is the first display that can be captured (on X11 the whole root
+     *   window). Takes effect on the next start; a display that no
+     *   longer exists fails the start.
+     */
+    static QStringList availableDisplays();
+    void setDisplay(int index) { m_displayIndex.store(index); }
+    int display() const { return m_displayIndex.load(); }
+    
+    /*
+     * Synthetic input
+     * - `setSyntheticSource` replaces the platform capture with a generator
+     *   (used by `clipper_bench`). Its frames are used as they come: the
+     *   display, region, window and output height settings do not apply.
+     *   Everything after capture - compression, the buffer, the live
+     *   encoder - runs as usual. nullptr goes back to the screen.
+     * - Fails while the capture thread is running.
+     */
+    bool setSyntheticSource(std::shared_ptr<SyntheticFrameSource> source);
+    
     void setFPS(int fps) { m_fps = fps; }
     int getFPS() const { return m_fps; }
     
+    // Clamped to MAX_BUFFER_SECONDS
     void setBufferSeconds(int seconds);
     int getBufferSeconds() const { return m_bufferSeconds; }
+    static constexpr int MAX_BUFFER_SECONDS = 3600;
+    
+    /*
+     * Replay buffer memory (JpegFrames mode)
+     * - JPEG frames live in a `ReplayBuffer` arena of `megabytes` (0 = sized
+     *   from physical memory). When the budget can't hold the whole
+     *   duration, the oldest frames are evicted early. Changing the budget
+     *   drops the buffered frames; returns false if it was unchanged.
+     */
+    bool setBufferBudgetMB(int megabytes);
+    ReplayBuffer::Stats replayStats();
+    
+    // Capture mode can only be changed while the capture thread is stopped
+    bool setCaptureMode(CaptureMode mode);
+    CaptureMode captureMode() const { return m_captureMode; }
+    bool isEncodedMode() const { return m_captureMode != JpegFrames; }
+    
+    // Encoder used by the encoded modes; takes effect on the next encoder open
+    void setEncoderBackend(EncoderBackend backend) { m_encoderBackend.store(backend); }
+    EncoderBackend encoderBackend() const { return m_encoderBackend.load(); }
+    
+    /*
+     * Zero-copy capture (Windows, encoded modes)
+     * - Desktop frames stay on the GPU: converted to NV12 by the video
+     *   processor and copied into a D3D11 NVENC/AMF encoder's frame pool.
+     *   Falls back to NV12 readback when the encoder can't take textures.
+     *   Takes effect on the next start.
+     */
+    void setZeroCopyCapture(bool enabled) { m_zeroCopy.store(enabled); }
+    bool zeroCopyCapture() const { return m_zeroCopy.load(); }
+    
+    /*
+     * Capture area and output size
+     * - `setCaptureRegion` limits capture to a rectangle of the screen, in
+     *   its physical pixels; an empty rectangle is the whole screen.
+     * - `setCaptureWindow` captures one window instead, looked up by title
+     *   (exact match first, then the first title containing it) when
+     *   recording starts and followed while it moves. The area keeps the
+     *   size the window had then, so the encoder never has to reopen, and
+     *   stays inside the screen. Takes precedence over the region; if no
+     *   window matches, the region (or whole screen) is used.
+     * - `setMaxOutputHeight` scales frames down to at most `height` rows
+     *   (0 = native), keeping the aspect ratio.
+     * - Cropping and scaling happen at capture, before anything else sees
+     *   the frame, so JPEG compression, the buffer, encoding and saving
+     *   all cost what the output size costs rather than what the monitor
+     *   size costs. On Windows the D3D11 video processor crops and scales
+     *   on the GPU; X11 grabs only the area and scales with swscale;
+     *   ScreenCaptureKit does both on the GPU (the CoreGraphics fallback
+     *   draws the area straight into an output-sized bitmap).
+     * - All of these take effect on the next start.
+     */
+    void setCaptureRegion(const QRect& region);
+    void setCaptureWindow(const QString& title);
+    QRect captureRegion();
+    QString captureWindow();
+    void setMaxOutputHeight(int height) { m_maxOutputHeight.store((std::max)(0, height)); }
+    int maxOutputHeight() const { return m_maxOutputHeight.load(); }
+    
+    /*
+     * Disk-backed buffer (encoded modes)
+     * - With spilling on, the GOP ring is kept in rolling segment files
+     *   under `directory` (see `SegmentStore`) instead of RAM; only the
+     *   segment being written stays in memory. Meant for buffers of tens
+     *   of minutes up to MAX_BUFFER_SECONDS. Takes effect on the next
+     *   start; if the directory can't be used the buffer stays in RAM.
+     */
+    void setSpillToDisk(bool enabled, const QString& directory);
+    bool spillToDisk() const { return m_spillToDisk.load(); }
+    QString spillDirectory();
+    
+    /*
+     * JPEG compression (JpegFrames mode)
+     * - Frames are compressed by a `CompressionPipeline` off the capture
+     *   thread. `workers` <= 0 picks a default from the core count; the
+     *   queue holds a few frames per worker before `policy` kicks in.
+     *   Takes effect on the next start.
+     */
+    void setCompressionWorkers(int workers) { m_compressionWorkers.store(workers); }
+    int compressionWorkers() const { return m_compressionWorkers.load(); }
+    void setBackpressurePolicy(CompressionPipeline::BackpressurePolicy policy) { m_backpressurePolicy.store(policy); }
+    CompressionPipeline::BackpressurePolicy backpressurePolicy() const { return m_backpressurePolicy.load(); }
+    
+    /*
+     * Adaptive quality
+     * - While enabled (the default) a `QualityController` watches the
+     *   capture loop's frame time against the frame budget, the compression
+     *   queue and missed slots. When capture cannot keep up it lowers JPEG
+     *   quality or the live encoder's rate, then the capture size (JPEG
+     *   mode only), then the frame rate, one level at a time, and restores
+     *   them once the load is gone. `qualityDegraded` / `qualityRestored`
+     *   report every step.
+     * - `qualityTimeline()` returns the level changes still covered by the
+     *   buffer, oldest first, starting with the level in force at its start.
+     *   Saves put them in the clip's index.
+     */
+    void setAdaptiveQuality(bool enabled) { m_adaptiveQuality.store(enabled); }
+    bool adaptiveQuality() const { return m_adaptiveQuality.load(); }
+    int qualityLevel() const { return m_qualityLevel.load(); }
+    std::vector<QualityController::Change> qualityTimeline();
     
-    // Get frames from buffer
-    std::vector<VideoFrame> getFrames(int seconds);
+    /*
+     * getFrames (JpegFrames mode)
+     * - Returns a snapshot of the most recent `seconds` of frames. It
+     *   shares the buffer's slabs instead of copying them, so the lock is
+     *   held only for a few pointer copies.
+     */
+    ReplaySnapshot getFrames(int seconds);
+    
+    /*
+     * getPackets (encoded modes)
+     * - Returns at least `seconds` of the most recent packets, starting at
+     *   the keyframe at or before the requested start. Under the lock it
+     *   only takes references to the GOPs, like `getFrames`; the packet
+     *   list is built after. Packet payloads are implicitly shared
+     *   `QByteArray`s, so this does not copy video data.
+     *   From the disk-backed buffer they point into mapped segment files
+     *   that the clip keeps open.
+     */
+    EncodedClip getPackets(int seconds);
     void clearBuffer();
 
 signals:
@@ -57,50 +226,277 @@ signals:
     void recordingStarted();
     void recordingStopped();
     void debugLog(const QString& message);  // Send logs to UI
+    void qualityDegraded(int level, const QString& description);
+    void qualityRestored(int level, const QString& description);
 
 protected:
     void run() override;
 
 private:
     /*
-     * Frame compression helper
-     * - `compressFrame` converts a raw captured `QImage` into the on-disk
-     *   representation used by the rest of the system (compressed JPEG
-     *   stored in `VideoFrame::jpegData`) and records metadata.
-     * - Keeping compression as a separate private method centralizes the
-     *   behavior and simplifies unit testing and fallback strategies.
+     * Capture result
+     * - Platform capture functions tell a failed capture apart from a
+     *   screen that simply did not change (DXGI timeout / same present
+     *   time, no XDamage events, identical CoreGraphics image). Unchanged
+     *   frames become cheap repeat records instead of new payloads.
+     */
+    enum CaptureResult {
+        CaptureFailed,
+        CaptureNewFrame,
+        CaptureUnchanged
+    };
+
+    /*
+     * Compressed frame sink
+     * - Called by the compression workers, in capture order, for every
+     *   frame and repeat record. Appends to `m_replayBuffer`, which evicts
+     *   by time and bytes on its own.
      */
-    void compressFrame(const QImage& raw, VideoFrame& outFrame);
+    void storeCompressedFrame(const VideoFrame& frame);
+
+    /*
+     * Continuous-encode helpers
+     * - `encodeFrame` (re)opens the live encoder when the frame size
+     *   changes, encodes `raw` and appends the packets to the GOP ring.
+     *   The NV12 overload is fed by the GPU conversion path on Windows.
+     * - `encodeRepeatFrame` re-submits the previous picture when the
+     *   screen did not change, keeping the packet stream at constant fps.
+     * - `encoderPts` turns a frame's MediaClock timestamp into encoder
+     *   time base units relative to when the encoder was opened.
+     * - The GOP ring holds one `PacketGop` per GOP, each starting at its
+     *   keyframe. `getPackets` shares the GOPs it needs rather than copying
+     *   packets under the lock. `appendPacket` only ever appends to the
+     *   newest GOP, and copies it first if a save still holds it, so a
+     *   shared GOP never changes.
+     * - `prunePacketBuffer` drops whole GOPs from the front while the
+     *   remaining packets still cover `m_bufferSeconds`, or whole segments
+     *   when spilling to disk. Caller holds `m_bufferMutex`.
+     * - `getSegmentPackets` is `getPackets` for the disk-backed buffer.
+     *   Caller holds `m_bufferMutex`.
+     */
+    bool encodeFrame(const QImage& raw, int64_t timestampUs);
+    bool encodeFrame(const Nv12Frame& raw, int64_t timestampUs);
+    bool encodeRepeatFrame(int64_t timestampUs);
+    int64_t encoderPts(int64_t timestampUs);
+    bool ensureLiveEncoder(int width, int height);
+    EncodedClip getSegmentPackets(int seconds);
+    void storePackets(std::vector<EncodedPacket>& packets);
+    void appendPacket(EncodedPacket&& packet);
+    void prunePacketBuffer();
+
+    /*
+     * Capture area helpers (capture thread)
+     * - `resolveCaptureArea` turns the requested window or region and the
+     *   output height into `m_captureRect` (screen pixels, even size) and
+     *   `m_outputSize`. Called when the capture backend is (re)initialised
+     *   and when the screen size changes.
+     * - `trackCaptureWindow` re-reads the captured window's position every
+     *   `WINDOW_TRACK_INTERVAL_MS` and moves `m_captureRect` with it.
+     * - `findCaptureWindow` / `captureWindowRect` are the platform part:
+     *   window lookup by title and its current bounds in screen pixels.
+     * - `screen` is the captured display in the platform's capture
+     *   coordinates: the duplicated output or CoreGraphics display from
+     *   (0,0), or a monitor's place in the X11 root window. Regions are
+     *   relative to its top-left.
+     */
+    void resolveCaptureArea(const QRect& screen);
+    void trackCaptureWindow();
+    bool findCaptureWindow(const QString& title);
+    bool captureWindowRect(QRect& rect);
+    bool isScalingCapture() const { return m_outputSize != m_captureRect.size(); }
+    // m_outputSize from the capture area, the output height setting and
+    // the quality controller's size step
+    void updateOutputSize();
+    
+    // Capture thread: feeds the controller after each frame slot and
+    // applies a new level when it changes
+    void updateQuality(int64_t slotStartUs, int missed);
+    void applyQualityLevel(int64_t timeUs);
+    static constexpr int WINDOW_TRACK_INTERVAL_MS = 250;
 
     int m_fps;
     int m_bufferSeconds;
     std::atomic<bool> m_recording;
     std::atomic<bool> m_stopRequested;
     
-    std::deque<VideoFrame> m_frameBuffer;
+    ReplayBuffer m_replayBuffer;
+    bool m_budgetWarned;
     QMutex m_bufferMutex;
     
+    std::unique_ptr<CompressionPipeline> m_compression;
+    std::atomic<int> m_compressionWorkers;
+    std::atomic<CompressionPipeline::BackpressurePolicy> m_backpressurePolicy;
+    std::atomic<bool> m_firstFrameStored;
+    
+    CaptureMode m_captureMode;
+    std::unique_ptr<LiveEncoder> m_liveEncoder;
+    std::atomic<EncoderBackend> m_encoderBackend;
+    std::atomic<bool> m_zeroCopy;
+    int64_t m_encoderEpochUs;
+    int64_t m_lastEncodedPts;
+    struct PacketGop {
+        std::vector<EncodedPacket> packets;
+        size_t bytes = 0;
+    };
+    std::deque<std::shared_ptr<PacketGop>> m_packetGops;   // oldest first
+    EncodedStreamInfo m_streamInfo;
+    size_t m_packetCount;
+    size_t m_packetBufferBytes;
+    
+    // Used instead of m_packetGops while m_spillActive; both guarded by
+    // m_bufferMutex, as is m_spillDirectory
+    SegmentStore m_segments;
+    bool m_spillActive;
+    std::atomic<bool> m_spillToDisk;
+    QString m_spillDirectory;
+    
+    // Requested area, guarded by m_bufferMutex; the rest is capture-thread
+    // state resolved from it
+    QRect m_captureRegion;
+    QString m_captureWindowTitle;
+    std::atomic<int> m_maxOutputHeight;
+    std::atomic<int> m_displayIndex;
+    std::shared_ptr<SyntheticFrameSource> m_synthetic;
+    QRect m_captureScreen;
+    QRect m_captureRect;
+    QSize m_outputSize;
+    quintptr m_captureWindowId;   // HWND, X11 Window or CGWindowID; 0 = none
+    QElapsedTimer m_windowTrackTimer;
+    FrameScaler m_scaler;
+    QImage m_captureAreaFrame;    // unscaled area when scaling on the CPU
+    
+    // Capture-thread state except for the atomics; m_qualityTimeline is
+    // guarded by m_bufferMutex
+    QualityController m_quality;
+    std::atomic<bool> m_adaptiveQuality;
+    std::atomic<int> m_qualityLevel;
+    int m_qualityScalePercent;
+    int m_qualityRatePercent;
+    std::deque<QualityController::Change> m_qualityTimeline;
+    
 #ifdef _WIN32
     ID3D11Device* m_d3dDevice;
     ID3D11DeviceContext* m_d3dContext;
     IDXGIOutputDuplication* m_deskDupl;
     LONGLONG m_lastFramePresented;
+    QSize m_outputModeSize;       // duplicated output, in texture pixels
+    POINT m_outputOrigin;         // its top-left on the virtual desktop
+    
+    /*
+     * Staging texture pool
+     * - Readback textures are created once per size/format and reused
+     *   round-robin, so the driver can keep a previous copy in flight while
+     *   the next frame is mapped instead of allocating every frame.
+     */
+    static const int STAGING_POOL_SIZE = 3;
+    ID3D11Texture2D* m_stagingPool[STAGING_POOL_SIZE];
+    int m_stagingNext;
+    
+    /*
+     * GPU colour conversion and scaling
+     * - An ID3D11VideoProcessor converts the BGRA desktop texture to NV12
+     *   before readback (encoded modes): 1.5 instead of 4 bytes per pixel
+     *   across PCIe and no CPU RGB->YUV pass. If the driver has no usable
+     *   video processor the BGRA path is used instead.
+     * - The same processor crops `m_captureRect` and scales it to
+     *   `m_outputSize`. The JPEG mode uses it with BGRA output when the
+     *   frame must be scaled. `m_vpWidth`/`m_vpHeight` are the output
+     *   size, `m_vpInputWidth`/`m_vpInputHeight` the desktop texture's.
+     */
+    ID3D11VideoDevice* m_videoDevice;
+    ID3D11VideoContext* m_videoContext;
+    ID3D11VideoProcessorEnumerator* m_vpEnum;
+    ID3D11VideoProcessor* m_videoProcessor;
+    ID3D11Texture2D* m_vpInputTexture;
+    ID3D11Texture2D* m_vpOutputTexture;
+    ID3D11VideoProcessorInputView* m_vpInputView;
+    ID3D11VideoProcessorOutputView* m_vpOutputView;
+    UINT m_vpWidth;
+    UINT m_vpHeight;
+    UINT m_vpInputWidth;
+    UINT m_vpInputHeight;
+    DXGI_FORMAT m_vpOutputFormat;
+    RECT m_vpSourceRect;
+    bool m_gpuConvertUnavailable;
+    Nv12Frame m_nv12Frame;
     
     bool initD3D();
     void cleanupD3D();
-    bool captureFrameD3D(QImage& outImage);
+    CaptureResult captureFrameD3D(QImage& outImage, Nv12Frame* outNv12, bool* outGpuFrame);
+    ID3D11Texture2D* acquireStagingTexture(UINT width, UINT height, DXGI_FORMAT format);
+    bool initVideoProcessor(UINT width, UINT height, DXGI_FORMAT outputFormat);
+    void cleanupVideoProcessor();
+    bool convertOnGpu(ID3D11Texture2D* texture, DXGI_FORMAT outputFormat);
+    bool readbackNV12(Nv12Frame& out);
+    bool encodeGpuFrame(int64_t timestampUs);
+    // Reads back `area` of the texture (all of it when empty)
+    bool readbackBGRA(ID3D11Texture2D* texture, QImage& outImage, const QRect& area = QRect());
 #elif __APPLE__
     CGDirectDisplayID m_displayID;
+    QImage m_previousCGFrame;
+    
+    /*
+     * ScreenCaptureKit capture (macOS 12.3+)
+     * - `m_sckStream` streams the display instead of a CGDisplayCreateImage
+     *   per frame; the pacer takes its newest buffer each slot and a slot
+     *   without a new one is a repeat. Crop and scale are the stream's
+     *   source rect and output size, updated when the window moves or the
+     *   quality controller changes the size.
+     * - The JPEG mode asks for BGRA and copies it into the frame. The
+     *   encoded modes ask for NV12: a VideoToolbox live encoder takes the
+     *   IOSurface-backed buffer as it is (`m_sckPixelBuffer`, retained
+     *   until the next one), other encoders get the planes copied out.
+     * - When the stream cannot start (older macOS, no screen recording
+     *   permission yet) `captureFrameCG` is used instead.
+     */
+    std::unique_ptr<ScreenCaptureKitStream> m_sckStream;
+    CVPixelBufferRef m_sckPixelBuffer;
+    Nv12Frame m_nv12Frame;
     
-    bool captureFrameCG(QImage& outImage);
+    bool initScreenCaptureKit();
+    void cleanupScreenCaptureKit();
+    CaptureResult captureFrameSCK(QImage& outImage, Nv12Frame* outNv12, bool* outPixelBuffer);
+    bool encodeGpuFrame(int64_t timestampUs);
+    CaptureResult captureFrameCG(QImage& outImage);
 #else
     Display* m_display;
     Window m_root;
+    
+    /*
+     * X11 capture state
+     * - `m_image` is an XShm image over one shared segment sized for the
+     *   whole root window and reused for every grab, so pixels never cross
+     *   the X socket. When XShm is unavailable (remote display) capture
+     *   falls back to XGetImage.
+     * - XDamage reports which parts of the root window changed. With no
+     *   damage since the last grab the previous frame is returned without
+     *   any X request; small damage is fetched rect by rect into the
+     *   caller's image instead of re-reading the whole screen.
+     * - Only `m_captureRect` is read and damage outside it is ignored.
+     *   When scaling, the area is grabbed into `m_captureAreaFrame` and
+     *   scaled into the caller's image.
+     */
     XImage* m_image;
+    XShmSegmentInfo m_shmInfo;
+    bool m_useShm;
+    int m_screenWidth;
+    int m_screenHeight;
+    QRect m_displayRect;          // the captured monitor within the root
+    bool m_useDamage;
+    int m_damageEventBase;
+    Damage m_damage;
+    XserverRegion m_damageRegion;
+    bool m_damagePending;
+    bool m_fullGrabNeeded;
     
     bool initX11();
     void cleanupX11();
-    bool captureFrameX11(QImage& outImage);
+    // The selected monitor's rect in the root window; empty if it is gone
+    QRect queryDisplayRect();
+    bool initShmImage();
+    void cleanupShmImage();
+    bool grabShmRect(QImage& outImage, int x, int y, int width, int height);
+    CaptureResult captureFrameX11(QImage& outImage);
 #endif
 };
 
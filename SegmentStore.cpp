@@ -0,0 +1,308 @@
+/*
+ * SegmentStore.cpp
+ *
+ * Rolling segment files for the encoded replay buffer. Each file is
+ * written front to back and never modified once finished, which is what
+ * lets clips read from its mapping while capture carries on.
+ *
+ * File layout (little endian):
+ *   "CLIPSEG1", stream description (codec id, size, fps, time base,
+ *   start time, extradata), packet payloads, index entries
+ *   (pts, dts, duration, offset, size, keyframe), index offset and
+ *   entry count, "CLIPIDX1".
+ */
+
+#include "SegmentStore.h"
+#include <QDataStream>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QMutex>
+#include <QSet>
+#include <atomic>
+
+static const char SEGMENT_MAGIC[] = "CLIPSEG1";
+static const char INDEX_MAGIC[] = "CLIPIDX1";
+static const char SEGMENT_SUFFIX[] = ".clipseg";
+
+// Segments can outlive the store that wrote them (a save still holds
+// them), so names never repeat within the process, and files some segment
+// still refers to are not leftovers. Clips drop segments on any thread.
+static std::atomic<quint64> s_nextSegment(0);
+static QMutex s_liveMutex;
+static QSet<QString> s_liveFiles;
+
+struct SegmentStore::Segment {
+    struct Entry {
+        int64_t pts;
+        int64_t dts;
+        int64_t duration;
+        quint64 offset;     // in the file
+        quint32 size;
+        bool keyframe;
+    };
+
+    QFile file;
+    uchar* map = nullptr;
+    bool onDisk = false;            // every payload so far is in the file
+    std::vector<Entry> index;
+    std::vector<QByteArray> hot;    // payloads until mapped
+    size_t bytes = 0;               // payload bytes
+    quint64 fileBytes = 0;          // set once finished
+
+    ~Segment() {
+        if (map) {
+            file.unmap(map);
+        }
+        if (!file.fileName().isEmpty()) {
+            file.remove();
+            QMutexLocker locker(&s_liveMutex);
+            s_liveFiles.remove(file.fileName());
+        }
+    }
+
+    QByteArray payload(size_t i) const {
+        if (map) {
+            return QByteArray::fromRawData(reinterpret_cast<const char*>(map + index[i].offset), index[i].size);
+        }
+        return hot[i];
+    }
+};
+
+SegmentStore::SegmentStore()
+    : m_writeFailed(false)
+    , m_packets(0)
+    , m_diskBytes(0)
+    , m_memoryBytes(0)
+{
+}
+
+SegmentStore::~SegmentStore() {
+    close();
+}
+
+bool SegmentStore::open(const QString& directory) {
+    close();
+
+    QDir dir(directory);
+    if (directory.isEmpty() || !dir.mkpath(".")) {
+        qDebug() << "[SegmentStore] Cannot create segment directory" << directory;
+        return false;
+    }
+
+    // Leftovers of a run that did not shut down cleanly; segments of an
+    // earlier open() that a save is still reading are not
+    QStringList stale;
+    {
+        QMutexLocker locker(&s_liveMutex);
+        for (const QString& name : dir.entryList({ QString("*") + SEGMENT_SUFFIX }, QDir::Files)) {
+            if (!s_liveFiles.contains(dir.absoluteFilePath(name))) {
+                stale.append(name);
+            }
+        }
+    }
+    for (const QString& name : stale) {
+        dir.remove(name);
+    }
+
+    m_directory = dir.absolutePath();
+    m_writeFailed = false;
+    qDebug() << "[SegmentStore] Writing segments to" << m_directory
+             << (stale.isEmpty() ? "" : QString("(removed %1 stale)").arg(stale.size()));
+    return true;
+}
+
+void SegmentStore::close() {
+    clear();
+    m_directory.clear();
+}
+
+void SegmentStore::clear() {
+    m_segments.clear();
+    m_packets = 0;
+    m_diskBytes = 0;
+    m_memoryBytes = 0;
+}
+
+void SegmentStore::openSegment(const EncodedStreamInfo& stream) {
+    auto segment = std::make_shared<Segment>();
+
+    if (!m_writeFailed) {
+        segment->file.setFileName(QDir(m_directory).filePath(
+            QString("segment_%1%2").arg(s_nextSegment++, 6, 10, QChar('0')).arg(SEGMENT_SUFFIX)));
+        {
+            QMutexLocker locker(&s_liveMutex);
+            s_liveFiles.insert(segment->file.fileName());
+        }
+        if (segment->file.open(QIODevice::ReadWrite | QIODevice::Truncate)) {
+            QDataStream out(&segment->file);
+            out.setByteOrder(QDataStream::LittleEndian);
+            out.writeRawData(SEGMENT_MAGIC, 8);
+            out << (qint32)stream.codecId << (qint32)stream.width << (qint32)stream.height
+                << (qint32)stream.fps << (qint32)stream.timeBaseNum << (qint32)stream.timeBaseDen
+                << (qint64)stream.startTimeUs << stream.extradata;
+            segment->onDisk = out.status() == QDataStream::Ok;
+        }
+        if (!segment->onDisk) {
+            m_writeFailed = true;
+            qDebug() << "[SegmentStore] Cannot write" << segment->file.fileName() << ":"
+                     << segment->file.errorString() << "- keeping the buffer in memory";
+        }
+    }
+
+    m_segments.push_back(std::move(segment));
+}
+
+void SegmentStore::finishSegment() {
+    if (m_segments.empty()) {
+        return;
+    }
+    Segment& segment = *m_segments.back();
+    if (!segment.onDisk || segment.map) {
+        return;
+    }
+
+    const quint64 indexOffset = segment.file.pos();
+    QDataStream out(&segment.file);
+    out.setByteOrder(QDataStream::LittleEndian);
+    for (const Segment::Entry& entry : segment.index) {
+        out << (qint64)entry.pts << (qint64)entry.dts << (qint64)entry.duration
+            << entry.offset << entry.size << (quint8)entry.keyframe;
+    }
+    out << indexOffset << (quint32)segment.index.size();
+    out.writeRawData(INDEX_MAGIC, 8);
+
+    if (out.status() != QDataStream::Ok || !segment.file.flush()) {
+        segment.onDisk = false;
+        m_writeFailed = true;
+        qDebug() << "[SegmentStore] Cannot finish" << segment.file.fileName() << ":"
+                 << segment.file.errorString() << "- keeping the buffer in memory";
+        return;
+    }
+
+    segment.map = segment.file.map(0, segment.file.size());
+    if (!segment.map) {
+        // Still readable from the RAM copies
+        qDebug() << "[SegmentStore] Cannot map" << segment.file.fileName() << ":" << segment.file.errorString();
+        return;
+    }
+    segment.fileBytes = segment.file.size();
+    m_diskBytes += segment.fileBytes;
+    m_memoryBytes -= segment.bytes;
+    segment.hot.clear();
+    segment.hot.shrink_to_fit();
+}
+
+void SegmentStore::append(const EncodedPacket& packet, const EncodedStreamInfo& stream) {
+    if (!isOpen() || stream.timeBaseNum <= 0) {
+        return;
+    }
+    if (m_segments.empty() && !packet.keyframe) {
+        return;
+    }
+
+    // Cut on the first keyframe once the current segment is long enough
+    const int64_t segmentTicks = (int64_t)SEGMENT_SECONDS * stream.timeBaseDen / stream.timeBaseNum;
+    if (m_segments.empty() ||
+        (packet.keyframe && packet.pts - m_segments.back()->index.front().pts >= segmentTicks)) {
+        finishSegment();
+        openSegment(stream);
+    }
+
+    Segment& segment = *m_segments.back();
+    Segment::Entry entry;
+    entry.pts = packet.pts;
+    entry.dts = packet.dts;
+    entry.duration = packet.duration;
+    entry.offset = segment.onDisk ? (quint64)segment.file.pos() : 0;
+    entry.size = (quint32)packet.data.size();
+    entry.keyframe = packet.keyframe;
+
+    if (segment.onDisk && segment.file.write(packet.data) != packet.data.size()) {
+        segment.onDisk = false;
+        m_writeFailed = true;
+        qDebug() << "[SegmentStore] Write to" << segment.file.fileName() << "failed:"
+                 << segment.file.errorString() << "- keeping the buffer in memory";
+    }
+
+    segment.index.push_back(entry);
+    segment.hot.push_back(packet.data);
+    segment.bytes += entry.size;
+    m_memoryBytes += entry.size;
+    m_packets++;
+}
+
+void SegmentStore::dropFront() {
+    const Segment& segment = *m_segments.front();
+    m_packets -= segment.index.size();
+    if (segment.map) {
+        m_diskBytes -= segment.fileBytes;
+    } else {
+        m_memoryBytes -= segment.bytes;
+    }
+    // The file goes with the last reference; a clip may still hold it
+    m_segments.pop_front();
+}
+
+void SegmentStore::prune(int64_t windowTicks) {
+    if (m_segments.size() < 2 || m_segments.back()->index.empty()) {
+        return;
+    }
+
+    // Segments start on keyframes, so dropping the front one leaves a
+    // decodable buffer; do it while the rest still covers the window
+    const int64_t newest = m_segments.back()->index.back().pts;
+    while (m_segments.size() > 1 && newest - m_segments[1]->index.front().pts >= windowTicks) {
+        dropFront();
+    }
+}
+
+EncodedClip SegmentStore::clip(int64_t wantedTicks, const EncodedStreamInfo& stream) const {
+    EncodedClip clip;
+    clip.stream = stream;
+    if (m_segments.empty() || m_segments.back()->index.empty()) {
+        return clip;
+    }
+
+    const int64_t startPts = m_segments.back()->index.back().pts - wantedTicks;
+
+    // The last keyframe at or before the start is in the last segment
+    // starting at or before it
+    size_t firstSegment = 0;
+    for (size_t s = m_segments.size(); s-- > 0;) {
+        if (m_segments[s]->index.front().pts <= startPts) {
+            firstSegment = s;
+            break;
+        }
+    }
+    const std::vector<Segment::Entry>& firstIndex = m_segments[firstSegment]->index;
+    size_t firstPacket = 0;
+    for (size_t i = firstIndex.size(); i-- > 0;) {
+        if (firstIndex[i].keyframe && firstIndex[i].pts <= startPts) {
+            firstPacket = i;
+            break;
+        }
+    }
+
+    size_t total = 0;
+    for (size_t s = firstSegment; s < m_segments.size(); s++) {
+        total += m_segments[s]->index.size();
+    }
+    clip.packets.reserve(total - firstPacket);
+
+    for (size_t s = firstSegment; s < m_segments.size(); s++) {
+        const std::shared_ptr<Segment>& segment = m_segments[s];
+        clip.storage.push_back(segment);
+        for (size_t i = (s == firstSegment ? firstPacket : 0); i < segment->index.size(); i++) {
+            const Segment::Entry& entry = segment->index[i];
+            EncodedPacket packet;
+            packet.data = segment->payload(i);
+            packet.pts = entry.pts;
+            packet.dts = entry.dts;
+            packet.duration = entry.duration;
+            packet.keyframe = entry.keyframe;
+            clip.packets.push_back(std::move(packet));
+        }
+    }
+    return clip;
+}
@@ -0,0 +1,89 @@
+#ifndef SEGMENTSTORE_H
+#define SEGMENTSTORE_H
+
+#include <QString>
+#include <deque>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include "LiveEncoder.h"
+
+/*
+ * SegmentStore
+ *
+ * Purpose
+ * - Disk-backed GOP ring for the encoded capture modes, so buffers of an
+ *   hour ("shadow recording") cost disk space instead of RAM. Packets go
+ *   into rolling segment files of about SEGMENT_SECONDS in a directory of
+ *   the caller's choosing.
+ *
+ * Behaviour
+ * - Every segment starts on a keyframe. A segment file holds a header
+ *   with the stream description, the packet payloads in decode order and
+ *   an index of them, so each file can be remuxed on its own.
+ * - Payloads are written through as they arrive; only the segment being
+ *   written also keeps them in RAM. A finished segment is memory-mapped
+ *   and its RAM copies are dropped, so reading never goes through a
+ *   read() into a buffer.
+ * - `prune()` drops whole segments from the front while the rest still
+ *   covers the window, like the in-memory GOP ring drops whole GOPs.
+ * - `clip()` returns packets whose payloads point into the mappings; the
+ *   clip holds the segments it covers, so a save in progress keeps them
+ *   alive after they were pruned. A segment's file is deleted once nothing
+ *   refers to it any more.
+ * - If a write fails (disk full, directory gone) the store keeps working
+ *   from RAM: segments that could not be written keep their payloads.
+ *
+ * Threading
+ * - Not synchronised; `ScreenRecorder` guards it with `m_bufferMutex`.
+ *   Clips need no lock.
+ */
+class SegmentStore {
+public:
+    static constexpr int SEGMENT_SECONDS = 10;
+
+    SegmentStore();
+    ~SegmentStore();
+
+    SegmentStore(const SegmentStore&) = delete;
+    SegmentStore& operator=(const SegmentStore&) = delete;
+
+    // Creates `directory` and removes segment files left over by an
+    // earlier run. Drops what was stored before; segments a clip still
+    // holds keep their files.
+    bool open(const QString& directory);
+    void close();
+    bool isOpen() const { return !m_directory.isEmpty(); }
+    QString directory() const { return m_directory; }
+
+    // `packet` must follow the previous one in decode order
+    void append(const EncodedPacket& packet, const EncodedStreamInfo& stream);
+    // Keeps at least `windowTicks` (stream time base) behind the newest packet
+    void prune(int64_t windowTicks);
+    void clear();
+
+    // At least `wantedTicks` of the newest packets, from a keyframe on
+    EncodedClip clip(int64_t wantedTicks, const EncodedStreamInfo& stream) const;
+
+    size_t packetCount() const { return m_packets; }
+    size_t segmentCount() const { return m_segments.size(); }
+    quint64 diskBytes() const { return m_diskBytes; }
+    size_t memoryBytes() const { return m_memoryBytes; }
+
+private:
+    struct Segment;
+
+    void openSegment(const EncodedStreamInfo& stream);
+    void finishSegment();
+    void dropFront();
+
+    QString m_directory;
+    bool m_writeFailed;      // logged once; stays in RAM from then on
+
+    std::deque<std::shared_ptr<Segment>> m_segments;   // oldest first, back is being written
+    size_t m_packets;
+    quint64 m_diskBytes;
+    size_t m_memoryBytes;
+};
+
+#endif // SEGMENTSTORE_H
@@ -0,0 +1,110 @@
+/*
+ * SyntheticSource.cpp
+ *
+ * Deterministic frame and audio generators for the benchmark harness.
+ */
+
+#include "SyntheticSource.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+static constexpr double TWO_PI = 6.283185307179586;
+
+// xorshift32: fast, and the same sequence on every platform
+static uint32_t xorshift(uint32_t& state) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+SyntheticFrameSource::SyntheticFrameSource(const Config& config)
+    : m_config(config)
+    , m_bandTop(0)
+    , m_bandHeight(0)
+    , m_offset(0)
+    , m_state(config.seed ? config.seed : 1)
+{
+    m_config.size = QSize((std::max)(16, config.size.width()) & ~1,
+                          (std::max)(16, config.size.height()) & ~1);
+    m_config.motionRatio = (std::min)(1.0, (std::max)(0.0, config.motionRatio));
+    m_config.staticRatio = (std::min)(1.0, (std::max)(0.0, config.staticRatio));
+
+    // Smooth gradients with noise on top: compresses like real content,
+    // not like a test card
+    const int width = m_config.size.width();
+    const int height = m_config.size.height();
+    m_scene = QImage(m_config.size, QImage::Format_RGB32);
+    for (int y = 0; y < height; ++y) {
+        uint32_t* row = reinterpret_cast<uint32_t*>(m_scene.scanLine(y));
+        for (int x = 0; x < width; ++x) {
+            const uint32_t noise = xorshift(m_state) & 0x1f;
+            const uint32_t r = (x * 255 / width + noise) & 0xff;
+            const uint32_t g = (y * 255 / height + noise) & 0xff;
+            const uint32_t b = ((x + y) / 8 % 64 * 4 + noise) & 0xff;
+            row[x] = 0xff000000u | (r << 16) | (g << 8) | b;
+        }
+    }
+
+    m_bandHeight = (int)std::lround(height * m_config.motionRatio);
+    m_bandTop = (height - m_bandHeight) / 2;
+    m_frame = m_scene.copy();
+}
+
+uint32_t SyntheticFrameSource::random() {
+    return xorshift(m_state);
+}
+
+void SyntheticFrameSource::drawMotion() {
+    if (m_bandHeight <= 0) {
+        return;
+    }
+    const int width = m_config.size.width();
+    m_offset = (m_offset + 7) % width;
+    const size_t tail = (size_t)(width - m_offset) * 4;
+    const size_t head = (size_t)m_offset * 4;
+    for (int y = m_bandTop; y < m_bandTop + m_bandHeight; ++y) {
+        const uchar* src = m_scene.constScanLine(y);
+        uchar* dst = m_frame.scanLine(y);
+        std::memcpy(dst, src + head, tail);
+        std::memcpy(dst + tail, src, head);
+    }
+}
+
+bool SyntheticFrameSource::next(QImage& out) {
+    const bool unchanged = !out.isNull() &&
+        (random() % 10000) < (uint32_t)(m_config.staticRatio * 10000.0);
+    if (unchanged) {
+        return false;
+    }
+    // `m_frame` may still be shared with the previous frame handed out;
+    // writing detaches it, the way a real capture produces a fresh image
+    drawMotion();
+    out = m_frame;
+    return true;
+}
+
+SyntheticAudioSource::SyntheticAudioSource(const Config& config)
+    : m_config(config)
+    , m_phase(0.0)
+    , m_state(config.seed ? config.seed : 1)
+{
+    m_config.sampleRate = (std::max)(8000, config.sampleRate);
+    m_config.channels = (std::max)(1, config.channels);
+}
+
+void SyntheticAudioSource::generate(float* out, size_t frames) {
+    const double step = TWO_PI * m_config.frequency / m_config.sampleRate;
+    for (size_t i = 0; i < frames; ++i) {
+        const float tone = (float)(0.25 * std::sin(m_phase));
+        m_phase += step;
+        if (m_phase > TWO_PI) {
+            m_phase -= TWO_PI;
+        }
+        for (int c = 0; c < m_config.channels; ++c) {
+            const float noise = ((int)(xorshift(m_state) & 0xffff) - 32768) / 32768.0f * 0.01f;
+            *out++ = tone + noise;
+        }
+    }
+}
@@ -0,0 +1,88 @@
+#ifndef SYNTHETICSOURCE_H
+#define SYNTHETICSOURCE_H
+
+#include <QImage>
+#include <QSize>
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * SyntheticFrameSource
+ *
+ * Purpose
+ * - Generated screen content for `clipper_bench`: plugged into a
+ *   `ScreenRecorder` with `setSyntheticSource()`, it stands in for the
+ *   platform capture so the rest of the pipeline (compression, buffer,
+ *   live encoder, saves) runs headless and repeatably.
+ *
+ * Behaviour
+ * - The scene is a fixed noisy texture, so JPEG sizes and encode costs
+ *   resemble a busy desktop rather than a flat colour.
+ * - `staticRatio` of the frames report no change, like an idle screen.
+ *   On the others a band covering `motionRatio` of the frame scrolls
+ *   sideways, like video or a game in part of the screen.
+ * - The sequence depends only on the config (including `seed`), so two
+ *   runs see the same frames.
+ *
+ * Threading
+ * - One instance per capture thread.
+ */
+class SyntheticFrameSource {
+public:
+    struct Config {
+        QSize size = QSize(1920, 1080);
+        double motionRatio = 0.25;   // share of the frame that moves
+        double staticRatio = 0.0;    // share of frames the screen is unchanged
+        uint32_t seed = 1;
+    };
+
+    explicit SyntheticFrameSource(const Config& config);
+
+    const Config& config() const { return m_config; }
+
+    // Fills `out` with the next frame; false if the screen is unchanged
+    // (`out` then still holds the previous frame)
+    bool next(QImage& out);
+
+private:
+    uint32_t random();
+    void drawMotion();
+
+    Config m_config;
+    QImage m_scene;     // the static texture
+    QImage m_frame;     // scene with the band at its current offset
+    int m_bandTop;
+    int m_bandHeight;
+    int m_offset;
+    uint32_t m_state;
+};
+
+/*
+ * SyntheticAudioSource
+ * - Generated audio for `clipper_bench`, plugged into an `AudioCapture`
+ *   with `setSyntheticSource()`: a tone with a little noise, interleaved
+ *   float at `sampleRate`. Deterministic per `seed`.
+ */
+class SyntheticAudioSource {
+public:
+    struct Config {
+        int sampleRate = 48000;
+        int channels = 2;
+        double frequency = 440.0;
+        uint32_t seed = 1;
+    };
+
+    explicit SyntheticAudioSource(const Config& config);
+
+    const Config& config() const { return m_config; }
+
+    // Writes `frames` frames of `config().channels` samples each
+    void generate(float* out, size_t frames);
+
+private:
+    Config m_config;
+    double m_phase;
+    uint32_t m_state;
+};
+
+#endif // SYNTHETICSOURCE_H
@@ -0,0 +1,214 @@
+/*
+ * Telemetry.cpp
+ *
+ * Per-thread counter and histogram slots, and the merge that reads them.
+ */
+
+#include "Telemetry.h"
+#include <QMutex>
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <memory>
+
+namespace {
+
+// One thread's samples. Only the owning thread writes; `snapshot()` reads
+// concurrently, hence the atomics, but a plain load and store is enough
+// for the writer since nobody else adds to the same slot.
+struct StageSlot {
+    std::atomic<uint64_t> totalNs{0};
+    std::atomic<uint64_t> maxNs{0};
+    std::atomic<uint64_t> buckets[Telemetry::BUCKETS] = {};
+};
+
+struct Slot {
+    std::atomic<bool> inUse{false};
+    std::atomic<uint64_t> counters[Telemetry::CounterCount] = {};
+    StageSlot stages[Telemetry::StageCount];
+};
+
+void bump(std::atomic<uint64_t>& value, uint64_t n) {
+    value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+// Slots are never freed; threads only borrow them
+struct Registry {
+    QMutex mutex;
+    std::deque<std::unique_ptr<Slot>> slots;
+};
+
+Registry& registry() {
+    // Leaked on purpose: threads still running at exit may record after
+    // static destructors have run
+    static Registry* instance = new Registry;
+    return *instance;
+}
+
+Slot* claimSlot() {
+    Registry& reg = registry();
+    QMutexLocker locker(&reg.mutex);
+    for (auto& slot : reg.slots) {
+        bool expected = false;
+        if (slot->inUse.compare_exchange_strong(expected, true)) {
+            return slot.get();
+        }
+    }
+    reg.slots.push_back(std::make_unique<Slot>());
+    reg.slots.back()->inUse.store(true);
+    return reg.slots.back().get();
+}
+
+// Gives the slot back when its thread ends
+struct ThreadSlot {
+    Slot* slot = nullptr;
+    ~ThreadSlot() {
+        if (slot) {
+            slot->inUse.store(false, std::memory_order_release);
+        }
+    }
+};
+
+Slot* threadSlot() {
+    thread_local ThreadSlot local;
+    if (!local.slot) {
+        local.slot = claimSlot();
+    }
+    return local.slot;
+}
+
+int highestBit(uint64_t value) {
+    int bit = 0;
+    for (int shift = 32; shift > 0; shift /= 2) {
+        if (value >> shift) {
+            value >>= shift;
+            bit += shift;
+        }
+    }
+    return bit;
+}
+
+} // namespace
+
+int Telemetry::bucketIndex(uint64_t ns) {
+    if (ns < (uint64_t)SUB_BUCKETS) {
+        return (int)ns;
+    }
+    const int exponent = highestBit(ns);
+    if (exponent >= MAX_EXPONENT) {
+        return BUCKETS - 1;
+    }
+    const int sub = (int)((ns >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1));
+    return (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + sub;
+}
+
+uint64_t Telemetry::bucketLowerBound(int index) {
+    if (index < SUB_BUCKETS) {
+        return (uint64_t)(std::max)(0, index);
+    }
+    const int exponent = index / SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+    const uint64_t sub = (uint64_t)(index % SUB_BUCKETS);
+    return (SUB_BUCKETS + sub) << (exponent - SUB_BUCKET_BITS);
+}
+
+void Telemetry::record(Stage stage, int64_t ns) {
+    if (stage < 0 || stage >= StageCount) {
+        return;
+    }
+    const uint64_t value = (uint64_t)(std::max<int64_t>)(0, ns);
+    StageSlot& slot = threadSlot()->stages[stage];
+    bump(slot.totalNs, value);
+    bump(slot.buckets[bucketIndex(value)], 1);
+    if (value > slot.maxNs.load(std::memory_order_relaxed)) {
+        slot.maxNs.store(value, std::memory_order_relaxed);
+    }
+}
+
+void Telemetry::add(Counter counter, uint64_t n) {
+    if (counter < 0 || counter >= CounterCount) {
+        return;
+    }
+    bump(threadSlot()->counters[counter], n);
+}
+
+Telemetry::Snapshot Telemetry::snapshot() {
+    Snapshot result;
+    for (Histogram& histogram : result.stages) {
+        histogram.buckets.assign(BUCKETS, 0);
+    }
+
+    Registry& reg = registry();
+    QMutexLocker locker(&reg.mutex);
+    for (const auto& slot : reg.slots) {
+        for (int c = 0; c < CounterCount; ++c) {
+            result.counters[c] += slot->counters[c].load(std::memory_order_relaxed);
+        }
+        for (int s = 0; s < StageCount; ++s) {
+            const StageSlot& from = slot->stages[s];
+            Histogram& to = result.stages[s];
+            to.totalNs += from.totalNs.load(std::memory_order_relaxed);
+            to.maxNs = (std::max)(to.maxNs, from.maxNs.load(std::memory_order_relaxed));
+            // The count is the bucket sum, so percentiles always add up
+            for (int b = 0; b < BUCKETS; ++b) {
+                const uint64_t n = from.buckets[b].load(std::memory_order_relaxed);
+                to.buckets[b] += n;
+                to.count += n;
+            }
+        }
+    }
+    return result;
+}
+
+uint64_t Telemetry::Histogram::percentileNs(double percentile) const {
+    if (count == 0 || buckets.size() != (size_t)BUCKETS) {
+        return 0;
+    }
+    const double clamped = (std::min)(100.0, (std::max)(0.0, percentile));
+    const uint64_t rank = (std::max<uint64_t>)(1, (uint64_t)(clamped / 100.0 * count + 0.5));
+    uint64_t seen = 0;
+    for (int b = 0; b < BUCKETS; ++b) {
+        seen += buckets[b];
+        if (seen >= rank) {
+            const uint64_t low = bucketLowerBound(b);
+            const uint64_t high = b + 1 < BUCKETS ? bucketLowerBound(b + 1) : low * 2;
+            return (std::min)(maxNs, low + (high - low) / 2);
+        }
+    }
+    return maxNs;
+}
+
+const char* Telemetry::stageName(Stage stage) {
+    switch (stage) {
+    case Capture:       return "capture";
+    case Convert:       return "convert";
+    case Compress:      return "compress";
+    case BufferLock:    return "buffer_lock";
+    case BufferInsert:  return "buffer_insert";
+    case AudioCallback: return "audio_callback";
+    case SaveSnapshot:  return "snapshot";
+    case Mix:           return "mix";
+    case Encode:        return "encode";
+    default:            return "unknown";
+    }
+}
+
+const char* Telemetry::counterName(Counter counter) {
+    switch (counter) {
+    case FramesCaptured:  return "frames_captured";
+    case FramesRepeated:  return "frames_repeated";
+    case FramesMissed:    return "frames_missed";
+    case FramesDropped:   return "frames_dropped";
+    case CaptureFailures: return "capture_failures";
+    case ClipsSaved:      return "clips_saved";
+    default:              return "unknown";
+    }
+}
+
+void Telemetry::Timer::stop() {
+    if (!m_running) {
+        return;
+    }
+    m_running = false;
+    record(m_stage, std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - m_start).count());
+}
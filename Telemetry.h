@@ -0,0 +1,115 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+/*
+ * Telemetry
+ *
+ * Purpose
+ * - Process-wide counters and latency histograms for each stage of the
+ *   capture and save pipelines, cheap enough to leave on. The stats panel
+ *   and the metrics endpoint (`MetricsServer`) read them, so a drop in
+ *   frame rate can be traced to the stage that caused it instead of being
+ *   guessed from log lines.
+ *
+ * Behaviour
+ * - Every thread that records gets a slot of its own, so recording is a
+ *   few relaxed atomic stores to memory no other thread writes: nothing
+ *   locks, nothing contends, nothing allocates after a thread's first
+ *   sample. A finished thread's slot is handed to the next new thread, so
+ *   totals survive short-lived save and decode threads.
+ * - Latencies go into log-linear histograms in the style of HdrHistogram:
+ *   `SUB_BUCKETS` buckets per power of two from 1 ns up to 2^MAX_EXPONENT
+ *   ns (about 18 minutes), so a percentile is never more than 12.5% off.
+ * - `snapshot()` sums all slots. Samples recorded while it runs may or may
+ *   not be included; totals never go backwards.
+ * - Stages nest where the code does: Capture includes Convert, and
+ *   BufferInsert does not include BufferLock.
+ *
+ * Threading
+ * - Every method may be called from any thread. Only a thread's first
+ *   sample and `snapshot()` take the lock that guards the slot list.
+ */
+class Telemetry {
+public:
+    enum Stage {
+        Capture,        // one grab, including crop, scale and readback
+        Convert,        // colour conversion, scaling and GPU readback
+        Compress,       // JPEG compression of one frame
+        BufferLock,     // waiting for the capture buffer lock
+        BufferInsert,   // storing a frame or packets once locked
+        AudioCallback,  // one audio period written into its ring
+        SaveSnapshot,   // copying a replay or audio buffer out for a save
+        Mix,            // mixing mic and desktop audio for a save
+        Encode,         // encoding one video frame, live or on save
+        StageCount
+    };
+
+    enum Counter {
+        FramesCaptured,   // new images from the screen
+        FramesRepeated,   // unchanged screen, or slots filled after a stall
+        FramesMissed,     // frame slots the pacer skipped
+        FramesDropped,    // images dropped by compression backpressure
+        CaptureFailures,
+        ClipsSaved,
+        CounterCount
+    };
+
+    static constexpr int SUB_BUCKET_BITS = 3;
+    static constexpr int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static constexpr int MAX_EXPONENT = 40;
+    // Values below SUB_BUCKETS get a bucket each, then one group of
+    // SUB_BUCKETS per power of two
+    static constexpr int BUCKETS = (MAX_EXPONENT - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    struct Histogram {
+        uint64_t count = 0;
+        uint64_t totalNs = 0;
+        uint64_t maxNs = 0;
+        std::vector<uint64_t> buckets;   // BUCKETS entries
+
+        double meanNs() const { return count > 0 ? totalNs / (double)count : 0.0; }
+        // Latency `percentile` (0-100) percent of samples are at or below;
+        // reported as the middle of its bucket and never above maxNs
+        uint64_t percentileNs(double percentile) const;
+    };
+
+    struct Snapshot {
+        std::array<Histogram, StageCount> stages;
+        std::array<uint64_t, CounterCount> counters{};
+    };
+
+    static void record(Stage stage, int64_t ns);
+    static void add(Counter counter, uint64_t n = 1);
+    static Snapshot snapshot();
+
+    // Lower-case names used by the metrics endpoint ("buffer_insert")
+    static const char* stageName(Stage stage);
+    static const char* counterName(Counter counter);
+
+    static int bucketIndex(uint64_t ns);
+    static uint64_t bucketLowerBound(int index);
+
+    // Records the time from construction to `stop()` or destruction
+    class Timer {
+    public:
+        explicit Timer(Stage stage)
+            : m_stage(stage), m_start(std::chrono::steady_clock::now()), m_running(true) {}
+        ~Timer() { stop(); }
+        Timer(const Timer&) = delete;
+        Timer& operator=(const Timer&) = delete;
+
+        void stop();
+
+    private:
+        Stage m_stage;
+        std::chrono::steady_clock::time_point m_start;
+        bool m_running;
+    };
+};
+
+#endif // TELEMETRY_H
@@ -2,15 +2,16 @@
  * TrimDialog.cpp
  *
  * Provides a lightweight UI for choosing trim start/end points for a
- * video clip. Seeking and preview use OpenCV; the dialog returns the
- * selected frame indexes for the caller to process.
+ * video clip. Previews are decoded in the background by `FrameDecoder`;
+ * the dialog returns the selected frame indexes for the caller to process.
  */
 
 #include "TrimDialog.h"
+#include "ClipIndex.h"
 #include <QVBoxLayout>
 #include <QHBoxLayout>
-#include <QImage>
 #include <QPixmap>
+#include <QResizeEvent>
 
 TrimDialog::TrimDialog(const QString& videoPath, QWidget *parent)
     : QDialog(parent)
@@ -19,23 +20,26 @@ TrimDialog::TrimDialog(const QString& videoPath, QWidget *parent)
     , m_endFrame(0)
     , m_totalFrames(0)
     , m_fps(30.0)
+    , m_shownFrame(0)
 {
-    m_capture.open(videoPath.toStdString());
-    
-    if (m_capture.isOpened()) {
-        m_totalFrames = static_cast<int>(m_capture.get(cv::CAP_PROP_FRAME_COUNT));
-        m_fps = m_capture.get(cv::CAP_PROP_FPS);
+    m_decoder = new FrameDecoder(this);
+    connect(m_decoder, &FrameDecoder::frameReady, this, &TrimDialog::onFrameReady);
+    
+    ClipIndex index;
+    const bool indexed = index.load(videoPath, false);
+    if (m_decoder->open(videoPath, indexed ? &index : nullptr)) {
+        m_totalFrames = m_decoder->info().frameCount;
+        m_fps = m_decoder->info().fps;
         m_endFrame = m_totalFrames - 1;
     }
     
     setupUI();
+    m_decoder->setDisplaySize(m_previewLabel->minimumSize());
     showFrame(0);
 }
 
 TrimDialog::~TrimDialog() {
-    if (m_capture.isOpened()) {
-        m_capture.release();
-    }
+    m_decoder->close();
 }
 
 void TrimDialog::setupUI() {
@@ -143,23 +147,29 @@ void TrimDialog::onPreviewEnd() {
 }
 
 void TrimDialog::showFrame(int frameNum) {
-    if (!m_capture.isOpened()) return;
-    
-    m_capture.set(cv::CAP_PROP_POS_FRAMES, frameNum);
-    cv::Mat frame;
-    
-    if (m_capture.read(frame)) {
-        cv::Mat rgb;
-        cv::cvtColor(frame, rgb, cv::COLOR_BGR2RGB);
-        
-        QImage img(rgb.data, rgb.cols, rgb.rows, rgb.step, QImage::Format_RGB888);
-        QPixmap pixmap = QPixmap::fromImage(img);
-        
-        QPixmap scaled = pixmap.scaled(m_previewLabel->size(),
-                                      Qt::KeepAspectRatio,
-                                      Qt::SmoothTransformation);
-        m_previewLabel->setPixmap(scaled);
+    if (!m_decoder->isOpen()) return;
+    
+    m_shownFrame = frameNum;
+    m_decoder->requestFrame(frameNum);
+}
+
+void TrimDialog::onFrameReady(int request, int index, const QImage& image) {
+    Q_UNUSED(index);
+    // A slower decode for an earlier preview; the newer one is already up
+    if (request != m_decoder->lastRequest()) {
+        return;
     }
+    if (!image.isNull()) {
+        m_previewLabel->setPixmap(QPixmap::fromImage(image));
+    }
+}
+
+void TrimDialog::resizeEvent(QResizeEvent* event) {
+    QDialog::resizeEvent(event);
+    
+    // Previews are decoded at display size; ask again at the new one
+    m_decoder->setDisplaySize(m_previewLabel->size());
+    showFrame(m_shownFrame);
 }
 
 void TrimDialog::updateTimeLabel() {
@@ -6,20 +6,24 @@
 #include <QSlider>
 #include <QPushButton>
 #include <QDialogButtonBox>
-#include <opencv2/opencv.hpp>
+#include <QImage>
+#include <cstdint>
+#include "FrameDecoder.h"
 
 /*
  * TrimDialog
  *
  * Purpose
  * - Presents a simple, non-destructive trimming UI for a single clip.
- * - Uses OpenCV to seek to requested frames for preview and allows the
- *   user to choose start/end frame indexes which the encoder will use to
- *   write a trimmed output.
+ * - Previews the requested frames and allows the user to choose start/end
+ *   frame indexes; `ClipTrimmer` writes the trimmed copy from them.
  *
  * Implementation notes
- * - The dialog keeps only lightweight preview images in memory and relies
- *   on OpenCV's on-disk decoding for random access via `CAP_PROP_POS_FRAMES`.
+ * - Previews come from the same `FrameDecoder` engine as `ClipViewer`, so
+ *   dragging a slider never blocks the dialog: only the newest position is
+ *   decoded, and frames already seen come from its cache.
+ * - Frame count, FPS and keyframes come from the clip's `ClipIndex` when
+ *   it has one, so opening the dialog does not probe the video.
  * - Frame numbers and FPS are used to display human-friendly durations.
  */
 
@@ -32,12 +36,20 @@ public:
 
     int getStartFrame() const { return m_startFrame; }
     int getEndFrame() const { return m_endFrame; }
+    
+    // The selection as [start, end) in microseconds, end frame included
+    int64_t getStartUs() const { return static_cast<int64_t>(m_startFrame * 1000000.0 / (m_fps > 0 ? m_fps : 30.0)); }
+    int64_t getEndUs() const { return static_cast<int64_t>((m_endFrame + 1) * 1000000.0 / (m_fps > 0 ? m_fps : 30.0)); }
+
+protected:
+    void resizeEvent(QResizeEvent* event) override;
 
 private slots:
     void onStartChanged(int value);
     void onEndChanged(int value);
     void onPreviewStart();
     void onPreviewEnd();
+    void onFrameReady(int request, int index, const QImage& image);
 
 private:
     void setupUI();
@@ -45,7 +57,7 @@ private:
     void updateTimeLabel();
 
     QString m_videoPath;
-    cv::VideoCapture m_capture;
+    FrameDecoder* m_decoder;
     
     QLabel* m_previewLabel;
     QLabel* m_timeLabel;
@@ -58,5 +70,6 @@ private:
     int m_endFrame;
     int m_totalFrames;
     double m_fps;
+    int m_shownFrame;   // last frame asked for, shown again after a resize
 };
 #endif // TRIMDIALOG_H
\ No newline at end of file
@@ -0,0 +1,564 @@
+/*
+ * UploadSession.cpp
+ *
+ * Chunked, resumable clip upload on a libcurl multi handle. Chunks are
+ * scheduled from the file's current size, so one loop serves a finished
+ * clip and one that is still being written.
+ */
+
+#include "UploadSession.h"
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <curl/curl.h>
+
+// How often a growing file is checked for new whole chunks
+static constexpr int GROWING_POLL_MS = 200;
+static constexpr int64_t THROUGHPUT_WINDOW_MS = 3000;
+static constexpr long CONNECT_TIMEOUT_S = 15;
+static constexpr long REQUEST_TIMEOUT_S = 60;
+// A chunk moving less than LOW_SPEED_BYTES a second for LOW_SPEED_S
+// seconds is treated as failed and retried
+static constexpr long LOW_SPEED_BYTES = 1024;
+static constexpr long LOW_SPEED_S = 30;
+
+UploadSession::UploadSession(const QString& path, const Settings& settings, bool growing)
+    : m_path(path)
+    , m_settings(settings)
+    , m_chunkBytes((int64_t)(std::max)(MIN_CHUNK_KB, settings.chunkSizeKB) * 1024)
+    , m_cancel(false)
+    , m_growing(growing)
+    , m_finalSize(-2)
+    , m_multi(nullptr)
+    , m_confirmedBytes(0)
+    , m_retries(0)
+    , m_lastReportMs(-PROGRESS_INTERVAL_MS)
+{
+    m_settings.parallelChunks = std::clamp(m_settings.parallelChunks, 1, MAX_PARALLEL);
+    m_settings.maxRetries = (std::max)(0, m_settings.maxRetries);
+    while (m_settings.endpoint.endsWith('/')) {
+        m_settings.endpoint.chop(1);
+    }
+
+    // curl_global_init is not thread-safe in older libcurl
+    static std::once_flag curlInit;
+    std::call_once(curlInit, []() { curl_global_init(CURL_GLOBAL_DEFAULT); });
+}
+
+UploadSession::~UploadSession() {
+    releaseSlots();
+}
+
+bool UploadSession::setError(const QString& message) {
+    m_lastError = message;
+    qDebug() << "[Upload]" << m_lastError;
+    return false;
+}
+
+QString UploadSession::sidecarPath(const QString& clipPath) {
+    return clipPath + ".upload";
+}
+
+void UploadSession::forget(const QString& clipPath) {
+    QFile::remove(sidecarPath(clipPath));
+}
+
+void UploadSession::finishSource(int64_t finalSize) {
+    m_finalSize.store(finalSize >= 0 ? finalSize : -1);
+}
+
+size_t UploadSession::collectResponse(char* data, size_t size, size_t count, void* userdata) {
+    static_cast<QByteArray*>(userdata)->append(data, static_cast<qsizetype>(size * count));
+    return size * count;
+}
+
+size_t UploadSession::readChunk(char* buffer, size_t size, size_t count, void* userdata) {
+    Slot* slot = static_cast<Slot*>(userdata);
+    const size_t bytes = (std::min)(size * count, static_cast<size_t>(slot->size - slot->sent));
+    memcpy(buffer, slot->data + slot->sent, bytes);
+    slot->sent += static_cast<int64_t>(bytes);
+    return bytes;
+}
+
+bool UploadSession::request(const char* method, const QString& url, const QByteArray& body,
+                            QByteArray* response, long* status) {
+    CURL* easy = curl_easy_init();
+    if (!easy) {
+        return setError("curl_easy_init failed");
+    }
+    curl_slist* headers = curl_slist_append(nullptr, "Content-Type: application/json");
+    if (!m_settings.token.isEmpty()) {
+        headers = curl_slist_append(headers, QString("Authorization: Bearer %1").arg(m_settings.token).toUtf8().constData());
+    }
+
+    const QByteArray urlBytes = url.toUtf8();
+    curl_easy_setopt(easy, CURLOPT_URL, urlBytes.constData());
+    curl_easy_setopt(easy, CURLOPT_CUSTOMREQUEST, method);
+    if (!body.isEmpty()) {
+        curl_easy_setopt(easy, CURLOPT_POSTFIELDS, body.constData());
+        curl_easy_setopt(easy, CURLOPT_POSTFIELDSIZE_LARGE, static_cast<curl_off_t>(body.size()));
+    }
+    curl_easy_setopt(easy, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, collectResponse);
+    curl_easy_setopt(easy, CURLOPT_WRITEDATA, response);
+    curl_easy_setopt(easy, CURLOPT_CONNECTTIMEOUT, CONNECT_TIMEOUT_S);
+    curl_easy_setopt(easy, CURLOPT_TIMEOUT, REQUEST_TIMEOUT_S);
+    curl_easy_setopt(easy, CURLOPT_NOSIGNAL, 1L);
+
+    const CURLcode result = curl_easy_perform(easy);
+    *status = 0;
+    curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, status);
+    curl_slist_free_all(headers);
+    curl_easy_cleanup(easy);
+    if (result != CURLE_OK) {
+        return setError(QString("%1 %2: %3").arg(QString::fromLatin1(method), url, QString::fromUtf8(curl_easy_strerror(result))));
+    }
+    return true;
+}
+
+bool UploadSession::openSession() {
+    const int64_t finalSize = m_finalSize.load();
+    QJsonObject body;
+    body["name"] = QFileInfo(m_path).fileName();
+    body["size"] = finalSize >= 0 ? QJsonValue((qint64)finalSize) : QJsonValue(QJsonValue::Null);
+    body["chunkSize"] = (qint64)m_chunkBytes;
+    body["user"] = m_settings.user;
+
+    QByteArray response;
+    long status = 0;
+    if (!request("POST", m_settings.endpoint + "/uploads", QJsonDocument(body).toJson(QJsonDocument::Compact),
+                 &response, &status)) {
+        return false;
+    }
+    const QString id = QJsonDocument::fromJson(response).object().value("id").toString();
+    if (status < 200 || status >= 300 || id.isEmpty()) {
+        return setError(QString("Creating the upload failed: HTTP %1 %2").arg(status).arg(QString::fromUtf8(response.left(200))));
+    }
+    m_uploadId = id;
+    for (ChunkState& chunk : m_chunks) {
+        chunk = ChunkState();
+    }
+    m_confirmedBytes = 0;
+    saveSidecar();
+    return true;
+}
+
+bool UploadSession::resumeSession() {
+    QByteArray response;
+    long status = 0;
+    if (!request("GET", QString("%1/uploads/%2").arg(m_settings.endpoint, m_uploadId), QByteArray(),
+                 &response, &status) || status < 200 || status >= 300) {
+        // Expired or unknown on the server: start over
+        qDebug() << "[Upload] Cannot resume" << m_uploadId << "(HTTP" << status << "), starting a new upload";
+        m_uploadId.clear();
+        return false;
+    }
+
+    // The server's list is the truth; the sidecar may be behind or ahead
+    const QJsonArray received = QJsonDocument::fromJson(response).object().value("received").toArray();
+    for (ChunkState& chunk : m_chunks) {
+        chunk.done = false;
+    }
+    m_confirmedBytes = 0;
+    for (const QJsonValue& value : received) {
+        const int index = value.toInt(-1);
+        if (index < 0) {
+            continue;
+        }
+        if (index >= (int)m_chunks.size()) {
+            m_chunks.resize(index + 1);
+        }
+        if (!m_chunks[index].done) {
+            m_chunks[index].done = true;
+            m_confirmedBytes += chunkSize(index);
+        }
+    }
+    qDebug() << "[Upload] Resuming" << m_uploadId << "with" << received.size() << "chunks on the server";
+    return true;
+}
+
+bool UploadSession::completeSession() {
+    const int64_t finalSize = m_finalSize.load();
+    QJsonObject body;
+    body["size"] = (qint64)finalSize;
+    body["chunks"] = chunkCount(finalSize);
+
+    QByteArray response;
+    long status = 0;
+    if (!request("POST", QString("%1/uploads/%2/complete").arg(m_settings.endpoint, m_uploadId),
+                 QJsonDocument(body).toJson(QJsonDocument::Compact), &response, &status)) {
+        return false;
+    }
+    if (status < 200 || status >= 300) {
+        return setError(QString("Finishing the upload failed: HTTP %1 %2").arg(status).arg(QString::fromUtf8(response.left(200))));
+    }
+    m_url = QJsonDocument::fromJson(response).object().value("url").toString();
+    forget(m_path);
+    return true;
+}
+
+void UploadSession::loadSidecar() {
+    QFile file(sidecarPath(m_path));
+    if (!file.open(QIODevice::ReadOnly)) {
+        return;
+    }
+    const QJsonObject state = QJsonDocument::fromJson(file.readAll()).object();
+    const int64_t finalSize = m_finalSize.load();
+    const QJsonValue size = state.value("size");
+
+    // Only resume the same upload of the same file
+    if (state.value("endpoint").toString() != m_settings.endpoint ||
+        state.value("chunkSize").toInteger() != m_chunkBytes ||
+        (size.isDouble() && finalSize >= 0 && size.toInteger() != finalSize)) {
+        return;
+    }
+    m_uploadId = state.value("id").toString();
+}
+
+void UploadSession::saveSidecar() const {
+    QJsonArray done;
+    for (int i = 0; i < (int)m_chunks.size(); i++) {
+        if (m_chunks[i].done) {
+            done.append(i);
+        }
+    }
+    const int64_t finalSize = m_finalSize.load();
+    QJsonObject state;
+    state["endpoint"] = m_settings.endpoint;
+    state["id"] = m_uploadId;
+    state["chunkSize"] = (qint64)m_chunkBytes;
+    state["size"] = finalSize >= 0 ? QJsonValue((qint64)finalSize) : QJsonValue(QJsonValue::Null);
+    state["done"] = done;
+
+    // Written whole or not at all, so a crash never leaves half a sidecar
+    QSaveFile file(sidecarPath(m_path));
+    if (file.open(QIODevice::WriteOnly)) {
+        file.write(QJsonDocument(state).toJson(QJsonDocument::Compact));
+        file.commit();
+    }
+}
+
+int64_t UploadSession::availableBytes() const {
+    const int64_t finalSize = m_finalSize.load();
+    return finalSize >= 0 ? finalSize : m_file.size();
+}
+
+int UploadSession::chunkCount(int64_t bytes) const {
+    return static_cast<int>((bytes + m_chunkBytes - 1) / m_chunkBytes);
+}
+
+int64_t UploadSession::chunkSize(int chunk) const {
+    const int64_t finalSize = m_finalSize.load();
+    const int64_t offset = chunk * m_chunkBytes;
+    return finalSize >= 0 ? std::clamp<int64_t>(finalSize - offset, 0, m_chunkBytes) : m_chunkBytes;
+}
+
+int UploadSession::nextReadyChunk(int64_t nowMs, int64_t available) const {
+    const bool sizeKnown = m_finalSize.load() >= 0;
+    for (int i = 0; i < (int)m_chunks.size(); i++) {
+        const ChunkState& chunk = m_chunks[i];
+        if (chunk.done || chunk.inFlight || chunk.retryAtMs > nowMs) {
+            continue;
+        }
+        // A growing file only has whole chunks below its current size
+        if (!sizeKnown && (i + 1) * m_chunkBytes > available) {
+            break;
+        }
+        return i;
+    }
+    return -1;
+}
+
+bool UploadSession::startChunk(Slot& slot, int chunk, int activeAfter) {
+    const int64_t offset = chunk * m_chunkBytes;
+    const int64_t size = chunkSize(chunk);
+    slot.data = m_file.map(offset, size);
+    if (!slot.data) {
+        return setError(QString("Cannot map %1 bytes at %2: %3").arg(size).arg(offset).arg(m_file.errorString()));
+    }
+    if (!slot.easy) {
+        slot.easy = curl_easy_init();
+        if (!slot.easy) {
+            m_file.unmap(slot.data);
+            slot.data = nullptr;
+            return setError("curl_easy_init failed");
+        }
+    }
+
+    const int64_t finalSize = m_finalSize.load();
+    const QString total = finalSize >= 0 ? QString::number(finalSize) : QString("*");
+    curl_slist_free_all(slot.headers);
+    slot.headers = curl_slist_append(nullptr, "Content-Type: application/octet-stream");
+    slot.headers = curl_slist_append(slot.headers, QString("Content-Range: bytes %1-%2/%3")
+        .arg(offset).arg(offset + size - 1).arg(total).toUtf8().constData());
+    // No 100-continue round trip per chunk
+    slot.headers = curl_slist_append(slot.headers, "Expect:");
+    if (!m_settings.token.isEmpty()) {
+        slot.headers = curl_slist_append(slot.headers,
+            QString("Authorization: Bearer %1").arg(m_settings.token).toUtf8().constData());
+    }
+
+    slot.chunk = chunk;
+    slot.size = size;
+    slot.sent = 0;
+    slot.response.clear();
+
+    const QByteArray url = QString("%1/uploads/%2/chunks/%3").arg(m_settings.endpoint, m_uploadId).arg(chunk).toUtf8();
+    CURL* easy = slot.easy;
+    curl_easy_setopt(easy, CURLOPT_URL, url.constData());
+    curl_easy_setopt(easy, CURLOPT_UPLOAD, 1L);
+    curl_easy_setopt(easy, CURLOPT_INFILESIZE_LARGE, static_cast<curl_off_t>(size));
+    curl_easy_setopt(easy, CURLOPT_READFUNCTION, readChunk);
+    curl_easy_setopt(easy, CURLOPT_READDATA, &slot);
+    // Lets curl send the chunk again after a redirect or an HTTP/2 retry.
+    // A lambda, since curl_off_t is not int64_t everywhere and the header
+    // does not include curl.
+    const curl_seek_callback seekChunk = [](void* userdata, curl_off_t offset, int origin) -> int {
+        Slot* seeking = static_cast<Slot*>(userdata);
+        if (origin != SEEK_SET || offset < 0 || offset > seeking->size) {
+            return CURL_SEEKFUNC_CANTSEEK;
+        }
+        seeking->sent = static_cast<int64_t>(offset);
+        return CURL_SEEKFUNC_OK;
+    };
+    curl_easy_setopt(easy, CURLOPT_SEEKFUNCTION, seekChunk);
+    curl_easy_setopt(easy, CURLOPT_SEEKDATA, &slot);
+    curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, collectResponse);
+    curl_easy_setopt(easy, CURLOPT_WRITEDATA, &slot.response);
+    curl_easy_setopt(easy, CURLOPT_HTTPHEADER, slot.headers);
+    // Connections stay open between chunks; with HTTP/2 the chunks in
+    // flight share one
+    curl_easy_setopt(easy, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+    curl_easy_setopt(easy, CURLOPT_PIPEWAIT, 1L);
+    curl_easy_setopt(easy, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(easy, CURLOPT_CONNECTTIMEOUT, CONNECT_TIMEOUT_S);
+    curl_easy_setopt(easy, CURLOPT_LOW_SPEED_LIMIT, LOW_SPEED_BYTES);
+    curl_easy_setopt(easy, CURLOPT_LOW_SPEED_TIME, LOW_SPEED_S);
+    curl_easy_setopt(easy, CURLOPT_NOSIGNAL, 1L);
+
+    m_chunks[chunk].inFlight = true;
+    applyRateLimit(activeAfter);
+    curl_multi_add_handle(m_multi, easy);
+    return true;
+}
+
+void UploadSession::applyRateLimit(int active) {
+    // Each transfer gets an equal share of the cap
+    const curl_off_t share = m_settings.limitKBps > 0
+        ? (curl_off_t)m_settings.limitKBps * 1024 / (std::max)(1, active) : 0;
+    for (Slot& slot : m_slots) {
+        if (slot.easy && slot.chunk >= 0) {
+            curl_easy_setopt(slot.easy, CURLOPT_MAX_SEND_SPEED_LARGE, share);
+        }
+    }
+}
+
+bool UploadSession::finishChunk(Slot& slot, int curlResult, int64_t nowMs) {
+    long status = 0;
+    curl_easy_getinfo(slot.easy, CURLINFO_RESPONSE_CODE, &status);
+    curl_multi_remove_handle(m_multi, slot.easy);
+    m_file.unmap(slot.data);
+    slot.data = nullptr;
+
+    const int index = slot.chunk;
+    slot.chunk = -1;
+    ChunkState& chunk = m_chunks[index];
+    chunk.inFlight = false;
+
+    if (curlResult == CURLE_OK && status >= 200 && status < 300) {
+        chunk.done = true;
+        m_confirmedBytes += slot.size;
+        saveSidecar();
+        return true;
+    }
+
+    const QString reason = curlResult != CURLE_OK
+        ? QString::fromUtf8(curl_easy_strerror(static_cast<CURLcode>(curlResult)))
+        : QString("HTTP %1 %2").arg(status).arg(QString::fromUtf8(slot.response.left(200)));
+    // Other 4xx answers will not change by asking again
+    const bool retryable = curlResult != CURLE_OK || status >= 500 || status == 408 || status == 429;
+    if (!retryable || ++chunk.attempts > m_settings.maxRetries) {
+        return setError(QString("Chunk %1 failed: %2").arg(index).arg(reason));
+    }
+    m_retries++;
+    const int64_t backoffMs = (std::min<int64_t>)(MAX_BACKOFF_MS, 1000LL << (std::min)(chunk.attempts - 1, 15));
+    chunk.retryAtMs = nowMs + backoffMs;
+    qDebug() << "[Upload] Chunk" << index << "failed (" << reason << "), retry" << chunk.attempts
+             << "in" << backoffMs << "ms";
+    return true;
+}
+
+void UploadSession::releaseSlots() {
+    for (Slot& slot : m_slots) {
+        if (slot.easy) {
+            if (slot.chunk >= 0 && m_multi) {
+                curl_multi_remove_handle(m_multi, slot.easy);
+            }
+            curl_easy_cleanup(slot.easy);
+        }
+        curl_slist_free_all(slot.headers);
+        if (slot.data) {
+            m_file.unmap(slot.data);
+        }
+    }
+    m_slots.clear();
+    if (m_multi) {
+        curl_multi_cleanup(m_multi);
+        m_multi = nullptr;
+    }
+}
+
+void UploadSession::reportProgress(int64_t nowMs, bool force) {
+    if (!force && nowMs - m_lastReportMs < PROGRESS_INTERVAL_MS) {
+        return;
+    }
+    m_lastReportMs = nowMs;
+
+    Progress progress;
+    int64_t inFlight = 0;
+    for (const Slot& slot : m_slots) {
+        if (slot.chunk >= 0) {
+            curl_off_t uploaded = 0;
+            curl_easy_getinfo(slot.easy, CURLINFO_SIZE_UPLOAD_T, &uploaded);
+            inFlight += uploaded;
+            progress.activeChunks++;
+        }
+    }
+    const int64_t finalSize = m_finalSize.load();
+    progress.sentBytes = m_confirmedBytes + inFlight;
+    progress.totalBytes = finalSize >= 0 ? finalSize : -1;
+    progress.retries = m_retries;
+
+    m_samples.emplace_back(nowMs, progress.sentBytes);
+    while (m_samples.size() > 2 && nowMs - m_samples.front().first > THROUGHPUT_WINDOW_MS) {
+        m_samples.erase(m_samples.begin());
+    }
+    const int64_t spanMs = nowMs - m_samples.front().first;
+    if (spanMs > 0) {
+        progress.bytesPerSecond = (std::max)(0.0, (progress.sentBytes - m_samples.front().second) * 1000.0 / spanMs);
+    }
+    if (m_onProgress) {
+        m_onProgress(progress);
+    }
+}
+
+bool UploadSession::run() {
+    if (m_settings.endpoint.isEmpty()) {
+        return setError("No upload endpoint configured");
+    }
+    m_file.setFileName(m_path);
+    if (!m_file.open(QIODevice::ReadOnly)) {
+        return setError(QString("Cannot open %1: %2").arg(m_path, m_file.errorString()));
+    }
+    if (!m_growing.load()) {
+        m_finalSize = m_file.size();
+    }
+    if (m_finalSize.load() >= 0) {
+        m_chunks.resize(chunkCount(m_finalSize.load()));
+    }
+
+    loadSidecar();
+    if ((m_uploadId.isEmpty() || !resumeSession()) && !openSession()) {
+        return false;
+    }
+
+    m_multi = curl_multi_init();
+    if (!m_multi) {
+        return setError("curl_multi_init failed");
+    }
+    curl_multi_setopt(m_multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+    curl_multi_setopt(m_multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long)m_settings.parallelChunks);
+    m_slots.assign(m_settings.parallelChunks, Slot());
+
+    QElapsedTimer clock;
+    clock.start();
+    bool ok = true;
+    while (ok) {
+        const int64_t nowMs = clock.elapsed();
+        if (m_cancel.load()) {
+            ok = setError("Upload canceled");
+            break;
+        }
+        const int64_t finalSize = m_finalSize.load();
+        if (finalSize == -1) {
+            // Nothing sent so far belongs to a clip that will exist
+            forget(m_path);
+            ok = setError("The clip was not saved");
+            break;
+        }
+
+        // Chunks known so far: all of a finished file, the whole ones of
+        // a growing one
+        const int64_t available = availableBytes();
+        const int known = finalSize >= 0 ? chunkCount(finalSize) : static_cast<int>(available / m_chunkBytes);
+        if ((int)m_chunks.size() < known) {
+            m_chunks.resize(known);
+        }
+
+        int active = 0;
+        for (const Slot& slot : m_slots) {
+            active += slot.chunk >= 0 ? 1 : 0;
+        }
+        if (finalSize >= 0 && active == 0 &&
+            std::all_of(m_chunks.begin(), m_chunks.end(), [](const ChunkState& c) { return c.done; })) {
+            break;
+        }
+
+        for (Slot& slot : m_slots) {
+            if (slot.chunk >= 0) {
+                continue;
+            }
+            const int chunk = nextReadyChunk(nowMs, available);
+            if (chunk < 0) {
+                break;
+            }
+            if (!startChunk(slot, chunk, active + 1)) {
+                ok = false;
+                break;
+            }
+            active++;
+        }
+        if (!ok) {
+            break;
+        }
+
+        int running = 0;
+        curl_multi_perform(m_multi, &running);
+        int queued = 0;
+        int finished = 0;
+        while (CURLMsg* message = curl_multi_info_read(m_multi, &queued)) {
+            if (message->msg != CURLMSG_DONE) {
+                continue;
+            }
+            auto slot = std::find_if(m_slots.begin(), m_slots.end(),
+                                     [&](const Slot& s) { return s.easy == message->easy_handle; });
+            if (slot == m_slots.end()) {
+                continue;
+            }
+            finished++;
+            if (!finishChunk(*slot, message->data.result, nowMs)) {
+                ok = false;
+                break;
+            }
+        }
+        if (finished > 0) {
+            // The chunks still in flight take over the finished ones' share
+            applyRateLimit(active - finished);
+        }
+        reportProgress(nowMs, false);
+        curl_multi_poll(m_multi, nullptr, 0, active > 0 ? 100 : GROWING_POLL_MS, nullptr);
+    }
+
+    reportProgress(clock.elapsed(), true);
+    releaseSlots();
+    m_file.close();
+    return ok && completeSession();
+}
@@ -0,0 +1,177 @@
+#ifndef UPLOADSESSION_H
+#define UPLOADSESSION_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+typedef void CURL;    // as curl/curl.h declares them
+typedef void CURLM;
+struct curl_slist;
+
+/*
+ * UploadSession
+ *
+ * Purpose
+ * - Uploads one clip file in fixed-size chunks over HTTP(S) with libcurl.
+ *   Each chunk is memory-mapped while curl sends it, so memory use does
+ *   not depend on the clip size and nothing is copied into a buffer
+ *   first. Several chunks are in flight at once over kept-alive (HTTP/2:
+ *   multiplexed) connections.
+ *
+ * Protocol
+ * - `POST {endpoint}/uploads` with {"name", "size", "chunkSize", "user"}
+ *   creates an upload and answers {"id"}. "size" is null while the file is
+ *   still growing.
+ * - `PUT {endpoint}/uploads/{id}/chunks/{index}` sends one chunk, with
+ *   `Content-Range: bytes first-last/total` ("*" for an unknown total).
+ *   Chunks may arrive in any order.
+ * - `GET {endpoint}/uploads/{id}` answers {"received": [indices]}; used
+ *   when resuming.
+ * - `POST {endpoint}/uploads/{id}/complete` with {"size", "chunks"}
+ *   finishes it and answers {"url"}.
+ * - `Settings::token`, when set, goes in `Authorization: Bearer`.
+ *
+ * Resuming
+ * - Progress is kept in a `<clip>.upload` JSON sidecar: the upload id,
+ *   endpoint, chunk size and the chunks the server confirmed. A failed or
+ *   canceled upload of the same file picks up from there, after asking
+ *   the server what it actually has. The sidecar is removed once the
+ *   upload completes; `forget()` removes it for a deleted clip.
+ * - A chunk that fails (network error, 5xx, timeout) is retried with
+ *   exponential backoff, up to `Settings::maxRetries` times; then the
+ *   whole upload fails, keeping the sidecar.
+ *
+ * Growing files
+ * - With `growing` set the file is still being written (a fragmented MP4
+ *   save, say) and must only be appended to. Only whole chunks below the
+ *   current size are sent until `finishSource()` gives the final size;
+ *   then the rest follows and the upload completes. `finishSource(-1)`
+ *   abandons it, sidecar included.
+ *
+ * Bandwidth
+ * - `Settings::limitKBps` caps the whole upload (0 = no limit). The cap is
+ *   shared between the chunks in flight, so uploading does not starve the
+ *   game of upstream bandwidth.
+ *
+ * Threading
+ * - `run()` blocks; call it on a worker thread. `cancel()` and
+ *   `finishSource()` may be called from any thread. `Progress` is reported
+ *   from the `run()` thread about every PROGRESS_INTERVAL_MS.
+ */
+class UploadSession {
+public:
+    struct Settings {
+        QString endpoint;          // base URL, e.g. https://clips.example.com/api
+        QString token;             // bearer token; empty = none
+        QString user;
+        int chunkSizeKB = 8192;
+        int parallelChunks = 3;
+        int limitKBps = 0;         // 0 = unlimited
+        int maxRetries = 5;
+    };
+
+    struct Progress {
+        int64_t sentBytes = 0;     // confirmed chunks plus bytes in flight
+        int64_t totalBytes = -1;   // -1 while the file is still growing
+        double bytesPerSecond = 0; // over the last few seconds
+        int activeChunks = 0;
+        int retries = 0;
+    };
+
+    static constexpr int MIN_CHUNK_KB = 256;
+    static constexpr int MAX_PARALLEL = 8;
+    static constexpr int PROGRESS_INTERVAL_MS = 500;
+    static constexpr int MAX_BACKOFF_MS = 30000;
+
+    UploadSession(const QString& path, const Settings& settings, bool growing = false);
+    ~UploadSession();
+
+    UploadSession(const UploadSession&) = delete;
+    UploadSession& operator=(const UploadSession&) = delete;
+
+    void setProgressCallback(std::function<void(const Progress&)> callback) { m_onProgress = std::move(callback); }
+
+    // Uploads the file; returns true with the clip's URL in `url()`
+    bool run();
+    void cancel() { m_cancel.store(true); }
+    bool isCanceled() const { return m_cancel.load(); }
+    // The final size of a growing file, or -1 if writing it failed
+    void finishSource(int64_t finalSize);
+
+    QString url() const { return m_url; }
+    QString lastError() const { return m_lastError; }
+
+    static QString sidecarPath(const QString& clipPath);
+    static void forget(const QString& clipPath);
+
+private:
+    // One chunk transfer; its easy handle is reused for the next chunk
+    struct Slot {
+        CURL* easy = nullptr;
+        curl_slist* headers = nullptr;
+        int chunk = -1;            // -1 while idle
+        uchar* data = nullptr;     // the chunk, mapped from m_file
+        int64_t size = 0;
+        int64_t sent = 0;          // handed to curl so far
+        QByteArray response;
+    };
+
+    struct ChunkState {
+        bool done = false;
+        bool inFlight = false;
+        int attempts = 0;
+        int64_t retryAtMs = 0;     // not before this (session clock)
+    };
+
+    bool setError(const QString& message);
+    bool request(const char* method, const QString& url, const QByteArray& body,
+                 QByteArray* response, long* status);
+    bool openSession();
+    bool resumeSession();
+    bool completeSession();
+    void loadSidecar();
+    void saveSidecar() const;
+    int64_t availableBytes() const;
+    int chunkCount(int64_t bytes) const;
+    int64_t chunkSize(int chunk) const;
+    int nextReadyChunk(int64_t nowMs, int64_t available) const;
+    bool startChunk(Slot& slot, int chunk, int activeAfter);
+    void applyRateLimit(int active);
+    bool finishChunk(Slot& slot, int curlResult, int64_t nowMs);
+    void releaseSlots();
+    void reportProgress(int64_t nowMs, bool force);
+    static size_t readChunk(char* buffer, size_t size, size_t count, void* userdata);
+    static size_t collectResponse(char* data, size_t size, size_t count, void* userdata);
+
+    QString m_path;
+    Settings m_settings;
+    int64_t m_chunkBytes;
+    QString m_uploadId;
+    QString m_url;
+    QString m_lastError;
+    std::atomic<bool> m_cancel;
+
+    // Growing source: m_finalSize is -2 until finishSource(), then the
+    // size or -1 for a failed write
+    std::atomic<bool> m_growing;
+    std::atomic<int64_t> m_finalSize;
+
+    std::vector<ChunkState> m_chunks;
+    std::vector<Slot> m_slots;
+    CURLM* m_multi;
+    QFile m_file;
+    int64_t m_confirmedBytes;
+    int m_retries;
+
+    // Throughput over a sliding window of samples
+    std::vector<std::pair<int64_t, int64_t>> m_samples;   // (ms, sent bytes)
+    int64_t m_lastReportMs;
+    std::function<void(const Progress&)> m_onProgress;
+};
+
+#endif // UPLOADSESSION_H
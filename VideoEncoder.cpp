@@ -3,19 +3,30 @@
  *
  * Responsible for turning an ordered sequence of compressed video frames
  * (`VideoFrame`) and audio chunks (`AudioSample`) into a single output
- * container file (MP4). The implementation prefers to use an external
- * `ffmpeg` binary when available for robustness and performance. When
- * `ffmpeg` is not present, a best-effort OpenCV-based writer is used.
+ * container file (MP4). The implementation encodes in-process through the
+ * FFmpeg libraries (`MediaWriter`). If that fails it falls back to an
+ * external `ffmpeg` binary, and when `ffmpeg` is not present, to a
+ * best-effort OpenCV-based writer.
  *
  * Key responsibilities
  * - Validate frames and audio, write intermediate files if required by
  *   the chosen encoding path, and invoke the encoder process.
- * - Mix microphone and desktop audio streams with resampling and time
- *   alignment before writing to the container.
+ * - Mix microphone and desktop audio streams (`AudioMixer`) with
+ *   resampling and time alignment while writing to the container.
  * - Emit progress updates and detailed error messages for the UI.
+ * - Stop any of the paths at the next frame when the save is cancelled,
+ *   leaving no partial output behind.
+ * - Write the clip's `ClipIndex` sidecar from the in-process paths, so the
+ *   UI never has to probe a freshly saved clip.
+ * - Optionally write fragmented MP4, which grows append-only while the
+ *   save runs and survives a crash up to its last fragment.
  */
 
 #include "VideoEncoder.h"
+#include "MediaWriter.h"
+#include "AudioMixer.h"
+#include "JpegDecodeQueue.h"
+#include "ClipIndex.h"
 #include <QProcess>
 #include <QTemporaryFile>
 #include <QDebug>
@@ -24,266 +35,618 @@
 #include <QFile>
 #include <QCoreApplication>
 #include <QDataStream>
+#include <QPainter>
 #include <cmath>
+#include <algorithm>
+#include <limits>
+#include <memory>
 #include <opencv2/opencv.hpp>
 
+// Share of the ffmpeg path's progress spent writing the JPEG list
+static const int FFMPEG_PREPARE_PERCENT = 30;
+
+// Clears a cancel request when the save that saw it returns
+struct CancelScope {
+    std::atomic<bool>& flag;
+    ~CancelScope() { flag = false; }
+};
+
+// The changes of `timeline` within [startUs, endUs), relative to startUs
+// and led by the level in force at startUs; empty for a clip that was
+// captured at full quality throughout
+static std::vector<std::pair<int64_t, int>> clipQualityTimeline(
+    const std::vector<QualityController::Change>& timeline, int64_t startUs, int64_t endUs)
+{
+    std::vector<std::pair<int64_t, int>> changes;
+    int atStart = 0;
+    for (const QualityController::Change& change : timeline) {
+        if (change.timeUs <= startUs) {
+            atStart = change.level;
+        } else if (change.timeUs < endUs) {
+            changes.emplace_back(change.timeUs - startUs, change.level);
+        }
+    }
+    if (atStart != 0 || !changes.empty()) {
+        changes.insert(changes.begin(), { 0, atStart });
+    }
+    return changes;
+}
+
+// The largest capture size in the clip, `firstSize` at least. Frames
+// captured while the quality controller had lowered the capture size are
+// scaled back up to it.
+static QSize clipOutputSize(const std::vector<VideoFrame>& frames, const QSize& firstSize)
+{
+    QSize size = firstSize;
+    for (const VideoFrame& frame : frames) {
+        if ((int64_t)frame.originalSize.width() * frame.originalSize.height() > (int64_t)size.width() * size.height()) {
+            size = frame.originalSize;
+        }
+    }
+    return size;
+}
+
 VideoEncoder::VideoEncoder(QObject *parent)
     : QObject(parent)
+    , m_cancelRequested(false)
+    , m_lastProgress(-1)
 {
 }
 
 VideoEncoder::~VideoEncoder() {
 }
 
-// Resample helper: convert an interleaved float buffer from srcRate to dstRate
-std::vector<float> resampleAudio(const std::vector<float>& input, int srcRate, int dstRate, int channels) {
-    if (srcRate == dstRate || input.empty()) return input;
+void VideoEncoder::reportProgress(int percent) {
+    percent = std::clamp(percent, 0, 100);
+    if (percent != m_lastProgress) {
+        m_lastProgress = percent;
+        emit progressUpdate(percent);
+    }
+}
 
-    qDebug() << "Resampling audio from" << srcRate << "to" << dstRate << "Hz";
-    
-    double ratio = (double)srcRate / (double)dstRate;
-    size_t inputFrames = input.size() / channels;
-    size_t outFrames = (size_t)(inputFrames / ratio);
-    
-    std::vector<float> output;
-    output.reserve(outFrames * channels);
-
-    for (size_t i = 0; i < outFrames; i++) {
-        // Linear interpolation between adjacent samples to approximate the value at
-        // the target sample index. This is a simple but effective resampling method
-        // that avoids expensive sinc interpolation while maintaining reasonable quality.
-        double srcIndex = i * ratio;
-        size_t index1 = (size_t)srcIndex;
-        size_t index2 = index1 + 1;
-        double frac = srcIndex - index1;
-
-        for (int c = 0; c < channels; c++) {
-            float val1 = 0.0f;
-            float val2 = 0.0f;
-            
-            // Fetch the two surrounding samples, clamping bounds to avoid out-of-range access.
-            size_t pos1 = index1 * channels + c;
-            size_t pos2 = index2 * channels + c;
-            
-            if (pos1 < input.size()) val1 = input[pos1];
-            if (pos2 < input.size()) val2 = input[pos2];
-            
-            // Linear blend: (1 - frac) * val1 + frac * val2
-            output.push_back(val1 * (1.0 - frac) + val2 * frac);
+void VideoEncoder::reportProgress(size_t done, size_t total) {
+    reportProgress(total > 0 ? static_cast<int>((done * 100) / total) : 0);
+}
+
+// Pulls mixed audio block by block until `target` frames have been
+// written or the audio runs out
+static bool writeMixedAudio(AudioMixer& mixer, MediaWriter& writer, size_t target, size_t& written) {
+    float block[AudioMixer::BLOCK_FRAMES * 2];
+    while (written < target) {
+        const size_t got = mixer.read(block, std::min<size_t>(AudioMixer::BLOCK_FRAMES, target - written));
+        if (got == 0) {
+            break;
+        }
+        if (!writer.writeAudio(block, got)) {
+            return false;
         }
+        written += got;
     }
-    
-    qDebug() << "Resampled from" << input.size() << "to" << output.size() << "samples";
-    return output;
+    return true;
 }
 
-std::vector<float> monoToStereo(const std::vector<float>& mono) {
-    std::vector<float> stereo;
-    stereo.reserve(mono.size() * 2);
-    // Duplicate each mono sample to both left and right channels. This is not ideal
-    // for true stereo content but works for mono audio that needs to be presented as stereo.
-    for (float sample : mono) {
-        stereo.push_back(sample);
-        stereo.push_back(sample);
+bool VideoEncoder::encode(
+    const std::vector<VideoFrame>& frames,
+    const AudioSnapshot& micAudio,
+    const AudioSnapshot& desktopAudio,
+    const EncodeOptions& options)
+{
+    CancelScope cancelScope{ m_cancelRequested };
+    m_lastProgress = -1;
+
+    if (frames.empty()) {
+        emit errorOccurred("No frames to encode");
+        return false;
+    }
+    
+    try {
+        if (frames[0].jpegData.isEmpty()) {
+            emit errorOccurred("No frame data available");
+            return false;
+        }
+
+        QString libavError;
+        if (encodeWithLibav(frames, micAudio, desktopAudio, options, libavError)) {
+            return true;
+        }
+        // A cancelled save does not go on to the fallbacks
+        if (isCancelRequested()) {
+            qDebug() << "Encoding canceled";
+            emit encodingCanceled();
+            return false;
+        }
+        qDebug() << "In-process encoding failed (" << libavError << "), trying ffmpeg binary";
+        // Whatever of the file was read while it grew is no longer valid
+        if (options.fragmented) {
+            emit outputDiscarded(options.outputPath);
+        }
+
+        bool ok;
+        QString ffmpegPath = findFFmpegPath();
+        if (!ffmpegPath.isEmpty()) {
+            qDebug() << "Using FFmpeg for encoding";
+            ok = encodeWithFFmpeg(frames, micAudio, desktopAudio, options, ffmpegPath);
+        } else {
+            qDebug() << "FFmpeg not found, using OpenCV fallback";
+            ok = encodeWithOpenCV(frames, micAudio, desktopAudio, options);
+        }
+        if (!ok && isCancelRequested()) {
+            qDebug() << "Encoding canceled";
+            emit encodingCanceled();
+        }
+        return ok;
+        
+    } catch (const std::exception& e) {
+        emit errorOccurred(QString("Encoding error: %1").arg(e.what()));
+        return false;
     }
-    return stereo;
 }
 
-std::vector<float> VideoEncoder::mixAudioSamples(
-    const std::vector<AudioSample>& mic,
-    const std::vector<AudioSample>& desktop)
+bool VideoEncoder::encodePackets(
+    const EncodedClip& clip,
+    const AudioSnapshot& micAudio,
+    const AudioSnapshot& desktopAudio,
+    const EncodeOptions& options)
 {
-    qDebug() << "=== Mixing audio samples ===";
-    qDebug() << "Mic samples:" << mic.size() << "chunks";
-    qDebug() << "Desktop samples:" << desktop.size() << "chunks";
-    
-    if (mic.empty() && desktop.empty()) {
-        qDebug() << "No audio samples to mix";
-        return {};
+    CancelScope cancelScope{ m_cancelRequested };
+    m_lastProgress = -1;
+
+    qDebug() << "=== Remuxing" << clip.packets.size() << "encoded packets ===";
+
+    if (clip.packets.empty() || !clip.stream.isValid()) {
+        emit errorOccurred("No encoded packets to save");
+        return false;
     }
 
-    std::vector<float> micData;
-    double micStartTime = 0;
-    int micSampleRate = 48000;
-    int micChannels = 2;
-    
-    if (!mic.empty()) {
-        micStartTime = mic[0].timestamp;
-        micSampleRate = mic[0].sampleRate;
-        micChannels = mic[0].channels;
-        
-        for (const auto& s : mic) {
-            micData.insert(micData.end(), s.data.begin(), s.data.end());
-        }
-        qDebug() << "Mic data size:" << micData.size() << "samples, rate:" << micSampleRate << "Hz, channels:" << micChannels;
+    const EncodedStreamInfo& stream = clip.stream;
+
+    // MediaClock time of the first packet, for lining the audio up with it
+    const int64_t videoStartUs = stream.startTimeUs +
+        clip.packets.front().pts * 1000000LL * stream.timeBaseNum / stream.timeBaseDen;
+
+    const int sampleRate = options.audioSampleRate;
+    AudioMixer mixer(micAudio, desktopAudio, sampleRate);
+    mixer.alignTo(videoStartUs);
+
+    MediaWriter writer;
+    MediaWriter::Config config;
+    config.outputPath = options.outputPath;
+    config.audioBitrate = options.audioBitrate;
+    config.audioSampleRate = sampleRate;
+    config.hasAudio = mixer.hasAudio();
+    config.copyVideo = stream;
+    config.fragmented = options.fragmented;
+
+    if (!writer.open(config)) {
+        emit errorOccurred(writer.lastError());
+        QFile::remove(options.outputPath);
+        return false;
+    }
+    if (options.fragmented) {
+        emit outputGrowing(options.outputPath);
     }
 
-    std::vector<float> deskData;
-    double deskStartTime = 0;
-    int deskSampleRate = 48000;
-    int deskChannels = 2;
-    
-    if (!desktop.empty()) {
-        deskStartTime = desktop[0].timestamp;
-        deskSampleRate = desktop[0].sampleRate;
-        deskChannels = desktop[0].channels;
-        
-        for (const auto& s : desktop) {
-            deskData.insert(deskData.end(), s.data.begin(), s.data.end());
+    const int64_t offset = clip.packets.front().dts;
+    int64_t endTicks = 0;
+    size_t audioWritten = 0;
+
+    for (size_t i = 0; i < clip.packets.size(); ++i) {
+        const EncodedPacket& packet = clip.packets[i];
+
+        if (isCancelRequested()) {
+            qDebug() << "Remux canceled at packet" << i;
+            writer.abort();
+            QFile::remove(options.outputPath);
+            emit encodingCanceled();
+            return false;
         }
-        qDebug() << "Desktop data size:" << deskData.size() << "samples, rate:" << deskSampleRate << "Hz, channels:" << deskChannels;
-    }
 
-    if (micData.empty()) {
-        qDebug() << "Only desktop audio available";
-        if (deskSampleRate != 48000 || deskChannels != 2) {
-            if (deskChannels == 1) deskData = monoToStereo(deskData);
-            if (deskSampleRate != 48000) deskData = resampleAudio(deskData, deskSampleRate, 48000, 2);
+        if (!writer.writeVideoPacket(packet, offset)) {
+            emit errorOccurred(writer.lastError());
+            QFile::remove(options.outputPath);
+            return false;
         }
-        return deskData;
-    }
-    if (deskData.empty()) {
-        qDebug() << "Only mic audio available";
-        if (micSampleRate != 48000 || micChannels != 2) {
-            if (micChannels == 1) micData = monoToStereo(micData);
-            if (micSampleRate != 48000) micData = resampleAudio(micData, micSampleRate, 48000, 2);
+
+        endTicks = std::max<int64_t>(endTicks, packet.pts + packet.duration - offset);
+
+        // Keep audio interleaved with the video timeline (ticks -> samples).
+        if (config.hasAudio) {
+            const size_t audioTarget = static_cast<size_t>(std::max<int64_t>(0,
+                endTicks * sampleRate * stream.timeBaseNum / stream.timeBaseDen));
+            if (!writeMixedAudio(mixer, writer, audioTarget, audioWritten)) {
+                emit errorOccurred(writer.lastError());
+                QFile::remove(options.outputPath);
+                return false;
+            }
         }
-        return micData;
+
+        reportProgress(i + 1, clip.packets.size());
     }
 
-    int targetRate = 48000;
-    int targetChannels = 2;
-    
-    qDebug() << "Normalizing both streams to" << targetRate << "Hz stereo";
-    
-    if (micChannels == 1) {
-        qDebug() << "Converting mic from mono to stereo";
-        micData = monoToStereo(micData);
-        micChannels = 2;
+    if (!writer.finish()) {
+        emit errorOccurred(writer.lastError());
+        QFile::remove(options.outputPath);
+        return false;
     }
-    
-    if (deskChannels == 1) {
-        qDebug() << "Converting desktop from mono to stereo";
-        deskData = monoToStereo(deskData);
-        deskChannels = 2;
+
+    // Metadata and keyframes come from the packets; the thumbnails need
+    // the keyframes decoded, which the written file has just cached
+    ClipIndex index;
+    ClipIndex::Info info;
+    info.valid = true;
+    info.durationUs = endTicks * 1000000LL * stream.timeBaseNum / stream.timeBaseDen;
+    info.fps = stream.fps;
+    info.width = stream.width;
+    info.height = stream.height;
+    info.frameCount = static_cast<int>(clip.packets.size());
+    index.setInfo(info);
+    index.setKeyframes(writer.keyframesUs());
+    index.setQualityTimeline(clipQualityTimeline(options.qualityTimeline, videoStartUs,
+                                                 videoStartUs + info.durationUs));
+    index.buildThumbnails(options.outputPath);
+    index.save(options.outputPath);
+
+    emit progressUpdate(100);
+    emit encodingComplete(true, "Video saved successfully (stream copy)");
+    return true;
+}
+
+bool VideoEncoder::encodeComposite(
+    const std::vector<std::vector<VideoFrame>>& displays,
+    const AudioSnapshot& micAudio,
+    const AudioSnapshot& desktopAudio,
+    const EncodeOptions& options)
+{
+    CancelScope cancelScope{ m_cancelRequested };
+    m_lastProgress = -1;
+
+    qDebug() << "=== Compositing" << displays.size() << "displays ===";
+
+    if (displays.empty()) {
+        emit errorOccurred("No frames to encode");
+        return false;
     }
-    
-    if (micSampleRate != targetRate) {
-        qDebug() << "Resampling mic from" << micSampleRate << "Hz to" << targetRate << "Hz";
-        micData = resampleAudio(micData, micSampleRate, targetRate, micChannels);
+
+    // Sizes come from each display's first frame; the timeline spans all
+    std::vector<QSize> sizes;
+    int64_t startUs = std::numeric_limits<int64_t>::max();
+    int64_t endUs = std::numeric_limits<int64_t>::min();
+    for (const std::vector<VideoFrame>& frames : displays) {
+        QImage first;
+        if (frames.empty() || !first.loadFromData(frames[0].jpegData, "JPEG")) {
+            emit errorOccurred(QString("Display %1 has no frames to encode").arg(sizes.size() + 1));
+            return false;
+        }
+        sizes.push_back(first.size());
+        startUs = std::min(startUs, frames.front().timestampUs);
+        endUs = std::max(endUs, frames.back().timestampUs);
     }
 
-    if (deskSampleRate != targetRate) {
-        qDebug() << "Resampling desktop from" << deskSampleRate << "Hz to" << targetRate << "Hz";
-        deskData = resampleAudio(deskData, deskSampleRate, targetRate, deskChannels);
+    // One row at the shortest display's height, shrunk to fit the limits
+    int rowHeight = std::numeric_limits<int>::max();
+    for (const QSize& size : sizes) {
+        rowHeight = std::min(rowHeight, size.height());
     }
+    double rowWidth = 0;
+    for (const QSize& size : sizes) {
+        rowWidth += size.width() * (double)rowHeight / size.height();
+    }
+    const double fit = std::min({ 1.0, MAX_WIDTH / rowWidth, MAX_HEIGHT / (double)rowHeight });
+    const int height = std::max(2, static_cast<int>(rowHeight * fit) & ~1);
+    std::vector<QRect> tiles;
+    int x = 0;
+    for (const QSize& size : sizes) {
+        const int tileWidth = std::max(1, static_cast<int>(std::lround(size.width() * (double)height / size.height())));
+        tiles.push_back(QRect(x, 0, tileWidth, height));
+        x += tileWidth;
+    }
+    const int width = std::max(2, std::min(x, MAX_WIDTH) & ~1);
 
-    qDebug() << "After normalization:";
-    qDebug() << "  Mic:" << micData.size() << "samples";
-    qDebug() << "  Desktop:" << deskData.size() << "samples";
+    const int sampleRate = options.audioSampleRate;
+    AudioMixer mixer(micAudio, desktopAudio, sampleRate);
+    mixer.alignTo(startUs);
 
-    double timeDiff = deskStartTime - micStartTime;
-    qDebug() << "Time difference:" << timeDiff << "seconds";
-    
-    size_t micSize = micData.size();
-    size_t deskSize = deskData.size();
-    
-    size_t finalSize = std::max(micSize, deskSize);
-    
-    if (timeDiff > 0.1) {
-        size_t offsetSamples = (size_t)(timeDiff * targetRate * targetChannels);
-        finalSize = std::max(micSize, deskSize + offsetSamples);
-    } else if (timeDiff < -0.1) {
-        size_t offsetSamples = (size_t)(-timeDiff * targetRate * targetChannels);
-        finalSize = std::max(micSize + offsetSamples, deskSize);
+    MediaWriter writer;
+    MediaWriter::Config config;
+    config.outputPath = options.outputPath;
+    config.width = width;
+    config.height = height;
+    config.fps = options.fps;
+    config.videoBitrate = options.videoBitrate;
+    config.backend = options.backend;
+    config.audioBitrate = options.audioBitrate;
+    config.audioSampleRate = sampleRate;
+    config.hasAudio = mixer.hasAudio();
+    config.fragmented = options.fragmented;
+
+    if (!writer.open(config)) {
+        emit errorOccurred(writer.lastError());
+        QFile::remove(options.outputPath);
+        return false;
     }
-    
-    const size_t MAX_SAMPLES = 48000 * targetChannels * 3600;
-    if (finalSize > MAX_SAMPLES) {
-        qDebug() << "WARNING: Audio too long (" << finalSize/(targetRate*targetChannels) << "s), truncating to 1 hour";
-        finalSize = MAX_SAMPLES;
+    if (options.fragmented) {
+        emit outputGrowing(options.outputPath);
     }
 
-    qDebug() << "Final mixed audio size:" << finalSize << "samples (" << (finalSize/(targetRate*targetChannels)) << "seconds)";
-
-    std::vector<float> mixed(finalSize, 0.0f);
-    
-    int micOffset = 0;
-    int deskOffset = 0;
-    
-    if (timeDiff > 0.1) {
-        deskOffset = (int)(timeDiff * targetRate * targetChannels);
-    } else if (timeDiff < -0.1) {
-        micOffset = (int)(-timeDiff * targetRate * targetChannels);
+    // The decode workers are shared out between the displays
+    const int decodeWorkers = std::max(1, JpegDecodeQueue::defaultWorkerCount() / static_cast<int>(displays.size()));
+    std::vector<std::unique_ptr<JpegDecodeQueue>> decoders;
+    for (const std::vector<VideoFrame>& frames : displays) {
+        decoders.push_back(std::make_unique<JpegDecodeQueue>(frames, decodeWorkers, decodeWorkers + 2));
+        decoders.back()->start();
     }
-    
-    qDebug() << "Mixing with offsets - mic:" << micOffset << "desk:" << deskOffset;
-    
-    for (size_t i = 0; i < finalSize; i++) {
-        float mVal = 0.0f;
-        float dVal = 0.0f;
+    auto cancelDecoders = [&decoders]() {
+        for (const std::unique_ptr<JpegDecodeQueue>& decoder : decoders) {
+            decoder->cancel();
+        }
+    };
+
+    const int64_t frameCount = (endUs - startUs) * options.fps / 1000000 + 1;
+    const int64_t halfFrameUs = 500000 / options.fps;
+
+    ClipIndex index;
+    const std::vector<int64_t> thumbnailTimes = ClipIndex::thumbnailTimes(frameCount * 1000000 / options.fps);
+    size_t nextThumbnail = 0;
 
-        long long micIdx = (long long)i - micOffset;
-        if (micIdx >= 0 && micIdx < (long long)micSize) {
-            mVal = micData[micIdx];
+    // Tiles are only repainted when their display has a new picture; a
+    // display that has not started yet (or has ended) stays as it was
+    QImage canvas(width, height, QImage::Format_RGB32);
+    canvas.fill(Qt::black);
+    std::vector<size_t> next(displays.size(), 0);
+    size_t audioWritten = 0;
+
+    for (int64_t frameIndex = 0; frameIndex < frameCount; ++frameIndex) {
+        if (isCancelRequested()) {
+            qDebug() << "Composite encoding canceled at frame" << frameIndex << "of" << frameCount;
+            cancelDecoders();
+            writer.abort();
+            QFile::remove(options.outputPath);
+            emit encodingCanceled();
+            return false;
         }
 
-        long long deskIdx = (long long)i - deskOffset;
-        if (deskIdx >= 0 && deskIdx < (long long)deskSize) {
-            dVal = deskData[deskIdx];
+        // Every display moves on to its newest frame due by this output
+        // time; frames in between are taken (in order) and skipped
+        // The painter is done with the canvas before the writer reads it
+        const int64_t timeUs = startUs + frameIndex * 1000000 / options.fps;
+        QPainter painter(&canvas);
+        painter.setRenderHint(QPainter::SmoothPixmapTransform);
+        for (size_t d = 0; d < displays.size(); ++d) {
+            const std::vector<VideoFrame>& frames = displays[d];
+            QImage latest;
+            while (next[d] < frames.size() && frames[next[d]].timestampUs <= timeUs + halfFrameUs) {
+                QImage img = decoders[d]->take(next[d]);
+                if (!frames[next[d]].repeat && !img.isNull()) {
+                    latest = img;
+                }
+                next[d]++;
+            }
+            if (!latest.isNull()) {
+                painter.drawImage(tiles[d], latest);
+            }
         }
+        painter.end();
 
-        float sum = mVal + dVal;
-        
-        if (sum > 1.0f) {
-            sum = 1.0f - (1.0f / (1.0f + (sum - 1.0f)));
-        } else if (sum < -1.0f) {
-            sum = -1.0f + (1.0f / (1.0f + (-sum - 1.0f)));
+        if (!writer.writeVideoFrame(canvas, frameIndex)) {
+            emit errorOccurred(writer.lastError());
+            cancelDecoders();
+            writer.abort();
+            QFile::remove(options.outputPath);
+            return false;
         }
-        
-        mixed[i] = sum * 0.95f;
+        const int64_t frameUs = frameIndex * 1000000 / options.fps;
+        while (nextThumbnail < thumbnailTimes.size() && thumbnailTimes[nextThumbnail] <= frameUs) {
+            index.addThumbnail(thumbnailTimes[nextThumbnail++], canvas);
+        }
+
+        if (config.hasAudio) {
+            const size_t audioTarget = static_cast<size_t>((frameIndex + 1) * sampleRate / options.fps);
+            if (!writeMixedAudio(mixer, writer, audioTarget, audioWritten)) {
+                emit errorOccurred(writer.lastError());
+                cancelDecoders();
+                writer.abort();
+                QFile::remove(options.outputPath);
+                return false;
+            }
+        }
+
+        reportProgress(static_cast<size_t>(frameIndex + 1), static_cast<size_t>(frameCount));
+    }
+
+    if (!writer.finish()) {
+        emit errorOccurred(writer.lastError());
+        QFile::remove(options.outputPath);
+        return false;
     }
 
-    qDebug() << "Audio mixing complete!";
-    return mixed;
+    qDebug() << "Composite encoding wrote" << frameCount << "frames of" << width << "x" << height;
+
+    ClipIndex::Info info;
+    info.valid = true;
+    info.durationUs = frameCount * 1000000 / options.fps;
+    info.fps = options.fps;
+    info.width = width;
+    info.height = height;
+    info.frameCount = static_cast<int>(frameCount);
+    index.setInfo(info);
+    index.setKeyframes(writer.keyframesUs());
+    index.setQualityTimeline(clipQualityTimeline(options.qualityTimeline, startUs, startUs + info.durationUs));
+    index.save(options.outputPath);
+
+    emit progressUpdate(100);
+    emit encodingComplete(true, "Video saved successfully (composited)");
+    return true;
 }
 
-bool VideoEncoder::encode(
+bool VideoEncoder::encodeWithLibav(
     const std::vector<VideoFrame>& frames,
-    const std::vector<AudioSample>& micAudio,
-    const std::vector<AudioSample>& desktopAudio,
-    const EncodeOptions& options)
+    const AudioSnapshot& micAudio,
+    const AudioSnapshot& desktopAudio,
+    const EncodeOptions& options,
+    QString& error)
 {
-    if (frames.empty()) {
-        emit errorOccurred("No frames to encode");
+    qDebug() << "=== Starting in-process encoding ===";
+
+    QImage firstFrame;
+    if (!firstFrame.loadFromData(frames[0].jpegData, "JPEG")) {
+        error = "Failed to decode first frame";
         return false;
     }
-    
-    try {
-        if (frames[0].jpegData.isEmpty()) {
-            emit errorOccurred("No frame data available");
+
+    const QSize outputSize = clipOutputSize(frames, firstFrame.size());
+    const int width  = outputSize.width();
+    const int height = outputSize.height();
+
+    if (width <= 0 || height <= 0 || width > MAX_WIDTH || height > MAX_HEIGHT) {
+        error = QString("Invalid video dimensions: %1x%2").arg(width).arg(height);
+        return false;
+    }
+
+    const int sampleRate = options.audioSampleRate;
+    AudioMixer mixer(micAudio, desktopAudio, sampleRate);
+    mixer.alignTo(frames[0].timestampUs);
+
+    MediaWriter writer;
+    MediaWriter::Config config;
+    config.outputPath = options.outputPath;
+    config.width = width;
+    config.height = height;
+    config.fps = options.fps;
+    config.videoBitrate = options.videoBitrate;
+    config.backend = options.backend;
+    config.audioBitrate = options.audioBitrate;
+    config.audioSampleRate = sampleRate;
+    config.hasAudio = mixer.hasAudio();
+    config.fragmented = options.fragmented;
+
+    if (!writer.open(config)) {
+        error = writer.lastError();
+        QFile::remove(options.outputPath);
+        return false;
+    }
+    if (options.fragmented) {
+        emit outputGrowing(options.outputPath);
+    }
+
+    int64_t frameIndex = 0;
+    size_t audioWritten = 0;
+    QImage lastImage;
+
+    // Thumbnails for the clip's index come from the frames going past
+    ClipIndex index;
+    const std::vector<int64_t> thumbnailTimes = ClipIndex::thumbnailTimes(
+        frames.back().timestampUs - frames[0].timestampUs + 1000000 / options.fps);
+    size_t nextThumbnail = 0;
+
+    // Decoding runs on worker threads a few frames ahead; this thread
+    // converts, encodes and muxes, and the encoder has threads of its own.
+    // Each decoded picture is a full RGB32 frame, so the window stays small.
+    const int decodeWorkers = JpegDecodeQueue::defaultWorkerCount();
+    JpegDecodeQueue decoder(frames, decodeWorkers, decodeWorkers + 2);
+    decoder.start();
+
+    for (size_t i = 0; i < frames.size(); ++i) {
+        if (isCancelRequested()) {
+            qDebug() << "In-process encoding canceled at frame" << i << "of" << frames.size();
+            decoder.cancel();
+            writer.abort();
+            QFile::remove(options.outputPath);
+            error = "Canceled";
             return false;
         }
 
-        QString ffmpegPath = findFFmpegPath();
-        if (!ffmpegPath.isEmpty()) {
-            qDebug() << "Using FFmpeg for encoding";
-            return encodeWithFFmpeg(frames, micAudio, desktopAudio, options, ffmpegPath);
+        // Repeat records share the previous payload; re-send the last
+        // decoded image instead of decoding the same JPEG again.
+        QImage img = decoder.take(i);
+        if (i == 0) {
+            img = firstFrame;
+        } else if (frames[i].repeat && !lastImage.isNull()) {
+            img = lastImage;
+        } else if (img.isNull() && (!frames[i].repeat || !img.loadFromData(frames[i].jpegData, "JPEG"))) {
+            continue;
         }
-        
-        qDebug() << "FFmpeg not found, using OpenCV fallback";
-        return encodeWithOpenCV(frames, micAudio, desktopAudio, options);
-        
-    } catch (const std::exception& e) {
-        emit errorOccurred(QString("Encoding error: %1").arg(e.what()));
+
+        // Presentation time comes from the capture timestamp, not the
+        // position in the list. Gaps (capture stalls, frames that failed
+        // to decode) are filled with the previous picture so the output
+        // keeps a constant frame interval and the real duration.
+        const int64_t pts = std::max<int64_t>(frameIndex,
+            ((frames[i].timestampUs - frames[0].timestampUs) * options.fps + 500000) / 1000000);
+        while (frameIndex < pts && !lastImage.isNull()) {
+            if (!writer.writeVideoFrame(lastImage, frameIndex)) {
+                error = writer.lastError();
+                QFile::remove(options.outputPath);
+                return false;
+            }
+            frameIndex++;
+        }
+        lastImage = img;
+
+        if (!writer.writeVideoFrame(img, frameIndex)) {
+            error = writer.lastError();
+            QFile::remove(options.outputPath);
+            return false;
+        }
+        const int64_t frameUs = frameIndex * 1000000 / options.fps;
+        while (nextThumbnail < thumbnailTimes.size() && thumbnailTimes[nextThumbnail] <= frameUs) {
+            index.addThumbnail(thumbnailTimes[nextThumbnail++], img);
+        }
+        frameIndex++;
+
+        // Interleave audio up to the end of the frame just written so the
+        // muxer never has to buffer more than one frame of either stream.
+        // Audio past the last video frame is dropped (same as -shortest).
+        if (config.hasAudio) {
+            const size_t audioTarget = static_cast<size_t>(frameIndex * sampleRate / options.fps);
+            if (!writeMixedAudio(mixer, writer, audioTarget, audioWritten)) {
+                error = writer.lastError();
+                QFile::remove(options.outputPath);
+                return false;
+            }
+        }
+
+        reportProgress(i + 1, frames.size());
+    }
+
+    if (frameIndex == 0) {
+        error = "No valid frames written";
+        writer.finish();
+        QFile::remove(options.outputPath);
+        return false;
+    }
+
+    if (!writer.finish()) {
+        error = writer.lastError();
+        QFile::remove(options.outputPath);
         return false;
     }
+
+    qDebug() << "In-process encoding wrote" << frameIndex << "frames and"
+             << audioWritten << "audio frames";
+
+    ClipIndex::Info info;
+    info.valid = true;
+    info.durationUs = frameIndex * 1000000 / options.fps;
+    info.fps = options.fps;
+    // MediaWriter drops an odd pixel
+    info.width = width & ~1;
+    info.height = height & ~1;
+    info.frameCount = static_cast<int>(frameIndex);
+    index.setInfo(info);
+    index.setKeyframes(writer.keyframesUs());
+    index.setQualityTimeline(clipQualityTimeline(options.qualityTimeline, frames[0].timestampUs,
+                                                 frames[0].timestampUs + info.durationUs));
+    index.save(options.outputPath);
+
+    emit progressUpdate(100);
+    emit encodingComplete(true, "Video saved successfully");
+    return true;
 }
 
 bool VideoEncoder::encodeWithFFmpeg(
     const std::vector<VideoFrame>& frames,
-    const std::vector<AudioSample>& micAudio,
-    const std::vector<AudioSample>& desktopAudio,
+    const AudioSnapshot& micAudio,
+    const AudioSnapshot& desktopAudio,
     const EncodeOptions& options,
     const QString& ffmpegPath)
 {
@@ -300,10 +663,11 @@ bool VideoEncoder::encodeWithFFmpeg(
         return false;
     }
 
-    const int width  = firstFrame.width();
-    const int height = firstFrame.height();
+    const QSize outputSize = clipOutputSize(frames, firstFrame.size());
+    const int width  = outputSize.width();
+    const int height = outputSize.height();
 
-    if (width <= 0 || height <= 0 || width > 7680 || height > 4320) {
+    if (width <= 0 || height <= 0 || width > MAX_WIDTH || height > MAX_HEIGHT) {
         emit errorOccurred(QString("Invalid video dimensions: %1x%2").arg(width).arg(height));
         return false;
     }
@@ -332,29 +696,61 @@ bool VideoEncoder::encodeWithFFmpeg(
     int validFrames = 0;
     QString lastFramePath;
 
+    // Every entry gets an explicit duration up to the next frame's
+    // timestamp; the output is then resampled to a constant rate with -r.
+    const double frameInterval = 1.0 / options.fps;
+    auto frameDuration = [&](size_t i) {
+        if (i + 1 < frames.size() && frames[i + 1].timestampUs > frames[i].timestampUs) {
+            return (frames[i + 1].timestampUs - frames[i].timestampUs) / 1000000.0;
+        }
+        return frameInterval;
+    };
+
     for (size_t i = 0; i < frames.size(); ++i) {
         const QByteArray& data = frames[i].jpegData;
 
+        if (isCancelRequested()) {
+            frameListFile.close();
+            QDir(tempDir).removeRecursively();
+            return false;
+        }
+        reportProgress(static_cast<int>(i * FFMPEG_PREPARE_PERCENT / frames.size()));
+
+        // A repeat record lists the previous file again; no new JPEG is
+        // decoded or written.
+        if (frames[i].repeat && !lastFramePath.isEmpty()) {
+            frameList << "file '" << lastFramePath << "'\n"
+                      << "duration " << QString::number(frameDuration(i), 'f', 6) << "\n";
+            validFrames++;
+            continue;
+        }
+
         if (data.size() < 2 || (uchar)data[0] != 0xFF || (uchar)data[1] != 0xD8)
             continue;
 
         QImage img;
-        if (!img.loadFromData(data, "JPEG") ||
-            img.width() != width ||
-            img.height() != height)
+        if (!img.loadFromData(data, "JPEG"))
             continue;
 
         const QString framePath =
             framesDir + QString("/frame_%1.jpg").arg(i, 6, 10, QChar('0'));
 
-        QFile f(framePath);
-        if (!f.open(QIODevice::WriteOnly))
-            continue;
+        // Captured at a lowered size by the quality controller
+        if (img.width() != width || img.height() != height) {
+            if (!img.scaled(width, height, Qt::IgnoreAspectRatio, Qt::SmoothTransformation)
+                    .save(framePath, "JPEG", 90))
+                continue;
+        } else {
+            QFile f(framePath);
+            if (!f.open(QIODevice::WriteOnly))
+                continue;
 
-        f.write(data);
-        f.close();
+            f.write(data);
+            f.close();
+        }
 
-        frameList << "file '" << framePath << "'\n";
+        frameList << "file '" << framePath << "'\n"
+                  << "duration " << QString::number(frameDuration(i), 'f', 6) << "\n";
         lastFramePath = framePath;
         validFrames++;
     }
@@ -368,58 +764,127 @@ bool VideoEncoder::encodeWithFFmpeg(
     frameListFile.close();
 
     bool hasAudio = false;
-    try {
-        auto mixed = mixAudioSamples(micAudio, desktopAudio);
-        if (!mixed.empty() &&
-            saveAudioToWav(mixed, audioPath, 48000) &&
+    {
+        AudioMixer mixer(micAudio, desktopAudio, 48000);
+        mixer.alignTo(frames[0].timestampUs);
+        if (mixer.hasAudio() &&
+            saveAudioToWav(mixer, audioPath) &&
             QFileInfo(audioPath).size() > 0)
         {
             hasAudio = true;
         }
-    } catch (...) {}
+    }
 
-    QStringList args;
-    args << "-y"
-         << "-loglevel" << "verbose"
-         << "-logfile" << ffmpegLogPath
-         << "-framerate" << QString::number(options.fps)
-         << "-f" << "concat"
-         << "-safe" << "0"
-         << "-i" << frameListPath;
+    // Try the selected hardware backend first; if ffmpeg rejects it (old
+    // build, missing driver) run once more with libx264.
+    QList<EncoderBackend> attempts;
+    attempts << EncoderBackends::resolve(options.backend);
+    if (attempts.first() != EncoderBackend::Software)
+        attempts << EncoderBackend::Software;
 
-    if (hasAudio)
-        args << "-i" << audioPath;
+    // ffmpeg reports the output frame count; it writes about this many
+    const double clipSeconds = (frames.back().timestampUs - frames.front().timestampUs) / 1000000.0 + frameInterval;
+    const qint64 expectedFrames = std::max<qint64>(1, static_cast<qint64>(clipSeconds * options.fps));
 
-    args << "-c:v" << "libx264"
-         << "-preset" << "medium"
-         << "-crf" << "23"
-         << "-pix_fmt" << "yuv420p";
+    bool encoded = false;
+    for (EncoderBackend backend : attempts) {
+        QStringList inputArgs;
+        const QStringList videoArgs = EncoderBackends::ffmpegVideoArgs(
+            backend, 0, width, height, options.fps, inputArgs);
 
-    if (hasAudio) {
-        args << "-c:a" << "aac"
-             << "-b:a" << "192k"
-             << "-ar" << "48000"
-             << "-ac" << "2"
-             << "-shortest";
-    } else {
-        args << "-an";
-    }
+        QStringList args;
+        args << "-y"
+             << "-loglevel" << "verbose"
+             << "-logfile" << ffmpegLogPath
+             << "-progress" << "pipe:1"
+             << "-nostats"
+             << inputArgs
+             << "-f" << "concat"
+             << "-safe" << "0"
+             << "-i" << frameListPath;
 
-    args << "-movflags" << "+faststart"
-         << options.outputPath;
+        if (hasAudio)
+            args << "-i" << audioPath;
 
-    QProcess ffmpeg;
-    ffmpeg.setWorkingDirectory(tempDir);
-    ffmpeg.start(ffmpegPath, args);
+        args << videoArgs
+             << "-r" << QString::number(options.fps);
 
-    if (!ffmpeg.waitForStarted(5000)) {
-        emit errorOccurred("Failed to start FFmpeg");
-        return false;
-    }
+        if (hasAudio) {
+            args << "-c:a" << "aac"
+                 << "-b:a" << "192k"
+                 << "-ar" << "48000"
+                 << "-ac" << "2"
+                 << "-shortest";
+        } else {
+            args << "-an";
+        }
+
+        // Fragmented output is written in one pass; faststart makes ffmpeg
+        // go over the finished file again to move the moov up front
+        if (options.fragmented) {
+            args << "-movflags" << "+frag_keyframe+empty_moov+default_base_moof"
+                 << "-flush_packets" << "1";
+        } else {
+            args << "-movflags" << "+faststart";
+        }
+        args << options.outputPath;
+
+        qDebug() << "FFmpeg video encoder:" << EncoderBackends::displayName(backend);
+
+        QProcess ffmpeg;
+        ffmpeg.setWorkingDirectory(tempDir);
+        ffmpeg.start(ffmpegPath, args);
+
+        if (!ffmpeg.waitForStarted(5000)) {
+            emit errorOccurred("Failed to start FFmpeg");
+            return false;
+        }
 
-    ffmpeg.waitForFinished(-1);
+        // Progress arrives as key=value lines on stdout. A cancel asks
+        // ffmpeg to stop through its stdin ('q') so it closes the file, and
+        // kills it if it does not.
+        QByteArray progressLines;
+        bool canceled = false;
+        while (ffmpeg.state() != QProcess::NotRunning) {
+            ffmpeg.waitForReadyRead(100);
+            progressLines += ffmpeg.readAllStandardOutput();
 
-    if (ffmpeg.exitStatus() != QProcess::NormalExit || ffmpeg.exitCode() != 0) {
+            int newline;
+            while ((newline = progressLines.indexOf('\n')) >= 0) {
+                const QByteArray line = progressLines.left(newline).trimmed();
+                progressLines.remove(0, newline + 1);
+                if (line.startsWith("frame=")) {
+                    const qint64 done = line.mid(6).toLongLong();
+                    reportProgress(FFMPEG_PREPARE_PERCENT + static_cast<int>(
+                        std::min(done, expectedFrames) * (100 - FFMPEG_PREPARE_PERCENT) / expectedFrames));
+                }
+            }
+
+            if (isCancelRequested() && !canceled) {
+                canceled = true;
+                qDebug() << "Stopping FFmpeg";
+                ffmpeg.write("q");
+                if (!ffmpeg.waitForFinished(3000)) {
+                    ffmpeg.kill();
+                    ffmpeg.waitForFinished(1000);
+                }
+            }
+        }
+
+        if (canceled) {
+            QFile::remove(options.outputPath);
+            QDir(tempDir).removeRecursively();
+            return false;
+        }
+
+        if (ffmpeg.exitStatus() == QProcess::NormalExit && ffmpeg.exitCode() == 0) {
+            encoded = true;
+            break;
+        }
+        qDebug() << "FFmpeg failed with" << EncoderBackends::displayName(backend);
+    }
+
+    if (!encoded) {
         QString err = "FFmpeg failed.\n\nLog file:\n" + ffmpegLogPath;
         emit errorOccurred(err);
         return false;
@@ -433,14 +898,15 @@ bool VideoEncoder::encodeWithFFmpeg(
     }
 
     QDir(tempDir).removeRecursively();
+    emit progressUpdate(100);
     emit encodingComplete(true, "Video saved successfully");
     return true;
 }
 
 bool VideoEncoder::encodeWithOpenCV(
     const std::vector<VideoFrame>& frames, 
-    const std::vector<AudioSample>& micAudio,
-    const std::vector<AudioSample>& desktopAudio,
+    const AudioSnapshot& micAudio,
+    const AudioSnapshot& desktopAudio,
     const EncodeOptions& options)
 {
     qDebug() << "=== Using OpenCV fallback encoder ===";
@@ -453,8 +919,9 @@ bool VideoEncoder::encodeWithOpenCV(
             return false;
         }
         
-        int width = firstFrame.width();
-        int height = firstFrame.height();
+        const QSize outputSize = clipOutputSize(frames, firstFrame.size());
+        const int width = outputSize.width();
+        const int height = outputSize.height();
         
         qDebug() << "Video dimensions:" << width << "x" << height;
         
@@ -471,24 +938,35 @@ bool VideoEncoder::encodeWithOpenCV(
         
         qDebug() << "Writing" << frames.size() << "frames...";
         
+        cv::Mat lastBgr;
         for (size_t i = 0; i < frames.size(); i++) {
+            if (isCancelRequested()) {
+                writer.release();
+                QFile::remove(options.outputPath);
+                return false;
+            }
+            reportProgress(i, frames.size());
+
+            if (frames[i].repeat && !lastBgr.empty()) {
+                writer.write(lastBgr);
+                continue;
+            }
+            
             QImage img;
             if (!img.loadFromData(frames[i].jpegData, "JPEG")) {
                 continue;
             }
             
+            if (img.width() != width || img.height() != height) {
+                img = img.scaled(width, height, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+            }
             img = img.convertToFormat(QImage::Format_RGB888);
             cv::Mat mat(img.height(), img.width(), CV_8UC3, 
                        const_cast<uchar*>(img.bits()), 
                        img.bytesPerLine());
             
-            cv::Mat bgr;
-            cv::cvtColor(mat, bgr, cv::COLOR_RGB2BGR);
-            writer.write(bgr);
-            
-            if (i % 30 == 0) {
-                emit progressUpdate(static_cast<int>((i * 100) / frames.size()));
-            }
+            cv::cvtColor(mat, lastBgr, cv::COLOR_RGB2BGR);
+            writer.write(lastBgr);
         }
         
         writer.release();
@@ -508,15 +986,9 @@ bool VideoEncoder::encodeWithOpenCV(
     }
 }
 
-bool VideoEncoder::saveAudioToWav(const std::vector<float>& samples, const QString& filepath, int sampleRate)
+bool VideoEncoder::saveAudioToWav(AudioMixer& mixer, const QString& filepath)
 {
-    if (samples.empty()) {
-        return false;
-    }
-    
     qDebug() << "Saving WAV:" << filepath;
-    qDebug() << "  Samples:" << samples.size();
-    qDebug() << "  Duration:" << (samples.size() / 2.0 / sampleRate) << "s";
     
     QFile file(filepath);
     if (!file.open(QIODevice::WriteOnly)) {
@@ -527,17 +999,12 @@ bool VideoEncoder::saveAudioToWav(const std::vector<float>& samples, const QStri
     QDataStream out(&file);
     out.setByteOrder(QDataStream::LittleEndian);
     
-    size_t numSamples = samples.size();
-    if (numSamples % 2 != 0) {
-        numSamples--;
-    }
-    
-    int channels = 2;
-    size_t dataSize = numSamples * sizeof(float);
-    quint32 fileSize = 36 + static_cast<quint32>(dataSize);
+    const int channels = 2;
+    const int sampleRate = mixer.sampleRate();
     
+    // The sizes are patched in once the length is known
     out.writeRawData("RIFF", 4);
-    out << fileSize;
+    out << quint32(0);
     out.writeRawData("WAVE", 4);
     out.writeRawData("fmt ", 4);
     
@@ -552,15 +1019,35 @@ bool VideoEncoder::saveAudioToWav(const std::vector<float>& samples, const QStri
     out << fmtChunkSize << audioFormat << numChannels << sampRate << byteRate << blockAlign << bitsPerSample;
     
     out.writeRawData("data", 4);
-    out << static_cast<quint32>(dataSize);
+    out << quint32(0);
     
-    for (size_t i = 0; i < numSamples; i++) {
-        out << samples[i];
+    // Samples go out a block at a time as the mixer produces them; every
+    // supported target is little-endian, matching the WAV layout
+    float block[AudioMixer::BLOCK_FRAMES * channels];
+    quint64 dataSize = 0;
+    size_t got;
+    while ((got = mixer.read(block, AudioMixer::BLOCK_FRAMES)) > 0) {
+        const qint64 bytes = static_cast<qint64>(got * channels * sizeof(float));
+        if (file.write(reinterpret_cast<const char*>(block), bytes) != bytes) {
+            qDebug() << "Failed to write WAV data:" << file.errorString();
+            return false;
+        }
+        dataSize += bytes;
     }
     
+    if (dataSize == 0 || dataSize > 0xFFFFFFFFull - 36) {
+        qDebug() << "WAV data size out of range:" << dataSize << "bytes";
+        return false;
+    }
+    
+    file.seek(4);
+    out << static_cast<quint32>(36 + dataSize);
+    file.seek(40);
+    out << static_cast<quint32>(dataSize);
     file.close();
     
-    qDebug() << "WAV saved:" << QFileInfo(filepath).size() << "bytes";
+    qDebug() << "WAV saved:" << (dataSize / (channels * sizeof(float)) / (double)sampleRate) << "s,"
+             << QFileInfo(filepath).size() << "bytes";
     return file.error() == QFile::NoError;
 }
 
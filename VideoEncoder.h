@@ -5,8 +5,12 @@
 #include <QString>
 #include <QImage>
 #include <vector>
+#include <atomic>
 #include "AudioCapture.h"
 #include "ScreenRecorder.h"
+#include "EncoderBackend.h"
+
+class AudioMixer;
 
 class VideoEncoder : public QObject {
     Q_OBJECT
@@ -21,52 +25,138 @@ public:
         int videoBitrate = 5000000; // 5 Mbps
         int audioBitrate = 192000;  // 192 kbps
         int audioSampleRate = 48000;
+        EncoderBackend backend = EncoderBackend::Auto;
+        // The recorder's quality changes (`ScreenRecorder::qualityTimeline`);
+        // those within the clip go into its index
+        std::vector<QualityController::Change> qualityTimeline;
+        // Fragmented MP4 (see MediaWriter): no faststart rewrite at the
+        // end, and a crash leaves a clip playable to its last fragment
+        bool fragmented = false;
     };
 
     /*
      * Encode video with audio
      * - `encode` coordinates turning an in-memory frame/audio buffer into
      *   a single MP4 (H.264 + AAC) file as specified by `options`.
-     * - Implementation strategy: prefer an external `ffmpeg` binary when
-     *   available (reliable and feature-complete). Fall back to an OpenCV
-     *   based writer when `ffmpeg` cannot be found.
+     * - Implementation strategy: encode in-process with libavcodec and
+     *   libavformat (`MediaWriter`), which avoids temporary files entirely.
+     *   If that fails, fall back to an external `ffmpeg` binary and finally
+     *   to an OpenCV based writer when `ffmpeg` cannot be found.
      * - The method emits `progressUpdate` to report percent-complete and
      *   `encodingComplete` upon finish. Any recoverable or fatal error is
      *   reported via `errorOccurred`.
+     * - In-process, JPEG decoding runs on a `JpegDecodeQueue` ahead of the
+     *   encoder, and packets are muxed to disk as they come out, so the
+     *   stages overlap and the file grows while the rest encodes.
+     *   Progress is reported per frame.
      */
     bool encode(const std::vector<VideoFrame>& frames,
-                const std::vector<AudioSample>& micAudio,
-                const std::vector<AudioSample>& desktopAudio,
+                const AudioSnapshot& micAudio,
+                const AudioSnapshot& desktopAudio,
                 const EncodeOptions& options);
 
+    /*
+     * Remux pre-encoded video with audio
+     * - `encodePackets` writes the packets of an `EncodedClip` (captured in
+     *   one of the continuous-encode modes) into the output container
+     *   without re-encoding the video. Only the mixed audio is encoded.
+     * - Emits the same progress/completion/error signals as `encode`.
+     */
+    bool encodePackets(const EncodedClip& clip,
+                       const AudioSnapshot& micAudio,
+                       const AudioSnapshot& desktopAudio,
+                       const EncodeOptions& options);
+
+    /*
+     * Composited save (several displays, JPEG capture mode)
+     * - `encodeComposite` lays the buffers of several displays out side by
+     *   side in one clip: every display is scaled to the height of the
+     *   shortest one, and the whole row further down if it would exceed
+     *   MAX_WIDTH x MAX_HEIGHT.
+     * - The clip runs from the earliest first frame to the latest last
+     *   one at `options.fps`. At each output time a display shows its
+     *   newest frame due by then; the displays' recorders all stamp
+     *   frames on `MediaClock`, so the tiles stay in step.
+     * - In-process only, each display decoding on its own
+     *   `JpegDecodeQueue`. Emits the same signals as `encode`.
+     */
+    bool encodeComposite(const std::vector<std::vector<VideoFrame>>& displays,
+                         const AudioSnapshot& micAudio,
+                         const AudioSnapshot& desktopAudio,
+                         const EncodeOptions& options);
+
+    static constexpr int MAX_WIDTH = 7680;
+    static constexpr int MAX_HEIGHT = 4320;
+
+    /*
+     * Cancellation
+     * - `requestCancel()` may be called from any thread while `encode` or
+     *   `encodePackets` runs. The running save stops at the next frame or
+     *   packet (the ffmpeg binary is asked to quit, then killed), removes
+     *   its partial output and emits `encodingCanceled` instead of
+     *   `encodingComplete`. The request is cleared when the save returns.
+     */
+    void requestCancel() { m_cancelRequested = true; }
+    bool isCancelRequested() const { return m_cancelRequested.load(); }
+
+    /*
+     * Growing output
+     * - With `EncodeOptions::fragmented`, the in-process paths emit
+     *   `outputGrowing` once the output file is open. From then on it is
+     *   only appended to until the save ends, so it can be read (or
+     *   uploaded) while the rest is encoded.
+     * - `outputDiscarded` follows if that file is then thrown away and the
+     *   save goes on with a fallback that writes it again from scratch.
+     *   A save that fails or is canceled just ends with its usual signal.
+     */
+
 signals:
     void progressUpdate(int percent);
     void encodingComplete(bool success, const QString& message);
+    void encodingCanceled();
     void errorOccurred(const QString& error);
+    void outputGrowing(const QString& outputPath);
+    void outputDiscarded(const QString& outputPath);
 
 private:
+    // Emits progressUpdate only when the percentage changes
+    void reportProgress(int percent);
+    void reportProgress(size_t done, size_t total);
+    
+    std::atomic<bool> m_cancelRequested;
+    int m_lastProgress;
+    
     /*
-     * mixAudioSamples
-     * - Merge two streams (mic and desktop) into a single interleaved
-     *   float buffer at the target sample rate and channel count.
-     * - Handles channel expansion (mono->stereo), resampling, time
-     *   alignment using timestamps, and soft clipping to avoid overflow.
+     * saveAudioToWav
+     * - Streams the mixer's output into a 32-bit float stereo WAV for the
+     *   ffmpeg binary path, one block at a time.
      */
-    std::vector<float> mixAudioSamples(const std::vector<AudioSample>& mic,
-                                       const std::vector<AudioSample>& desktop);
-    
-    bool saveAudioToWav(const std::vector<float>& samples, const QString& filepath, int sampleRate);
+    bool saveAudioToWav(AudioMixer& mixer, const QString& filepath);
     QString findFFmpegPath();
     
+    /*
+     * encodeWithLibav
+     * - In-process path: each JPEG is decoded exactly once, converted with
+     *   swscale and fed straight into the encoder together with the mixed
+     *   audio. No temporary directory, frame list or WAV file is created.
+     * - Returns false with `error` set when the path is unusable so that
+     *   `encode` can fall back to the external ffmpeg binary.
+     */
+    bool encodeWithLibav(const std::vector<VideoFrame>& frames,
+                         const AudioSnapshot& micAudio,
+                         const AudioSnapshot& desktopAudio,
+                         const EncodeOptions& options,
+                         QString& error);
+    
     bool encodeWithFFmpeg(const std::vector<VideoFrame>& frames,
-                         const std::vector<AudioSample>& micAudio,
-                         const std::vector<AudioSample>& desktopAudio,
+                         const AudioSnapshot& micAudio,
+                         const AudioSnapshot& desktopAudio,
                          const EncodeOptions& options,
                          const QString& ffmpegPath);
     
     bool encodeWithOpenCV(const std::vector<VideoFrame>& frames,
-                         const std::vector<AudioSample>& micAudio,
-                         const std::vector<AudioSample>& desktopAudio,
+                         const AudioSnapshot& micAudio,
+                         const AudioSnapshot& desktopAudio,
                          const EncodeOptions& options);
 };
 